@@ -12,6 +12,8 @@
 #include "exec_cmd.h"
 #include "attr.h"
 #include "dir.h"
+#include "hashmap.h"
+#include "thread-utils.h"
 
 const char git_attr__true[] = "(builtin)true";
 const char git_attr__false[] = "\0(builtin)false";
@@ -36,9 +38,38 @@ struct git_attr {
 };
 static int attr_nr;
 
-static struct git_attr_check *check_all_attr;
+static struct git_attr **all_attrs;
 static struct git_attr *(git_attr_hash[HASHSIZE]);
 
+#ifndef NO_PTHREADS
+/*
+ * This lock protects the attribute names and the frames read from the
+ * attribute files.  It is held only while looking up the frames for a
+ * directory (reading the files on the first visit), never while
+ * matching paths against them.
+ */
+static pthread_mutex_t attr_mutex;
+static int attr_mutex_initialized;
+
+static void attr_lock(void)
+{
+	if (!attr_mutex_initialized) {
+		/* the first call cannot race; see git_attr_context_alloc() */
+		pthread_mutex_init(&attr_mutex, NULL);
+		attr_mutex_initialized = 1;
+	}
+	pthread_mutex_lock(&attr_mutex);
+}
+
+static void attr_unlock(void)
+{
+	pthread_mutex_unlock(&attr_mutex);
+}
+#else
+#define attr_lock()
+#define attr_unlock()
+#endif
+
 char *git_attr_name(struct git_attr *attr)
 {
 	return attr->name;
@@ -97,16 +128,19 @@ static struct git_attr *git_attr_internal(const char *name, int len)
 	a->attr_nr = attr_nr++;
 	git_attr_hash[pos] = a;
 
-	check_all_attr = xrealloc(check_all_attr,
-				  sizeof(*check_all_attr) * attr_nr);
-	check_all_attr[a->attr_nr].attr = a;
-	check_all_attr[a->attr_nr].value = ATTR__UNKNOWN;
+	all_attrs = xrealloc(all_attrs, sizeof(*all_attrs) * attr_nr);
+	all_attrs[a->attr_nr] = a;
 	return a;
 }
 
 struct git_attr *git_attr(const char *name)
 {
-	return git_attr_internal(name, strlen(name));
+	struct git_attr *a;
+
+	attr_lock();
+	a = git_attr_internal(name, strlen(name));
+	attr_unlock();
+	return a;
 }
 
 /* What does a matched pattern decide? */
@@ -288,21 +322,55 @@ static struct match_attr *parse_attr_line(const char *line, const char *src,
  * current directory, and then scan the list backwards to find the first match.
  * This is exactly the same as what is_excluded() does in dir.c to deal with
  * .gitignore
+ *
+ * Each file is read into a frame, whose "prev" is the frame of the
+ * closest file that is consulted after it.  Once read, frames are
+ * never modified until they are all dropped by drop_attr_stack(), so
+ * that they can be shared by threads looking up attributes in
+ * different git_attr_contexts.
  */
 
-static struct attr_stack {
+struct attr_stack {
 	struct attr_stack *prev;
 	char *origin;
 	size_t originlen;
 	unsigned num_matches;
 	unsigned alloc;
 	struct match_attr **attrs;
-} *attr_stack;
+	struct attr_match_table *table;
+	int id;
+};
+
+/* $GIT_DIR/info/attributes; consulted before any other frame */
+static struct attr_stack *attr_info;
+
+/* every frame read so far, indexed by their id */
+static struct attr_stack **attr_frames;
+static int attr_frames_nr, attr_frames_alloc;
+
+/*
+ * Maps a directory (without the trailing slash; "" for the top level)
+ * to the innermost frame that applies to the paths in it.
+ */
+struct attr_dir {
+	struct hashmap_entry ent;
+	struct attr_stack *stack;
+	int len;
+	char name[FLEX_ARRAY];
+};
+static struct hashmap attr_dirs;
+
+/* incremented whenever the frames are dropped */
+static unsigned attr_generation;
+
+static void free_attr_match_table(struct attr_match_table *);
+static struct attr_match_table *compile_attr_stack(struct attr_stack *);
 
 static void free_attr_elem(struct attr_stack *e)
 {
 	int i;
 	free(e->origin);
+	free_attr_match_table(e->table);
 	for (i = 0; i < e->num_matches; i++) {
 		struct match_attr *a = e->attrs[i];
 		int j;
@@ -461,11 +529,17 @@ static void debug_set(const char *what, const char *match, struct git_attr *attr
 
 static void drop_attr_stack(void)
 {
-	while (attr_stack) {
-		struct attr_stack *elem = attr_stack;
-		attr_stack = elem->prev;
-		free_attr_elem(elem);
+	int i;
+
+	for (i = 0; i < attr_frames_nr; i++) {
+		debug_pop(attr_frames[i]);
+		free_attr_elem(attr_frames[i]);
 	}
+	attr_frames_nr = 0;
+	attr_info = NULL;
+	if (attr_dirs.tablesize)
+		hashmap_free(&attr_dirs, 1);
+	attr_generation++;
 }
 
 static const char *git_etc_gitattributes(void)
@@ -481,25 +555,69 @@ static int git_attr_system(void)
 	return !git_env_bool("GIT_ATTR_NOSYSTEM", 0);
 }
 
+static int attr_dir_cmp(const struct attr_dir *a, const struct attr_dir *b,
+			const char *name)
+{
+	return a->len != b->len ||
+		memcmp(a->name, name ? name : b->name, a->len);
+}
+
+static struct attr_dir *find_attr_dir(const char *name, int len)
+{
+	struct attr_dir key;
+
+	hashmap_entry_init(&key, memhash(name, len));
+	key.len = len;
+	return hashmap_get(&attr_dirs, &key, name);
+}
+
+static void add_attr_dir(const char *name, int len, struct attr_stack *stack)
+{
+	struct attr_dir *d = xmalloc(sizeof(*d) + len + 1);
+
+	hashmap_entry_init(d, memhash(name, len));
+	d->stack = stack;
+	d->len = len;
+	memcpy(d->name, name, len);
+	d->name[len] = '\0';
+	hashmap_add(&attr_dirs, d);
+}
+
+/*
+ * Make elem, a frame that was just read, the one consulted before
+ * prev, and make it ready to be shared.
+ */
+static void push_attr_frame(struct attr_stack *elem, struct attr_stack *prev)
+{
+	elem->prev = prev;
+	elem->table = compile_attr_stack(elem);
+	elem->id = attr_frames_nr;
+	ALLOC_GROW(attr_frames, attr_frames_nr + 1, attr_frames_alloc);
+	attr_frames[attr_frames_nr++] = elem;
+	debug_push(elem);
+}
+
 static void bootstrap_attr_stack(void)
 {
-	struct attr_stack *elem;
+	struct attr_stack *elem, *stack;
 	char *xdg_attributes_file;
 
-	if (attr_stack)
+	if (attr_info)
 		return;
 
+	hashmap_init(&attr_dirs, (hashmap_cmp_fn)attr_dir_cmp, 0);
+
 	elem = read_attr_from_array(builtin_attr);
 	elem->origin = NULL;
-	elem->prev = attr_stack;
-	attr_stack = elem;
+	push_attr_frame(elem, NULL);
+	stack = elem;
 
 	if (git_attr_system()) {
 		elem = read_attr_from_file(git_etc_gitattributes(), 1);
 		if (elem) {
 			elem->origin = NULL;
-			elem->prev = attr_stack;
-			attr_stack = elem;
+			push_attr_frame(elem, stack);
+			stack = elem;
 		}
 	}
 
@@ -511,8 +629,8 @@ static void bootstrap_attr_stack(void)
 		elem = read_attr_from_file(git_attributes_file, 1);
 		if (elem) {
 			elem->origin = NULL;
-			elem->prev = attr_stack;
-			attr_stack = elem;
+			push_attr_frame(elem, stack);
+			stack = elem;
 		}
 	}
 
@@ -520,107 +638,78 @@ static void bootstrap_attr_stack(void)
 		elem = read_attr(GITATTRIBUTES_FILE, 1);
 		elem->origin = xstrdup("");
 		elem->originlen = 0;
-		elem->prev = attr_stack;
-		attr_stack = elem;
-		debug_push(elem);
+		push_attr_frame(elem, stack);
+		stack = elem;
 	}
+	add_attr_dir("", 0, stack);
 
 	elem = read_attr_from_file(git_path(INFOATTRIBUTES_FILE), 1);
 	if (!elem)
 		elem = xcalloc(1, sizeof(*elem));
 	elem->origin = NULL;
-	elem->prev = attr_stack;
-	attr_stack = elem;
+	push_attr_frame(elem, NULL);
+	attr_info = elem;
 }
 
-static void prepare_attr_stack(const char *path, int dirlen)
+/*
+ * Return the innermost frame that applies to the paths in the
+ * directory path[0..dirlen), reading the .gitattributes files of the
+ * directories leading to it that have not been visited yet.
+ *
+ * At the bottom of the attribute stack is the built-in set of
+ * attribute definitions, followed by the contents of
+ * $(prefix)/etc/gitattributes and a file specified by
+ * core.attributesfile.  Then, contents from .gitattribute files from
+ * directories closer to the root to the ones in deeper directories
+ * are stacked.  The contents of $GIT_DIR/info/attributes (attr_info)
+ * are not part of it, as they are consulted before everything else.
+ *
+ * When checking, we use entries from near the top of the stack,
+ * preferring $GIT_DIR/info/attributes, then .gitattributes in deeper
+ * directories to shallower ones, and finally use the built-in set as
+ * the default.
+ *
+ * Must be called with the attr_lock held.
+ */
+static struct attr_stack *get_attr_stack(const char *path, int dirlen)
 {
-	struct attr_stack *elem, *info;
-	int len;
-	const char *cp;
+	struct attr_dir *d;
+	struct attr_stack *parent, *elem;
+	struct strbuf pathbuf = STRBUF_INIT;
+	int parentlen;
 
-	/*
-	 * At the bottom of the attribute stack is the built-in
-	 * set of attribute definitions, followed by the contents
-	 * of $(prefix)/etc/gitattributes and a file specified by
-	 * core.attributesfile.  Then, contents from
-	 * .gitattribute files from directories closer to the
-	 * root to the ones in deeper directories are pushed
-	 * to the stack.  Finally, at the very top of the stack
-	 * we always keep the contents of $GIT_DIR/info/attributes.
-	 *
-	 * When checking, we use entries from near the top of the
-	 * stack, preferring $GIT_DIR/info/attributes, then
-	 * .gitattributes in deeper directories to shallower ones,
-	 * and finally use the built-in set as the default.
-	 */
 	bootstrap_attr_stack();
+	d = find_attr_dir(path, dirlen);
+	if (d)
+		return d->stack;
 
-	/*
-	 * Pop the "info" one that is always at the top of the stack.
-	 */
-	info = attr_stack;
-	attr_stack = info->prev;
-
-	/*
-	 * Pop the ones from directories that are not the prefix of
-	 * the path we are checking. Break out of the loop when we see
-	 * the root one (whose origin is an empty string "") or the builtin
-	 * one (whose origin is NULL) without popping it.
-	 */
-	while (attr_stack->origin) {
-		int namelen = strlen(attr_stack->origin);
-
-		elem = attr_stack;
-		if (namelen <= dirlen &&
-		    !strncmp(elem->origin, path, namelen) &&
-		    (!namelen || path[namelen] == '/'))
+	/* the top level is always there, so dirlen is not 0 here */
+	for (parentlen = dirlen - 1; 0 < parentlen; parentlen--)
+		if (path[parentlen] == '/')
 			break;
+	parent = get_attr_stack(path, parentlen);
 
-		debug_pop(elem);
-		attr_stack = elem->prev;
-		free_attr_elem(elem);
+	if (is_bare_repository() && direction != GIT_ATTR_INDEX) {
+		add_attr_dir(path, dirlen, parent);
+		return parent;
 	}
 
-	/*
-	 * Read from parent directories and push them down
-	 */
-	if (!is_bare_repository() || direction == GIT_ATTR_INDEX) {
-		/*
-		 * bootstrap_attr_stack() should have added, and the
-		 * above loop should have stopped before popping, the
-		 * root element whose attr_stack->origin is set to an
-		 * empty string.
-		 */
-		struct strbuf pathbuf = STRBUF_INIT;
-
-		assert(attr_stack->origin);
-		while (1) {
-			len = strlen(attr_stack->origin);
-			if (dirlen <= len)
-				break;
-			cp = memchr(path + len + 1, '/', dirlen - len - 1);
-			if (!cp)
-				cp = path + dirlen;
-			strbuf_add(&pathbuf, path, cp - path);
-			strbuf_addch(&pathbuf, '/');
-			strbuf_addstr(&pathbuf, GITATTRIBUTES_FILE);
-			elem = read_attr(pathbuf.buf, 0);
-			strbuf_setlen(&pathbuf, cp - path);
-			elem->origin = strbuf_detach(&pathbuf, &elem->originlen);
-			elem->prev = attr_stack;
-			attr_stack = elem;
-			debug_push(elem);
-		}
-
+	strbuf_add(&pathbuf, path, dirlen);
+	strbuf_addch(&pathbuf, '/');
+	strbuf_addstr(&pathbuf, GITATTRIBUTES_FILE);
+	elem = read_attr(pathbuf.buf, 0);
+	if (!elem->num_matches) {
+		/* there is nothing to match against here */
+		free_attr_elem(elem);
 		strbuf_release(&pathbuf);
+		add_attr_dir(path, dirlen, parent);
+		return parent;
 	}
-
-	/*
-	 * Finally push the "info" one at the top of the stack.
-	 */
-	info->prev = attr_stack;
-	attr_stack = info;
+	strbuf_setlen(&pathbuf, dirlen);
+	elem->origin = strbuf_detach(&pathbuf, &elem->originlen);
+	push_attr_frame(elem, parent);
+	add_attr_dir(path, dirlen, elem);
+	return elem;
 }
 
 static int path_matches(const char *pathname, int pathlen,
@@ -646,16 +735,262 @@ static int path_matches(const char *pathname, int pathlen,
 			      pattern, prefix, pat->patternlen, pat->flags);
 }
 
-static int macroexpand_one(int attr_nr, int rem);
+/*
+ * To avoid matching every path against every rule of a frame, the
+ * pattern rules of a frame are compiled into a match table the first
+ * time the frame is used:
+ *
+ *  - rules whose pattern is a literal basename ("Makefile") are
+ *    hashed by that name;
+ *
+ *  - rules of the form "*<literal>" ("*.c", "*.tar.gz") whose literal
+ *    has a '.' in it are hashed by what follows the last '.' ("c",
+ *    "gz"), to be looked up with the extension of the path;
+ *
+ *  - rules whose pattern starts with a literal leading directory
+ *    ("Documentation/git-*.txt", "/t/helper/test-*.c") are hashed by
+ *    that directory ("Documentation", "t/helper"), to be looked up
+ *    with each leading directory of the path relative to the frame,
+ *    i.e. they form a flattened prefix trie;
+ *
+ *  - everything else is tried on every path.
+ *
+ * These only narrow down the candidates; each candidate is still
+ * matched with path_matches(), in the original order of the rules.
+ * As all paths in a directory share the last two kinds of candidates,
+ * each git_attr_context remembers them for the directory it last
+ * asked about.
+ */
+struct attr_bucket {
+	struct hashmap_entry ent;
+	const char *key;
+	int keylen;
+	int nr, alloc;
+	int *rule;
+};
+
+struct rule_list {
+	int nr, alloc;
+	int *rule;
+};
+
+struct attr_match_table {
+	struct hashmap basenames;
+	struct hashmap extensions;
+	struct hashmap dirs;
+	struct rule_list other;
+};
+
+static int attr_bucket_cmp(const struct attr_bucket *a,
+			   const struct attr_bucket *b, const void *unused)
+{
+	return a->keylen != b->keylen ||
+		strncmp_icase(a->key, b->key, a->keylen);
+}
+
+static unsigned int attr_bucket_hash(const char *key, int keylen)
+{
+	return ignore_case ? memihash(key, keylen) : memhash(key, keylen);
+}
+
+static struct attr_bucket *find_attr_bucket(struct hashmap *map,
+					    const char *key, int keylen)
+{
+	struct attr_bucket k;
+
+	hashmap_entry_init(&k, attr_bucket_hash(key, keylen));
+	k.key = key;
+	k.keylen = keylen;
+	return hashmap_get(map, &k, NULL);
+}
+
+static void add_to_attr_bucket(struct hashmap *map,
+			       const char *key, int keylen, int rule)
+{
+	struct attr_bucket *b = find_attr_bucket(map, key, keylen);
+
+	if (!b) {
+		b = xcalloc(1, sizeof(*b));
+		hashmap_entry_init(b, attr_bucket_hash(key, keylen));
+		b->key = key;
+		b->keylen = keylen;
+		hashmap_add(map, b);
+	}
+	ALLOC_GROW(b->rule, b->nr + 1, b->alloc);
+	b->rule[b->nr++] = rule;
+}
+
+static void free_attr_buckets(struct hashmap *map)
+{
+	struct hashmap_iter iter;
+	struct attr_bucket *b;
+
+	for (b = hashmap_iter_first(map, &iter); b; b = hashmap_iter_next(&iter))
+		free(b->rule);
+	hashmap_free(map, 1);
+}
+
+static const char *find_last(const char *s, int c, int len)
+{
+	while (0 < len--)
+		if (s[len] == c)
+			return s + len;
+	return NULL;
+}
+
+static void add_rules(struct rule_list *list, const int *rule, int nr)
+{
+	ALLOC_GROW(list->rule, list->nr + nr, list->alloc);
+	memcpy(list->rule + list->nr, rule, nr * sizeof(*rule));
+	list->nr += nr;
+}
+
+static void free_attr_match_table(struct attr_match_table *t)
+{
+	if (!t)
+		return;
+	free_attr_buckets(&t->basenames);
+	free_attr_buckets(&t->extensions);
+	free_attr_buckets(&t->dirs);
+	free(t->other.rule);
+	free(t);
+}
+
+static struct attr_match_table *compile_attr_stack(struct attr_stack *stk)
+{
+	struct attr_match_table *t = xcalloc(1, sizeof(*t));
+	int i;
+
+	hashmap_init(&t->basenames, (hashmap_cmp_fn)attr_bucket_cmp, 0);
+	hashmap_init(&t->extensions, (hashmap_cmp_fn)attr_bucket_cmp, 0);
+	hashmap_init(&t->dirs, (hashmap_cmp_fn)attr_bucket_cmp, 0);
+
+	for (i = 0; i < stk->num_matches; i++) {
+		const struct pattern *pat = &stk->attrs[i]->u.pat;
+		const char *p = pat->pattern;
+		int prefix = pat->nowildcardlen;
+		const char *slash;
+
+		if (stk->attrs[i]->is_macro)
+			continue;
+		if (pat->flags & EXC_FLAG_NODIR) {
+			if (prefix == pat->patternlen) {
+				add_to_attr_bucket(&t->basenames,
+						   p, pat->patternlen, i);
+				continue;
+			}
+			if (pat->flags & EXC_FLAG_ENDSWITH) {
+				const char *dot = find_last(p, '.', pat->patternlen);
+				if (dot) {
+					dot++;
+					add_to_attr_bucket(&t->extensions, dot,
+							   p + pat->patternlen - dot, i);
+					continue;
+				}
+			}
+		} else {
+			/* as in match_pathname() */
+			if (*p == '/') {
+				p++;
+				prefix--;
+			}
+			slash = find_last(p, '/', prefix);
+			if (slash && slash != p) {
+				add_to_attr_bucket(&t->dirs, p, slash - p, i);
+				continue;
+			}
+		}
+		add_rules(&t->other, &i, 1);
+	}
+	return t;
+}
+
+static int rule_cmp_desc(const void *a_, const void *b_)
+{
+	int a = *(const int *)a_, b = *(const int *)b_;
+	return a < b ? 1 : a > b ? -1 : 0;
+}
+
+/* The candidate rules of one frame for the paths in the directory "dir" */
+struct attr_dir_rules {
+	struct strbuf dir;
+	int valid;
+	struct rule_list rules;
+};
+
+struct git_attr_context {
+	unsigned generation;
+
+	/* the innermost frame for the paths in the directory "dir" */
+	struct strbuf dir;
+	struct attr_stack *stack;
+
+	/* the number of attributes known when stack was looked up */
+	int attr_nr;
+
+	/* the values found so far, indexed by attr_nr */
+	const char **value;
+	int value_alloc;
+
+	/* indexed by the id of the frames */
+	struct attr_dir_rules *dir_rules;
+	int dir_rules_alloc;
+
+	struct rule_list hits;
+};
+
+/*
+ * Collect the rules of stk that may match a path in the directory
+ * path[0..dirlen) (which must be inside the directory of the frame),
+ * except for those looked up by basename, highest first.
+ */
+static struct rule_list *dir_candidates(struct git_attr_context *ctx,
+					struct attr_stack *stk,
+					const char *path, int dirlen)
+{
+	struct attr_dir_rules *d = &ctx->dir_rules[stk->id];
+	struct attr_match_table *t = stk->table;
+	int baselen = stk->originlen;
+	const char *rel;
+	int rellen, i;
+
+	if (d->valid && d->dir.len == dirlen &&
+	    !memcmp(d->dir.buf, path, dirlen))
+		return &d->rules;
+
+	d->rules.nr = 0;
+	add_rules(&d->rules, t->other.rule, t->other.nr);
+
+	if (t->dirs.size) {
+		rel = path + baselen + (baselen ? 1 : 0);
+		rellen = dirlen - (rel - path);
+		for (i = 1; i <= rellen; i++) {
+			struct attr_bucket *b;
+			if (i < rellen && rel[i] != '/')
+				continue;
+			b = find_attr_bucket(&t->dirs, rel, i);
+			if (b)
+				add_rules(&d->rules, b->rule, b->nr);
+		}
+	}
+	qsort(d->rules.rule, d->rules.nr, sizeof(int), rule_cmp_desc);
+
+	strbuf_reset(&d->dir);
+	strbuf_add(&d->dir, path, dirlen);
+	d->valid = 1;
+	return &d->rules;
+}
+
+static int macroexpand_one(struct git_attr_context *ctx, int attr_nr, int rem);
 
-static int fill_one(const char *what, struct match_attr *a, int rem)
+static int fill_one(struct git_attr_context *ctx, const char *what,
+		    struct match_attr *a, int rem)
 {
-	struct git_attr_check *check = check_all_attr;
 	int i;
 
 	for (i = a->num_attr - 1; 0 < rem && 0 <= i; i--) {
 		struct git_attr *attr = a->state[i].attr;
-		const char **n = &(check[attr->attr_nr].value);
+		const char **n = &ctx->value[attr->attr_nr];
 		const char *v = a->state[i].setto;
 
 		if (*n == ATTR__UNKNOWN) {
@@ -664,58 +999,177 @@ static int fill_one(const char *what, struct match_attr *a, int rem)
 				  attr, v);
 			*n = v;
 			rem--;
-			rem = macroexpand_one(attr->attr_nr, rem);
+			rem = macroexpand_one(ctx, attr->attr_nr, rem);
 		}
 	}
 	return rem;
 }
 
-static int fill(const char *path, int pathlen, int basename_offset,
-		struct attr_stack *stk, int rem)
+static int fill_rule(struct git_attr_context *ctx,
+		     const char *path, int pathlen, int basename_offset,
+		     struct attr_stack *stk, int i, int rem)
 {
-	int i;
+	struct match_attr *a = stk->attrs[i];
 	const char *base = stk->origin ? stk->origin : "";
 
-	for (i = stk->num_matches - 1; 0 < rem && 0 <= i; i--) {
-		struct match_attr *a = stk->attrs[i];
-		if (a->is_macro)
-			continue;
-		if (path_matches(path, pathlen, basename_offset,
-				 &a->u.pat, base, stk->originlen))
-			rem = fill_one("fill", a, rem);
+	if (path_matches(path, pathlen, basename_offset,
+			 &a->u.pat, base, stk->originlen))
+		rem = fill_one(ctx, "fill", a, rem);
+	return rem;
+}
+
+static int fill(struct git_attr_context *ctx,
+		const char *path, int pathlen, int basename_offset,
+		struct attr_stack *stk, int rem)
+{
+	struct rule_list *hits = &ctx->hits;
+	struct attr_match_table *t = stk->table;
+	struct rule_list *dir;
+	struct attr_bucket *b;
+	const char *name = path + basename_offset;
+	int namelen = pathlen - basename_offset;
+	const char *ext;
+	int i, j;
+
+	if (!stk->num_matches)
+		return rem;
+
+	if (namelen && name[namelen - 1] == '/')
+		namelen--;
+	hits->nr = 0;
+	b = find_attr_bucket(&t->basenames, name, namelen);
+	if (b)
+		add_rules(hits, b->rule, b->nr);
+	ext = find_last(name, '.', namelen);
+	if (ext) {
+		ext++;
+		b = find_attr_bucket(&t->extensions, ext, name + namelen - ext);
+		if (b)
+			add_rules(hits, b->rule, b->nr);
+	}
+	if (hits->nr > 1)
+		qsort(hits->rule, hits->nr, sizeof(int), rule_cmp_desc);
+
+	dir = dir_candidates(ctx, stk, path,
+			     basename_offset ? basename_offset - 1 : 0);
+
+	/* merge the two lists, highest first */
+	for (i = j = 0; 0 < rem && (i < dir->nr || j < hits->nr); ) {
+		int rule;
+		if (j >= hits->nr ||
+		    (i < dir->nr && dir->rule[i] > hits->rule[j]))
+			rule = dir->rule[i++];
+		else
+			rule = hits->rule[j++];
+		rem = fill_rule(ctx, path, pathlen, basename_offset,
+				stk, rule, rem);
 	}
 	return rem;
 }
 
-static int macroexpand_one(int attr_nr, int rem)
+static struct match_attr *find_macro(struct attr_stack *stk, int attr_nr)
 {
-	struct attr_stack *stk;
-	struct match_attr *a = NULL;
 	int i;
 
-	if (check_all_attr[attr_nr].value != ATTR__TRUE)
-		return rem;
-
-	for (stk = attr_stack; !a && stk; stk = stk->prev)
-		for (i = stk->num_matches - 1; !a && 0 <= i; i--) {
+	for (; stk; stk = stk->prev)
+		for (i = stk->num_matches - 1; 0 <= i; i--) {
 			struct match_attr *ma = stk->attrs[i];
 			if (!ma->is_macro)
 				continue;
 			if (ma->u.attr->attr_nr == attr_nr)
-				a = ma;
+				return ma;
 		}
+	return NULL;
+}
 
+static int macroexpand_one(struct git_attr_context *ctx, int attr_nr, int rem)
+{
+	struct match_attr *a;
+
+	if (ctx->value[attr_nr] != ATTR__TRUE)
+		return rem;
+
+	a = find_macro(attr_info, attr_nr);
+	if (!a)
+		a = find_macro(ctx->stack, attr_nr);
 	if (a)
-		rem = fill_one("expand", a, rem);
+		rem = fill_one(ctx, "expand", a, rem);
 
 	return rem;
 }
 
+struct git_attr_context *git_attr_context_alloc(void)
+{
+	struct git_attr_context *ctx = xcalloc(1, sizeof(*ctx));
+
+	strbuf_init(&ctx->dir, 0);
+	/* this is run before any threads are started */
+	attr_lock();
+	attr_unlock();
+	return ctx;
+}
+
+void git_attr_context_free(struct git_attr_context *ctx)
+{
+	int i;
+
+	if (!ctx)
+		return;
+	strbuf_release(&ctx->dir);
+	free(ctx->value);
+	for (i = 0; i < ctx->dir_rules_alloc; i++) {
+		strbuf_release(&ctx->dir_rules[i].dir);
+		free(ctx->dir_rules[i].rules.rule);
+	}
+	free(ctx->dir_rules);
+	free(ctx->hits.rule);
+	free(ctx);
+}
+
 /*
- * Collect all attributes for path into the array pointed to by
- * check_all_attr.
+ * Look up the frames for the directory path[0..dirlen) in ctx, unless
+ * they are those of the directory last asked about.
  */
-static void collect_all_attrs(const char *path)
+static void prepare_attr_context(struct git_attr_context *ctx,
+				 const char *path, int dirlen)
+{
+	int i, frames_nr;
+
+	if (ctx->stack && ctx->generation == attr_generation &&
+	    ctx->dir.len == dirlen && !memcmp(ctx->dir.buf, path, dirlen))
+		return;
+
+	attr_lock();
+	if (ctx->generation != attr_generation) {
+		/* the frames our ids refer to are gone */
+		for (i = 0; i < ctx->dir_rules_alloc; i++)
+			ctx->dir_rules[i].valid = 0;
+		ctx->generation = attr_generation;
+	}
+	ctx->stack = get_attr_stack(path, dirlen);
+	ctx->attr_nr = attr_nr;
+	frames_nr = attr_frames_nr;
+	attr_unlock();
+
+	ALLOC_GROW(ctx->value, ctx->attr_nr, ctx->value_alloc);
+	if (ctx->dir_rules_alloc < frames_nr) {
+		int alloc = alloc_nr(frames_nr);
+		ctx->dir_rules = xrealloc(ctx->dir_rules,
+					  alloc * sizeof(*ctx->dir_rules));
+		memset(ctx->dir_rules + ctx->dir_rules_alloc, 0,
+		       (alloc - ctx->dir_rules_alloc) * sizeof(*ctx->dir_rules));
+		for (i = ctx->dir_rules_alloc; i < alloc; i++)
+			strbuf_init(&ctx->dir_rules[i].dir, 0);
+		ctx->dir_rules_alloc = alloc;
+	}
+	strbuf_reset(&ctx->dir);
+	strbuf_add(&ctx->dir, path, dirlen);
+}
+
+/*
+ * Collect all attributes for path into ctx->value.
+ */
+static void collect_all_attrs(struct git_attr_context *ctx, const char *path)
 {
 	struct attr_stack *stk;
 	int i, pathlen, rem, dirlen;
@@ -735,55 +1189,105 @@ static void collect_all_attrs(const char *path)
 		dirlen = 0;
 	}
 
-	prepare_attr_stack(path, dirlen);
-	for (i = 0; i < attr_nr; i++)
-		check_all_attr[i].value = ATTR__UNKNOWN;
+	prepare_attr_context(ctx, path, dirlen);
+	for (i = 0; i < ctx->attr_nr; i++)
+		ctx->value[i] = ATTR__UNKNOWN;
 
-	rem = attr_nr;
-	for (stk = attr_stack; 0 < rem && stk; stk = stk->prev)
-		rem = fill(path, pathlen, basename_offset, stk, rem);
+	rem = ctx->attr_nr;
+	rem = fill(ctx, path, pathlen, basename_offset, attr_info, rem);
+	for (stk = ctx->stack; 0 < rem && stk; stk = stk->prev)
+		rem = fill(ctx, path, pathlen, basename_offset, stk, rem);
 }
 
-int git_check_attr(const char *path, int num, struct git_attr_check *check)
+static const char *attr_value(struct git_attr_context *ctx,
+			      const struct git_attr *attr)
+{
+	const char *value;
+
+	/* no file that applies mentions attributes defined later */
+	if (ctx->attr_nr <= attr->attr_nr)
+		return ATTR__UNSET;
+	value = ctx->value[attr->attr_nr];
+	if (value == ATTR__UNKNOWN)
+		value = ATTR__UNSET;
+	return value;
+}
+
+static struct git_attr_context *default_attr_context(void);
+
+int git_check_attr_ctx(struct git_attr_context *ctx, const char *path,
+		       int num, struct git_attr_check *check)
 {
 	int i;
 
-	collect_all_attrs(path);
+	if (!ctx)
+		ctx = default_attr_context();
+	collect_all_attrs(ctx, path);
 
-	for (i = 0; i < num; i++) {
-		const char *value = check_all_attr[check[i].attr->attr_nr].value;
-		if (value == ATTR__UNKNOWN)
-			value = ATTR__UNSET;
-		check[i].value = value;
-	}
+	for (i = 0; i < num; i++)
+		check[i].value = attr_value(ctx, check[i].attr);
 
 	return 0;
 }
 
+int git_check_attr_batch(struct git_attr_context *ctx,
+			 int nr, const char **paths,
+			 int num, const struct git_attr_check *check,
+			 const char **values)
+{
+	int i, j;
+
+	if (!ctx)
+		ctx = default_attr_context();
+	for (i = 0; i < nr; i++) {
+		collect_all_attrs(ctx, paths[i]);
+		for (j = 0; j < num; j++)
+			*values++ = attr_value(ctx, check[j].attr);
+	}
+	return 0;
+}
+
+static struct git_attr_context *default_attr_context(void)
+{
+	static struct git_attr_context *ctx;
+
+	if (!ctx)
+		ctx = git_attr_context_alloc();
+	return ctx;
+}
+
+int git_check_attr(const char *path, int num, struct git_attr_check *check)
+{
+	return git_check_attr_ctx(default_attr_context(), path, num, check);
+}
+
 int git_all_attrs(const char *path, int *num, struct git_attr_check **check)
 {
+	struct git_attr_context *ctx = default_attr_context();
 	int i, count, j;
 
-	collect_all_attrs(path);
+	collect_all_attrs(ctx, path);
 
 	/* Count the number of attributes that are set. */
 	count = 0;
-	for (i = 0; i < attr_nr; i++) {
-		const char *value = check_all_attr[i].value;
+	for (i = 0; i < ctx->attr_nr; i++) {
+		const char *value = ctx->value[i];
 		if (value != ATTR__UNSET && value != ATTR__UNKNOWN)
 			++count;
 	}
 	*num = count;
 	*check = xmalloc(sizeof(**check) * count);
 	j = 0;
-	for (i = 0; i < attr_nr; i++) {
-		const char *value = check_all_attr[i].value;
+	attr_lock();
+	for (i = 0; i < ctx->attr_nr; i++) {
+		const char *value = ctx->value[i];
 		if (value != ATTR__UNSET && value != ATTR__UNKNOWN) {
-			(*check)[j].attr = check_all_attr[i].attr;
+			(*check)[j].attr = all_attrs[i];
 			(*check)[j].value = value;
 			++j;
 		}
 	}
+	attr_unlock();
 
 	return 0;
 }
@@ -38,6 +38,37 @@ char *git_attr_name(struct git_attr *);
 
 int git_check_attr(const char *path, int, struct git_attr_check *);
 
+/*
+ * The state of the attribute lookups of one thread.  The attribute
+ * files themselves are read once and shared by all contexts, so
+ * threads that each use their own context can look up attributes at
+ * the same time.  Contexts must be allocated before the threads that
+ * use them are started.
+ */
+struct git_attr_context;
+
+struct git_attr_context *git_attr_context_alloc(void);
+void git_attr_context_free(struct git_attr_context *);
+
+/*
+ * Same as git_check_attr(), but using the given context; NULL stands
+ * for the one git_check_attr() uses.
+ */
+int git_check_attr_ctx(struct git_attr_context *, const char *path,
+		       int, struct git_attr_check *);
+
+/*
+ * Check the attributes in check[0..num) of each of paths[0..nr),
+ * storing the value of check[j].attr for paths[i] in
+ * values[i * num + j].  The paths are best given in sorted order, so
+ * that the lookups for the paths in the same directory share their
+ * work.
+ */
+int git_check_attr_batch(struct git_attr_context *,
+			 int nr, const char **paths,
+			 int num, const struct git_attr_check *check,
+			 const char **values);
+
 /*
  * Retrieve all attributes that apply to the specified path.  *num
  * will be set to the number of attributes on the path; **check will
@@ -52,6 +83,10 @@ enum git_attr_direction {
 	GIT_ATTR_CHECKOUT,
 	GIT_ATTR_INDEX
 };
+/*
+ * Changing the direction drops what has been read from the attribute
+ * files; it must not be done while other threads look up attributes.
+ */
 void git_attr_set_direction(enum git_attr_direction, struct index_state *);
 
 #endif /* ATTR_H */
@@ -91,6 +91,9 @@ struct origin {
 	char path[FLEX_ARRAY];
 };
 
+/* scratch memory of xdiff, kept for all the diffs we run */
+static xdarena_t xdl_arena;
+
 static int diff_hunks(mmfile_t *file_a, mmfile_t *file_b, long ctxlen,
 		      xdl_emit_hunk_consume_func_t hunk_func, void *cb_data)
 {
@@ -99,6 +102,7 @@ static int diff_hunks(mmfile_t *file_a, mmfile_t *file_b, long ctxlen,
 	xdemitcb_t ecb = {NULL};
 
 	xpp.flags = xdl_opts;
+	xpp.arena = &xdl_arena;
 	xecfg.ctxlen = ctxlen;
 	xecfg.hunk_func = hunk_func;
 	ecb.priv = cb_data;
@@ -1524,6 +1528,311 @@ static void found_guilty_entry(struct blame_entry *ent)
 	}
 }
 
+/*
+ * The blame cache remembers the finished blame of a <commit, path>
+ * pair under $GIT_DIR/blame-cache/, so that blaming a descendant of
+ * that commit only has to dig through the commits that are new since:
+ * when the digging reaches a cached <commit, path>, the lines still
+ * suspected on it are taken over from the cached result instead of
+ * being passed on to its parents.
+ *
+ * The file for a pair is named after the SHA-1 of the commit, the
+ * path and the options that influence the result (see
+ * setup_blame_cache()).  It starts with the blob the result is for,
+ * followed by one record per blame_entry, in line order:
+ *
+ *   <lno> SP <num_lines> SP <s_lno> SP <commit> SP <previous> LF
+ *   <path> NUL <previous-path> NUL
+ *
+ * where <previous> is the null SHA-1 (and <previous-path> empty) if
+ * the suspect has no previous origin.
+ */
+static int blame_cache_config;
+static int blame_cache;
+static struct strbuf blame_cache_key = STRBUF_INIT;
+
+struct blame_cache_entry {
+	int lno, num_lines, s_lno;
+	unsigned char commit[20];
+	unsigned char previous[20];
+	const char *path;
+	const char *previous_path;
+};
+
+struct blame_cache_file {
+	struct strbuf buf;
+	unsigned char blob_sha1[20];
+	int nr, alloc;
+	struct blame_cache_entry *entry;
+};
+
+static const char *blame_cache_path(struct commit *commit, const char *path)
+{
+	git_SHA_CTX ctx;
+	unsigned char sha1[20];
+	const char *hex;
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, commit->object.sha1, 20);
+	git_SHA1_Update(&ctx, path, strlen(path) + 1);
+	git_SHA1_Update(&ctx, blame_cache_key.buf, blame_cache_key.len);
+	git_SHA1_Final(sha1, &ctx);
+	hex = sha1_to_hex(sha1);
+	return git_path("blame-cache/%.2s/%s", hex, hex + 2);
+}
+
+static void free_blame_cache_file(struct blame_cache_file *bc)
+{
+	strbuf_release(&bc->buf);
+	free(bc->entry);
+}
+
+/*
+ * Read the cached blame for <commit, path>.  Return -1 if there is
+ * none, or if it does not look like a complete result.
+ */
+static int read_blame_cache(struct blame_cache_file *bc,
+			    struct commit *commit, const char *path)
+{
+	static const char header[] = "blame-cache v1\nblob ";
+	const char *p, *end;
+	int next_lno = 0;
+
+	memset(bc, 0, sizeof(*bc));
+	strbuf_init(&bc->buf, 0);
+	if (strbuf_read_file(&bc->buf, blame_cache_path(commit, path), 0) < 0)
+		goto bad;
+	p = bc->buf.buf;
+	end = p + bc->buf.len;
+	if (bc->buf.len < strlen(header) + 41 ||
+	    memcmp(p, header, strlen(header)) ||
+	    get_sha1_hex(p + strlen(header), bc->blob_sha1) ||
+	    p[strlen(header) + 40] != '\n')
+		goto bad;
+	p += strlen(header) + 41;
+
+	while (p < end) {
+		struct blame_cache_entry *e;
+		char *ep;
+
+		ALLOC_GROW(bc->entry, bc->nr + 1, bc->alloc);
+		e = &bc->entry[bc->nr++];
+		e->lno = strtol(p, &ep, 10);
+		if (*ep != ' ' || e->lno != next_lno)
+			goto bad;
+		e->num_lines = strtol(ep + 1, &ep, 10);
+		if (*ep != ' ' || e->num_lines <= 0)
+			goto bad;
+		e->s_lno = strtol(ep + 1, &ep, 10);
+		if (*ep != ' ' || e->s_lno < 0 || end - ep < 84 ||
+		    get_sha1_hex(ep + 1, e->commit) || ep[41] != ' ' ||
+		    get_sha1_hex(ep + 42, e->previous) || ep[82] != '\n')
+			goto bad;
+		p = ep + 83;
+		e->path = p;
+		p = memchr(p, '\0', end - p);
+		if (!p || !*e->path)
+			goto bad;
+		e->previous_path = ++p;
+		p = memchr(p, '\0', end - p);
+		if (!p)
+			goto bad;
+		p++;
+		next_lno = e->lno + e->num_lines;
+	}
+	return 0;
+
+bad:
+	free_blame_cache_file(bc);
+	return -1;
+}
+
+/*
+ * Blame the lines of ent, which are suspected on a <commit, path>
+ * whose blame is cached in bc, on the origins recorded in the cache.
+ */
+static int take_blame_from_cache(struct scoreboard *sb,
+				 struct blame_entry *ent,
+				 struct blame_cache_file *bc)
+{
+	int s_lno = ent->s_lno, s_end = ent->s_lno + ent->num_lines;
+	int lno = ent->lno;
+	struct blame_entry *first = ent;
+	int i;
+
+	for (i = 0; i < bc->nr && s_lno < s_end; i++) {
+		struct blame_cache_entry *c = &bc->entry[i];
+		struct blame_entry piece;
+		struct commit *commit;
+		struct origin *o;
+		int num;
+
+		if (c->lno + c->num_lines <= s_lno)
+			continue;
+		num = c->lno + c->num_lines - s_lno;
+		if (s_end - s_lno < num)
+			num = s_end - s_lno;
+
+		commit = lookup_commit(c->commit);
+		if (!commit || parse_commit(commit))
+			return -1;
+		/* treat root commit as boundary, as assign_blame() does */
+		if (!commit->parents && !show_root)
+			commit->object.flags |= UNINTERESTING;
+		o = get_origin(sb, commit, c->path);
+		if (!o->previous && !is_null_sha1(c->previous)) {
+			struct commit *prev = lookup_commit(c->previous);
+			if (prev)
+				o->previous = get_origin(sb, prev,
+							 c->previous_path);
+		}
+
+		memset(&piece, 0, sizeof(piece));
+		piece.lno = lno;
+		piece.num_lines = num;
+		piece.suspect = o;
+		piece.s_lno = c->s_lno + (s_lno - c->lno);
+		if (first) {
+			dup_entry(first, &piece);
+			found_guilty_entry(first);
+			first = NULL;
+		} else {
+			struct blame_entry *e = xmalloc(sizeof(*e));
+			memcpy(e, &piece, sizeof(*e));
+			add_blame_entry(sb, e);
+			found_guilty_entry(e);
+		}
+		origin_decref(o);
+		lno += num;
+		s_lno += num;
+	}
+	return s_lno < s_end ? -1 : 0;
+}
+
+/*
+ * If the blame of suspect is cached, blame its lines on the origins
+ * recorded in the cache and return 1; otherwise return 0 to have
+ * them passed to its parents as usual.
+ */
+static int blame_from_cache(struct scoreboard *sb, struct origin *suspect)
+{
+	struct blame_cache_file bc;
+	struct blame_entry *ent, *next;
+	int lines = 0;
+
+	if (!blame_cache || is_null_sha1(suspect->commit->object.sha1))
+		return 0;
+	if (read_blame_cache(&bc, suspect->commit, suspect->path))
+		return 0;
+	if (hashcmp(bc.blob_sha1, suspect->blob_sha1)) {
+		free_blame_cache_file(&bc);
+		return 0;
+	}
+	/* The cache must cover every line still suspected on it */
+	if (bc.nr)
+		lines = bc.entry[bc.nr - 1].lno + bc.entry[bc.nr - 1].num_lines;
+	for (ent = sb->ent; ent; ent = ent->next)
+		if (!ent->guilty && same_suspect(ent->suspect, suspect) &&
+		    lines < ent->s_lno + ent->num_lines) {
+			free_blame_cache_file(&bc);
+			return 0;
+		}
+
+	for (ent = sb->ent; ent; ent = next) {
+		next = ent->next;
+		if (ent->guilty || !same_suspect(ent->suspect, suspect))
+			continue;
+		if (take_blame_from_cache(sb, ent, &bc))
+			die("corrupt blame cache for %s in %s",
+			    suspect->path,
+			    sha1_to_hex(suspect->commit->object.sha1));
+	}
+	free_blame_cache_file(&bc);
+	return 1;
+}
+
+/*
+ * Store the finished blame in sb, if it covers the whole file, for
+ * later runs to reuse.  Failing to do so is not an error.
+ */
+static void write_blame_cache(struct scoreboard *sb,
+			      const unsigned char *blob_sha1)
+{
+	static struct lock_file lock;
+	struct strbuf buf = STRBUF_INIT;
+	struct blame_entry *ent;
+	char *path;
+	int fd, lno = 0;
+
+	if (!blame_cache || is_null_sha1(sb->final->object.sha1))
+		return;
+	for (ent = sb->ent; ent; ent = ent->next) {
+		if (ent->lno != lno)
+			return;
+		lno += ent->num_lines;
+	}
+	if (lno != sb->num_lines)
+		return;
+
+	path = xstrdup(blame_cache_path(sb->final, sb->path));
+	if (safe_create_leading_directories(path) ||
+	    (fd = hold_lock_file_for_update(&lock, path, 0)) < 0) {
+		free(path);
+		return;
+	}
+	strbuf_addf(&buf, "blame-cache v1\nblob %s\n", sha1_to_hex(blob_sha1));
+	for (ent = sb->ent; ent; ent = ent->next) {
+		struct origin *o = ent->suspect;
+		struct origin *prev = o->previous;
+
+		strbuf_addf(&buf, "%d %d %d %s", ent->lno, ent->num_lines,
+			    ent->s_lno, sha1_to_hex(o->commit->object.sha1));
+		strbuf_addf(&buf, " %s\n", sha1_to_hex(prev ?
+							 prev->commit->object.sha1 :
+							 null_sha1));
+		strbuf_addstr(&buf, o->path);
+		strbuf_addch(&buf, '\0');
+		strbuf_addstr(&buf, prev ? prev->path : "");
+		strbuf_addch(&buf, '\0');
+	}
+	if (write_in_full(fd, buf.buf, buf.len) != buf.len ||
+	    commit_lock_file(&lock))
+		rollback_lock_file(&lock);
+	strbuf_release(&buf);
+	free(path);
+}
+
+/*
+ * Decide whether the blame cache can be used for this run, and set up
+ * the part of the cache key that describes the options.
+ */
+static void setup_blame_cache(struct rev_info *revs, int opt,
+			      const char *revs_file)
+{
+	int i;
+
+	if (!blame_cache_config || reverse || revs_file ||
+	    revs->max_age != -1)
+		return;
+	/*
+	 * Which lines -M and -C find moved or copied depends on how
+	 * the lines blamed on a commit are split into blame_entries
+	 * when it is reached, which a cached result does not keep.
+	 */
+	if (opt & (PICKAXE_BLAME_MOVE | PICKAXE_BLAME_COPY))
+		return;
+	/* a bottom commit cuts the history short */
+	for (i = 0; i < revs->pending.nr; i++)
+		if (revs->pending.objects[i].item->flags & UNINTERESTING)
+			return;
+
+	strbuf_addf(&blame_cache_key, "xdl=%d", xdl_opts);
+	strbuf_addf(&blame_cache_key, " textconv=%d rename=%d",
+		    !!DIFF_OPT_TST(&revs->diffopt, ALLOW_TEXTCONV),
+		    !no_whole_file_rename);
+	blame_cache = 1;
+}
+
 /*
  * The main loop -- while the scoreboard has lines whose true origin
  * is still unknown, pick one blame_entry, and allow its current
@@ -1554,9 +1863,10 @@ static void assign_blame(struct scoreboard *sb, int opt)
 		parse_commit(commit);
 		if (reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
-		     !(revs->max_age != -1 && commit->date < revs->max_age)))
-			pass_blame(sb, suspect, opt);
-		else {
+		     !(revs->max_age != -1 && commit->date < revs->max_age))) {
+			if (!blame_from_cache(sb, suspect))
+				pass_blame(sb, suspect, opt);
+		} else {
 			commit->object.flags |= UNINTERESTING;
 			if (commit->object.parsed)
 				mark_parents_uninteresting(commit);
@@ -1943,6 +2253,10 @@ static int git_blame_config(const char *var, const char *value, void *cb)
 		blank_boundary = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "blame.cache")) {
+		blame_cache_config = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "blame.date")) {
 		if (!value)
 			return config_error_nonbool(var);
@@ -2239,6 +2553,7 @@ int cmd_blame(int argc, const char **argv, const char *prefix)
 	long dashdash_pos, lno;
 	const char *final_commit_name = NULL;
 	enum object_type type;
+	unsigned char final_blob_sha1[20] = { 0 };
 
 	static struct string_list range_list;
 	static int output_option = 0, opt = 0;
@@ -2431,6 +2746,8 @@ parse_done:
 	else if (contents_from)
 		die("Cannot use --contents with final commit object name");
 
+	setup_blame_cache(&revs, opt, revs_file);
+
 	/*
 	 * If we have bottom, this will mark the ancestors of the
 	 * bottom commits we would reach while traversing as
@@ -2451,6 +2768,7 @@ parse_done:
 		o = get_origin(&sb, sb.final, path);
 		if (fill_blob_sha1_and_mode(o))
 			die("no such path %s in %s", path, final_commit_name);
+		hashcpy(final_blob_sha1, o->blob_sha1);
 
 		if (DIFF_OPT_TST(&sb.revs->diffopt, ALLOW_TEXTCONV) &&
 		    textconv_object(path, o->mode, o->blob_sha1, 1, (char **) &sb.final_buf,
@@ -2521,6 +2839,8 @@ parse_done:
 
 	assign_blame(&sb, opt);
 
+	write_blame_cache(&sb, final_blob_sha1);
+
 	if (incremental)
 		return 0;
 
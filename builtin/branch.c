@@ -631,6 +631,9 @@ static int print_ref_list(int kinds, int detached, int verbose, int abbrev, stru
 	struct append_ref_cb cb;
 	struct ref_list ref_list;
 
+	/* the subjects shown by -v are read on demand */
+	save_commit_buffer = 0;
+
 	memset(&ref_list, 0, sizeof(ref_list));
 	ref_list.kinds = kinds;
 	ref_list.verbose = verbose;
@@ -69,6 +69,28 @@ static void check_attr(const char *prefix, int cnt,
 	free(full_path);
 }
 
+static void check_attr_paths(const char *prefix, int cnt,
+	struct git_attr_check *check, int nr, const char **files)
+{
+	const char **full_path = xmalloc(nr * sizeof(*full_path));
+	const char **values = xmalloc(nr * cnt * sizeof(*values));
+	int i, j;
+
+	for (i = 0; i < nr; i++)
+		full_path[i] = prefix_path(prefix, prefix ? strlen(prefix) : 0,
+					   files[i]);
+	if (git_check_attr_batch(NULL, nr, full_path, cnt, check, values))
+		die("git_check_attr_batch died");
+	for (i = 0; i < nr; i++) {
+		for (j = 0; j < cnt; j++)
+			check[j].value = values[i * cnt + j];
+		output_attr(cnt, check, files[i]);
+		free((char *)full_path[i]);
+	}
+	free(full_path);
+	free(values);
+}
+
 static void check_attr_stdin_paths(const char *prefix, int cnt,
 	struct git_attr_check *check)
 {
@@ -174,7 +196,10 @@ int cmd_check_attr(int argc, const char **argv, const char *prefix)
 
 	if (stdin_paths)
 		check_attr_stdin_paths(prefix, cnt, check);
-	else {
+	else if (check) {
+		check_attr_paths(prefix, cnt, check, argc - filei, argv + filei);
+		maybe_flush_or_die(stdout, "attribute to stdout");
+	} else {
 		for (i = filei; i < argc; i++)
 			check_attr(prefix, cnt, check, argv[i]);
 		maybe_flush_or_die(stdout, "attribute to stdout");
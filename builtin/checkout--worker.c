@@ -0,0 +1,15 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parallel-checkout.h"
+
+static const char checkout_worker_usage[] =
+	"git checkout--worker";
+
+int cmd_checkout__worker(int argc, const char **argv, const char *prefix)
+{
+	if (argc != 1)
+		usage(checkout_worker_usage);
+
+	git_config(git_default_config, NULL);
+	return checkout_worker(0, 1);
+}
@@ -23,6 +23,7 @@
 #include "remote.h"
 #include "run-command.h"
 #include "connected.h"
+#include "argv-array.h"
 
 /*
  * Overall FIXMEs:
@@ -754,6 +755,7 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 
 	struct refspec *refspec;
 	const char *fetch_pattern;
+	struct argv_array ref_prefixes = ARGV_ARRAY_INIT;
 
 	junk_pid = getpid();
 
@@ -922,7 +924,16 @@ int cmd_clone(int argc, const char **argv, const char *prefix)
 	if (transport->smart_options && !option_depth)
 		transport->smart_options->check_self_contained_and_connected = 1;
 
-	refs = transport_get_remote_refs(transport);
+	/*
+	 * Besides the refs the refspec copies, we look at HEAD to
+	 * decide what to check out, and at the tags to follow.
+	 */
+	refspec_ref_prefixes(refspec, 1, &ref_prefixes);
+	argv_array_push(&ref_prefixes, "HEAD");
+	argv_array_push(&ref_prefixes, "refs/tags/");
+
+	refs = transport_get_remote_refs(transport, &ref_prefixes);
+	argv_array_clear(&ref_prefixes);
 
 	if (refs) {
 		mapped_refs = wanted_peer_refs(refs, refspec);
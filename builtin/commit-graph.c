@@ -0,0 +1,28 @@
+#include "builtin.h"
+#include "cache.h"
+#include "commit.h"
+#include "parse-options.h"
+#include "commit-graph.h"
+
+static const char * const builtin_commit_graph_usage[] = {
+	N_("git commit-graph write"),
+	NULL
+};
+
+int cmd_commit_graph(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_commit_graph_usage, 0);
+	if (argc != 1 || strcmp(argv[0], "write"))
+		usage_with_options(builtin_commit_graph_usage, options);
+
+	/* we only need the parents, not the messages */
+	save_commit_buffer = 0;
+
+	return !!write_commit_graph_reachable();
+}
@@ -194,7 +194,7 @@ static void find_non_local_tags(struct transport *transport,
 	struct string_list_item *item = NULL;
 
 	for_each_ref(add_existing, &existing_refs);
-	for (ref = transport_get_remote_refs(transport); ref; ref = ref->next) {
+	for (ref = transport_get_remote_refs(transport, NULL); ref; ref = ref->next) {
 		if (!starts_with(ref->name, "refs/tags/"))
 			continue;
 
@@ -263,6 +263,49 @@ static void find_non_local_tags(struct transport *transport,
 	string_list_clear(&remote_refs, 0);
 }
 
+/*
+ * Collect the prefixes of the remote refs get_ref_map() may look at,
+ * so that a server can leave the other refs out of its list.  Return
+ * 0 if it may look at any ref.
+ */
+static int get_ref_prefixes(struct transport *transport,
+			    struct refspec *refspecs, int refspec_count,
+			    int tags, struct argv_array *prefixes)
+{
+	int i;
+
+	if (refspec_count) {
+		if (refspec_ref_prefixes(refspecs, refspec_count, prefixes) < 0)
+			return 0;
+	} else {
+		struct remote *remote = transport->remote;
+		struct branch *branch = branch_get(NULL);
+		int has_merge = branch_has_merge_config(branch);
+		if (remote &&
+		    (remote->fetch_refspec_nr ||
+		     (has_merge && !strcmp(branch->remote_name, remote->name)))) {
+			if (refspec_ref_prefixes(remote->fetch,
+						 remote->fetch_refspec_nr,
+						 prefixes) < 0)
+				return 0;
+			if (has_merge &&
+			    !strcmp(branch->remote_name, remote->name))
+				for (i = 0; i < branch->merge_nr; i++) {
+					const char *src = branch->merge[i]->src;
+					if (starts_with(src, "refs/"))
+						argv_array_push(prefixes, src);
+					else
+						expand_ref_prefix(prefixes, src);
+				}
+		} else
+			argv_array_push(prefixes, "HEAD");
+	}
+
+	if (tags != TAGS_UNSET)
+		argv_array_push(prefixes, "refs/tags/");
+	return 1;
+}
+
 static struct ref *get_ref_map(struct transport *transport,
 			       struct refspec *refspecs, int refspec_count,
 			       int tags, int *autotags)
@@ -275,7 +318,14 @@ static struct ref *get_ref_map(struct transport *transport,
 	/* opportunistically-updated references: */
 	struct ref *orefs = NULL, **oref_tail = &orefs;
 
-	const struct ref *remote_refs = transport_get_remote_refs(transport);
+	struct argv_array ref_prefixes = ARGV_ARRAY_INIT;
+	const struct ref *remote_refs;
+
+	if (!get_ref_prefixes(transport, refspecs, refspec_count, tags,
+			      &ref_prefixes))
+		argv_array_clear(&ref_prefixes);
+	remote_refs = transport_get_remote_refs(transport, &ref_prefixes);
+	argv_array_clear(&ref_prefixes);
 
 	if (refspec_count) {
 		for (i = 0; i < refspec_count; i++) {
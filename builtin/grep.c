@@ -19,6 +19,7 @@
 #include "dir.h"
 #include "pathspec.h"
 #include "attr.h"
+#include "trigram-index.h"
 
 static char const * const grep_usage[] = {
 	N_("git grep [options] [-e] <pattern> [<rev>...] [[--] <path>...]"),
@@ -26,14 +27,38 @@ static char const * const grep_usage[] = {
 };
 
 static int use_threads = 1;
+static int num_threads;
+
+static int use_trigram_index;
+static struct trigram_index *trigram_index;
+static struct trigram_query trigram_query;
+
+/*
+ * Record the trigrams of a blob the index does not know about yet,
+ * now that its contents have been read anyway.
+ */
+static void record_trigrams(struct grep_opt *opt, struct grep_source *gs)
+{
+	struct trigram_filter *filter;
+
+	if (!trigram_index || opt->allow_textconv ||
+	    gs->type != GREP_SOURCE_SHA1 || !gs->buf ||
+	    0 <= trigram_index_may_match(trigram_index, gs->identifier,
+					 &trigram_query))
+		return;
+	filter = trigram_filter_compute(gs->buf, gs->size);
+	/* the read lock serializes the updates to the index, too */
+	grep_read_lock();
+	trigram_index_add(trigram_index, gs->identifier, filter);
+	grep_read_unlock();
+}
 
 #ifndef NO_PTHREADS
-#define THREADS 8
-static pthread_t threads[THREADS];
+#define GREP_NUM_THREADS_DEFAULT 8
 
-/* We use one producer thread and THREADS consumer
- * threads. The producer adds struct work_items to 'todo' and the
- * consumers pick work items from the same array.
+/* We use one producer thread and num_threads consumer threads.
+ * The producer adds struct work_items to 'todo' in the order their
+ * results are to be shown, and the consumers take them from there.
  */
 struct work_item {
 	struct grep_source source;
@@ -41,24 +66,28 @@ struct work_item {
 	struct strbuf out;
 };
 
-/* In the range [todo_done, todo_start) in 'todo' we have work_items
- * that have been or are processed by a consumer thread. We haven't
- * written the result for these to stdout yet.
+/* The work_items are numbered in the order they are added, and the
+ * one numbered n lives in todo[n % todo_size].
+ *
+ * In the range [todo_done, todo_start) we have work_items that have
+ * been or are processed by a consumer thread. We haven't written the
+ * result for these to stdout yet.
  *
  * The work_items in [todo_start, todo_end) are waiting to be picked
  * up by a consumer thread.
- *
- * The ranges are modulo TODO_SIZE.
  */
-#define TODO_SIZE 128
-static struct work_item todo[TODO_SIZE];
-static int todo_start;
-static int todo_end;
-static int todo_done;
+static struct work_item *todo;
+static unsigned long todo_size;
+static unsigned long todo_start;
+static unsigned long todo_end;
+static unsigned long todo_done;
 
 /* Has all work items been added? */
 static int all_work_added;
 
+/* Is a consumer writing results to stdout? */
+static int writing_results;
+
 /* This lock protects all the variables above. */
 static pthread_mutex_t grep_mutex;
 
@@ -74,7 +103,9 @@ static inline void grep_unlock(void)
 		pthread_mutex_unlock(&grep_mutex);
 }
 
-/* Signalled when a new work_item is added to todo. */
+/* Signalled when a new work_item is added to todo, or when there
+ * is work to steal.
+ */
 static pthread_cond_t cond_add;
 
 /* Signalled when the result from one work_item is written to
@@ -85,79 +116,197 @@ static pthread_cond_t cond_write;
 /* Signalled when we are finished with everything. */
 static pthread_cond_t cond_result;
 
+/* A consumer picks up a batch of up to MAX_BATCH work_items at a
+ * time, and works through them without going through grep_mutex.
+ * One that runs out of work steals the second half of the largest
+ * batch that is left, so that a slow work_item does not hold up the
+ * ones that come after it in its batch.  'mutex' protects the batch
+ * between its owner and the thieves; it is hardly ever contended.
+ */
+#define MAX_BATCH 16
+
+struct grep_thread {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	unsigned long next, end;
+	struct grep_opt *opt;
+};
+static struct grep_thread *threads;
+
 static int skip_first_line;
 
+static inline struct work_item *todo_item(unsigned long n)
+{
+	return &todo[n % todo_size];
+}
+
 static void add_work(struct grep_opt *opt, enum grep_source_type type,
 		     const char *name, const char *path, const void *id)
 {
+	struct grep_source source;
+	struct work_item *w;
+
+	grep_source_init(&source, type, name, path, id);
+	if (opt->binary != GREP_BINARY_TEXT)
+		grep_source_load_driver(&source, NULL);
+
 	grep_lock();
 
-	while ((todo_end+1) % ARRAY_SIZE(todo) == todo_done) {
+	while (todo_end - todo_done == todo_size) {
 		pthread_cond_wait(&cond_write, &grep_mutex);
 	}
 
-	grep_source_init(&todo[todo_end].source, type, name, path, id);
-	if (opt->binary != GREP_BINARY_TEXT)
-		grep_source_load_driver(&todo[todo_end].source);
-	todo[todo_end].done = 0;
-	strbuf_reset(&todo[todo_end].out);
-	todo_end = (todo_end + 1) % ARRAY_SIZE(todo);
+	w = todo_item(todo_end);
+	w->source = source;
+	w->done = 0;
+	strbuf_reset(&w->out);
+	todo_end++;
 
 	pthread_cond_signal(&cond_add);
 	grep_unlock();
 }
 
-static struct work_item *get_work(void)
+static void set_batch(struct grep_thread *t, unsigned long next,
+		      unsigned long end)
 {
-	struct work_item *ret;
+	pthread_mutex_lock(&t->mutex);
+	t->next = next;
+	t->end = end;
+	pthread_mutex_unlock(&t->mutex);
+}
 
-	grep_lock();
-	while (todo_start == todo_end && !all_work_added) {
-		pthread_cond_wait(&cond_add, &grep_mutex);
+/* Must be called with grep_mutex held, which keeps the thieves out of
+ * each other's way.
+ */
+static int steal_work(struct grep_thread *self, unsigned long *n)
+{
+	struct grep_thread *victim = NULL;
+	unsigned long most = 0, take;
+	int i;
+
+	for (i = 0; i < num_threads; i++) {
+		struct grep_thread *t = &threads[i];
+		unsigned long left;
+
+		if (t == self)
+			continue;
+		pthread_mutex_lock(&t->mutex);
+		left = t->end - t->next;
+		pthread_mutex_unlock(&t->mutex);
+		if (most < left) {
+			most = left;
+			victim = t;
+		}
 	}
+	if (!victim)
+		return 0;
 
-	if (todo_start == todo_end && all_work_added) {
-		ret = NULL;
-	} else {
-		ret = &todo[todo_start];
-		todo_start = (todo_start + 1) % ARRAY_SIZE(todo);
+	pthread_mutex_lock(&victim->mutex);
+	take = (victim->end - victim->next + 1) / 2;
+	victim->end -= take;
+	*n = victim->end;
+	pthread_mutex_unlock(&victim->mutex);
+	if (!take)
+		return 0;
+
+	set_batch(self, *n + 1, *n + take);
+	if (take > 1)
+		pthread_cond_signal(&cond_add);
+	return 1;
+}
+
+static struct work_item *get_work(struct grep_thread *self)
+{
+	unsigned long n, batch;
+	int found = 0;
+
+	pthread_mutex_lock(&self->mutex);
+	if (self->next < self->end) {
+		n = self->next++;
+		found = 1;
+	}
+	pthread_mutex_unlock(&self->mutex);
+	if (found)
+		return todo_item(n);
+
+	grep_lock();
+	while (!found) {
+		if (todo_start != todo_end) {
+			batch = (todo_end - todo_start) / num_threads;
+			if (batch < 1)
+				batch = 1;
+			else if (batch > MAX_BATCH)
+				batch = MAX_BATCH;
+			n = todo_start;
+			todo_start += batch;
+			set_batch(self, n + 1, todo_start);
+			if (batch > 1)
+				pthread_cond_signal(&cond_add);
+			found = 1;
+		} else if (steal_work(self, &n)) {
+			found = 1;
+		} else if (all_work_added) {
+			break;
+		} else {
+			pthread_cond_wait(&cond_add, &grep_mutex);
+		}
 	}
 	grep_unlock();
-	return ret;
+	return found ? todo_item(n) : NULL;
+}
+
+static void write_result(struct work_item *w)
+{
+	if (w->out.len) {
+		const char *p = w->out.buf;
+		size_t len = w->out.len;
+
+		/* Skip the leading hunk mark of the first file. */
+		if (skip_first_line) {
+			while (len) {
+				len--;
+				if (*p++ == '\n')
+					break;
+			}
+			skip_first_line = 0;
+		}
+
+		write_or_die(1, p, len);
+	}
+	grep_source_clear(&w->source);
 }
 
 static void work_done(struct work_item *w)
 {
-	int old_done;
+	unsigned long n, end;
 
 	grep_lock();
 	w->done = 1;
-	old_done = todo_done;
-	for(; todo[todo_done].done && todo_done != todo_start;
-	    todo_done = (todo_done+1) % ARRAY_SIZE(todo)) {
-		w = &todo[todo_done];
-		if (w->out.len) {
-			const char *p = w->out.buf;
-			size_t len = w->out.len;
-
-			/* Skip the leading hunk mark of the first file. */
-			if (skip_first_line) {
-				while (len) {
-					len--;
-					if (*p++ == '\n')
-						break;
-				}
-				skip_first_line = 0;
-			}
 
-			write_or_die(1, p, len);
+	/*
+	 * Whoever finishes the first work_item we have not written out
+	 * yet writes out all the finished ones that follow it, without
+	 * holding up the others while doing so.  Those who finish in
+	 * the meantime leave their results to it.
+	 */
+	if (!writing_results) {
+		writing_results = 1;
+		while (todo_done != todo_start && todo_item(todo_done)->done) {
+			for (end = todo_done + 1;
+			     end != todo_start && todo_item(end)->done;
+			     end++)
+				; /* nothing */
+			n = todo_done;
+			grep_unlock();
+			for (; n != end; n++)
+				write_result(todo_item(n));
+			grep_lock();
+			todo_done = end;
+			pthread_cond_signal(&cond_write);
 		}
-		grep_source_clear(&w->source);
+		writing_results = 0;
 	}
 
-	if (old_done != todo_done)
-		pthread_cond_signal(&cond_write);
-
 	if (all_work_added && todo_done == todo_end)
 		pthread_cond_signal(&cond_result);
 
@@ -174,7 +323,7 @@ static int skip_binary(struct grep_opt *opt, const char *filename)
 			attr_text = git_attr("text");
 		memset(&check, 0, sizeof(check));
 		check.attr = attr_text;
-		return !git_check_attr(filename, 1, &check) &&
+		return !git_check_attr_ctx(opt->attr_context, filename, 1, &check) &&
 				ATTR_FALSE(check.value);
 	}
 	return 0;
@@ -183,10 +332,11 @@ static int skip_binary(struct grep_opt *opt, const char *filename)
 static void *run(void *arg)
 {
 	int hit = 0;
-	struct grep_opt *opt = arg;
+	struct grep_thread *self = arg;
+	struct grep_opt *opt = self->opt;
 
 	while (1) {
-		struct work_item *w = get_work();
+		struct work_item *w = get_work(self);
 		if (!w)
 			break;
 
@@ -195,11 +345,13 @@ static void *run(void *arg)
 
 		opt->output_priv = w;
 		hit |= grep_source(opt, &w->source);
+		record_trigrams(opt, &w->source);
 		grep_source_clear_data(&w->source);
 		work_done(w);
 	}
-	free_grep_patterns(arg);
-	free(arg);
+	git_attr_context_free(opt->attr_context);
+	free_grep_patterns(opt);
+	free(opt);
 
 	return (void*) (intptr_t) hit;
 }
@@ -215,24 +367,32 @@ static void start_threads(struct grep_opt *opt)
 	int i;
 
 	pthread_mutex_init(&grep_mutex, NULL);
-	pthread_mutex_init(&grep_read_mutex, NULL);
 	pthread_mutex_init(&grep_attr_mutex, NULL);
 	pthread_cond_init(&cond_add, NULL);
 	pthread_cond_init(&cond_write, NULL);
 	pthread_cond_init(&cond_result, NULL);
+	enable_obj_read_lock();
 	grep_use_locks = 1;
 
-	for (i = 0; i < ARRAY_SIZE(todo); i++) {
+	todo_size = num_threads * MAX_BATCH;
+	todo = xcalloc(todo_size, sizeof(*todo));
+	for (i = 0; i < todo_size; i++) {
 		strbuf_init(&todo[i].out, 0);
 	}
 
-	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+	threads = xcalloc(num_threads, sizeof(*threads));
+	for (i = 0; i < num_threads; i++)
+		pthread_mutex_init(&threads[i].mutex, NULL);
+
+	for (i = 0; i < num_threads; i++) {
 		int err;
 		struct grep_opt *o = grep_opt_dup(opt);
 		o->output = strbuf_out;
 		o->debug = 0;
+		o->attr_context = git_attr_context_alloc();
 		compile_grep_patterns(o);
-		err = pthread_create(&threads[i], NULL, run, o);
+		threads[i].opt = o;
+		err = pthread_create(&threads[i].thread, NULL, run, &threads[i]);
 
 		if (err)
 			die(_("grep: failed to create thread: %s"),
@@ -248,6 +408,9 @@ static int wait_all(void)
 	grep_lock();
 	all_work_added = 1;
 
+	/* Let the idle consumer threads steal what is left or quit. */
+	pthread_cond_broadcast(&cond_add);
+
 	/* Wait until all work is done. */
 	while (todo_done != todo_end)
 		pthread_cond_wait(&cond_result, &grep_mutex);
@@ -258,19 +421,25 @@ static int wait_all(void)
 	pthread_cond_broadcast(&cond_add);
 	grep_unlock();
 
-	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+	for (i = 0; i < num_threads; i++) {
 		void *h;
-		pthread_join(threads[i], &h);
+		pthread_join(threads[i].thread, &h);
 		hit |= (int) (intptr_t) h;
+		pthread_mutex_destroy(&threads[i].mutex);
 	}
+	free(threads);
+
+	for (i = 0; i < todo_size; i++)
+		strbuf_release(&todo[i].out);
+	free(todo);
 
 	pthread_mutex_destroy(&grep_mutex);
-	pthread_mutex_destroy(&grep_read_mutex);
 	pthread_mutex_destroy(&grep_attr_mutex);
 	pthread_cond_destroy(&cond_add);
 	pthread_cond_destroy(&cond_write);
 	pthread_cond_destroy(&cond_result);
 	grep_use_locks = 0;
+	disable_obj_read_lock();
 
 	return hit;
 }
@@ -284,7 +453,24 @@ static int wait_all(void)
 
 static int grep_cmd_config(const char *var, const char *value, void *cb)
 {
-	int st = grep_config(var, value, cb);
+	int st;
+
+	if (!strcmp(var, "grep.trigramindex")) {
+		use_trigram_index = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "grep.threads")) {
+		num_threads = git_config_int(var, value);
+		if (num_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    num_threads, var);
+#ifdef NO_PTHREADS
+		else if (num_threads && num_threads != 1)
+			warning(_("no threads support, ignoring %s"), var);
+#endif
+		return 0;
+	}
+	st = grep_config(var, value, cb);
 	if (git_color_default_config(var, value, cb) < 0)
 		st = -1;
 	return st;
@@ -306,6 +492,10 @@ static int grep_sha1(struct grep_opt *opt, const unsigned char *sha1,
 {
 	struct strbuf pathbuf = STRBUF_INIT;
 
+	if (trigram_index && trigram_query.nr &&
+	    !trigram_index_may_match(trigram_index, sha1, &trigram_query))
+		return 0;
+
 	if (opt->relative && opt->prefix_length) {
 		quote_path_relative(filename + tree_name_len, opt->prefix, &pathbuf);
 		strbuf_insert(&pathbuf, 0, filename, tree_name_len);
@@ -327,6 +517,7 @@ static int grep_sha1(struct grep_opt *opt, const unsigned char *sha1,
 		grep_source_init(&gs, GREP_SOURCE_SHA1, pathbuf.buf, path, sha1);
 		strbuf_release(&pathbuf);
 		hit = grep_source(opt, &gs);
+		record_trigrams(opt, &gs);
 
 		grep_source_clear(&gs);
 		return hit;
@@ -525,7 +716,9 @@ static int grep_objects(struct grep_opt *opt, const struct pathspec *pathspec,
 
 	for (i = 0; i < nr; i++) {
 		struct object *real_obj;
+		grep_read_lock();
 		real_obj = deref_tag(list->objects[i].item, NULL, 0);
+		grep_read_unlock();
 		if (grep_object(opt, pathspec, real_obj, list->objects[i].name, list->objects[i].context)) {
 			hit = 1;
 			if (opt->status_only)
@@ -686,6 +879,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		{ OPTION_INTEGER, 0, "max-depth", &opt.max_depth, N_("depth"),
 			N_("descend at most <depth> levels"), PARSE_OPT_NONEG,
 			NULL, 1 },
+		OPT_INTEGER(0, "threads", &num_threads,
+			N_("use <n> worker threads")),
 		OPT_GROUP(""),
 		OPT_SET_INT('E', "extended-regexp", &pattern_type_arg,
 			    N_("use extended POSIX regular expressions"),
@@ -860,10 +1055,16 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		break;
 	}
 
+	if (num_threads < 0)
+		die(_("invalid number of threads specified (%d)"), num_threads);
 #ifndef NO_PTHREADS
-	if (list.nr || cached || online_cpus() == 1)
+	if (!num_threads)
+		num_threads = online_cpus() == 1 ? 1 : GREP_NUM_THREADS_DEFAULT;
+	if (num_threads == 1)
 		use_threads = 0;
 #else
+	if (num_threads && num_threads != 1)
+		warning(_("no threads support, ignoring --threads"));
 	use_threads = 0;
 #endif
 
@@ -920,6 +1121,11 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	if (!use_index && (untracked || cached))
 		die(_("--cached or --untracked cannot be used with --no-index."));
 
+	if (use_trigram_index && use_index && !untracked && (cached || list.nr)) {
+		trigram_index = trigram_index_open();
+		grep_trigram_query(&opt, &trigram_query);
+	}
+
 	if (!use_index || untracked) {
 		int use_exclude = (opt_exclude < 0) ? use_index : !!opt_exclude;
 		if (list.nr)
@@ -940,6 +1146,11 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 
 	if (use_threads)
 		hit |= wait_all();
+	if (trigram_index) {
+		trigram_index_write(trigram_index);
+		trigram_index_free(trigram_index);
+		trigram_query_release(&trigram_query);
+	}
 	if (hit && show_in_pager)
 		run_pager(&opt, prefix);
 	free_grep_patterns(&opt);
@@ -0,0 +1,24 @@
+#include "builtin.h"
+#include "cache.h"
+#include "parse-options.h"
+#include "midx.h"
+
+static const char * const builtin_multi_pack_index_usage[] = {
+	N_("git multi-pack-index write"),
+	NULL
+};
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     builtin_multi_pack_index_usage, 0);
+	if (argc != 1 || strcmp(argv[0], "write"))
+		usage_with_options(builtin_multi_pack_index_usage, options);
+
+	return !!write_midx_file();
+}
@@ -43,6 +43,9 @@ static int prefer_ofs_delta = 1;
 static int auto_update_server_info;
 static int auto_gc = 1;
 static int fix_thin = 1;
+static int check_connectivity_in_pack;
+static int pack_threads;
+static const char *pack_lockfile;
 static const char *head_name;
 static void *head_name_to_free;
 static int sent_capabilities;
@@ -136,6 +139,19 @@ static int receive_pack_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (strcmp(var, "receive.checkconnectivityinpack") == 0) {
+		check_connectivity_in_pack = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (strcmp(var, "pack.threads") == 0) {
+		pack_threads = git_config_int(var, value);
+		if (pack_threads < 0)
+			die("invalid number of threads specified (%d)",
+			    pack_threads);
+		return 0;
+	}
+
 	return git_default_config(var, value, cb);
 }
 
@@ -774,6 +790,55 @@ static int command_singleton_iterator(void *cb_data, unsigned char sha1[20])
 	return 0;
 }
 
+/*
+ * Check that the new objects are connected to ours; when they came in
+ * a pack, that is, with receive.checkConnectivityInPack, by walking
+ * only what is in it.
+ */
+static int check_connected(sha1_iterate_fn fn, void *cb_data)
+{
+	struct strbuf idx_file = STRBUF_INIT;
+	int ret;
+
+	if (!check_connectivity_in_pack || !pack_lockfile ||
+	    !ends_with(pack_lockfile, ".keep"))
+		return check_everything_connected(fn, 0, cb_data);
+
+	strbuf_addstr(&idx_file, pack_lockfile);
+	strbuf_setlen(&idx_file, idx_file.len - 5); /* ".keep" */
+	strbuf_addstr(&idx_file, ".idx");
+	ret = check_connected_in_pack(fn, 0, cb_data, idx_file.buf,
+				      pack_threads);
+	strbuf_release(&idx_file);
+	return ret;
+}
+
+/*
+ * The pack that failed check_connected() must not stay: the pushes
+ * that come next would trust what is in it.
+ */
+static void remove_received_pack(void)
+{
+	struct strbuf path = STRBUF_INIT;
+	size_t len;
+
+	strbuf_addstr(&path, pack_lockfile);
+	strbuf_setlen(&path, path.len - 5); /* ".keep" */
+	len = path.len;
+	strbuf_addstr(&path, ".pack");
+	free_pack_by_name(path.buf);
+	strbuf_setlen(&path, len);
+	strbuf_addstr(&path, ".idx");
+	unlink_or_warn(path.buf);
+	strbuf_setlen(&path, len);
+	strbuf_addstr(&path, ".pack");
+	unlink_or_warn(path.buf);
+	strbuf_release(&path);
+
+	unlink_or_warn(pack_lockfile);
+	pack_lockfile = NULL;
+}
+
 static void set_connectivity_errors(struct command *commands,
 				    struct shallow_info *si)
 {
@@ -784,8 +849,7 @@ static void set_connectivity_errors(struct command *commands,
 		if (shallow_update && si->shallow_ref[cmd->index])
 			/* to be checked in update_shallow_ref() */
 			continue;
-		if (!check_everything_connected(command_singleton_iterator,
-						0, &singleton))
+		if (!check_connected(command_singleton_iterator, &singleton))
 			continue;
 		cmd->error_string = "missing necessary objects";
 	}
@@ -847,8 +911,16 @@ static void execute_commands(struct command *commands,
 
 	data.cmds = commands;
 	data.si = si;
-	if (check_everything_connected(iterate_receive_command_list, 0, &data))
+	if (check_connected(iterate_receive_command_list, &data)) {
+		/*
+		 * Without the pack, the updates that only need what we
+		 * had already are found by the checks of each command.
+		 */
+		if (check_connectivity_in_pack && pack_lockfile &&
+		    ends_with(pack_lockfile, ".keep"))
+			remove_received_pack();
 		set_connectivity_errors(commands, si);
+	}
 
 	reject_updates_to_hidden(commands);
 
@@ -963,8 +1035,6 @@ static const char *parse_pack_header(struct pack_header *hdr)
 	}
 }
 
-static const char *pack_lockfile;
-
 static const char *unpack(int err_fd, struct shallow_info *si)
 {
 	struct pack_header hdr;
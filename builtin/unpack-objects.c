@@ -11,8 +11,9 @@
 #include "progress.h"
 #include "decorate.h"
 #include "fsck.h"
+#include "bulk-checkin.h"
 
-static int dry_run, quiet, recover, has_errors, strict;
+static int dry_run, quiet, recover, has_errors, strict, to_pack;
 static const char unpack_usage[] = "git unpack-objects [-n] [-q] [-r] [--strict] < pack-file";
 
 /* We always read in 4kB chunks. */
@@ -148,6 +149,36 @@ static void add_delta_to_list(unsigned nr, unsigned const char *base_sha1,
 	delta_list = info;
 }
 
+/*
+ * With unpack.toPack, the objects go to a single new pack instead of
+ * one loose object each; until it is finished, they can only be found
+ * through bulk-checkin.
+ */
+static int write_object_file(void *buf, unsigned long size,
+			     enum object_type type, unsigned char *sha1)
+{
+	if (to_pack)
+		return index_bulk_checkin_buffer(sha1, buf, size, type,
+						 HASH_WRITE_OBJECT);
+	return write_sha1_file(buf, size, typename(type), sha1);
+}
+
+static int has_object(const unsigned char *sha1)
+{
+	return (to_pack && has_bulk_checkin_object(sha1)) ||
+		has_sha1_file(sha1);
+}
+
+static void *read_object(const unsigned char *sha1, enum object_type *type,
+			 unsigned long *size)
+{
+	void *buf = NULL;
+
+	if (to_pack)
+		buf = read_bulk_checkin_object(sha1, type, size);
+	return buf ? buf : read_sha1_file(sha1, type, size);
+}
+
 struct obj_info {
 	off_t offset;
 	unsigned char sha1[20];
@@ -168,7 +199,7 @@ static void write_cached_object(struct object *obj)
 {
 	unsigned char sha1[20];
 	struct obj_buffer *obj_buf = lookup_object_buffer(obj);
-	if (write_sha1_file(obj_buf->buffer, obj_buf->size, typename(obj->type), sha1) < 0)
+	if (write_object_file(obj_buf->buffer, obj_buf->size, obj->type, sha1) < 0)
 		die("failed to write object %s", sha1_to_hex(obj->sha1));
 	obj->flags |= FLAG_WRITTEN;
 }
@@ -227,14 +258,14 @@ static void write_object(unsigned nr, enum object_type type,
 			 void *buf, unsigned long size)
 {
 	if (!strict) {
-		if (write_sha1_file(buf, size, typename(type), obj_list[nr].sha1) < 0)
+		if (write_object_file(buf, size, type, obj_list[nr].sha1) < 0)
 			die("failed to write object");
 		added_object(nr, type, buf, size);
 		free(buf);
 		obj_list[nr].obj = NULL;
 	} else if (type == OBJ_BLOB) {
 		struct blob *blob;
-		if (write_sha1_file(buf, size, typename(type), obj_list[nr].sha1) < 0)
+		if (write_object_file(buf, size, type, obj_list[nr].sha1) < 0)
 			die("failed to write object");
 		added_object(nr, type, buf, size);
 		free(buf);
@@ -341,7 +372,7 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 			free(delta_data);
 			return;
 		}
-		if (has_sha1_file(base_sha1))
+		if (has_object(base_sha1))
 			; /* Ok we have this one */
 		else if (resolve_against_held(nr, base_sha1,
 					      delta_data, delta_size))
@@ -408,7 +439,7 @@ static void unpack_delta_entry(enum object_type type, unsigned long delta_size,
 	if (resolve_against_held(nr, base_sha1, delta_data, delta_size))
 		return;
 
-	base = read_sha1_file(base_sha1, &type, &base_size);
+	base = read_object(base_sha1, &type, &base_size);
 	if (!base) {
 		error("failed to read delta-pack base object %s",
 		      sha1_to_hex(base_sha1));
@@ -492,6 +523,15 @@ static void unpack_all(void)
 		die("unresolved deltas left after unpacking");
 }
 
+static int unpack_objects_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "unpack.topack")) {
+		to_pack = git_config_bool(var, value);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
 int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 {
 	int i;
@@ -499,7 +539,7 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 
 	read_replace_refs = 0;
 
-	git_config(git_default_config, NULL);
+	git_config(unpack_objects_config, NULL);
 
 	quiet = !isatty(2);
 
@@ -545,6 +585,8 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 		usage(unpack_usage);
 	}
 	git_SHA1_Init(&ctx);
+	if (to_pack && !dry_run)
+		plug_bulk_checkin();
 	unpack_all();
 	git_SHA1_Update(&ctx, buffer, offset);
 	git_SHA1_Final(sha1, &ctx);
@@ -553,6 +595,8 @@ int cmd_unpack_objects(int argc, const char **argv, const char *prefix)
 	if (hashcmp(fill(20), sha1))
 		die("final sha1 did not match");
 	use(20);
+	if (to_pack && !dry_run)
+		unplug_bulk_checkin();
 
 	/* Write the last part of the buffer to stdout */
 	while (len) {
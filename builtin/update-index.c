@@ -12,6 +12,8 @@
 #include "resolve-undo.h"
 #include "parse-options.h"
 #include "pathspec.h"
+#include "split-index.h"
+#include "dir.h"
 
 /*
  * Default to not allowing changes to the list of files. The
@@ -709,6 +711,8 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 	int read_from_stdin = 0;
 	int prefix_length = prefix ? strlen(prefix) : 0;
 	int preferred_index_format = 0;
+	int split_index = -1;
+	int untracked_cache = -1;
 	char set_executable_bit = 0;
 	struct refresh_params refresh_args = {0, &has_errors};
 	int lock_error = 0;
@@ -794,6 +798,10 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 			resolve_undo_clear_callback},
 		OPT_INTEGER(0, "index-version", &preferred_index_format,
 			N_("write index in this format")),
+		OPT_BOOL(0, "split-index", &split_index,
+			N_("enable or disable split index")),
+		OPT_BOOL(0, "untracked-cache", &untracked_cache,
+			N_("enable or disable untracked cache")),
 		OPT_END()
 	};
 
@@ -866,6 +874,24 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 		the_index.version = preferred_index_format;
 	}
 
+	if (split_index > 0) {
+		core_split_index = 1;
+		init_split_index(&the_index);
+		active_cache_changed = 1;
+	} else if (!split_index) {
+		core_split_index = 0;
+		if (the_index.split_index)
+			active_cache_changed = 1;
+	}
+
+	if (untracked_cache > 0) {
+		core_untracked_cache = 1;
+		add_untracked_cache(&the_index);
+	} else if (!untracked_cache) {
+		core_untracked_cache = 0;
+		remove_untracked_cache(&the_index);
+	}
+
 	if (read_from_stdin) {
 		struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT;
 
@@ -58,26 +58,32 @@ clear_exit:
 	reprepare_packed_git();
 }
 
-static int already_written(struct bulk_checkin_state *state, unsigned char sha1[])
+static struct pack_idx_entry *find_written(struct bulk_checkin_state *state,
+					    const unsigned char *sha1)
 {
 	int i;
 
-	/* The object may already exist in the repository */
-	if (has_sha1_file(sha1))
-		return 1;
-
 	/* Might want to keep the list sorted */
 	for (i = 0; i < state->nr_written; i++)
 		if (!hashcmp(state->written[i]->sha1, sha1))
-			return 1;
+			return state->written[i];
+	return NULL;
+}
 
-	/* This is a new object we need to keep */
-	return 0;
+static int already_written(struct bulk_checkin_state *state, unsigned char sha1[])
+{
+	/* The object may already exist in the repository */
+	if (has_sha1_file(sha1))
+		return 1;
+
+	/* This is a new object if we have not written it yet */
+	return !!find_written(state, sha1);
 }
 
 /*
- * Read the contents from fd for size bytes, streaming it to the
- * packfile in state while updating the hash in ctx. Signal a failure
+ * Read the contents from fd (or buf, if not NULL) for size bytes,
+ * streaming it to the packfile in state while updating the hash in
+ * ctx. Signal a failure
  * by returning a negative value when the resulting pack would exceed
  * the pack size limit and this is not the first object in the pack,
  * so that the caller can discard what we wrote from the current pack
@@ -92,7 +98,8 @@ static int already_written(struct bulk_checkin_state *state, unsigned char sha1[
  */
 static int stream_to_pack(struct bulk_checkin_state *state,
 			  git_SHA_CTX *ctx, off_t *already_hashed_to,
-			  int fd, size_t size, enum object_type type,
+			  int fd, const unsigned char *buf,
+			  size_t size, enum object_type type,
 			  const char *path, unsigned flags)
 {
 	git_zstream s;
@@ -114,7 +121,11 @@ static int stream_to_pack(struct bulk_checkin_state *state,
 
 		if (size && !s.avail_in) {
 			ssize_t rsize = size < sizeof(ibuf) ? size : sizeof(ibuf);
-			if (read_in_full(fd, ibuf, rsize) != rsize)
+			const unsigned char *in = ibuf;
+
+			if (buf)
+				in = buf + offset;
+			else if (read_in_full(fd, ibuf, rsize) != rsize)
 				die("failed to read %d bytes from '%s'",
 				    (int)rsize, path);
 			offset += rsize;
@@ -123,10 +134,10 @@ static int stream_to_pack(struct bulk_checkin_state *state,
 				if (rsize < hsize)
 					hsize = rsize;
 				if (hsize)
-					git_SHA1_Update(ctx, ibuf, hsize);
+					git_SHA1_Update(ctx, in, hsize);
 				*already_hashed_to = offset;
 			}
-			s.next_in = ibuf;
+			s.next_in = (unsigned char *)in;
 			s.avail_in = rsize;
 			size -= rsize;
 		}
@@ -183,20 +194,22 @@ static void prepare_to_stream(struct bulk_checkin_state *state,
 
 static int deflate_to_pack(struct bulk_checkin_state *state,
 			   unsigned char result_sha1[],
-			   int fd, size_t size,
+			   int fd, const unsigned char *buf, size_t size,
 			   enum object_type type, const char *path,
 			   unsigned flags)
 {
-	off_t seekback, already_hashed_to;
+	off_t seekback = 0, already_hashed_to;
 	git_SHA_CTX ctx;
 	unsigned char obuf[16384];
 	unsigned header_len;
 	struct sha1file_checkpoint checkpoint;
 	struct pack_idx_entry *idx = NULL;
 
-	seekback = lseek(fd, 0, SEEK_CUR);
-	if (seekback == (off_t) -1)
-		return error("cannot find the current offset");
+	if (!buf) {
+		seekback = lseek(fd, 0, SEEK_CUR);
+		if (seekback == (off_t) -1)
+			return error("cannot find the current offset");
+	}
 
 	header_len = sprintf((char *)obuf, "%s %" PRIuMAX,
 			     typename(type), (uintmax_t)size) + 1;
@@ -217,7 +230,7 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 			crc32_begin(state->f);
 		}
 		if (!stream_to_pack(state, &ctx, &already_hashed_to,
-				    fd, size, type, path, flags))
+				    fd, buf, size, type, path, flags))
 			break;
 		/*
 		 * Writing this object to the current pack will make
@@ -229,7 +242,7 @@ static int deflate_to_pack(struct bulk_checkin_state *state,
 		sha1file_truncate(state->f, &checkpoint);
 		state->offset = checkpoint.offset;
 		finish_bulk_checkin(state);
-		if (lseek(fd, seekback, SEEK_SET) == (off_t) -1)
+		if (!buf && lseek(fd, seekback, SEEK_SET) == (off_t) -1)
 			return error("cannot seek back");
 	}
 	git_SHA1_Final(result_sha1, &ctx);
@@ -255,13 +268,84 @@ int index_bulk_checkin(unsigned char *sha1,
 		       int fd, size_t size, enum object_type type,
 		       const char *path, unsigned flags)
 {
-	int status = deflate_to_pack(&state, sha1, fd, size, type,
+	int status = deflate_to_pack(&state, sha1, fd, NULL, size, type,
 				     path, flags);
 	if (!state.plugged)
 		finish_bulk_checkin(&state);
 	return status;
 }
 
+int index_bulk_checkin_buffer(unsigned char *sha1,
+			      const void *buf, size_t size,
+			      enum object_type type, unsigned flags)
+{
+	int status = deflate_to_pack(&state, sha1, -1, buf, size, type,
+				     NULL, flags);
+	if (!state.plugged)
+		finish_bulk_checkin(&state);
+	return status;
+}
+
+int has_bulk_checkin_object(const unsigned char *sha1)
+{
+	return state.f && find_written(&state, sha1);
+}
+
+/*
+ * Objects in the pack we are writing cannot be found by the usual
+ * means until it is finished; read them back from the file.
+ */
+void *read_bulk_checkin_object(const unsigned char *sha1,
+			       enum object_type *type, unsigned long *size)
+{
+	struct pack_idx_entry *idx;
+	unsigned char ibuf[16384];
+	git_zstream s;
+	off_t offset;
+	ssize_t n;
+	unsigned long hdrlen;
+	int status = Z_OK;
+	void *buf;
+
+	if (!state.f || !(idx = find_written(&state, sha1)))
+		return NULL;
+	sha1flush(state.f);
+
+	offset = idx->offset;
+	n = pread(state.f->fd, ibuf, sizeof(ibuf), offset);
+	if (n <= 0)
+		return NULL;
+	hdrlen = unpack_object_header_buffer(ibuf, n, type, size);
+	if (!hdrlen)
+		return NULL;
+	offset += n;
+
+	buf = xmallocz(*size);
+	memset(&s, 0, sizeof(s));
+	s.next_in = ibuf + hdrlen;
+	s.avail_in = n - hdrlen;
+	s.next_out = buf;
+	s.avail_out = *size + 1;
+	git_inflate_init(&s);
+	while ((status == Z_OK || status == Z_BUF_ERROR) && s.avail_out) {
+		if (!s.avail_in) {
+			n = pread(state.f->fd, ibuf, sizeof(ibuf), offset);
+			if (n <= 0)
+				break;
+			offset += n;
+			s.next_in = ibuf;
+			s.avail_in = n;
+		}
+		status = git_inflate(&s, 0);
+	}
+	git_inflate_end(&s);
+	if (status != Z_STREAM_END || s.total_out != *size) {
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
 void plug_bulk_checkin(void)
 {
 	state.plugged = 1;
@@ -10,6 +10,20 @@ extern int index_bulk_checkin(unsigned char sha1[],
 			      int fd, size_t size, enum object_type type,
 			      const char *path, unsigned flags);
 
+/* Like index_bulk_checkin(), but with the contents in core */
+extern int index_bulk_checkin_buffer(unsigned char sha1[],
+				     const void *buf, size_t size,
+				     enum object_type type, unsigned flags);
+
+/*
+ * Look up (or read back) an object written to the pack that is not
+ * finished yet, while plugged.
+ */
+extern int has_bulk_checkin_object(const unsigned char *sha1);
+extern void *read_bulk_checkin_object(const unsigned char *sha1,
+				      enum object_type *type,
+				      unsigned long *size);
+
 extern void plug_bulk_checkin(void);
 extern void unplug_bulk_checkin(void);
 
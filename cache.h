@@ -169,6 +169,9 @@ struct cache_entry {
 /* used to temporarily mark paths matched by pathspecs */
 #define CE_MATCHED           (1 << 26)
 
+/* the work tree file is unchanged, according to core.fsmonitor */
+#define CE_FSMONITOR_VALID   (1 << 27)
+
 /*
  * Extended on-disk flags
  */
@@ -268,15 +271,23 @@ static inline unsigned int canon_mode(unsigned int mode)
 
 #define cache_entry_size(len) (offsetof(struct cache_entry,name) + (len) + 1)
 
+struct split_index;
+struct untracked_cache;
+struct ewah_bitmap;
 struct index_state {
 	struct cache_entry **cache;
 	unsigned int version;
 	unsigned int cache_nr, cache_alloc, cache_changed;
 	struct string_list *resolve_undo;
 	struct cache_tree *cache_tree;
+	struct split_index *split_index;
+	struct untracked_cache *untracked;
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
-		 initialized : 1;
+		 initialized : 1,
+		 fsmonitor_has_run_once : 1;
+	uint64_t fsmonitor_last_update;
+	struct ewah_bitmap *fsmonitor_dirty;
 	struct hash_table name_hash;
 	struct hash_table dir_hash;
 };
@@ -583,6 +594,10 @@ extern unsigned long pack_size_limit_cfg;
 extern int read_replace_refs;
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int core_commit_graph;
+extern int core_multi_pack_index;
+extern int core_split_index;
+extern int core_untracked_cache;
 extern int core_apply_sparse_checkout;
 extern int precomposed_unicode;
 
@@ -791,6 +806,23 @@ int longest_ancestor_length(const char *path, struct string_list *prefixes);
 char *strip_path_suffix(const char *path, const char *suffix);
 int daemon_avoid_alias(const char *path);
 
+/*
+ * Threads that read objects concurrently enable the object read lock;
+ * read_sha1_file() then takes it by itself, and any other access to
+ * the object database must be made while holding it.
+ */
+#ifndef NO_PTHREADS
+extern void enable_obj_read_lock(void);
+extern void disable_obj_read_lock(void);
+extern void obj_read_lock(void);
+extern void obj_read_unlock(void);
+#else
+#define enable_obj_read_lock()
+#define disable_obj_read_lock()
+#define obj_read_lock()
+#define obj_read_unlock()
+#endif
+
 /* object replacement */
 #define LOOKUP_REPLACE_OBJECT 1
 extern void *read_sha1_file_extended(const unsigned char *sha1, enum object_type *type, unsigned long *size, unsigned flag);
@@ -932,6 +964,13 @@ extern int get_sha1_mb(const char *str, unsigned char *sha1);
  */
 extern int refname_match(const char *abbrev_name, const char *full_name);
 
+/*
+ * Add to prefixes the full names that abbrev_name may stand for,
+ * according to the same rules.
+ */
+struct argv_array;
+extern void expand_ref_prefix(struct argv_array *prefixes, const char *abbrev_name);
+
 extern int create_symref(const char *ref, const char *refs_heads_master, const char *logmsg);
 extern int validate_headref(const char *ref);
 
@@ -1068,7 +1107,8 @@ extern struct packed_git {
 	int pack_fd;
 	unsigned pack_local:1,
 		 pack_keep:1,
-		 do_not_close:1;
+		 do_not_close:1,
+		 multi_pack_index:1;
 	unsigned char sha1[20];
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
@@ -1088,6 +1128,7 @@ extern void (*report_garbage)(const char *desc, const char *path);
 extern void prepare_packed_git(void);
 extern void reprepare_packed_git(void);
 extern void install_packed_git(struct packed_git *pack);
+extern int git_open_noatime(const char *name);
 
 extern struct packed_git *find_sha1_pack(const unsigned char *sha1,
 					 struct packed_git *packs);
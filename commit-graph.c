@@ -0,0 +1,655 @@
+#include "cache.h"
+#include "commit.h"
+#include "tree.h"
+#include "refs.h"
+#include "csum-file.h"
+#include "sha1-lookup.h"
+#include "commit-graph.h"
+
+#define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
+#define GRAPH_CHUNKID_LARGEEDGES 0x45444745 /* "EDGE" */
+
+#define GRAPH_VERSION 1
+#define GRAPH_OID_VERSION 1 /* SHA-1 */
+#define GRAPH_OID_LEN 20
+
+#define GRAPH_DATA_WIDTH (GRAPH_OID_LEN + 16)
+#define GRAPH_FANOUT_SIZE (4 * 256)
+#define GRAPH_CHUNKLOOKUP_WIDTH 12
+#define GRAPH_HEADER_SIZE 8
+#define GRAPH_MIN_SIZE (GRAPH_HEADER_SIZE + 4 * GRAPH_CHUNKLOOKUP_WIDTH + \
+			GRAPH_FANOUT_SIZE + GRAPH_OID_LEN)
+
+#define GRAPH_PARENT_NONE 0x70000000
+#define GRAPH_OCTOPUS_EDGES_NEEDED 0x80000000
+#define GRAPH_EDGE_LAST_MASK 0x7fffffff
+#define GRAPH_LAST_EDGE 0x80000000
+
+struct commit_graph {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t num_commits;
+
+	const unsigned char *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_commit_data;
+	const unsigned char *chunk_large_edges;
+	size_t large_edges_len;
+};
+
+static struct commit_graph *commit_graph;
+static int commit_graph_prepared;
+
+static char *get_commit_graph_filename(void)
+{
+	return mkpathdup("%s/info/commit-graph", get_object_directory());
+}
+
+static struct commit_graph *load_commit_graph_one(const char *graph_file)
+{
+	int fd;
+	struct stat st;
+	size_t len, i, chunk_lookup_len;
+	const unsigned char *data, *chunk_lookup;
+	struct commit_graph *graph;
+	unsigned char num_chunks;
+
+	fd = git_open_noatime(graph_file);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	len = xsize_t(st.st_size);
+	if (len < GRAPH_MIN_SIZE) {
+		close(fd);
+		error("commit-graph file %s is too small", graph_file);
+		return NULL;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	graph = xcalloc(1, sizeof(*graph));
+	graph->data = data;
+	graph->data_len = len;
+
+	if (get_be32(data) != GRAPH_SIGNATURE) {
+		error("commit-graph signature %X does not match signature %X",
+		      get_be32(data), GRAPH_SIGNATURE);
+		goto cleanup_fail;
+	}
+	if (data[4] != GRAPH_VERSION) {
+		error("commit-graph version %d does not match version %d",
+		      data[4], GRAPH_VERSION);
+		goto cleanup_fail;
+	}
+	if (data[5] != GRAPH_OID_VERSION) {
+		error("commit-graph hash version %d does not match version %d",
+		      data[5], GRAPH_OID_VERSION);
+		goto cleanup_fail;
+	}
+	num_chunks = data[6];
+
+	/* the chunk table ends with a terminating entry */
+	chunk_lookup = data + GRAPH_HEADER_SIZE;
+	chunk_lookup_len = (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	if (GRAPH_HEADER_SIZE + chunk_lookup_len + GRAPH_OID_LEN > len) {
+		error("commit-graph chunk lookup table is truncated");
+		goto cleanup_fail;
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		const unsigned char *entry = chunk_lookup + i * GRAPH_CHUNKLOOKUP_WIDTH;
+		uint32_t chunk_id = get_be32(entry);
+		uint64_t chunk_offset = get_be64(entry + 4);
+		uint64_t next_offset = get_be64(entry + 4 + GRAPH_CHUNKLOOKUP_WIDTH);
+
+		if (chunk_offset > next_offset ||
+		    next_offset > len - GRAPH_OID_LEN) {
+			error("commit-graph chunk %08x has an improper offset",
+			      chunk_id);
+			goto cleanup_fail;
+		}
+
+		switch (chunk_id) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			if (next_offset - chunk_offset != GRAPH_FANOUT_SIZE)
+				goto bad_chunk;
+			graph->chunk_oid_fanout = data + chunk_offset;
+			break;
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			graph->chunk_oid_lookup = data + chunk_offset;
+			graph->num_commits = (next_offset - chunk_offset) / GRAPH_OID_LEN;
+			break;
+		case GRAPH_CHUNKID_DATA:
+			graph->chunk_commit_data = data + chunk_offset;
+			if ((next_offset - chunk_offset) / GRAPH_DATA_WIDTH !=
+			    graph->num_commits)
+				goto bad_chunk;
+			break;
+		case GRAPH_CHUNKID_LARGEEDGES:
+			graph->chunk_large_edges = data + chunk_offset;
+			graph->large_edges_len = next_offset - chunk_offset;
+			break;
+		}
+		continue;
+
+	bad_chunk:
+		error("commit-graph chunk %08x has an improper size", chunk_id);
+		goto cleanup_fail;
+	}
+
+	if (!graph->chunk_oid_fanout || !graph->chunk_oid_lookup ||
+	    !graph->chunk_commit_data) {
+		error("commit-graph is missing a required chunk");
+		goto cleanup_fail;
+	}
+	if (get_be32(graph->chunk_oid_fanout + 4 * 255) != graph->num_commits) {
+		error("commit-graph fanout does not match the number of commits");
+		goto cleanup_fail;
+	}
+
+	return graph;
+
+cleanup_fail:
+	munmap((void *)data, len);
+	free(graph);
+	return NULL;
+}
+
+/*
+ * Replacement objects change the parents of a commit without changing
+ * its name, which the graph cannot know about.  (Grafts are handled
+ * by the callers in commit.c.)
+ */
+static int commit_graph_compatible(void)
+{
+	if (read_replace_refs) {
+		/* this reads the replace refs, and clears the flag if there are none */
+		lookup_replace_object(null_sha1);
+		if (read_replace_refs)
+			return 0;
+	}
+	return 1;
+}
+
+static struct commit_graph *prepare_commit_graph(void)
+{
+	char *graph_name;
+
+	if (commit_graph_prepared)
+		return commit_graph;
+	commit_graph_prepared = 1;
+
+	if (!core_commit_graph || !commit_graph_compatible())
+		return NULL;
+
+	graph_name = get_commit_graph_filename();
+	commit_graph = load_commit_graph_one(graph_name);
+	free(graph_name);
+	return commit_graph;
+}
+
+void close_commit_graph(void)
+{
+	if (!commit_graph)
+		return;
+	munmap((void *)commit_graph->data, commit_graph->data_len);
+	free(commit_graph);
+	commit_graph = NULL;
+	commit_graph_prepared = 0;
+}
+
+static int bsearch_graph(struct commit_graph *g, const unsigned char *sha1,
+			 uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? get_be32(g->chunk_oid_fanout + 4 * (sha1[0] - 1)) : 0;
+	hi = get_be32(g->chunk_oid_fanout + 4 * sha1[0]);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, g->chunk_oid_lookup + GRAPH_OID_LEN * mi);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static struct commit_list **insert_parent_or_die(struct commit_graph *g,
+						 uint32_t pos,
+						 struct commit_list **pptr)
+{
+	struct commit *c;
+
+	if (pos >= g->num_commits)
+		die("invalid parent position %"PRIu32" in commit-graph", pos);
+	c = lookup_commit(g->chunk_oid_lookup + GRAPH_OID_LEN * pos);
+	if (!c)
+		die("could not find commit %s",
+		    sha1_to_hex(g->chunk_oid_lookup + GRAPH_OID_LEN * pos));
+	c->graph_pos = pos;
+	return &commit_list_insert(c, pptr)->next;
+}
+
+static void fill_commit_graph_info(struct commit *item, struct commit_graph *g,
+				   uint32_t pos)
+{
+	const unsigned char *commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+
+	item->graph_pos = pos;
+	item->generation = get_be32(commit_data + GRAPH_OID_LEN + 8) >> 2;
+}
+
+static int fill_commit_in_graph(struct commit *item, struct commit_graph *g,
+				uint32_t pos)
+{
+	uint32_t edge_value;
+	uint64_t date_high, date_low;
+	const unsigned char *commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+	struct commit_list **pptr;
+
+	item->object.parsed = 1;
+	fill_commit_graph_info(item, g, pos);
+
+	item->tree = lookup_tree(commit_data);
+	date_high = get_be32(commit_data + GRAPH_OID_LEN + 8) & 0x3;
+	date_low = get_be32(commit_data + GRAPH_OID_LEN + 12);
+	item->date = (unsigned long)((date_high << 32) | date_low);
+
+	pptr = &item->parents;
+
+	edge_value = get_be32(commit_data + GRAPH_OID_LEN);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	pptr = insert_parent_or_die(g, edge_value, pptr);
+
+	edge_value = get_be32(commit_data + GRAPH_OID_LEN + 4);
+	if (edge_value == GRAPH_PARENT_NONE)
+		return 1;
+	if (!(edge_value & GRAPH_OCTOPUS_EDGES_NEEDED)) {
+		insert_parent_or_die(g, edge_value, pptr);
+		return 1;
+	}
+
+	/* the remaining parents of an octopus merge live in the EDGE chunk */
+	edge_value &= GRAPH_EDGE_LAST_MASK;
+	do {
+		if (!g->chunk_large_edges ||
+		    (size_t)edge_value * 4 + 4 > g->large_edges_len)
+			die("commit-graph has an invalid octopus edge for %s",
+			    sha1_to_hex(item->object.sha1));
+		pos = get_be32(g->chunk_large_edges + 4 * edge_value++);
+		pptr = insert_parent_or_die(g, pos & GRAPH_EDGE_LAST_MASK, pptr);
+	} while (!(pos & GRAPH_LAST_EDGE));
+
+	return 1;
+}
+
+static int find_commit_in_graph(struct commit *item, struct commit_graph *g,
+				uint32_t *pos)
+{
+	if (item->graph_pos != COMMIT_NOT_FROM_GRAPH) {
+		*pos = item->graph_pos;
+		return 1;
+	}
+	return bsearch_graph(g, item->object.sha1, pos);
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	struct commit_graph *g = prepare_commit_graph();
+	uint32_t pos;
+
+	if (!g || item->object.parsed)
+		return 0;
+	if (!find_commit_in_graph(item, g, &pos))
+		return 0;
+	return fill_commit_in_graph(item, g, pos);
+}
+
+void load_commit_graph_info(struct commit *item)
+{
+	struct commit_graph *g = prepare_commit_graph();
+	uint32_t pos;
+
+	if (g && find_commit_in_graph(item, g, &pos))
+		fill_commit_graph_info(item, g, pos);
+}
+
+/* Writing */
+
+#define GRAPH_SEEN (1u<<23)
+
+struct packed_commit_list {
+	struct commit **list;
+	int nr;
+	int alloc;
+};
+
+static void add_commit(struct packed_commit_list *commits, struct commit *c)
+{
+	ALLOC_GROW(commits->list, commits->nr + 1, commits->alloc);
+	commits->list[commits->nr++] = c;
+}
+
+static int add_ref_to_list(const char *refname, const unsigned char *sha1,
+			   int flags, void *cb_data)
+{
+	struct commit_list **tips = cb_data;
+	struct commit *c = lookup_commit_reference_gently(sha1, 1);
+
+	if (c && !(c->object.flags & GRAPH_SEEN)) {
+		c->object.flags |= GRAPH_SEEN;
+		commit_list_insert(c, tips);
+	}
+	return 0;
+}
+
+/*
+ * Collect every commit reachable from "tips", parents before children
+ * is not required; the list is sorted by object name afterwards.
+ */
+static int collect_commits(struct commit_list *tips,
+			   struct packed_commit_list *commits)
+{
+	while (tips) {
+		struct commit *c = pop_commit(&tips);
+		struct commit_list *p;
+
+		if (parse_commit(c)) {
+			free_commit_list(tips);
+			return error("unable to parse commit %s",
+				     sha1_to_hex(c->object.sha1));
+		}
+		add_commit(commits, c);
+
+		for (p = c->parents; p; p = p->next) {
+			if (p->item->object.flags & GRAPH_SEEN)
+				continue;
+			p->item->object.flags |= GRAPH_SEEN;
+			commit_list_insert(p->item, &tips);
+		}
+	}
+	return 0;
+}
+
+static int commit_sha1_cmp(const void *a_, const void *b_)
+{
+	const struct commit *a = *(const struct commit **)a_;
+	const struct commit *b = *(const struct commit **)b_;
+	return hashcmp(a->object.sha1, b->object.sha1);
+}
+
+static const unsigned char *commit_sha1_access(size_t index, void *table)
+{
+	struct commit **commits = table;
+	return commits[index]->object.sha1;
+}
+
+/*
+ * Compute the generation numbers of all commits in the list that do
+ * not have one yet (those read from an earlier graph do).  This is a
+ * depth-first walk with an explicit stack, as histories can be far
+ * deeper than the C stack.
+ */
+static void compute_generation_numbers(struct packed_commit_list *commits)
+{
+	int i;
+	struct commit_list *stack = NULL;
+
+	for (i = 0; i < commits->nr; i++) {
+		if (commits->list[i]->generation != GENERATION_NUMBER_INFINITY)
+			continue;
+
+		commit_list_insert(commits->list[i], &stack);
+		while (stack) {
+			struct commit *current = stack->item;
+			struct commit_list *parent;
+			uint32_t max_generation = 0;
+			int all_parents_computed = 1;
+
+			for (parent = current->parents; parent; parent = parent->next) {
+				uint32_t gen = parent->item->generation;
+
+				if (gen == GENERATION_NUMBER_INFINITY) {
+					all_parents_computed = 0;
+					commit_list_insert(parent->item, &stack);
+					break;
+				}
+				if (gen > max_generation)
+					max_generation = gen;
+			}
+
+			if (all_parents_computed) {
+				pop_commit(&stack);
+				if (max_generation >= GENERATION_NUMBER_MAX)
+					max_generation = GENERATION_NUMBER_MAX - 1;
+				current->generation = max_generation + 1;
+			}
+		}
+	}
+}
+
+static uint32_t parent_position(struct packed_commit_list *commits,
+				struct commit *parent, struct commit *child)
+{
+	int pos = sha1_pos(parent->object.sha1, commits->list, commits->nr,
+			   commit_sha1_access);
+	if (pos < 0)
+		die("BUG: parent %s of %s is not in the commit-graph",
+		    sha1_to_hex(parent->object.sha1),
+		    sha1_to_hex(child->object.sha1));
+	return pos;
+}
+
+static void write_graph_chunk_fanout(struct sha1file *f,
+				     struct packed_commit_list *commits)
+{
+	int i, count = 0;
+	struct commit **list = commits->list;
+
+	/*
+	 * Write the first-level table (the list is sorted, but we use
+	 * a 256-entry lookup to be able to avoid having to do a binary
+	 * search over the whole list).
+	 */
+	for (i = 0; i < 256; i++) {
+		while (count < commits->nr && list[count]->object.sha1[0] <= i)
+			count++;
+		sha1write_be32(f, count);
+	}
+}
+
+static void write_graph_chunk_oids(struct sha1file *f,
+				   struct packed_commit_list *commits)
+{
+	int i;
+
+	for (i = 0; i < commits->nr; i++)
+		sha1write(f, commits->list[i]->object.sha1, GRAPH_OID_LEN);
+}
+
+static void write_graph_chunk_data(struct sha1file *f,
+				   struct packed_commit_list *commits)
+{
+	int i;
+	uint32_t num_extra_edges = 0;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *c = commits->list[i];
+		struct commit_list *parent = c->parents;
+		uint32_t packed_date[2];
+
+		sha1write(f, c->tree->object.sha1, GRAPH_OID_LEN);
+
+		if (!parent)
+			sha1write_be32(f, GRAPH_PARENT_NONE);
+		else {
+			sha1write_be32(f, parent_position(commits, parent->item, c));
+			parent = parent->next;
+		}
+
+		if (!parent)
+			sha1write_be32(f, GRAPH_PARENT_NONE);
+		else if (parent->next) {
+			sha1write_be32(f, GRAPH_OCTOPUS_EDGES_NEEDED | num_extra_edges);
+			num_extra_edges += commit_list_count(parent);
+		} else
+			sha1write_be32(f, parent_position(commits, parent->item, c));
+
+		if (sizeof(c->date) > 4)
+			packed_date[0] = (c->date >> 16 >> 16) & 0x3;
+		else
+			packed_date[0] = 0;
+		packed_date[0] |= c->generation << 2;
+		packed_date[1] = (uint32_t)c->date;
+		sha1write_be32(f, packed_date[0]);
+		sha1write_be32(f, packed_date[1]);
+	}
+}
+
+static void write_graph_chunk_large_edges(struct sha1file *f,
+					  struct packed_commit_list *commits)
+{
+	int i;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit *c = commits->list[i];
+		struct commit_list *parent = c->parents;
+
+		if (!parent || !parent->next || !parent->next->next)
+			continue;
+
+		for (parent = parent->next; parent; parent = parent->next) {
+			uint32_t edge_value = parent_position(commits, parent->item, c);
+			if (!parent->next)
+				edge_value |= GRAPH_LAST_EDGE;
+			sha1write_be32(f, edge_value);
+		}
+	}
+}
+
+static uint32_t count_large_edges(struct packed_commit_list *commits)
+{
+	int i;
+	uint32_t num = 0;
+
+	for (i = 0; i < commits->nr; i++) {
+		struct commit_list *parent = commits->list[i]->parents;
+		if (parent && parent->next && parent->next->next)
+			num += commit_list_count(parent->next);
+	}
+	return num;
+}
+
+static int write_commit_graph_file(struct packed_commit_list *commits)
+{
+	static struct lock_file lk;
+	struct sha1file *f;
+	char *graph_name;
+	uint32_t chunk_ids[5];
+	uint64_t chunk_offsets[5];
+	uint32_t num_large_edges;
+	int num_chunks, i, fd;
+
+	num_large_edges = count_large_edges(commits);
+	num_chunks = num_large_edges ? 4 : 3;
+
+	chunk_ids[0] = GRAPH_CHUNKID_OIDFANOUT;
+	chunk_ids[1] = GRAPH_CHUNKID_OIDLOOKUP;
+	chunk_ids[2] = GRAPH_CHUNKID_DATA;
+	chunk_ids[3] = num_large_edges ? GRAPH_CHUNKID_LARGEEDGES : 0;
+	chunk_ids[4] = 0;
+
+	chunk_offsets[0] = GRAPH_HEADER_SIZE + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + GRAPH_FANOUT_SIZE;
+	chunk_offsets[2] = chunk_offsets[1] + (uint64_t)GRAPH_OID_LEN * commits->nr;
+	chunk_offsets[3] = chunk_offsets[2] + (uint64_t)GRAPH_DATA_WIDTH * commits->nr;
+	chunk_offsets[4] = chunk_offsets[3] + 4 * (uint64_t)num_large_edges;
+
+	graph_name = get_commit_graph_filename();
+	if (safe_create_leading_directories(graph_name)) {
+		error("unable to create leading directories of %s", graph_name);
+		free(graph_name);
+		return -1;
+	}
+	fd = hold_lock_file_for_update(&lk, graph_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lk.filename);
+
+	sha1write_be32(f, GRAPH_SIGNATURE);
+	sha1write_u8(f, GRAPH_VERSION);
+	sha1write_u8(f, GRAPH_OID_VERSION);
+	sha1write_u8(f, num_chunks);
+	sha1write_u8(f, 0); /* unused padding byte */
+
+	for (i = 0; i <= num_chunks; i++) {
+		sha1write_be32(f, chunk_ids[i]);
+		sha1write_be64(f, chunk_offsets[i]);
+	}
+
+	write_graph_chunk_fanout(f, commits);
+	write_graph_chunk_oids(f, commits);
+	write_graph_chunk_data(f, commits);
+	write_graph_chunk_large_edges(f, commits);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lk.fd = -1;
+
+	/* our own mapping of the old file would keep it busy on some systems */
+	close_commit_graph();
+	if (commit_lock_file(&lk)) {
+		error("unable to write %s", graph_name);
+		free(graph_name);
+		return -1;
+	}
+	adjust_shared_perm(graph_name);
+	free(graph_name);
+	return 0;
+}
+
+int write_commit_graph_reachable(void)
+{
+	struct packed_commit_list commits;
+	struct commit_list *tips = NULL;
+	int i, ret;
+
+	if (has_commit_grafts() || !commit_graph_compatible())
+		return error("not writing a commit-graph in a repository "
+			     "with grafts or replace refs");
+
+	memset(&commits, 0, sizeof(commits));
+	head_ref(add_ref_to_list, &tips);
+	for_each_ref(add_ref_to_list, &tips);
+
+	ret = collect_commits(tips, &commits);
+	for (i = 0; i < commits.nr; i++)
+		commits.list[i]->object.flags &= ~GRAPH_SEEN;
+	if (ret)
+		goto out;
+
+	if (commits.nr >= GRAPH_PARENT_NONE) {
+		ret = error("too many commits to write a commit-graph");
+		goto out;
+	}
+
+	qsort(commits.list, commits.nr, sizeof(*commits.list), commit_sha1_cmp);
+	compute_generation_numbers(&commits);
+
+	ret = write_commit_graph_file(&commits);
+
+out:
+	free(commits.list);
+	return ret;
+}
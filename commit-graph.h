@@ -0,0 +1,47 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+/*
+ * The commit-graph file ($GIT_OBJECT_DIRECTORY/info/commit-graph)
+ * caches, for every commit reachable from the refs at the time it was
+ * written, the tree, the parents, the committer date and a generation
+ * number, so that history walks do not have to inflate and parse the
+ * commit objects.  See Documentation/technical/commit-graph-format.txt.
+ *
+ * A generation number is 1 for a root commit and one more than the
+ * largest generation of its parents otherwise; a commit can therefore
+ * never reach a commit with a larger generation number.  Commits that
+ * are not in the graph have GENERATION_NUMBER_INFINITY.
+ */
+
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+#define COMMIT_NOT_FROM_GRAPH 0xFFFFFFFF
+
+struct commit;
+
+/*
+ * Fill "item" (parents, tree, date and generation) from the
+ * commit-graph, without reading the object.  Returns 1 on success,
+ * and 0 if the commit is not in the graph or the graph cannot be
+ * used, in which case the caller has to parse the object.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * Record the graph position and generation number of a commit that
+ * has been parsed from its object.
+ */
+extern void load_commit_graph_info(struct commit *item);
+
+/* Unmap the commit-graph file, e.g. before replacing it. */
+extern void close_commit_graph(void);
+
+/*
+ * Write a new commit-graph file covering every commit reachable from
+ * the refs.  Returns 0 on success and -1 (after reporting an error)
+ * otherwise.
+ */
+extern int write_commit_graph_reachable(void);
+
+#endif
@@ -10,6 +10,7 @@
 #include "mergesort.h"
 #include "commit-slab.h"
 #include "prio-queue.h"
+#include "commit-graph.h"
 
 static struct commit_extra_header *read_commit_extra_header_lines(const char *buf, size_t len, const char **);
 
@@ -64,10 +65,16 @@ struct commit *lookup_commit(const unsigned char *sha1)
 	if (!obj) {
 		struct commit *c = alloc_commit_node();
 		c->index = commit_count++;
+		c->graph_pos = COMMIT_NOT_FROM_GRAPH;
+		c->generation = GENERATION_NUMBER_INFINITY;
 		return create_object(sha1, OBJ_COMMIT, c);
 	}
-	if (!obj->type)
+	if (!obj->type) {
+		struct commit *c = (struct commit *)obj;
 		obj->type = OBJ_COMMIT;
+		c->graph_pos = COMMIT_NOT_FROM_GRAPH;
+		c->generation = GENERATION_NUMBER_INFINITY;
+	}
 	return check_commit(obj, sha1, 0);
 }
 
@@ -244,6 +251,16 @@ int for_each_commit_graft(each_commit_graft_fn fn, void *cb_data)
 	return ret;
 }
 
+/*
+ * Grafts (including the shallow boundary) rewrite the parents of
+ * commits, which the commit-graph does not know about.
+ */
+int has_commit_grafts(void)
+{
+	prepare_commit_graft();
+	return commit_graft_nr > 0;
+}
+
 int unregister_shallow(const unsigned char *sha1)
 {
 	int pos = commit_graft_pos(sha1);
@@ -309,6 +326,9 @@ int parse_commit_buffer(struct commit *item, const void *buffer, unsigned long s
 	}
 	item->date = parse_commit_date(bufptr, tail);
 
+	if (!commit_graft_nr)
+		load_commit_graph_info(item);
+
 	return 0;
 }
 
@@ -323,6 +343,13 @@ int parse_commit(struct commit *item)
 		return -1;
 	if (item->object.parsed)
 		return 0;
+	/*
+	 * Callers that want the commit message keep the buffer around,
+	 * so only those that do not can be served from the commit-graph.
+	 */
+	if (!save_commit_buffer && !has_commit_grafts() &&
+	    parse_commit_in_graph(item))
+		return 0;
 	buffer = read_sha1_file(item->object.sha1, &type, &size);
 	if (!buffer)
 		return error("Could not read %s",
@@ -615,6 +642,19 @@ int compare_commits_by_commit_date(const void *a_, const void *b_, void *unused)
 	return 0;
 }
 
+int compare_commits_by_gen_then_commit_date(const void *a_, const void *b_, void *unused)
+{
+	const struct commit *a = a_, *b = b_;
+
+	/* higher generation commits first */
+	if (a->generation < b->generation)
+		return 1;
+	else if (a->generation > b->generation)
+		return -1;
+
+	return compare_commits_by_commit_date(a_, b_, unused);
+}
+
 /*
  * Performs an in-place topological sort on the list supplied.
  */
@@ -751,20 +791,51 @@ static struct commit *interesting(struct commit_list *list)
 	return NULL;
 }
 
-/* all input commits in one and twos[] must have been parsed! */
-static struct commit_list *paint_down_to_common(struct commit *one, int n, struct commit **twos)
+/*
+ * Like commit_list_insert_by_date(), but commits with a higher
+ * generation number come first.  Commits that are not in the
+ * commit-graph all have an infinite generation, and are therefore
+ * sorted by date as before.
+ */
+static struct commit_list *insert_by_generation(struct commit *item,
+						struct commit_list **list)
+{
+	struct commit_list **pp = list;
+	struct commit_list *p;
+
+	while ((p = *pp) != NULL) {
+		if (compare_commits_by_gen_then_commit_date(p->item, item, NULL) > 0)
+			break;
+		pp = &p->next;
+	}
+	return commit_list_insert(item, pp);
+}
+
+/*
+ * All input commits in one and twos[] must have been parsed!
+ *
+ * Commits are processed in decreasing generation order (and by date
+ * among commits that are not in the commit-graph), so that a commit
+ * is never visited before any of its descendants.  Once the walk
+ * reaches commits with a generation below "min_generation", none of
+ * the remaining ones can reach a commit at that generation and the
+ * walk stops.
+ */
+static struct commit_list *paint_down_to_common(struct commit *one, int n,
+						struct commit **twos,
+						uint32_t min_generation)
 {
 	struct commit_list *list = NULL;
 	struct commit_list *result = NULL;
 	int i;
 
 	one->object.flags |= PARENT1;
-	commit_list_insert_by_date(one, &list);
+	insert_by_generation(one, &list);
 	if (!n)
 		return list;
 	for (i = 0; i < n; i++) {
 		twos[i]->object.flags |= PARENT2;
-		commit_list_insert_by_date(twos[i], &list);
+		insert_by_generation(twos[i], &list);
 	}
 
 	while (interesting(list)) {
@@ -774,6 +845,8 @@ static struct commit_list *paint_down_to_common(struct commit *one, int n, struc
 		int flags;
 
 		commit = list->item;
+		if (commit->generation < min_generation)
+			break;
 		next = list->next;
 		free(list);
 		list = next;
@@ -796,7 +869,7 @@ static struct commit_list *paint_down_to_common(struct commit *one, int n, struc
 			if (parse_commit(p))
 				return NULL;
 			p->object.flags |= flags;
-			commit_list_insert_by_date(p, &list);
+			insert_by_generation(p, &list);
 		}
 	}
 
@@ -826,7 +899,7 @@ static struct commit_list *merge_bases_many(struct commit *one, int n, struct co
 			return NULL;
 	}
 
-	list = paint_down_to_common(one, n, twos);
+	list = paint_down_to_common(one, n, twos, 0);
 
 	while (list) {
 		struct commit_list *next = list->next;
@@ -895,7 +968,7 @@ static int remove_redundant(struct commit **array, int cnt)
 			filled_index[filled] = j;
 			work[filled++] = array[j];
 		}
-		common = paint_down_to_common(array[i], filled, work);
+		common = paint_down_to_common(array[i], filled, work, 0);
 		if (array[i]->object.flags & PARENT2)
 			redundant[i] = 1;
 		for (j = 0; j < filled; j++)
@@ -998,14 +1071,23 @@ int in_merge_bases_many(struct commit *commit, int nr_reference, struct commit *
 {
 	struct commit_list *bases;
 	int ret = 0, i;
+	uint32_t max_generation = 0;
 
 	if (parse_commit(commit))
 		return ret;
-	for (i = 0; i < nr_reference; i++)
+	for (i = 0; i < nr_reference; i++) {
 		if (parse_commit(reference[i]))
 			return ret;
+		if (reference[i]->generation > max_generation)
+			max_generation = reference[i]->generation;
+	}
+
+	/* a commit cannot be reached from commits of a lower generation */
+	if (commit->generation > max_generation)
+		return ret;
 
-	bases = paint_down_to_common(commit, nr_reference, reference);
+	bases = paint_down_to_common(commit, nr_reference, reference,
+				     commit->generation);
 	if (commit->object.flags & PARENT2)
 		ret = 1;
 	clear_commit_marks(commit, all_flags);
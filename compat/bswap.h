@@ -48,3 +48,87 @@ static inline uint32_t git_bswap32(uint32_t x)
 #define htonl(x) bswap32(x)
 
 #endif
+
+/*
+ * 64-bit network byte order conversion.  The fallback reads the bytes
+ * of the value in memory order, which is correct regardless of the
+ * host byte order.
+ */
+static inline uint64_t default_bswap64(uint64_t val)
+{
+	const unsigned char *p = (const unsigned char *)&val;
+	return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+	       ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+	       ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+	       ((uint64_t)p[6] << 8) | (uint64_t)p[7];
+}
+
+#undef bswap64
+
+#if defined(__GNUC__) && defined(__x86_64__)
+
+#define bswap64 git_bswap64
+static inline uint64_t git_bswap64(uint64_t x)
+{
+	uint64_t result;
+	if (__builtin_constant_p(x))
+		result = default_bswap64(x);
+	else
+		__asm__("bswap %q0" : "=r" (result) : "0" (x));
+	return result;
+}
+
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+
+#define bswap64(x) _byteswap_uint64(x)
+
+#endif
+
+#undef ntohll
+#undef htonll
+#ifdef bswap64
+#define ntohll(x) bswap64(x)
+#define htonll(x) bswap64(x)
+#else
+#define ntohll(x) default_bswap64(x)
+#define htonll(x) default_bswap64(x)
+#endif
+
+/*
+ * Unaligned big-endian accessors for on-disk formats.
+ */
+static inline uint16_t get_be16(const void *ptr)
+{
+	const unsigned char *p = ptr;
+	return (uint16_t)p[0] << 8 | (uint16_t)p[1];
+}
+
+static inline uint32_t get_be32(const void *ptr)
+{
+	const unsigned char *p = ptr;
+	return	(uint32_t)p[0] << 24 |
+		(uint32_t)p[1] << 16 |
+		(uint32_t)p[2] <<  8 |
+		(uint32_t)p[3] <<  0;
+}
+
+static inline uint64_t get_be64(const void *ptr)
+{
+	return (uint64_t)get_be32(ptr) << 32 |
+	       get_be32((const unsigned char *)ptr + 4);
+}
+
+static inline void put_be32(void *ptr, uint32_t value)
+{
+	unsigned char *p = ptr;
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >>  8;
+	p[3] = value >>  0;
+}
+
+static inline void put_be64(void *ptr, uint64_t value)
+{
+	put_be32(ptr, value >> 32);
+	put_be32((unsigned char *)ptr + 4, value);
+}
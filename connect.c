@@ -9,8 +9,12 @@
 #include "url.h"
 #include "string-list.h"
 #include "sha1-array.h"
+#include "argv-array.h"
+#include "protocol.h"
+#include "version.h"
 
 static char *server_capabilities;
+static struct argv_array server_capabilities_v2 = ARGV_ARRAY_INIT;
 static const char *parse_feature_value(const char *, const char *, int *);
 
 static int check_ref(const char *name, int len, unsigned int flags)
@@ -182,6 +186,126 @@ struct ref **get_remote_heads(int in, char *src_buf, size_t src_len,
 	return list;
 }
 
+/*
+ * Read the first packet the server sent.  A server that speaks
+ * protocol v2 says "version 2" and lists its capabilities, which are
+ * remembered for server_supports_v2().  Otherwise the packet is the
+ * first one of a v0 ref advertisement, and it is put back into
+ * "pushback", for get_remote_heads() to read before the rest.
+ */
+enum protocol_version discover_version(int in, struct strbuf *pushback)
+{
+	int len;
+
+	len = packet_read(in, NULL, NULL, packet_buffer, sizeof(packet_buffer),
+			  PACKET_READ_GENTLE_ON_EOF);
+	if (len < 0)
+		die_initial_contact(0);
+
+	if ((len == 9 || len == 10) && starts_with(packet_buffer, "version 2") &&
+	    (len == 9 || packet_buffer[9] == '\n')) {
+		char *line;
+
+		argv_array_clear(&server_capabilities_v2);
+		while ((line = packet_read_line(in, NULL)))
+			argv_array_push(&server_capabilities_v2, line);
+		return protocol_v2;
+	}
+
+	if (!len)
+		strbuf_add(pushback, "0000", 4);
+	else {
+		strbuf_addf(pushback, "%04x", len + 4);
+		strbuf_add(pushback, packet_buffer, len);
+	}
+	return protocol_v0;
+}
+
+int server_supports_v2(const char *capability, int die_on_error)
+{
+	int i;
+
+	for (i = 0; i < server_capabilities_v2.argc; i++) {
+		const char *out = skip_prefix(server_capabilities_v2.argv[i],
+					      capability);
+		if (out && (!*out || *out == '='))
+			return 1;
+	}
+	if (die_on_error)
+		die("server doesn't support '%s'", capability);
+	return 0;
+}
+
+/*
+ * Ask a server that speaks protocol v2 for its refs, or only for those
+ * that start with one of ref_prefixes, and store them in list the way
+ * get_remote_heads() does; peeled tags come as "<name>^{}" entries.
+ */
+struct ref **get_remote_refs(int fd_out, int fd_in, struct ref **list,
+			     const struct argv_array *ref_prefixes)
+{
+	struct strbuf req = STRBUF_INIT;
+	char *line;
+	int i;
+
+	*list = NULL;
+	server_supports_v2("ls-refs", 1);
+	packet_buf_write(&req, "command=ls-refs\n");
+	if (server_supports_v2("agent", 0))
+		packet_buf_write(&req, "agent=%s\n", git_user_agent_sanitized());
+	packet_buf_delim(&req);
+	packet_buf_write(&req, "symrefs\n");
+	packet_buf_write(&req, "peel\n");
+	for (i = 0; ref_prefixes && i < ref_prefixes->argc; i++)
+		packet_buf_write(&req, "ref-prefix %s\n", ref_prefixes->argv[i]);
+	packet_buf_flush(&req);
+	write_or_die(fd_out, req.buf, req.len);
+	strbuf_release(&req);
+
+	while ((line = packet_read_line(fd_in, NULL))) {
+		unsigned char sha1[20];
+		struct ref *ref;
+		char *attr;
+
+		if (starts_with(line, "ERR "))
+			die("remote error: %s", line + 4);
+		if (get_sha1_hex(line, sha1) || line[40] != ' ' || !line[41])
+			die("protocol error: expected sha/ref, got '%s'", line);
+		attr = strchr(line + 41, ' ');
+		if (attr)
+			*attr++ = '\0';
+		ref = alloc_ref(line + 41);
+		hashcpy(ref->old_sha1, sha1);
+		*list = ref;
+		list = &ref->next;
+
+		while (attr) {
+			const char *val;
+			char *next = strchr(attr, ' ');
+
+			if (next)
+				*next++ = '\0';
+			if ((val = skip_prefix(attr, "symref-target:"))) {
+				ref->symref = xstrdup(val);
+			} else if ((val = skip_prefix(attr, "peeled:"))) {
+				struct strbuf name = STRBUF_INIT;
+				struct ref *peeled;
+
+				if (get_sha1_hex(val, sha1) || val[40])
+					die("protocol error: bad peeled value '%s'", val);
+				strbuf_addf(&name, "%s^{}", ref->name);
+				peeled = alloc_ref(name.buf);
+				strbuf_release(&name);
+				hashcpy(peeled->old_sha1, sha1);
+				*list = peeled;
+				list = &peeled->next;
+			}
+			attr = next;
+		}
+	}
+	return list;
+}
+
 static const char *parse_feature_value(const char *feature_list, const char *feature, int *lenp)
 {
 	int len;
@@ -646,6 +770,26 @@ static enum protocol parse_connect_url(const char *url_orig, char **ret_host,
 
 static struct child_process no_fork;
 
+static const char *protocol_v2_env[] = {
+	GIT_PROTOCOL_ENVIRONMENT "=version=2",
+	NULL
+};
+
+/* local_repo_env, plus the request for protocol v2 */
+static const char *const *local_repo_env_v2(void)
+{
+	static struct argv_array env = ARGV_ARRAY_INIT;
+
+	if (!env.argc) {
+		const char *const *var;
+
+		for (var = local_repo_env; *var; var++)
+			argv_array_push(&env, *var);
+		argv_array_push(&env, protocol_v2_env[0]);
+	}
+	return env.argv;
+}
+
 /*
  * This returns a dummy child_process if the transport protocol does not
  * need fork(2), or a struct child_process object if it does.  Once done,
@@ -692,12 +836,20 @@ struct child_process *git_connect(int fd[2], const char *url,
 		 * from extended host header with a NUL byte.
 		 *
 		 * Note: Do not add any other headers here!  Doing so
-		 * will cause older git-daemon servers to crash.
+		 * will cause older git-daemon servers to crash.  The
+		 * request for protocol v2 is safe, as it comes after a
+		 * second NUL byte, where older servers do not look.
 		 */
-		packet_write(fd[1],
-			     "%s %s%chost=%s%c",
-			     prog, path, 0,
-			     target_host, 0);
+		if (flags & CONNECT_PROTOCOL_V2)
+			packet_write(fd[1],
+				     "%s %s%chost=%s%c%cversion=2%c",
+				     prog, path, 0,
+				     target_host, 0, 0, 0);
+		else
+			packet_write(fd[1],
+				     "%s %s%chost=%s%c",
+				     prog, path, 0,
+				     target_host, 0);
 		free(target_host);
 	} else {
 		conn = xcalloc(1, sizeof(*conn));
@@ -707,7 +859,7 @@ struct child_process *git_connect(int fd[2], const char *url,
 		sq_quote_buf(&cmd, path);
 
 		conn->in = conn->out = -1;
-		conn->argv = arg = xcalloc(7, sizeof(*arg));
+		conn->argv = arg = xcalloc(9, sizeof(*arg));
 		if (protocol == PROTO_SSH) {
 			const char *ssh = getenv("GIT_SSH");
 			int putty = ssh && strcasestr(ssh, "plink");
@@ -721,6 +873,13 @@ struct child_process *git_connect(int fd[2], const char *url,
 			*arg++ = ssh;
 			if (putty && !strcasestr(ssh, "tortoiseplink"))
 				*arg++ = "-batch";
+			if (flags & CONNECT_PROTOCOL_V2) {
+				if (!putty) {
+					*arg++ = "-o";
+					*arg++ = "SendEnv=" GIT_PROTOCOL_ENVIRONMENT;
+				}
+				conn->env = protocol_v2_env;
+			}
 			if (port) {
 				/* P is for PuTTY, p is for OpenSSH */
 				*arg++ = putty ? "-P" : "-p";
@@ -729,7 +888,10 @@ struct child_process *git_connect(int fd[2], const char *url,
 			*arg++ = ssh_host;
 		}	else {
 			/* remove repo-local variables from the environment */
-			conn->env = local_repo_env;
+			if (flags & CONNECT_PROTOCOL_V2)
+				conn->env = local_repo_env_v2();
+			else
+				conn->env = local_repo_env;
 			conn->use_shell = 1;
 		}
 		*arg++ = cmd.buf;
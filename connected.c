@@ -3,6 +3,12 @@
 #include "sigchain.h"
 #include "connected.h"
 #include "transport.h"
+#include "commit.h"
+#include "dir.h"
+#include "tree-walk.h"
+#include "hashmap.h"
+#include "thread-utils.h"
+#include "refs.h"
 
 int check_everything_connected(sha1_iterate_fn fn, int quiet, void *cb_data)
 {
@@ -118,3 +124,395 @@ int check_shallow_connected(sha1_iterate_fn fn, int quiet, void *cb_data,
 	return check_everything_connected_real(fn, quiet, cb_data,
 					       NULL, shallow_file);
 }
+
+/*
+ * The in-pack check walks what is reachable from the new tips, like
+ * rev-list does, but stops at the objects found in another pack of
+ * the repository, which are trusted to be connected already, instead
+ * of at the objects reachable from our refs, which are expensive to
+ * find in a repository with many refs.  What the walk reads then is
+ * what came in the new pack (and the odd loose object).
+ *
+ * Kept packs are not trusted: one may be another push still being
+ * checked, or a pack nobody checked.  Their objects are walked like
+ * the new ones, down to the objects our refs point at.
+ *
+ * Several threads take the objects to read from a shared stack, and
+ * push what these refer to back on it; the object read lock is held
+ * while looking up objects, but not while inflating them.
+ */
+
+struct seen_object {
+	struct hashmap_entry ent;
+	unsigned char sha1[20];
+};
+
+struct walk_item {
+	unsigned char sha1[20];
+	enum object_type type; /* OBJ_NONE if not known yet */
+};
+
+struct pack_walk {
+	struct packed_git *new_pack;
+	struct packed_git **other_packs;
+	int nr_other_packs, other_packs_alloc;
+	int quiet;
+	int failed;
+
+	/* the objects queued to be walked, ever */
+	struct hashmap seen;
+	/* ... and those not taken by a thread yet */
+	struct walk_item *todo;
+	int todo_nr, todo_alloc;
+	/* the threads walking an object */
+	int busy;
+
+#ifndef NO_PTHREADS
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+#endif
+};
+
+#ifndef NO_PTHREADS
+#define walk_lock(w)		pthread_mutex_lock(&(w)->mutex)
+#define walk_unlock(w)		pthread_mutex_unlock(&(w)->mutex)
+#define walk_wait(w)		pthread_cond_wait(&(w)->cond, &(w)->mutex)
+#define walk_wake(w)		pthread_cond_broadcast(&(w)->cond)
+#else
+#define walk_lock(w)		(void)0
+#define walk_unlock(w)		(void)0
+#define walk_wait(w)		(void)0
+#define walk_wake(w)		(void)0
+#endif
+
+static unsigned int sha1_hash(const unsigned char *sha1)
+{
+	unsigned int hash;
+	memcpy(&hash, sha1, sizeof(hash));
+	return hash;
+}
+
+static int seen_object_cmp(const struct seen_object *a,
+			   const struct seen_object *b,
+			   const unsigned char *sha1)
+{
+	return hashcmp(a->sha1, sha1 ? sha1 : b->sha1);
+}
+
+static int in_other_pack(struct pack_walk *w, const unsigned char *sha1)
+{
+	int i;
+
+	for (i = 0; i < w->nr_other_packs; i++)
+		if (find_pack_entry_one(sha1, w->other_packs[i]))
+			return 1;
+	return 0;
+}
+
+static int walk_failed(struct pack_walk *w, const char *fmt, ...)
+{
+	if (!w->quiet) {
+		va_list params;
+		va_start(params, fmt);
+		vreportf("error: ", fmt, params);
+		va_end(params);
+	}
+	w->failed = 1;
+	return -1;
+}
+
+/*
+ * An object of the given type is referred to; unless it is trusted,
+ * or it is a blob that we have, add it to the objects to walk.
+ */
+static int refer_to(struct pack_walk *w, const unsigned char *sha1,
+		    enum object_type type, struct walk_item **found,
+		    int *nr, int *alloc)
+{
+	if (in_other_pack(w, sha1))
+		return 0;
+	if (type == OBJ_BLOB) {
+		int has;
+
+		if (find_pack_entry_one(sha1, w->new_pack))
+			return 0;
+		obj_read_lock();
+		has = has_sha1_file(sha1);
+		obj_read_unlock();
+		if (has)
+			return 0;
+		return walk_failed(w, "missing blob %s", sha1_to_hex(sha1));
+	}
+	ALLOC_GROW(*found, *nr + 1, *alloc);
+	hashcpy((*found)[*nr].sha1, sha1);
+	(*found)[*nr].type = type;
+	(*nr)++;
+	return 0;
+}
+
+/*
+ * Read the object, and collect the objects it refers to in "found".
+ */
+static int walk_one(struct pack_walk *w, const struct walk_item *item,
+		    struct walk_item **found, int *nr, int *alloc)
+{
+	enum object_type type;
+	unsigned long size;
+	const char *hex = sha1_to_hex(item->sha1);
+	char *buf, *p;
+	unsigned char sha1[20];
+	int ret = 0;
+
+	buf = read_sha1_file(item->sha1, &type, &size);
+	if (!buf)
+		return walk_failed(w, "missing %s %s",
+				   item->type ? typename(item->type) : "object",
+				   hex);
+	if (item->type && item->type != type) {
+		free(buf);
+		return walk_failed(w, "object %s is a %s, not a %s",
+				   hex, typename(type), typename(item->type));
+	}
+
+	switch (type) {
+	case OBJ_COMMIT:
+		p = buf;
+		if (size < 46 || !starts_with(p, "tree ") ||
+		    get_sha1_hex(p + 5, sha1) || p[45] != '\n')
+			goto bad;
+		ret = refer_to(w, sha1, OBJ_TREE, found, nr, alloc);
+		p += 46;
+		while (!ret && p + 48 <= buf + size &&
+		       starts_with(p, "parent ")) {
+			if (get_sha1_hex(p + 7, sha1) || p[47] != '\n')
+				goto bad;
+			ret = refer_to(w, sha1, OBJ_COMMIT, found, nr, alloc);
+			p += 48;
+		}
+		break;
+	case OBJ_TREE: {
+		struct tree_desc desc;
+		struct name_entry entry;
+
+		init_tree_desc(&desc, buf, size);
+		while (!ret && tree_entry(&desc, &entry)) {
+			if (S_ISGITLINK(entry.mode))
+				continue;
+			ret = refer_to(w, entry.sha1,
+				       S_ISDIR(entry.mode) ? OBJ_TREE : OBJ_BLOB,
+				       found, nr, alloc);
+		}
+		break;
+	}
+	case OBJ_TAG: {
+		enum object_type tagged_type;
+
+		if (!starts_with(buf, "object ") || size < 53 ||
+		    get_sha1_hex(buf + 7, sha1) || buf[47] != '\n' ||
+		    !starts_with(buf + 48, "type "))
+			goto bad;
+		p = buf + 53;
+		for (tagged_type = OBJ_COMMIT; tagged_type <= OBJ_TAG; tagged_type++) {
+			const char *name = typename(tagged_type);
+			size_t len = strlen(name);
+			if (p + len < buf + size && !strncmp(p, name, len) &&
+			    p[len] == '\n')
+				break;
+		}
+		if (tagged_type > OBJ_TAG)
+			goto bad;
+		ret = refer_to(w, sha1, tagged_type, found, nr, alloc);
+		break;
+	}
+	case OBJ_BLOB:
+		break;
+	default:
+		goto bad;
+	}
+	free(buf);
+	return ret;
+
+bad:
+	free(buf);
+	return walk_failed(w, "bad %s %s", typename(type), hex);
+}
+
+/* Return 0 if the object was seen already, 1 if it is seen now */
+static int mark_seen(struct pack_walk *w, const unsigned char *sha1)
+{
+	struct hashmap_entry key;
+	struct seen_object *o;
+
+	hashmap_entry_init(&key, sha1_hash(sha1));
+	if (hashmap_get(&w->seen, &key, sha1))
+		return 0;
+	o = xmalloc(sizeof(*o));
+	hashmap_entry_init(o, sha1_hash(sha1));
+	hashcpy(o->sha1, sha1);
+	hashmap_add(&w->seen, o);
+	return 1;
+}
+
+static int mark_ref_seen(const char *refname, const unsigned char *sha1,
+			 int flags, void *cb_data)
+{
+	mark_seen(cb_data, sha1);
+	return 0;
+}
+
+/* Queue what is not queued yet; call with the walk locked */
+static void queue_items(struct pack_walk *w, const struct walk_item *items,
+			int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (!mark_seen(w, items[i].sha1))
+			continue;
+
+		ALLOC_GROW(w->todo, w->todo_nr + 1, w->todo_alloc);
+		w->todo[w->todo_nr++] = items[i];
+	}
+}
+
+static void *walk_thread(void *data)
+{
+	struct pack_walk *w = data;
+	struct walk_item *found = NULL;
+	int nr, alloc = 0;
+
+	walk_lock(w);
+	for (;;) {
+		struct walk_item item;
+
+		while (!w->todo_nr && w->busy && !w->failed)
+			walk_wait(w);
+		if (!w->todo_nr || w->failed)
+			break;
+		item = w->todo[--w->todo_nr];
+		w->busy++;
+		walk_unlock(w);
+
+		nr = 0;
+		walk_one(w, &item, &found, &nr, &alloc);
+
+		walk_lock(w);
+		w->busy--;
+		queue_items(w, found, nr);
+		walk_wake(w);
+	}
+	walk_wake(w);
+	walk_unlock(w);
+	free(found);
+	return NULL;
+}
+
+int check_connected_in_pack(sha1_iterate_fn fn, int quiet, void *cb_data,
+			    const char *idx_file, int nr_threads)
+{
+	struct pack_walk w;
+	struct packed_git *p;
+	unsigned char sha1[20];
+	int i, kept_packs = 0;
+
+	/* grafts and shallow commits have parents that we do not see */
+	if (is_repository_shallow() || file_exists(get_graft_file()))
+		return check_everything_connected(fn, quiet, cb_data);
+
+	memset(&w, 0, sizeof(w));
+	w.quiet = quiet;
+	w.new_pack = add_packed_git(idx_file, strlen(idx_file), 1);
+	if (!w.new_pack)
+		return check_everything_connected(fn, quiet, cb_data);
+	if (open_pack_index(w.new_pack)) {
+		free(w.new_pack);
+		return check_everything_connected(fn, quiet, cb_data);
+	}
+
+	if (fn(cb_data, sha1)) {
+		close_pack_index(w.new_pack);
+		free(w.new_pack);
+		return 0;
+	}
+
+	/* open the pack indices before the threads look into them */
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (!strcmp(p->pack_name, w.new_pack->pack_name))
+			continue;
+		if (p->pack_keep) {
+			kept_packs++;
+			continue;
+		}
+		if (open_pack_index(p))
+			continue;
+		ALLOC_GROW(w.other_packs, w.nr_other_packs + 1,
+			   w.other_packs_alloc);
+		w.other_packs[w.nr_other_packs++] = p;
+	}
+
+	hashmap_init(&w.seen, (hashmap_cmp_fn)seen_object_cmp, 0);
+	/*
+	 * What our refs point at is connected; walking into a kept
+	 * pack, we stop there, as rev-list would.
+	 */
+	if (kept_packs)
+		for_each_ref(mark_ref_seen, &w);
+	do {
+		struct walk_item tip;
+
+		if (in_other_pack(&w, sha1))
+			continue;
+		hashcpy(tip.sha1, sha1);
+		tip.type = OBJ_NONE;
+		queue_items(&w, &tip, 1);
+	} while (!fn(cb_data, sha1));
+
+	/*
+	 * The pack is trusted by the checks of later pushes, so what is
+	 * in it besides the history of the tips must be connected, too.
+	 * Blobs refer to nothing, and are not read.
+	 */
+	for (i = 0; i < w.new_pack->num_objects; i++) {
+		struct walk_item item;
+		int type;
+
+		hashcpy(item.sha1, nth_packed_object_sha1(w.new_pack, i));
+		if (in_other_pack(&w, item.sha1))
+			continue;
+		type = sha1_object_info(item.sha1, NULL);
+		if (type == OBJ_BLOB)
+			continue;
+		item.type = type > 0 ? type : OBJ_NONE;
+		queue_items(&w, &item, 1);
+	}
+
+	if (!nr_threads)
+		nr_threads = online_cpus();
+#ifndef NO_PTHREADS
+	if (nr_threads > 1) {
+		pthread_t *threads = xcalloc(nr_threads, sizeof(*threads));
+
+		pthread_mutex_init(&w.mutex, NULL);
+		pthread_cond_init(&w.cond, NULL);
+		enable_obj_read_lock();
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_create(&threads[i], NULL, walk_thread, &w))
+				die(_("unable to create thread"));
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		disable_obj_read_lock();
+		pthread_mutex_destroy(&w.mutex);
+		pthread_cond_destroy(&w.cond);
+		free(threads);
+	} else
+#endif
+		walk_thread(&w);
+
+	hashmap_free(&w.seen, 1);
+	free(w.todo);
+	free(w.other_packs);
+	close_pack_index(w.new_pack);
+	free(w.new_pack);
+	return w.failed;
+}
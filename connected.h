@@ -24,4 +24,17 @@ extern int check_everything_connected_with_transport(sha1_iterate_fn, int quiet,
 						     void *cb_data,
 						     struct transport *transport);
 
+/*
+ * Like check_everything_connected(), for objects that just came in
+ * the pack whose ".idx" file is "idx_file".  Only the objects that are
+ * not in another pack of the repository are walked, with "nr_threads"
+ * threads (0 for one per CPU); the others are trusted to be connected
+ * already, without looking at our refs, unless their pack is kept (it
+ * may be another push being checked).  For that trust to hold, all
+ * of the pack is checked, not only what the tips reach, and a pack
+ * that fails the check must be removed by the caller.
+ */
+extern int check_connected_in_pack(sha1_iterate_fn, int quiet, void *cb_data,
+				   const char *idx_file, int nr_threads);
+
 #endif /* CONNECTED_H */
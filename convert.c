@@ -3,6 +3,7 @@
 #include "run-command.h"
 #include "quote.h"
 #include "sigchain.h"
+#include "pkt-line.h"
 
 /*
  * convert.c - convert a file when checking it out and checking it in.
@@ -13,15 +14,6 @@
  * translation when the "text" attribute or "auto_crlf" option is set.
  */
 
-enum crlf_action {
-	CRLF_GUESS = -1,
-	CRLF_BINARY = 0,
-	CRLF_TEXT,
-	CRLF_INPUT,
-	CRLF_CRLF,
-	CRLF_AUTO
-};
-
 struct text_stat {
 	/* NUL, CR, LF and CRLF counts */
 	unsigned nul, cr, lf, crlf;
@@ -424,14 +416,271 @@ static int apply_filter(const char *path, const char *src, size_t len,
 	return ret;
 }
 
+/*
+ * Long-running filter processes (filter.<driver>.process): one process
+ * is started per command the first time it is needed, and is then fed
+ * every blob through the pkt-line protocol described in
+ * gitattributes(5), instead of spawning the command once per blob.
+ */
+#define CAP_CLEAN	(1u<<0)
+#define CAP_SMUDGE	(1u<<1)
+
+static struct filter_process {
+	struct filter_process *next;
+	struct child_process process;
+	const char *argv[2];
+	unsigned int supported;
+	char cmd[FLEX_ARRAY];
+} *filter_processes;
+
+static void stop_filter_process(struct filter_process *fp)
+{
+	struct filter_process **pp;
+
+	for (pp = &filter_processes; *pp; pp = &(*pp)->next)
+		if (*pp == fp) {
+			*pp = fp->next;
+			break;
+		}
+	close(fp->process.in);
+	close(fp->process.out);
+	finish_command(&fp->process);
+	free(fp);
+}
+
+static void stop_filter_processes(void)
+{
+	while (filter_processes)
+		stop_filter_process(filter_processes);
+}
+
+static int write_filter_line(int fd, const char *fmt, ...)
+{
+	struct strbuf line = STRBUF_INIT;
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	strbuf_vaddf(&line, fmt, ap);
+	va_end(ap);
+	strbuf_addch(&line, '\n');
+	ret = packet_write_gently(fd, line.buf, line.len);
+	strbuf_release(&line);
+	return ret;
+}
+
+/*
+ * Read one line from the filter process into packet_buffer.  Return 1
+ * for a line, 0 for a flush packet, and -1 if the process went away.
+ */
+static int read_filter_line(int fd)
+{
+	int len = packet_read(fd, NULL, NULL,
+			      packet_buffer, sizeof(packet_buffer),
+			      PACKET_READ_GENTLE_ON_EOF |
+			      PACKET_READ_CHOMP_NEWLINE);
+	if (len < 0)
+		return -1;
+	return len ? 1 : 0;
+}
+
+/*
+ * Read a list of "key=value" lines up to a flush packet, remembering
+ * the value of the last "status" key in status.  Return -1 if the
+ * process went away.
+ */
+static int read_filter_status(int fd, struct strbuf *status)
+{
+	int ret;
+
+	while ((ret = read_filter_line(fd)) > 0) {
+		const char *value = skip_prefix(packet_buffer, "status=");
+		if (value) {
+			strbuf_reset(status);
+			strbuf_addstr(status, value);
+		}
+	}
+	return ret;
+}
+
+static int handshake_filter_process(struct filter_process *fp)
+{
+	int in = fp->process.in, out = fp->process.out;
+	int ret;
+
+	if (write_filter_line(in, "git-filter-client") ||
+	    write_filter_line(in, "version=2") ||
+	    packet_flush_gently(in))
+		return error("cannot start filter process '%s'", fp->cmd);
+
+	if (read_filter_line(out) <= 0 ||
+	    strcmp(packet_buffer, "git-filter-server"))
+		return error("filter process '%s' did not identify itself",
+			     fp->cmd);
+	while ((ret = read_filter_line(out)) > 0)
+		if (!strcmp(packet_buffer, "version=2"))
+			break;
+	if (ret <= 0)
+		return error("filter process '%s' does not speak version 2",
+			     fp->cmd);
+	while ((ret = read_filter_line(out)) > 0)
+		; /* ignore other versions the process may support */
+	if (ret < 0)
+		return error("filter process '%s' went away", fp->cmd);
+
+	if (write_filter_line(in, "capability=clean") ||
+	    write_filter_line(in, "capability=smudge") ||
+	    packet_flush_gently(in))
+		return error("cannot negotiate with filter process '%s'",
+			     fp->cmd);
+	while ((ret = read_filter_line(out)) > 0) {
+		if (!strcmp(packet_buffer, "capability=clean"))
+			fp->supported |= CAP_CLEAN;
+		else if (!strcmp(packet_buffer, "capability=smudge"))
+			fp->supported |= CAP_SMUDGE;
+		/* unknown capabilities are ignored */
+	}
+	if (ret < 0)
+		return error("filter process '%s' went away", fp->cmd);
+	return 0;
+}
+
+static struct filter_process *start_filter_process(const char *cmd)
+{
+	static int atexit_registered;
+	struct filter_process *fp;
+	size_t len = strlen(cmd);
+	int ret;
+
+	for (fp = filter_processes; fp; fp = fp->next)
+		if (!strcmp(fp->cmd, cmd))
+			return fp;
+
+	fp = xcalloc(1, sizeof(*fp) + len + 1);
+	memcpy(fp->cmd, cmd, len);
+	fp->argv[0] = fp->cmd;
+	fp->process.argv = fp->argv;
+	fp->process.use_shell = 1;
+	fp->process.in = -1;
+	fp->process.out = -1;
+
+	fflush(NULL);
+	if (start_command(&fp->process)) {
+		error("cannot fork to run filter process '%s'", cmd);
+		free(fp);
+		return NULL;
+	}
+	fp->next = filter_processes;
+	filter_processes = fp;
+	if (!atexit_registered) {
+		atexit(stop_filter_processes);
+		atexit_registered = 1;
+	}
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	ret = handshake_filter_process(fp);
+	sigchain_pop(SIGPIPE);
+	if (ret) {
+		stop_filter_process(fp);
+		return NULL;
+	}
+	return fp;
+}
+
+static int apply_process_filter(const char *path, const char *src, size_t len,
+				struct strbuf *dst, const char *cmd,
+				unsigned int wanted)
+{
+	struct filter_process *fp;
+	struct strbuf nbuf = STRBUF_INIT;
+	struct strbuf status = STRBUF_INIT;
+	int in, out, err = 0, ret = 0;
+	size_t pos;
+
+	if (!cmd)
+		return 0;
+
+	if (!dst)
+		return 1;
+
+	fp = start_filter_process(cmd);
+	if (!fp)
+		return 0;	/* error was already reported */
+	if (!(fp->supported & wanted))
+		return 0;
+	in = fp->process.in;
+	out = fp->process.out;
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+	err = write_filter_line(in, "command=%s",
+				wanted == CAP_CLEAN ? "clean" : "smudge") ||
+		write_filter_line(in, "pathname=%s", path) ||
+		packet_flush_gently(in);
+	for (pos = 0; !err && pos < len; pos += LARGE_PACKET_MAX - 4) {
+		size_t chunk = len - pos;
+		if (chunk > LARGE_PACKET_MAX - 4)
+			chunk = LARGE_PACKET_MAX - 4;
+		err = packet_write_gently(in, src + pos, chunk);
+	}
+	if (!err)
+		err = packet_flush_gently(in);
+
+	/*
+	 * The process answers with a status, and on success with the
+	 * filtered contents, followed by a status list that may
+	 * override the first one (an empty list leaves it alone).
+	 */
+	if (!err)
+		err = read_filter_status(out, &status);
+	if (!err && !strcmp(status.buf, "success")) {
+		int n;
+		while ((n = packet_read(out, NULL, NULL,
+					packet_buffer, sizeof(packet_buffer),
+					PACKET_READ_GENTLE_ON_EOF)) > 0)
+			strbuf_add(&nbuf, packet_buffer, n);
+		err = n < 0 || read_filter_status(out, &status);
+	}
+	sigchain_pop(SIGPIPE);
+
+	if (err) {
+		error("filter process '%s' failed on '%s'", cmd, path);
+		stop_filter_process(fp);
+	} else if (!strcmp(status.buf, "success")) {
+		strbuf_swap(dst, &nbuf);
+		ret = 1;
+	} else if (!strcmp(status.buf, "abort")) {
+		/* The process does not want to do this any more */
+		fp->supported &= ~wanted;
+	} else {
+		error("filter process '%s' failed on '%s'", cmd, path);
+	}
+	strbuf_release(&nbuf);
+	strbuf_release(&status);
+	return ret;
+}
+
 static struct convert_driver {
 	const char *name;
 	struct convert_driver *next;
 	const char *smudge;
 	const char *clean;
+	const char *process;
 	int required;
 } *user_convert, **user_convert_tail;
 
+static int apply_driver(const char *path, const char *src, size_t len,
+			struct strbuf *dst, const struct convert_driver *drv,
+			unsigned int wanted)
+{
+	if (!drv)
+		return 0;
+	if (drv->process)
+		return apply_process_filter(path, src, len, dst,
+					    drv->process, wanted);
+	return apply_filter(path, src, len, dst,
+			    wanted == CAP_CLEAN ? drv->clean : drv->smudge);
+}
+
 static int read_convert_config(const char *var, const char *value, void *cb)
 {
 	const char *key, *name;
@@ -469,6 +718,13 @@ static int read_convert_config(const char *var, const char *value, void *cb)
 	if (!strcmp("clean", key))
 		return git_config_string(&drv->clean, var, value);
 
+	/*
+	 * filter.<name>.process specifies a command line for a
+	 * long-running process that takes over from smudge and clean.
+	 */
+	if (!strcmp("process", key))
+		return git_config_string(&drv->process, var, value);
+
 	if (!strcmp("required", key)) {
 		drv->required = git_config_bool(var, value);
 		return 0;
@@ -708,19 +964,12 @@ static enum crlf_action input_crlf_action(enum crlf_action text_attr, enum eol e
 	return text_attr;
 }
 
-struct conv_attrs {
-	struct convert_driver *drv;
-	enum crlf_action crlf_action;
-	enum eol eol_attr;
-	int ident;
-};
-
 static const char *conv_attr_name[] = {
 	"crlf", "ident", "filter", "eol", "text",
 };
 #define NUM_CONV_ATTRS ARRAY_SIZE(conv_attr_name)
 
-static void convert_attrs(struct conv_attrs *ca, const char *path)
+void convert_attrs(struct conv_attrs *ca, const char *path)
 {
 	int i;
 	static struct git_attr_check ccheck[NUM_CONV_ATTRS];
@@ -751,17 +1000,14 @@ int convert_to_git(const char *path, const char *src, size_t len,
                    struct strbuf *dst, enum safe_crlf checksafe)
 {
 	int ret = 0;
-	const char *filter = NULL;
 	int required = 0;
 	struct conv_attrs ca;
 
 	convert_attrs(&ca, path);
-	if (ca.drv) {
-		filter = ca.drv->clean;
+	if (ca.drv)
 		required = ca.drv->required;
-	}
 
-	ret |= apply_filter(path, src, len, dst, filter);
+	ret |= apply_driver(path, src, len, dst, ca.drv, CAP_CLEAN);
 	if (!ret && required)
 		die("%s: clean filter '%s' failed", path, ca.drv->name);
 
@@ -778,18 +1024,18 @@ int convert_to_git(const char *path, const char *src, size_t len,
 	return ret | ident_to_git(path, src, len, dst, ca.ident);
 }
 
-static int convert_to_working_tree_internal(const char *path, const char *src,
+static int convert_to_working_tree_internal(const struct conv_attrs *attrs,
+					    const char *path, const char *src,
 					    size_t len, struct strbuf *dst,
 					    int normalizing)
 {
 	int ret = 0, ret_filter = 0;
-	const char *filter = NULL;
+	int filter = 0;
 	int required = 0;
-	struct conv_attrs ca;
+	struct conv_attrs ca = *attrs;
 
-	convert_attrs(&ca, path);
 	if (ca.drv) {
-		filter = ca.drv->smudge;
+		filter = ca.drv->smudge || ca.drv->process;
 		required = ca.drv->required;
 	}
 
@@ -811,21 +1057,34 @@ static int convert_to_working_tree_internal(const char *path, const char *src,
 		}
 	}
 
-	ret_filter = apply_filter(path, src, len, dst, filter);
+	ret_filter = apply_driver(path, src, len, dst, ca.drv, CAP_SMUDGE);
 	if (!ret_filter && required)
 		die("%s: smudge filter %s failed", path, ca.drv->name);
 
 	return ret | ret_filter;
 }
 
+int convert_to_working_tree_ca(const struct conv_attrs *ca, const char *path,
+			       const char *src, size_t len, struct strbuf *dst)
+{
+	return convert_to_working_tree_internal(ca, path, src, len, dst, 0);
+}
+
 int convert_to_working_tree(const char *path, const char *src, size_t len, struct strbuf *dst)
 {
-	return convert_to_working_tree_internal(path, src, len, dst, 0);
+	struct conv_attrs ca;
+
+	convert_attrs(&ca, path);
+	return convert_to_working_tree_ca(&ca, path, src, len, dst);
 }
 
 int renormalize_buffer(const char *path, const char *src, size_t len, struct strbuf *dst)
 {
-	int ret = convert_to_working_tree_internal(path, src, len, dst, 1);
+	struct conv_attrs ca;
+	int ret;
+
+	convert_attrs(&ca, path);
+	ret = convert_to_working_tree_internal(&ca, path, src, len, dst, 1);
 	if (ret) {
 		src = dst->buf;
 		len = dst->len;
@@ -1257,21 +1516,19 @@ static struct stream_filter *ident_filter(const unsigned char *sha1)
  * Note that you would be crazy to set CRLF, smuge/clean or ident to a
  * large binary blob you would want us not to slurp into the memory!
  */
-struct stream_filter *get_stream_filter(const char *path, const unsigned char *sha1)
+struct stream_filter *get_stream_filter_ca(const struct conv_attrs *ca,
+					   const unsigned char *sha1)
 {
-	struct conv_attrs ca;
 	enum crlf_action crlf_action;
 	struct stream_filter *filter = NULL;
 
-	convert_attrs(&ca, path);
-
-	if (ca.drv && (ca.drv->smudge || ca.drv->clean))
+	if (ca->drv && (ca->drv->smudge || ca->drv->clean || ca->drv->process))
 		return filter;
 
-	if (ca.ident)
+	if (ca->ident)
 		filter = ident_filter(sha1);
 
-	crlf_action = input_crlf_action(ca.crlf_action, ca.eol_attr);
+	crlf_action = input_crlf_action(ca->crlf_action, ca->eol_attr);
 
 	if ((crlf_action == CRLF_BINARY) || (crlf_action == CRLF_INPUT) ||
 	    (crlf_action == CRLF_GUESS && auto_crlf == AUTO_CRLF_FALSE))
@@ -1284,6 +1541,14 @@ struct stream_filter *get_stream_filter(const char *path, const unsigned char *s
 	return filter;
 }
 
+struct stream_filter *get_stream_filter(const char *path, const unsigned char *sha1)
+{
+	struct conv_attrs ca;
+
+	convert_attrs(&ca, path);
+	return get_stream_filter_ca(&ca, sha1);
+}
+
 void free_stream_filter(struct stream_filter *filter)
 {
 	filter->vtbl->free(filter);
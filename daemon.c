@@ -4,6 +4,11 @@
 #include "run-command.h"
 #include "strbuf.h"
 #include "string-list.h"
+#include "protocol.h"
+#include "sigchain.h"
+#ifndef NO_UNIX_SOCKETS
+#include "unix-socket.h"
+#endif
 
 #ifndef HOST_NAME_MAX
 #define HOST_NAME_MAX 256
@@ -26,7 +31,7 @@ static const char daemon_usage[] =
 "           [--interpolated-path=<path>]\n"
 "           [--reuseaddr] [--pid-file=<file>]\n"
 "           [--(enable|disable|allow-override|forbid-override)=<service>]\n"
-"           [--access-hook=<path>]\n"
+"           [--access-hook=<path>] [--worker-pool]\n"
 "           [--inetd | [--listen=<host_or_ipaddr>] [--port=<n>]\n"
 "                      [--detach] [--user=<user> [--group=<group>]]\n"
 "           [<directory>...]";
@@ -60,6 +65,17 @@ static char *hostname;
 static char *canon_hostname;
 static char *ip_address;
 static char *tcp_port;
+/* What the client asked for after the host, for $GIT_PROTOCOL */
+static char *git_protocol;
+
+/*
+ * With --worker-pool, the socket to hand connections to "upload-pack
+ * --worker" processes through: in the daemon, the end it receives
+ * them on, and in the process serving a connection, the end to send
+ * it on.
+ */
+static int worker_pool;
+static int pool_socket = -1;
 
 static void logreport(int priority, const char *err, va_list params)
 {
@@ -405,13 +421,26 @@ static void copy_to_log(int fd)
 static int run_service_command(const char **argv)
 {
 	struct child_process cld;
+	struct strbuf protocol_env = STRBUF_INIT;
+	const char *env[2];
+
+	/* Without a request, do not pass on our own $GIT_PROTOCOL */
+	strbuf_addstr(&protocol_env, GIT_PROTOCOL_ENVIRONMENT);
+	if (git_protocol)
+		strbuf_addf(&protocol_env, "=%s", git_protocol);
+	env[0] = protocol_env.buf;
+	env[1] = NULL;
 
 	memset(&cld, 0, sizeof(cld));
 	cld.argv = argv;
+	cld.env = env;
 	cld.git_cmd = 1;
 	cld.err = -1;
-	if (start_command(&cld))
+	if (start_command(&cld)) {
+		strbuf_release(&protocol_env);
 		return -1;
+	}
+	strbuf_release(&protocol_env);
 
 	close(0);
 	close(1);
@@ -421,12 +450,67 @@ static int run_service_command(const char **argv)
 	return finish_command(&cld);
 }
 
+#ifndef NO_UNIX_SOCKETS
+/*
+ * Hand our connection to the daemon, to be served by the worker of
+ * the repository we are in, and wait until it is.  Return -1 if it
+ * cannot be, for the caller to run upload-pack itself.
+ */
+static int serve_by_worker(void)
+{
+	char cwd[PATH_MAX];
+	struct strbuf msg = STRBUF_INIT;
+	int done[2], fds[2];
+	char c;
+	ssize_t ret;
+
+	if (!getcwd(cwd, sizeof(cwd)))
+		return -1;
+	if (pipe(done) < 0) {
+		logerror("unable to create pipe: %s", strerror(errno));
+		return -1;
+	}
+	strbuf_addstr(&msg, cwd);
+	strbuf_addch(&msg, '\0');
+	if (git_protocol)
+		strbuf_addstr(&msg, git_protocol);
+
+	fds[0] = 0;
+	fds[1] = done[1];
+	ret = unix_send_fds(pool_socket, msg.buf, msg.len, fds, 2);
+	strbuf_release(&msg);
+	close(done[1]);
+	if (ret < 0) {
+		logerror("unable to hand connection to a worker: %s",
+			 strerror(errno));
+		close(done[0]);
+		return -1;
+	}
+
+	/*
+	 * The write end of the pipe is now held by whoever serves the
+	 * connection; a byte means nobody will.
+	 */
+	ret = xread(done[0], &c, 1);
+	close(done[0]);
+	return ret ? -1 : 0;
+}
+#else
+static int serve_by_worker(void)
+{
+	return -1;
+}
+#endif
+
 static int upload_pack(void)
 {
 	/* Timeout as string */
 	char timeout_buf[64];
 	const char *argv[] = { "upload-pack", "--strict", NULL, ".", NULL };
 
+	if (0 <= pool_socket && !serve_by_worker())
+		return 0;
+
 	argv[2] = timeout_buf;
 
 	snprintf(timeout_buf, sizeof timeout_buf, "--timeout=%u", timeout);
@@ -511,7 +595,33 @@ static void parse_host_and_port(char *hostport, char **host,
 }
 
 /*
- * Read the host as supplied by the client connection.
+ * Read the parameters that come after the host and another NUL byte,
+ * such as "version=2", and which older versions of the daemon do not
+ * look at, into git_protocol.
+ */
+static void parse_extra_args(char *extra_args, int buflen)
+{
+	struct strbuf protocol = STRBUF_INIT;
+	char *end = extra_args + buflen;
+
+	for (; extra_args < end; extra_args += strlen(extra_args) + 1) {
+		if (!*extra_args)
+			continue;
+		if (protocol.len)
+			strbuf_addch(&protocol, ':');
+		strbuf_addstr(&protocol, extra_args);
+	}
+
+	if (protocol.len) {
+		loginfo("Extended protocol parameters <%s>", protocol.buf);
+		git_protocol = strbuf_detach(&protocol, NULL);
+	}
+	strbuf_release(&protocol);
+}
+
+/*
+ * Read the host as supplied by the client connection, and the extra
+ * parameters after it.
  */
 static void parse_host_arg(char *extra_args, int buflen)
 {
@@ -544,6 +654,9 @@ static void parse_host_arg(char *extra_args, int buflen)
 			die("Invalid request");
 	}
 
+	if (extra_args < end && !*extra_args)
+		parse_extra_args(extra_args + 1, end - extra_args - 1);
+
 	/*
 	 * Locate canonical hostname and its IP address.
 	 */
@@ -625,7 +738,9 @@ static int execute(void)
 	free(canon_hostname);
 	free(ip_address);
 	free(tcp_port);
+	free(git_protocol);
 	hostname = canon_hostname = ip_address = tcp_port = NULL;
+	git_protocol = NULL;
 
 	if (len != pktlen)
 		parse_host_arg(line + len + 1, pktlen - len - 1);
@@ -735,6 +850,271 @@ static void check_dead_children(void)
 			cradle = &blanket->next;
 }
 
+#ifndef NO_UNIX_SOCKETS
+/*
+ * The "upload-pack --worker" processes of the pool, one per repository,
+ * the most recently used first.  They are at most "max_connections";
+ * to make room for another one, the least recently used is retired,
+ * by closing its socket: it exits when it has read what we sent it.
+ * What they (and the processes they fork) write to their standard
+ * error goes to our log, a line at a time, from the service loop.
+ */
+static struct worker {
+	struct worker *next;
+	struct child_process cld;	/* cld.pid is 0 once reaped */
+	char *path;
+	int fd;		/* -1 once retired */
+	int err;	/* -1 once all writers are gone */
+	struct strbuf err_line;
+} *workers;
+
+static unsigned int live_workers;
+
+static void retire_worker(struct worker *w)
+{
+	if (w->fd < 0)
+		return;
+	close(w->fd);
+	w->fd = -1;
+	live_workers--;
+}
+
+static void check_dead_workers(void)
+{
+	int status;
+	pid_t pid;
+
+	struct worker **cradle, *w;
+	for (cradle = &workers; (w = *cradle);) {
+		if (w->cld.pid &&
+		    (pid = waitpid(w->cld.pid, &status, WNOHANG)) > 0) {
+			const char *dead = "";
+			if (status)
+				dead = " (with error)";
+			loginfo("[%"PRIuMAX"] Worker for '%s' exited%s",
+				(uintmax_t)pid, w->path, dead);
+
+			retire_worker(w);
+			w->cld.pid = 0;
+		}
+		/* what it forked may still have something to say */
+		if (!w->cld.pid && w->err < 0) {
+			*cradle = w->next;
+			strbuf_release(&w->err_line);
+			free(w->path);
+			free(w);
+		} else
+			cradle = &w->next;
+	}
+}
+
+static struct worker *find_worker(const char *path)
+{
+	struct worker **cradle, *w;
+
+	for (cradle = &workers; (w = *cradle); cradle = &w->next)
+		if (0 <= w->fd && !strcmp(w->path, path)) {
+			/* move it to the front */
+			*cradle = w->next;
+			w->next = workers;
+			workers = w;
+			return w;
+		}
+	return NULL;
+}
+
+static struct worker *start_worker(const char *path)
+{
+	char timeout_buf[64];
+	const char *argv[] = {
+		"upload-pack", "--worker", "--strict", timeout_buf, ".", NULL
+	};
+	struct worker *w;
+	int sv[2];
+	long flags;
+
+	if (max_connections && live_workers >= max_connections) {
+		struct worker *oldest = NULL;
+		for (w = workers; w; w = w->next)
+			if (0 <= w->fd)
+				oldest = w;
+		if (oldest)
+			retire_worker(oldest);
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		logerror("unable to create socket pair: %s", strerror(errno));
+		return NULL;
+	}
+	flags = fcntl(sv[0], F_GETFD, 0);
+	if (flags >= 0)
+		fcntl(sv[0], F_SETFD, flags | FD_CLOEXEC);
+	/* a worker too busy to read must not hold up the daemon */
+	flags = fcntl(sv[0], F_GETFL, 0);
+	if (flags >= 0)
+		fcntl(sv[0], F_SETFL, flags | O_NONBLOCK);
+
+	snprintf(timeout_buf, sizeof timeout_buf, "--timeout=%u", timeout);
+	w = xcalloc(1, sizeof(*w));
+	w->path = xstrdup(path);
+	w->cld.argv = argv;
+	w->cld.git_cmd = 1;
+	w->cld.dir = w->path;
+	w->cld.in = sv[1];
+	w->cld.no_stdout = 1;
+	w->cld.err = -1;
+	if (start_command(&w->cld)) {
+		logerror("unable to start worker for '%s'", path);
+		close(sv[0]);
+		free(w->path);
+		free(w);
+		return NULL;
+	}
+	w->cld.argv = NULL;
+	w->fd = sv[0];
+	w->err = w->cld.err;
+	flags = fcntl(w->err, F_GETFD, 0);
+	if (flags >= 0)
+		fcntl(w->err, F_SETFD, flags | FD_CLOEXEC);
+	strbuf_init(&w->err_line, 0);
+	w->next = workers;
+	workers = w;
+	live_workers++;
+	loginfo("[%"PRIuMAX"] Worker started for '%s'",
+		(uintmax_t)w->cld.pid, path);
+	return w;
+}
+
+static int send_to_worker(struct worker *w, const char *msg, int len,
+			  const int *fds)
+{
+	struct strbuf pkt = STRBUF_INIT;
+	int ret;
+
+	strbuf_addf(&pkt, "%04x", len + 4);
+	strbuf_add(&pkt, msg, len);
+	sigchain_push(SIGPIPE, SIG_IGN);
+	ret = unix_send_fds(w->fd, pkt.buf, pkt.len, fds, 2);
+	sigchain_pop(SIGPIPE);
+	strbuf_release(&pkt);
+	return ret;
+}
+
+/*
+ * A process serving a connection sent it to us, with the path of the
+ * repository and the $GIT_PROTOCOL of the request, for the worker of
+ * that repository.  If it cannot be handed over (even to a new worker,
+ * when the one we had went away), tell the sender to serve it itself.
+ */
+static void handle_pool_request(void)
+{
+	static char msg[LARGE_PACKET_MAX];
+	struct worker *w;
+	int fds[2], len, attempt;
+
+	len = unix_recv_fds(pool_socket, msg, sizeof(msg) - 4, fds, 2);
+	if (len <= 0) {
+		if (len < 0)
+			logerror("unable to receive connection: %s",
+				 strerror(errno));
+		return;
+	}
+	msg[len] = '\0';
+
+	w = find_worker(msg);
+	for (attempt = 0; attempt < 2; attempt++) {
+		if (!w)
+			w = start_worker(msg);
+		if (!w)
+			break;
+		if (!send_to_worker(w, msg, len, fds)) {
+			close(fds[0]);
+			close(fds[1]);
+			return;
+		}
+		logerror("unable to hand connection to worker [%"PRIuMAX"]: %s",
+			 (uintmax_t)w->cld.pid, strerror(errno));
+		retire_worker(w);
+		w = NULL;
+	}
+	sigchain_push(SIGPIPE, SIG_IGN);
+	write_in_full(fds[1], "n", 1);
+	sigchain_pop(SIGPIPE);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+/* Add the standard error of the workers to "pfd", after its "nr" fds */
+static int poll_worker_errors(struct pollfd **pfd, int nr, int *alloc)
+{
+	struct worker *w;
+
+	for (w = workers; w; w = w->next) {
+		if (w->err < 0)
+			continue;
+		ALLOC_GROW(*pfd, nr + 1, *alloc);
+		(*pfd)[nr].fd = w->err;
+		(*pfd)[nr].events = POLLIN;
+		(*pfd)[nr].revents = 0;
+		nr++;
+	}
+	return nr;
+}
+
+static void log_worker_errors(const struct pollfd *pfd, int nr)
+{
+	struct worker *w;
+	char buf[1024], *eol;
+	ssize_t len;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (!(pfd[i].revents & (POLLIN | POLLHUP)))
+			continue;
+		for (w = workers; w && w->err != pfd[i].fd; w = w->next)
+			; /* nothing */
+		if (!w)
+			continue;
+
+		len = xread(w->err, buf, sizeof(buf));
+		if (len > 0)
+			strbuf_add(&w->err_line, buf, len);
+		while ((eol = memchr(w->err_line.buf, '\n', w->err_line.len))) {
+			*eol = '\0';
+			logerror("%s", w->err_line.buf);
+			strbuf_remove(&w->err_line, 0, eol - w->err_line.buf + 1);
+		}
+		if (len <= 0) {
+			if (w->err_line.len)
+				logerror("%s", w->err_line.buf);
+			strbuf_reset(&w->err_line);
+			close(w->err);
+			w->err = -1;
+		}
+	}
+}
+#else
+static void check_dead_workers(void)
+{
+	/* nothing */
+}
+
+static void handle_pool_request(void)
+{
+	/* nothing */
+}
+
+static int poll_worker_errors(struct pollfd **pfd, int nr, int *alloc)
+{
+	return nr;
+}
+
+static void log_worker_errors(const struct pollfd *pfd, int nr)
+{
+	/* nothing */
+}
+#endif
+
 static char **cld_argv;
 static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 {
@@ -995,23 +1375,32 @@ static void socksetup(struct string_list *listen_addr, int listen_port, struct s
 static int service_loop(struct socketlist *socklist)
 {
 	struct pollfd *pfd;
-	int i;
+	int i, nr_pfd, pfd_alloc;
 
-	pfd = xcalloc(socklist->nr, sizeof(struct pollfd));
+	pfd_alloc = socklist->nr + 1;
+	pfd = xcalloc(pfd_alloc, sizeof(struct pollfd));
 
 	for (i = 0; i < socklist->nr; i++) {
 		pfd[i].fd = socklist->list[i];
 		pfd[i].events = POLLIN;
 	}
+	nr_pfd = socklist->nr;
+	if (0 <= pool_socket) {
+		pfd[nr_pfd].fd = pool_socket;
+		pfd[nr_pfd].events = POLLIN;
+		nr_pfd++;
+	}
 
 	signal(SIGCHLD, child_handler);
 
 	for (;;) {
-		int i;
+		int i, nr;
 
 		check_dead_children();
+		check_dead_workers();
 
-		if (poll(pfd, socklist->nr, -1) < 0) {
+		nr = poll_worker_errors(&pfd, nr_pfd, &pfd_alloc);
+		if (poll(pfd, nr, -1) < 0) {
 			if (errno != EINTR) {
 				logerror("Poll failed, resuming: %s",
 				      strerror(errno));
@@ -1044,6 +1433,12 @@ static int service_loop(struct socketlist *socklist)
 				handle(incoming, &ss.sa, sslen);
 			}
 		}
+
+		if (socklist->nr < nr_pfd &&
+		    (pfd[socklist->nr].revents & POLLIN))
+			handle_pool_request();
+
+		log_worker_errors(pfd + nr_pfd, nr - nr_pfd);
 	}
 }
 
@@ -1122,6 +1517,35 @@ static void daemonize(void)
 }
 #endif
 
+#ifndef NO_UNIX_SOCKETS
+/*
+ * Create the socket the processes serving connections hand them to
+ * us through, and return the option that tells them about it.
+ */
+static char *setup_worker_pool(void)
+{
+	static char arg_buf[64];
+	int sv[2];
+	long flags;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) < 0)
+		die_errno("unable to create socket pair");
+	flags = fcntl(sv[0], F_GETFD, 0);
+	if (flags >= 0)
+		fcntl(sv[0], F_SETFD, flags | FD_CLOEXEC);
+	pool_socket = sv[0];
+
+	/* the other end is inherited by the serving processes */
+	snprintf(arg_buf, sizeof(arg_buf), "--pool-socket=%d", sv[1]);
+	return arg_buf;
+}
+#else
+static char *setup_worker_pool(void)
+{
+	die("--worker-pool not supported on this platform");
+}
+#endif
+
 static void store_pid(const char *path)
 {
 	FILE *f = fopen(path, "w");
@@ -1156,7 +1580,7 @@ int main(int argc, char **argv)
 	const char *pid_file = NULL, *user_name = NULL, *group_name = NULL;
 	int detach = 0;
 	struct credentials *cred = NULL;
-	int i;
+	int i, cld_argc;
 
 	git_setup_gettext();
 
@@ -1182,6 +1606,10 @@ int main(int argc, char **argv)
 			serve_mode = 1;
 			continue;
 		}
+		if (starts_with(arg, "--pool-socket=")) {
+			pool_socket = atoi(arg + 14);
+			continue;
+		}
 		if (!strcmp(arg, "--inetd")) {
 			inetd_mode = 1;
 			log_syslog = 1;
@@ -1286,6 +1714,10 @@ int main(int argc, char **argv)
 			informative_errors = 0;
 			continue;
 		}
+		if (!strcmp(arg, "--worker-pool")) {
+			worker_pool = 1;
+			continue;
+		}
 		if (!strcmp(arg, "--")) {
 			ok_paths = &argv[i+1];
 			break;
@@ -1307,6 +1739,9 @@ int main(int argc, char **argv)
 	if (inetd_mode && (detach || group_name || user_name))
 		die("--detach, --user and --group are incompatible with --inetd");
 
+	if (inetd_mode && worker_pool)
+		die("--worker-pool is incompatible with --inetd");
+
 	if (inetd_mode && (listen_port || (listen_addr.nr > 0)))
 		die("--listen= and --port= are incompatible with --inetd");
 	else if (listen_port == 0)
@@ -1330,6 +1765,12 @@ int main(int argc, char **argv)
 			die_errno("failed to redirect stderr to /dev/null");
 	}
 
+	if (serve_mode && 0 <= pool_socket) {
+		long flags = fcntl(pool_socket, F_GETFD, 0);
+		if (flags >= 0)
+			fcntl(pool_socket, F_SETFD, flags | FD_CLOEXEC);
+	}
+
 	if (inetd_mode || serve_mode)
 		return execute();
 
@@ -1342,12 +1783,15 @@ int main(int argc, char **argv)
 		store_pid(pid_file);
 
 	/* prepare argv for serving-processes */
-	cld_argv = xmalloc(sizeof (char *) * (argc + 2));
+	cld_argv = xmalloc(sizeof (char *) * (argc + 3));
 	cld_argv[0] = argv[0];	/* git-daemon */
 	cld_argv[1] = "--serve";
+	cld_argc = 2;
+	if (worker_pool)
+		cld_argv[cld_argc++] = setup_worker_pool();
 	for (i = 1; i < argc; ++i)
-		cld_argv[i+1] = argv[i];
-	cld_argv[argc+1] = NULL;
+		cld_argv[cld_argc++] = argv[i];
+	cld_argv[cld_argc] = NULL;
 
 	return serve(&listen_addr, listen_port, cred);
 }
@@ -7,10 +7,14 @@
 #include "diffcore.h"
 #include "xdiff-interface.h"
 #include "kwset.h"
+#include "hashmap.h"
 
-typedef int (*pickaxe_fn)(mmfile_t *one, mmfile_t *two,
-			  struct diff_options *o,
-			  regex_t *regexp, kwset_t kws);
+typedef int (*pickaxe_fn)(struct diff_filepair *p, struct diff_options *o,
+			  regex_t *regexp, kwset_t kws,
+			  struct userdiff_driver *textconv_one,
+			  struct userdiff_driver *textconv_two);
+
+typedef unsigned int (*count_fn)(mmfile_t *mf, regex_t *regexp, kwset_t kws);
 
 static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
 			 regex_t *regexp, kwset_t kws, pickaxe_fn fn);
@@ -53,6 +57,107 @@ static void pickaxe(struct diff_queue_struct *q, struct diff_options *o,
 	*q = outq;
 }
 
+/*
+ * A blob is usually on the postimage side of one pair, and on the
+ * preimage side of the next pair that touches the same path further
+ * down the history.  We remember what we counted in the blobs we have
+ * searched for as long as the needle stays the same, so that each of
+ * them is read and searched only once.
+ */
+struct pickaxe_memo_entry {
+	struct hashmap_entry ent;
+	unsigned char sha1[20];
+	unsigned int count;
+};
+
+static struct hashmap pickaxe_memo;
+static char *pickaxe_memo_needle;
+static int pickaxe_memo_opts, pickaxe_memo_icase;
+
+/* Stop remembering new blobs after this many. */
+#define PICKAXE_MEMO_MAX (1 << 20)
+
+static int pickaxe_memo_cmp(const struct pickaxe_memo_entry *a,
+			    const struct pickaxe_memo_entry *b,
+			    const void *unused)
+{
+	return hashcmp(a->sha1, b->sha1);
+}
+
+static void prepare_pickaxe_memo(struct diff_options *o)
+{
+	int opts = o->pickaxe_opts & ~DIFF_PICKAXE_ALL;
+	int icase = !!DIFF_OPT_TST(o, PICKAXE_IGNORE_CASE);
+
+	if (pickaxe_memo_needle && opts == pickaxe_memo_opts &&
+	    icase == pickaxe_memo_icase &&
+	    !strcmp(pickaxe_memo_needle, o->pickaxe))
+		return;
+	if (pickaxe_memo_needle)
+		hashmap_free(&pickaxe_memo, 1);
+	hashmap_init(&pickaxe_memo, (hashmap_cmp_fn) pickaxe_memo_cmp, 0);
+	free(pickaxe_memo_needle);
+	pickaxe_memo_needle = xstrdup(o->pickaxe);
+	pickaxe_memo_opts = opts;
+	pickaxe_memo_icase = icase;
+}
+
+static struct pickaxe_memo_entry *pickaxe_memo_get(const unsigned char *sha1)
+{
+	struct pickaxe_memo_entry key;
+	unsigned int hash;
+
+	memcpy(&hash, sha1, sizeof(hash));
+	hashmap_entry_init(&key, hash);
+	hashcpy(key.sha1, sha1);
+	return hashmap_get(&pickaxe_memo, &key, NULL);
+}
+
+static void pickaxe_memo_add(const unsigned char *sha1, unsigned int count)
+{
+	struct pickaxe_memo_entry *e;
+	unsigned int hash;
+
+	if (pickaxe_memo.size >= PICKAXE_MEMO_MAX)
+		return;
+	e = xmalloc(sizeof(*e));
+	memcpy(&hash, sha1, sizeof(hash));
+	hashmap_entry_init(e, hash);
+	hashcpy(e->sha1, sha1);
+	e->count = count;
+	hashmap_add(&pickaxe_memo, e);
+}
+
+/*
+ * Count the needle on one side of a pair with fn, which is 0 when
+ * the side does not exist.  The blobs without textconv are looked up
+ * in and added to the memo.
+ */
+static unsigned int count_side(struct diff_filespec *one,
+			       struct userdiff_driver *textconv,
+			       regex_t *regexp, kwset_t kws, count_fn fn)
+{
+	struct pickaxe_memo_entry *e;
+	int use_memo = !textconv && one->sha1_valid;
+	unsigned int cnt;
+	mmfile_t mf;
+
+	if (!DIFF_FILE_VALID(one))
+		return 0;
+	if (use_memo && (e = pickaxe_memo_get(one->sha1)))
+		return e->count;
+
+	mf.size = fill_textconv(textconv, one, &mf.ptr);
+	cnt = fn(&mf, regexp, kws);
+	if (textconv)
+		free(mf.ptr);
+	diff_free_filespec_data(one);
+
+	if (use_memo)
+		pickaxe_memo_add(one->sha1, cnt);
+	return cnt;
+}
+
 struct diffgrep_cb {
 	regex_t *regexp;
 	int hit;
@@ -79,39 +184,93 @@ static void diffgrep_consume(void *priv, char *line, unsigned long len)
 	line[len] = hold;
 }
 
-static int diff_grep(mmfile_t *one, mmfile_t *two,
-		     struct diff_options *o,
-		     regex_t *regexp, kwset_t kws)
+/*
+ * Whether the blob matches anywhere; with REG_NEWLINE, no line of it
+ * can match if the whole does not.  A literal needle is looked for
+ * with kws instead.  regexec() stops at a NUL, so we look again after
+ * each one, for the lines that follow it.
+ */
+static unsigned int matches(mmfile_t *mf, regex_t *regexp, kwset_t kws)
 {
 	regmatch_t regmatch;
+	const char *ptr = mf->ptr, *end = mf->ptr + mf->size;
+	int eflags = 0;
+
+	if (kws)
+		return kwsexec(kws, mf->ptr, mf->size, NULL) != -1;
+	for (;;) {
+		if (!regexec(regexp, ptr, 1, &regmatch, eflags))
+			return 1;
+		ptr = memchr(ptr, '\0', end - ptr);
+		if (!ptr || ++ptr >= end)
+			return 0;
+		eflags = REG_NOTBOL;
+	}
+}
+
+static int diff_grep(struct diff_filepair *p, struct diff_options *o,
+		     regex_t *regexp, kwset_t kws,
+		     struct userdiff_driver *textconv_one,
+		     struct userdiff_driver *textconv_two)
+{
 	struct diffgrep_cb ecbdata;
 	xpparam_t xpp;
 	xdemitconf_t xecfg;
+	mmfile_t mf1, mf2;
+
+	if (!DIFF_FILE_VALID(p->one))
+		return count_side(p->two, textconv_two, regexp, kws, matches);
+	if (!DIFF_FILE_VALID(p->two))
+		return count_side(p->one, textconv_one, regexp, kws, matches);
 
-	if (!one)
-		return !regexec(regexp, two->ptr, 1, &regmatch, 0);
-	if (!two)
-		return !regexec(regexp, one->ptr, 1, &regmatch, 0);
+	/*
+	 * Added or deleted lines can only match if either side matches
+	 * as a whole, which the memo often knows without reading the
+	 * blobs.  Not worth running the textconv filters twice, though.
+	 */
+	if (!textconv_one && !textconv_two &&
+	    !count_side(p->one, NULL, regexp, kws, matches) &&
+	    !count_side(p->two, NULL, regexp, kws, matches))
+		return 0;
 
 	/*
 	 * We have both sides; need to run textual diff and see if
 	 * the pattern appears on added/deleted lines.
 	 */
+	mf1.size = fill_textconv(textconv_one, p->one, &mf1.ptr);
+	mf2.size = fill_textconv(textconv_two, p->two, &mf2.ptr);
+
 	memset(&xpp, 0, sizeof(xpp));
 	memset(&xecfg, 0, sizeof(xecfg));
 	ecbdata.regexp = regexp;
 	ecbdata.hit = 0;
 	xecfg.ctxlen = o->context;
 	xecfg.interhunkctxlen = o->interhunkcontext;
-	xdi_diff_outf(one, two, diffgrep_consume, &ecbdata,
+	xdi_diff_outf(&mf1, &mf2, diffgrep_consume, &ecbdata,
 		      &xpp, &xecfg);
+
+	if (textconv_one)
+		free(mf1.ptr);
+	if (textconv_two)
+		free(mf2.ptr);
+	diff_free_filespec_data(p->one);
+	diff_free_filespec_data(p->two);
 	return ecbdata.hit;
 }
 
+static int is_literal(const char *s)
+{
+	for (; *s; s++)
+		if (is_regex_special(*s))
+			return 0;
+	return 1;
+}
+
 static void diffcore_pickaxe_grep(struct diff_options *o)
 {
 	int err;
 	regex_t regex;
+	kwset_t kws = NULL;
 	int cflags = REG_EXTENDED | REG_NEWLINE;
 
 	if (DIFF_OPT_TST(o, PICKAXE_IGNORE_CASE))
@@ -125,9 +284,22 @@ static void diffcore_pickaxe_grep(struct diff_options *o)
 		die("invalid regex: %s", errbuf);
 	}
 
-	pickaxe(&diff_queued_diff, o, &regex, NULL, diff_grep);
+	/*
+	 * A literal needle can be looked for in the blobs much faster
+	 * with kwset; not when ignoring case, though, as the regex
+	 * library may know more about case than tolower_trans_tbl.
+	 */
+	if (!(cflags & REG_ICASE) && is_literal(o->pickaxe)) {
+		kws = kwsalloc(NULL);
+		kwsincr(kws, o->pickaxe, strlen(o->pickaxe));
+		kwsprep(kws);
+	}
+
+	pickaxe(&diff_queued_diff, o, &regex, kws, diff_grep);
 
 	regfree(&regex);
+	if (kws)
+		kwsfree(kws);
 	return;
 }
 
@@ -171,12 +343,15 @@ static unsigned int contains(mmfile_t *mf, regex_t *regexp, kwset_t kws)
 	return cnt;
 }
 
-static int has_changes(mmfile_t *one, mmfile_t *two,
-		       struct diff_options *o,
-		       regex_t *regexp, kwset_t kws)
+static int has_changes(struct diff_filepair *p, struct diff_options *o,
+		       regex_t *regexp, kwset_t kws,
+		       struct userdiff_driver *textconv_one,
+		       struct userdiff_driver *textconv_two)
 {
-	unsigned int one_contains = one ? contains(one, regexp, kws) : 0;
-	unsigned int two_contains = two ? contains(two, regexp, kws) : 0;
+	unsigned int one_contains = count_side(p->one, textconv_one,
+					       regexp, kws, contains);
+	unsigned int two_contains = count_side(p->two, textconv_two,
+					       regexp, kws, contains);
 	return one_contains != two_contains;
 }
 
@@ -185,8 +360,6 @@ static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
 {
 	struct userdiff_driver *textconv_one = NULL;
 	struct userdiff_driver *textconv_two = NULL;
-	mmfile_t mf1, mf2;
-	int ret;
 
 	if (!o->pickaxe[0])
 		return 0;
@@ -210,21 +383,7 @@ static int pickaxe_match(struct diff_filepair *p, struct diff_options *o,
 	if (textconv_one == textconv_two && diff_unmodified_pair(p))
 		return 0;
 
-	mf1.size = fill_textconv(textconv_one, p->one, &mf1.ptr);
-	mf2.size = fill_textconv(textconv_two, p->two, &mf2.ptr);
-
-	ret = fn(DIFF_FILE_VALID(p->one) ? &mf1 : NULL,
-		 DIFF_FILE_VALID(p->two) ? &mf2 : NULL,
-		 o, regexp, kws);
-
-	if (textconv_one)
-		free(mf1.ptr);
-	if (textconv_two)
-		free(mf2.ptr);
-	diff_free_filespec_data(p->one);
-	diff_free_filespec_data(p->two);
-
-	return ret;
+	return fn(p, o, regexp, kws, textconv_one, textconv_two);
 }
 
 static void diffcore_pickaxe_count(struct diff_options *o)
@@ -264,6 +423,8 @@ static void diffcore_pickaxe_count(struct diff_options *o)
 
 void diffcore_pickaxe(struct diff_options *o)
 {
+	prepare_pickaxe_memo(o);
+
 	/* Might want to warn when both S and G are on; I don't care... */
 	if (o->pickaxe_opts & DIFF_PICKAXE_KIND_G)
 		diffcore_pickaxe_grep(o);
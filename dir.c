@@ -12,12 +12,29 @@
 #include "refs.h"
 #include "wildmatch.h"
 #include "pathspec.h"
+#include "varint.h"
+#include "ewah/ewok.h"
 
 struct path_simplify {
 	int len;
 	const char *path;
 };
 
+/*
+ * A directory being read, either from the file system or, when its
+ * untracked cache entry is still valid, from the untracked cache.
+ */
+struct cached_dir {
+	DIR *fdir;
+	struct untracked_cache_dir *untracked;
+	int nr_files;
+	int nr_dirs;
+
+	struct dirent *de;
+	const char *file;
+	struct untracked_cache_dir *ucd;
+};
+
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
  * Values are ordered by significance, e.g. if a directory contains both
@@ -32,9 +49,10 @@ enum path_treatment {
 };
 
 static enum path_treatment read_directory_recursive(struct dir_struct *dir,
-	const char *path, int len,
+	const char *path, int len, struct untracked_cache_dir *untracked,
 	int check_only, const struct path_simplify *simplify);
 static int get_dtype(struct dirent *de, const char *path, int len);
+static void free_untracked_cache_dir(struct untracked_cache_dir *ucd);
 
 /* helper string functions with support for the ignore_case flag */
 int strcmp_icase(const char *a, const char *b)
@@ -451,7 +469,8 @@ void add_exclude(const char *string, const char *base,
 	x->el = el;
 }
 
-static void *read_skip_worktree_file_from_index(const char *path, size_t *size)
+static void *read_skip_worktree_file_from_index(const char *path, size_t *size,
+						struct sha1_stat *sha1_stat)
 {
 	int pos, len;
 	unsigned long sz;
@@ -470,6 +489,11 @@ static void *read_skip_worktree_file_from_index(const char *path, size_t *size)
 		return NULL;
 	}
 	*size = xsize_t(sz);
+	if (sha1_stat) {
+		memset(&sha1_stat->stat, 0, sizeof(sha1_stat->stat));
+		hashcpy(sha1_stat->sha1, active_cache[pos]->sha1);
+		sha1_stat->valid = 1;
+	}
 	return data;
 }
 
@@ -491,11 +515,21 @@ void clear_exclude_list(struct exclude_list *el)
 	el->filebuf = NULL;
 }
 
-int add_excludes_from_file_to_list(const char *fname,
-				   const char *base,
-				   int baselen,
-				   struct exclude_list *el,
-				   int check_index)
+/*
+ * Given a file with name "fname", read it (either from disk, or from
+ * the index if "check_index" is non-zero), parse it and store the
+ * exclude rules in "el".
+ *
+ * If "sha1_stat" is not NULL, compute SHA-1 of the exclude file and
+ * stat data from disk (only valid if add_excludes returns zero). If
+ * the file does not exist, its SHA-1 is left null.
+ */
+static int add_excludes(const char *fname,
+			const char *base,
+			int baselen,
+			struct exclude_list *el,
+			int check_index,
+			struct sha1_stat *sha1_stat)
 {
 	struct stat st;
 	int fd, i, lineno = 1;
@@ -509,7 +543,8 @@ int add_excludes_from_file_to_list(const char *fname,
 		if (0 <= fd)
 			close(fd);
 		if (!check_index ||
-		    (buf = read_skip_worktree_file_from_index(fname, &size)) == NULL)
+		    (buf = read_skip_worktree_file_from_index(fname, &size,
+							      sha1_stat)) == NULL)
 			return -1;
 		if (size == 0) {
 			free(buf);
@@ -523,6 +558,11 @@ int add_excludes_from_file_to_list(const char *fname,
 	else {
 		size = xsize_t(st.st_size);
 		if (size == 0) {
+			if (sha1_stat) {
+				fill_stat_data(&sha1_stat->stat, &st);
+				hashcpy(sha1_stat->sha1, EMPTY_BLOB_SHA1_BIN);
+				sha1_stat->valid = 1;
+			}
 			close(fd);
 			return 0;
 		}
@@ -532,6 +572,11 @@ int add_excludes_from_file_to_list(const char *fname,
 			close(fd);
 			return -1;
 		}
+		if (sha1_stat) {
+			fill_stat_data(&sha1_stat->stat, &st);
+			hash_sha1_file(buf, size, "blob", sha1_stat->sha1);
+			sha1_stat->valid = 1;
+		}
 		buf[size++] = '\n';
 		close(fd);
 	}
@@ -551,6 +596,15 @@ int add_excludes_from_file_to_list(const char *fname,
 	return 0;
 }
 
+int add_excludes_from_file_to_list(const char *fname,
+				   const char *base,
+				   int baselen,
+				   struct exclude_list *el,
+				   int check_index)
+{
+	return add_excludes(fname, base, baselen, el, check_index, NULL);
+}
+
 struct exclude_list *add_exclude_list(struct dir_struct *dir,
 				      int group_type, const char *src)
 {
@@ -568,14 +622,22 @@ struct exclude_list *add_exclude_list(struct dir_struct *dir,
 /*
  * Used to set up core.excludesfile and .git/info/exclude lists.
  */
-void add_excludes_from_file(struct dir_struct *dir, const char *fname)
+static void add_excludes_from_file_1(struct dir_struct *dir, const char *fname,
+				     struct sha1_stat *sha1_stat)
 {
 	struct exclude_list *el;
 	el = add_exclude_list(dir, EXC_FILE, fname);
-	if (add_excludes_from_file_to_list(fname, "", 0, el, 0) < 0)
+	if (add_excludes(fname, "", 0, el, 0, sha1_stat) < 0)
 		die("cannot use %s as an exclude file", fname);
 }
 
+void add_excludes_from_file(struct dir_struct *dir, const char *fname)
+{
+	/* the untracked cache does not know about this file */
+	dir->unmanaged_exclude_files++;
+	add_excludes_from_file_1(dir, fname, NULL);
+}
+
 int match_basename(const char *basename, int basenamelen,
 		   const char *pattern, int prefix, int patternlen,
 		   int flags)
@@ -741,6 +803,105 @@ static struct exclude *last_exclude_matching_from_lists(struct dir_struct *dir,
 	return NULL;
 }
 
+/*
+ * Find the subdirectory "name" (of length "len", a trailing slash
+ * is ignored) of "dir" in the untracked cache, creating it if needed.
+ */
+static struct untracked_cache_dir *lookup_untracked(struct untracked_cache *uc,
+						    struct untracked_cache_dir *dir,
+						    const char *name, int len)
+{
+	int first, last;
+	struct untracked_cache_dir *d;
+
+	if (!dir)
+		return NULL;
+	if (len && name[len - 1] == '/')
+		len--;
+	first = 0;
+	last = dir->dirs_nr;
+	while (last > first) {
+		int cmp, next = (last + first) >> 1;
+		d = dir->dirs[next];
+		cmp = strncmp(name, d->name, len);
+		if (!cmp && strlen(d->name) > len)
+			cmp = -1;
+		if (!cmp)
+			return d;
+		if (cmp < 0) {
+			last = next;
+			continue;
+		}
+		first = next+1;
+	}
+
+	uc->dir_created++;
+	d = xcalloc(1, sizeof(*d) + len + 1);
+	memcpy(d->name, name, len);
+	d->name[len] = '\0';
+
+	ALLOC_GROW(dir->dirs, dir->dirs_nr + 1, dir->dirs_alloc);
+	memmove(dir->dirs + first + 1, dir->dirs + first,
+		(dir->dirs_nr - first) * sizeof(*dir->dirs));
+	dir->dirs_nr++;
+	dir->dirs[first] = d;
+	return d;
+}
+
+static void clear_untracked(struct untracked_cache_dir *dir)
+{
+	int i;
+
+	for (i = 0; i < dir->untracked_nr; i++)
+		free(dir->untracked[i]);
+	dir->untracked_nr = 0;
+}
+
+static void add_untracked(struct untracked_cache_dir *dir, const char *name)
+{
+	if (!dir)
+		return;
+	ALLOC_GROW(dir->untracked, dir->untracked_nr + 1,
+		   dir->untracked_alloc);
+	dir->untracked[dir->untracked_nr++] = xstrdup(name);
+}
+
+static void invalidate_one_directory(struct untracked_cache *uc,
+				     struct untracked_cache_dir *dir)
+{
+	uc->dir_invalidated++;
+	dir->valid = 0;
+	clear_untracked(dir);
+}
+
+/*
+ * The exclude rules that apply to "dir" changed: none of the cached
+ * results in it, or below it, can be trusted anymore.
+ */
+static void invalidate_gitignore(struct untracked_cache *uc,
+				 struct untracked_cache_dir *dir)
+{
+	int i;
+
+	uc->gitignore_invalidated++;
+	for (i = 0; i < dir->dirs_nr; i++)
+		invalidate_gitignore(uc, dir->dirs[i]);
+	invalidate_one_directory(uc, dir);
+}
+
+/* The list of entries of "dir" changed. */
+static void invalidate_directory(struct untracked_cache *uc,
+				 struct untracked_cache_dir *dir)
+{
+	int i;
+
+	uc->dir_invalidated++;
+	dir->valid = 0;
+	clear_untracked(dir);
+	for (i = 0; i < dir->dirs_nr; i++)
+		dir->dirs[i]->recurse = 0;
+}
+
 /*
  * Loads the per-directory exclude list for the substring of base
  * which has a char length of baselen.
@@ -750,6 +911,7 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 	struct exclude_list_group *group;
 	struct exclude_list *el;
 	struct exclude_stack *stk = NULL;
+	struct untracked_cache_dir *untracked;
 	int current;
 
 	group = &dir->exclude_list_group[EXC_DIRS];
@@ -776,6 +938,7 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 
 	/* Read from the parent directories and push them down. */
 	current = stk ? stk->baselen : -1;
+	untracked = stk ? stk->ucd : NULL;
 	while (current < baselen) {
 		struct exclude_stack *stk = xcalloc(1, sizeof(*stk));
 		const char *cp;
@@ -783,16 +946,23 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 		if (current < 0) {
 			cp = base;
 			current = 0;
+			if (dir->untracked)
+				untracked = dir->untracked->root;
 		}
 		else {
 			cp = strchr(base + current + 1, '/');
 			if (!cp)
 				die("oops in prep_exclude");
 			cp++;
+			untracked =
+				lookup_untracked(dir->untracked, untracked,
+						 base + current,
+						 cp - base - current);
 		}
 		stk->prev = dir->exclude_stack;
 		stk->baselen = cp - base;
 		stk->exclude_ix = group->nr;
+		stk->ucd = untracked;
 		el = add_exclude_list(dir, EXC_DIRS, NULL);
 		memcpy(dir->basebuf + current, base + current,
 		       stk->baselen - current);
@@ -818,6 +988,8 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 		/* Try to read per-directory file unless path is too long */
 		if (dir->exclude_per_dir &&
 		    stk->baselen + strlen(dir->exclude_per_dir) < PATH_MAX) {
+			struct sha1_stat sha1_stat;
+
 			strcpy(dir->basebuf + stk->baselen,
 					dir->exclude_per_dir);
 			/*
@@ -829,8 +1001,20 @@ static void prep_exclude(struct dir_struct *dir, const char *base, int baselen)
 			 * strdup() and free() here in the caller.
 			 */
 			el->src = strdup(dir->basebuf);
-			add_excludes_from_file_to_list(dir->basebuf,
-					dir->basebuf, stk->baselen, el, 1);
+			memset(&sha1_stat, 0, sizeof(sha1_stat));
+			add_excludes(dir->basebuf, dir->basebuf, stk->baselen,
+				     el, 1, untracked ? &sha1_stat : NULL);
+
+			/*
+			 * A changed (or added, or removed) exclude file
+			 * invalidates what we know of this directory and
+			 * everything below it.
+			 */
+			if (untracked &&
+			    hashcmp(sha1_stat.sha1, untracked->exclude_sha1)) {
+				invalidate_gitignore(dir->untracked, untracked);
+				hashcpy(untracked->exclude_sha1, sha1_stat.sha1);
+			}
 		}
 		dir->exclude_stack = stk;
 		current = stk->baselen;
@@ -1011,7 +1195,8 @@ static enum exist_status directory_exists_in_index(const char *dirname, int len)
  *  (c) otherwise, we recurse into it.
  */
 static enum path_treatment treat_directory(struct dir_struct *dir,
-	const char *dirname, int len, int exclude,
+	struct untracked_cache_dir *untracked,
+	const char *dirname, int len, int baselen, int exclude,
 	const struct path_simplify *simplify)
 {
 	/* The "len-1" is to strip the final '/' */
@@ -1038,7 +1223,10 @@ static enum path_treatment treat_directory(struct dir_struct *dir,
 	if (!(dir->flags & DIR_HIDE_EMPTY_DIRECTORIES))
 		return exclude ? path_excluded : path_untracked;
 
-	return read_directory_recursive(dir, dirname, len, 1, simplify);
+	untracked = lookup_untracked(dir->untracked, untracked,
+				     dirname + baselen, len - baselen);
+	return read_directory_recursive(dir, dirname, len,
+					untracked, 1, simplify);
 }
 
 /*
@@ -1154,7 +1342,9 @@ static int get_dtype(struct dirent *de, const char *path, int len)
 }
 
 static enum path_treatment treat_one_path(struct dir_struct *dir,
+					  struct untracked_cache_dir *untracked,
 					  struct strbuf *path,
+					  int baselen,
 					  const struct path_simplify *simplify,
 					  int dtype, struct dirent *de)
 {
@@ -1206,22 +1396,65 @@ static enum path_treatment treat_one_path(struct dir_struct *dir,
 		return path_none;
 	case DT_DIR:
 		strbuf_addch(path, '/');
-		return treat_directory(dir, path->buf, path->len, exclude,
-			simplify);
+		return treat_directory(dir, untracked, path->buf, path->len,
+				       baselen, exclude, simplify);
 	case DT_REG:
 	case DT_LNK:
 		return exclude ? path_excluded : path_untracked;
 	}
 }
 
+/*
+ * An entry replayed from the untracked cache: either an untracked
+ * file (or directory, shown as a whole), or a subdirectory to look
+ * into again.
+ */
+static enum path_treatment treat_path_fast(struct dir_struct *dir,
+					   struct untracked_cache_dir *untracked,
+					   struct cached_dir *cdir,
+					   struct strbuf *path,
+					   int baselen,
+					   const struct path_simplify *simplify)
+{
+	strbuf_setlen(path, baselen);
+	if (!cdir->ucd) {
+		strbuf_addstr(path, cdir->file);
+		return path_untracked;
+	}
+	strbuf_addstr(path, cdir->ucd->name);
+	/* treat_one_path() does this before it calls treat_directory() */
+	if (path->buf[path->len - 1] != '/')
+		strbuf_addch(path, '/');
+	if (cdir->ucd->check_only)
+		/*
+		 * check_only is set as a result of treat_directory() getting
+		 * to its bottom. Verify again the same set of directories
+		 * with check_only set.
+		 */
+		return read_directory_recursive(dir, path->buf, path->len,
+						cdir->ucd, 1, simplify);
+	/*
+	 * We get path_recurse in the first run when
+	 * directory_exists_in_index() returns index_nonexistent. We
+	 * are sure that new changes in the index does not impact the
+	 * outcome. Return now.
+	 */
+	return path_recurse;
+}
+
 static enum path_treatment treat_path(struct dir_struct *dir,
-				      struct dirent *de,
+				      struct untracked_cache_dir *untracked,
+				      struct cached_dir *cdir,
 				      struct strbuf *path,
 				      int baselen,
 				      const struct path_simplify *simplify)
 {
 	int dtype;
+	struct dirent *de = cdir->de;
 
+	if (!de)
+		return treat_path_fast(dir, untracked, cdir, path,
+				       baselen, simplify);
 	if (is_dot_or_dotdot(de->d_name) || !strcmp(de->d_name, ".git"))
 		return path_none;
 	strbuf_setlen(path, baselen);
@@ -1230,7 +1463,163 @@ static enum path_treatment treat_path(struct dir_struct *dir,
 		return path_none;
 
 	dtype = DTYPE(de);
-	return treat_one_path(dir, path, simplify, dtype, de);
+	return treat_one_path(dir, untracked, path, baselen, simplify, dtype, de);
+}
+
+/*
+ * Like is_racy_timestamp() for index entries: a directory modified in
+ * the same second the index was written may have changed again since,
+ * without its mtime telling.
+ */
+static int is_racy_stat_data(const struct stat_data *sd)
+{
+	return the_index.timestamp.sec &&
+#ifdef USE_NSEC
+		(the_index.timestamp.sec < sd->sd_mtime.sec ||
+		 (the_index.timestamp.sec == sd->sd_mtime.sec &&
+		  the_index.timestamp.nsec <= sd->sd_mtime.nsec));
+#else
+		the_index.timestamp.sec <= sd->sd_mtime.sec;
+#endif
+}
+
+/*
+ * Can we answer for the directory "path" from the untracked cache?
+ * Its list of entries must not have changed (its stat data are the
+ * same), nor the exclude rules that apply to it.
+ */
+static int valid_cached_dir(struct dir_struct *dir,
+			    struct untracked_cache_dir *untracked,
+			    struct strbuf *path,
+			    int check_only)
+{
+	struct stat st;
+
+	if (!untracked)
+		return 0;
+
+	if (stat(path->len ? path->buf : ".", &st)) {
+		invalidate_directory(dir->untracked, untracked);
+		memset(&untracked->stat_data, 0, sizeof(untracked->stat_data));
+		return 0;
+	}
+	if (!untracked->valid ||
+	    match_stat_data(&untracked->stat_data, &st) ||
+	    is_racy_stat_data(&untracked->stat_data)) {
+		if (untracked->valid)
+			invalidate_directory(dir->untracked, untracked);
+		fill_stat_data(&untracked->stat_data, &st);
+		return 0;
+	}
+
+	if (untracked->check_only != !!check_only) {
+		invalidate_directory(dir->untracked, untracked);
+		return 0;
+	}
+
+	/*
+	 * prep_exclude will be called eventually on this directory,
+	 * but it's called much later in last_exclude_matching(). We
+	 * need it now to determine the validity of the cache for this
+	 * path. The next calls will be nearly no-op, the way
+	 * prep_exclude() is designed.
+	 */
+	if (path->len && path->buf[path->len - 1] != '/') {
+		strbuf_addch(path, '/');
+		prep_exclude(dir, path->buf, path->len);
+		strbuf_setlen(path, path->len - 1);
+	} else
+		prep_exclude(dir, path->buf, path->len);
+
+	/* hopefully prep_exclude() haven't invalidated this entry... */
+	return untracked->valid;
+}
+
+static int open_cached_dir(struct cached_dir *cdir,
+			   struct dir_struct *dir,
+			   struct untracked_cache_dir *untracked,
+			   struct strbuf *path,
+			   int check_only)
+{
+	int i;
+
+	memset(cdir, 0, sizeof(*cdir));
+	cdir->untracked = untracked;
+	if (valid_cached_dir(dir, untracked, path, check_only))
+		return 0;
+	cdir->fdir = opendir(path->len ? path->buf : ".");
+	if (!cdir->fdir)
+		return -1;
+	if (untracked) {
+		/* start over; the scan below records what it finds */
+		dir->untracked->dir_opened++;
+		clear_untracked(untracked);
+		for (i = 0; i < untracked->dirs_nr; i++)
+			untracked->dirs[i]->recurse = 0;
+	}
+	return 0;
+}
+
+static int read_cached_dir(struct cached_dir *cdir)
+{
+	if (cdir->fdir) {
+		cdir->de = readdir(cdir->fdir);
+		if (!cdir->de)
+			return -1;
+		return 0;
+	}
+	while (cdir->nr_dirs < cdir->untracked->dirs_nr) {
+		struct untracked_cache_dir *d =
+			cdir->untracked->dirs[cdir->nr_dirs];
+		cdir->nr_dirs++;
+		if (!d->recurse)
+			continue;
+		cdir->ucd = d;
+		return 0;
+	}
+	cdir->ucd = NULL;
+	if (cdir->nr_files < cdir->untracked->untracked_nr) {
+		struct untracked_cache_dir *d = cdir->untracked;
+		cdir->file = d->untracked[cdir->nr_files++];
+		return 0;
+	}
+	return -1;
+}
+
+static void close_cached_dir(struct cached_dir *cdir)
+{
+	if (cdir->fdir)
+		closedir(cdir->fdir);
+	/*
+	 * We have gone through this directory and found no untracked
+	 * entries. Mark it valid.
+	 */
+	if (cdir->untracked) {
+		cdir->untracked->valid = 1;
+		cdir->untracked->recurse = 1;
+	}
+}
+
+/*
+ * Is "path" (relative to its parent directory "untracked") a
+ * subdirectory that the untracked cache looks into on its own?  Then
+ * it must not also be recorded as an untracked entry of its parent.
+ */
+static int is_cached_subdir(struct untracked_cache_dir *untracked,
+			    const char *name, int len)
+{
+	int i;
+
+	if (!untracked || !len || name[len - 1] != '/')
+		return 0;
+	len--;
+	for (i = 0; i < untracked->dirs_nr; i++) {
+		struct untracked_cache_dir *d = untracked->dirs[i];
+		if (d->recurse && d->check_only &&
+		    !strncmp(d->name, name, len) && !d->name[len])
+			return 1;
+	}
+	return 0;
 }
 
 /*
@@ -1242,42 +1631,57 @@ static enum path_treatment treat_path(struct dir_struct *dir,
  * Also, we ignore the name ".git" (even if it is not a directory).
  * That likely will not change.
  *
+ * If "untracked" is not NULL, the directory is read from, or its
+ * untracked entries recorded in, the untracked cache.
+ *
  * Returns the most significant path_treatment value encountered in the scan.
  */
 static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 				    const char *base, int baselen,
+				    struct untracked_cache_dir *untracked,
 				    int check_only,
 				    const struct path_simplify *simplify)
 {
-	DIR *fdir;
+	struct cached_dir cdir;
 	enum path_treatment state, subdir_state, dir_state = path_none;
-	struct dirent *de;
 	struct strbuf path = STRBUF_INIT;
 
 	strbuf_add(&path, base, baselen);
 
-	fdir = opendir(path.len ? path.buf : ".");
-	if (!fdir)
+	if (open_cached_dir(&cdir, dir, untracked, &path, check_only))
 		goto out;
 
-	while ((de = readdir(fdir)) != NULL) {
+	if (untracked)
+		untracked->check_only = !!check_only;
+
+	while (!read_cached_dir(&cdir)) {
 		/* check how the file or directory should be treated */
-		state = treat_path(dir, de, &path, baselen, simplify);
+		state = treat_path(dir, untracked, &cdir, &path, baselen, simplify);
 		if (state > dir_state)
 			dir_state = state;
 
 		/* recurse into subdir if instructed by treat_path */
 		if (state == path_recurse) {
-			subdir_state = read_directory_recursive(dir, path.buf,
-				path.len, check_only, simplify);
+			struct untracked_cache_dir *ud;
+			ud = lookup_untracked(dir->untracked, untracked,
+					      path.buf + baselen,
+					      path.len - baselen);
+			subdir_state =
+				read_directory_recursive(dir, path.buf, path.len,
+							 ud, check_only, simplify);
 			if (subdir_state > dir_state)
 				dir_state = subdir_state;
 		}
 
 		if (check_only) {
 			/* abort early if maximum state has been reached */
-			if (dir_state == path_untracked)
+			if (dir_state == path_untracked) {
+				if (cdir.fdir &&
+				    !is_cached_subdir(untracked, path.buf + baselen,
+						      path.len - baselen))
+					add_untracked(untracked, path.buf + baselen);
 				break;
+			}
 			/* skip the dir_add_* part */
 			continue;
 		}
@@ -1295,15 +1699,20 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 			break;
 
 		case path_untracked:
-			if (!(dir->flags & DIR_SHOW_IGNORED))
-				dir_add_name(dir, path.buf, path.len);
+			if (dir->flags & DIR_SHOW_IGNORED)
+				break;
+			dir_add_name(dir, path.buf, path.len);
+			if (cdir.fdir &&
+			    !is_cached_subdir(untracked, path.buf + baselen,
+					      path.len - baselen))
+				add_untracked(untracked, path.buf + baselen);
 			break;
 
 		default:
 			break;
 		}
 	}
-	closedir(fdir);
+	close_cached_dir(&cdir);
  out:
 	strbuf_release(&path);
 
@@ -1377,7 +1786,7 @@ static int treat_leading_path(struct dir_struct *dir,
 			break;
 		if (simplify_away(sb.buf, sb.len, simplify))
 			break;
-		if (treat_one_path(dir, &sb, simplify,
+		if (treat_one_path(dir, NULL, &sb, baselen, simplify,
 				   DT_DIR, NULL) == path_none)
 			break; /* do not recurse into it */
 		if (len <= baselen) {
@@ -1390,9 +1799,105 @@ static int treat_leading_path(struct dir_struct *dir,
 	return rc;
 }
 
+static const char *untracked_cache_ident(void)
+{
+	static struct strbuf ident = STRBUF_INIT;
+
+	if (!ident.len) {
+		const char *worktree = get_git_work_tree();
+		strbuf_addf(&ident, "Location %s", worktree ? worktree : "");
+	}
+	return ident.buf;
+}
+
+/*
+ * Can the untracked cache answer this read_directory() call?  If so,
+ * return the root of the cache, after dropping what the current
+ * global exclude files make obsolete.
+ */
+static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *dir,
+						      int base_len,
+						      const struct pathspec *pathspec)
+{
+	struct untracked_cache *uc = dir->untracked;
+	struct untracked_cache_dir *root;
+
+	if (!uc || getenv("GIT_DISABLE_UNTRACKED_CACHE"))
+		return NULL;
+
+	/*
+	 * We only support $GIT_DIR/info/exclude and core.excludesfile
+	 * as the global ignore rule files. Any other additions
+	 * (e.g. from command line) invalidate the cache.
+	 */
+	if (dir->unmanaged_exclude_files ||
+	    dir->exclude_list_group[EXC_CMDL].nr)
+		return NULL;
+
+	/*
+	 * Optimize for the main use case only: whole-tree git
+	 * status. More work involved in treat_leading_path() if we
+	 * use cache on just a subset of the worktree. pathspec
+	 * support could make the matter even worse.
+	 */
+	if (base_len || (pathspec && pathspec->nr))
+		return NULL;
+
+	/* Different set of flags may produce different results */
+	if (dir->flags != uc->dir_flags ||
+	    /*
+	     * See treat_directory(), case index_nonexistent. Without
+	     * this flag, we may need to also cache .git file content
+	     * for the resolve_gitlink_ref() call, which we don't.
+	     */
+	    !(dir->flags & DIR_SHOW_OTHER_DIRECTORIES) ||
+	    /* We don't support collecting ignore files */
+	    (dir->flags & (DIR_SHOW_IGNORED | DIR_SHOW_IGNORED_TOO |
+			   DIR_COLLECT_IGNORED)))
+		return NULL;
+
+	/*
+	 * If we use .gitignore in the cache and now you change it to
+	 * .gitexclude, everything will go wrong.
+	 */
+	if (!dir->exclude_per_dir ||
+	    strcmp(dir->exclude_per_dir, uc->exclude_per_dir))
+		return NULL;
+
+	/* The stat data are meaningless for another work tree */
+	if (strcmp(uc->ident.buf, untracked_cache_ident())) {
+		free_untracked_cache_dir(uc->root);
+		uc->root = NULL;
+		strbuf_reset(&uc->ident);
+		strbuf_addstr(&uc->ident, untracked_cache_ident());
+		uc->dir_invalidated++;
+	}
+
+	if (!uc->root) {
+		uc->root = xcalloc(1, sizeof(*uc->root) + 1);
+		uc->dir_created++;
+	}
+
+	/* Validate $GIT_DIR/info/exclude and core.excludesfile */
+	root = uc->root;
+	if (hashcmp(dir->ss_info_exclude.sha1, uc->ss_info_exclude.sha1)) {
+		invalidate_gitignore(uc, root);
+		uc->ss_info_exclude = dir->ss_info_exclude;
+	}
+	if (hashcmp(dir->ss_excludes_file.sha1, uc->ss_excludes_file.sha1)) {
+		invalidate_gitignore(uc, root);
+		uc->ss_excludes_file = dir->ss_excludes_file;
+	}
+
+	/* Make sure this directory is not dropped out at saving phase */
+	root->recurse = 1;
+	return root;
+}
+
 int read_directory(struct dir_struct *dir, const char *path, int len, const struct pathspec *pathspec)
 {
 	struct path_simplify *simplify;
+	struct untracked_cache_dir *untracked;
 
 	/*
 	 * Check out create_simplify()
@@ -1416,11 +1921,35 @@ int read_directory(struct dir_struct *dir, const char *path, int len, const stru
 	 * create_simplify().
 	 */
 	simplify = create_simplify(pathspec ? pathspec->_raw : NULL);
+	untracked = validate_untracked_cache(dir, len, pathspec);
+	if (!untracked)
+		/*
+		 * make sure untracked cache code path is disabled,
+		 * e.g. prep_exclude()
+		 */
+		dir->untracked = NULL;
 	if (!len || treat_leading_path(dir, path, len, simplify))
-		read_directory_recursive(dir, path, len, 0, simplify);
+		read_directory_recursive(dir, path, len, untracked, 0, simplify);
 	free_simplify(simplify);
 	qsort(dir->entries, dir->nr, sizeof(struct dir_entry *), cmp_name);
 	qsort(dir->ignored, dir->ignored_nr, sizeof(struct dir_entry *), cmp_name);
+	if (dir->untracked) {
+		struct untracked_cache *uc = dir->untracked;
+		trace_printf_key("GIT_TRACE_UNTRACKED_STATS",
+				 "node creation: %u\n"
+				 "gitignore invalidation: %u\n"
+				 "directory invalidation: %u\n"
+				 "opendir: %u\n",
+				 uc->dir_created, uc->gitignore_invalidated,
+				 uc->dir_invalidated, uc->dir_opened);
+		if (uc->dir_created || uc->gitignore_invalidated ||
+		    uc->dir_invalidated || uc->dir_opened)
+			the_index.cache_changed = 1;
+		uc->dir_created = 0;
+		uc->gitignore_invalidated = 0;
+		uc->dir_invalidated = 0;
+		uc->dir_opened = 0;
+	}
 	return dir->nr;
 }
 
@@ -1584,9 +2113,10 @@ void setup_standard_excludes(struct dir_struct *dir)
 		excludes_file = xdg_path;
 	}
 	if (!access_or_warn(path, R_OK, 0))
-		add_excludes_from_file(dir, path);
+		add_excludes_from_file_1(dir, path, &dir->ss_info_exclude);
 	if (excludes_file && !access_or_warn(excludes_file, R_OK, 0))
-		add_excludes_from_file(dir, excludes_file);
+		add_excludes_from_file_1(dir, excludes_file,
+					 &dir->ss_excludes_file);
 }
 
 int remove_path(const char *name)
@@ -1637,3 +2167,312 @@ void clear_directory(struct dir_struct *dir)
 		stk = prev;
 	}
 }
+
+static void free_untracked_cache_dir(struct untracked_cache_dir *ucd)
+{
+	int i;
+
+	if (!ucd)
+		return;
+	for (i = 0; i < ucd->dirs_nr; i++)
+		free_untracked_cache_dir(ucd->dirs[i]);
+	clear_untracked(ucd);
+	free(ucd->untracked);
+	free(ucd->dirs);
+	free(ucd);
+}
+
+void free_untracked_cache(struct untracked_cache *uc)
+{
+	if (!uc)
+		return;
+	free_untracked_cache_dir(uc->root);
+	strbuf_release(&uc->ident);
+	free((char *)uc->exclude_per_dir);
+	free(uc);
+}
+
+static struct untracked_cache *new_untracked_cache(void)
+{
+	struct untracked_cache *uc = xcalloc(1, sizeof(*uc));
+
+	strbuf_init(&uc->ident, 100);
+	strbuf_addstr(&uc->ident, untracked_cache_ident());
+	uc->exclude_per_dir = xstrdup(".gitignore");
+	/* the flags "git status" uses by default */
+	uc->dir_flags = DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES;
+	return uc;
+}
+
+void add_untracked_cache(struct index_state *istate)
+{
+	if (istate->untracked)
+		return;
+	istate->untracked = new_untracked_cache();
+	istate->cache_changed = 1;
+}
+
+void remove_untracked_cache(struct index_state *istate)
+{
+	if (!istate->untracked)
+		return;
+	free_untracked_cache(istate->untracked);
+	istate->untracked = NULL;
+	istate->cache_changed = 1;
+}
+
+static int invalidate_one_component(struct untracked_cache *uc,
+				    struct untracked_cache_dir *dir,
+				    const char *path, int len)
+{
+	const char *rest = memchr(path, '/', len);
+
+	if (rest) {
+		int component_len = rest - path;
+		struct untracked_cache_dir *d =
+			lookup_untracked(uc, dir, path, component_len);
+		int ret =
+			invalidate_one_component(uc, d, rest + 1,
+						 len - (component_len + 1));
+		if (ret)
+			invalidate_one_directory(uc, dir);
+		return ret;
+	}
+
+	invalidate_one_directory(uc, dir);
+	/*
+	 * An untracked directory is listed as a whole in its parent,
+	 * which needs another look as well.
+	 */
+	return uc->dir_flags & DIR_SHOW_OTHER_DIRECTORIES;
+}
+
+void untracked_cache_invalidate_path(struct index_state *istate,
+				     const char *path)
+{
+	if (!istate->untracked || !istate->untracked->root)
+		return;
+	invalidate_one_component(istate->untracked, istate->untracked->root,
+				 path, strlen(path));
+}
+
+/*
+ * The stat data are stored like those of an index entry, as nine
+ * 32-bit network byte order values.
+ */
+#define ONDISK_STAT_DATA_SIZE (9 * 4)
+
+static void stat_data_to_disk(struct strbuf *out, const struct stat_data *sd)
+{
+	unsigned char buf[ONDISK_STAT_DATA_SIZE];
+
+	put_be32(buf, sd->sd_ctime.sec);
+	put_be32(buf + 4, sd->sd_ctime.nsec);
+	put_be32(buf + 8, sd->sd_mtime.sec);
+	put_be32(buf + 12, sd->sd_mtime.nsec);
+	put_be32(buf + 16, sd->sd_dev);
+	put_be32(buf + 20, sd->sd_ino);
+	put_be32(buf + 24, sd->sd_uid);
+	put_be32(buf + 28, sd->sd_gid);
+	put_be32(buf + 32, sd->sd_size);
+	strbuf_add(out, buf, sizeof(buf));
+}
+
+static void stat_data_from_disk(struct stat_data *sd, const unsigned char *buf)
+{
+	sd->sd_ctime.sec = get_be32(buf);
+	sd->sd_ctime.nsec = get_be32(buf + 4);
+	sd->sd_mtime.sec = get_be32(buf + 8);
+	sd->sd_mtime.nsec = get_be32(buf + 12);
+	sd->sd_dev = get_be32(buf + 16);
+	sd->sd_ino = get_be32(buf + 20);
+	sd->sd_uid = get_be32(buf + 24);
+	sd->sd_gid = get_be32(buf + 28);
+	sd->sd_size = get_be32(buf + 32);
+}
+
+static void varint_to_disk(struct strbuf *out, uintmax_t value)
+{
+	unsigned char buf[16];
+
+	strbuf_add(out, buf, encode_varint(value, buf));
+}
+
+#define UCD_VALID      (1<<0)
+#define UCD_CHECK_ONLY (1<<1)
+
+static void write_one_dir(struct strbuf *out, struct untracked_cache_dir *ucd)
+{
+	unsigned int i, dirs_nr = 0;
+	unsigned int untracked_nr = ucd->valid ? ucd->untracked_nr : 0;
+
+	for (i = 0; i < ucd->dirs_nr; i++)
+		if (ucd->dirs[i]->recurse)
+			dirs_nr++;
+
+	varint_to_disk(out, untracked_nr);
+	varint_to_disk(out, dirs_nr);
+	strbuf_addch(out, (ucd->valid ? UCD_VALID : 0) |
+			  (ucd->check_only ? UCD_CHECK_ONLY : 0));
+	strbuf_add(out, ucd->name, strlen(ucd->name) + 1);
+	stat_data_to_disk(out, &ucd->stat_data);
+	strbuf_add(out, ucd->exclude_sha1, 20);
+	for (i = 0; i < untracked_nr; i++)
+		strbuf_add(out, ucd->untracked[i], strlen(ucd->untracked[i]) + 1);
+
+	/* directories not seen in the last scan are gone */
+	for (i = 0; i < ucd->dirs_nr; i++)
+		if (ucd->dirs[i]->recurse)
+			write_one_dir(out, ucd->dirs[i]);
+}
+
+void write_untracked_extension(struct strbuf *out, struct untracked_cache *uc)
+{
+	unsigned char flags[4];
+
+	varint_to_disk(out, uc->ident.len);
+	strbuf_addbuf(out, &uc->ident);
+	stat_data_to_disk(out, &uc->ss_info_exclude.stat);
+	strbuf_add(out, uc->ss_info_exclude.sha1, 20);
+	stat_data_to_disk(out, &uc->ss_excludes_file.stat);
+	strbuf_add(out, uc->ss_excludes_file.sha1, 20);
+	put_be32(flags, uc->dir_flags);
+	strbuf_add(out, flags, sizeof(flags));
+	strbuf_add(out, uc->exclude_per_dir, strlen(uc->exclude_per_dir) + 1);
+	varint_to_disk(out, !!uc->root);
+	if (uc->root)
+		write_one_dir(out, uc->root);
+}
+
+struct read_data {
+	const unsigned char *data;
+	const unsigned char *end;
+};
+
+static const char *read_string(struct read_data *rd)
+{
+	const unsigned char *eos = memchr(rd->data, '\0', rd->end - rd->data);
+	const char *s = (const char *)rd->data;
+
+	if (!eos)
+		return NULL;
+	rd->data = eos + 1;
+	return s;
+}
+
+static int read_varint(struct read_data *rd, uintmax_t *value)
+{
+	const unsigned char *p = rd->data;
+
+	/* make sure decode_varint() finds the last byte before the end */
+	while (p < rd->end && (*p & 0x80))
+		p++;
+	if (p >= rd->end)
+		return -1;
+	*value = decode_varint(&rd->data);
+	return 0;
+}
+
+static int read_sha1_stat(struct read_data *rd, struct sha1_stat *ss)
+{
+	if (rd->end - rd->data < ONDISK_STAT_DATA_SIZE + 20)
+		return -1;
+	stat_data_from_disk(&ss->stat, rd->data);
+	hashcpy(ss->sha1, rd->data + ONDISK_STAT_DATA_SIZE);
+	ss->valid = 1;
+	rd->data += ONDISK_STAT_DATA_SIZE + 20;
+	return 0;
+}
+
+static struct untracked_cache_dir *read_one_dir(struct read_data *rd)
+{
+	struct untracked_cache_dir *ucd;
+	uintmax_t untracked_nr, dirs_nr, i;
+	const char *name;
+	unsigned char flags;
+
+	if (read_varint(rd, &untracked_nr) || read_varint(rd, &dirs_nr) ||
+	    rd->data >= rd->end)
+		return NULL;
+	flags = *rd->data++;
+	name = read_string(rd);
+	if (!name || rd->end - rd->data < ONDISK_STAT_DATA_SIZE + 20 ||
+	    untracked_nr > rd->end - rd->data || dirs_nr > rd->end - rd->data)
+		return NULL;
+
+	ucd = xcalloc(1, sizeof(*ucd) + strlen(name) + 1);
+	strcpy(ucd->name, name);
+	ucd->valid = !!(flags & UCD_VALID);
+	ucd->check_only = !!(flags & UCD_CHECK_ONLY);
+	ucd->recurse = 1;
+	stat_data_from_disk(&ucd->stat_data, rd->data);
+	hashcpy(ucd->exclude_sha1, rd->data + ONDISK_STAT_DATA_SIZE);
+	rd->data += ONDISK_STAT_DATA_SIZE + 20;
+
+	ucd->untracked_alloc = untracked_nr;
+	ucd->untracked = xcalloc(untracked_nr, sizeof(*ucd->untracked));
+	for (i = 0; i < untracked_nr; i++) {
+		const char *file = read_string(rd);
+		if (!file)
+			goto corrupt;
+		ucd->untracked[ucd->untracked_nr++] = xstrdup(file);
+	}
+
+	ucd->dirs_alloc = dirs_nr;
+	ucd->dirs = xcalloc(dirs_nr, sizeof(*ucd->dirs));
+	for (i = 0; i < dirs_nr; i++) {
+		struct untracked_cache_dir *d = read_one_dir(rd);
+		if (!d)
+			goto corrupt;
+		ucd->dirs[ucd->dirs_nr++] = d;
+	}
+	return ucd;
+
+corrupt:
+	free_untracked_cache_dir(ucd);
+	return NULL;
+}
+
+struct untracked_cache *read_untracked_extension(const void *data, unsigned long sz)
+{
+	struct untracked_cache *uc;
+	struct read_data rd;
+	uintmax_t ident_len, has_root;
+	const char *exclude_per_dir;
+
+	rd.data = data;
+	rd.end = rd.data + sz;
+	if (read_varint(&rd, &ident_len) || ident_len > rd.end - rd.data)
+		return NULL;
+
+	uc = xcalloc(1, sizeof(*uc));
+	strbuf_init(&uc->ident, ident_len);
+	strbuf_add(&uc->ident, rd.data, ident_len);
+	rd.data += ident_len;
+
+	if (read_sha1_stat(&rd, &uc->ss_info_exclude) ||
+	    read_sha1_stat(&rd, &uc->ss_excludes_file) ||
+	    rd.end - rd.data < 4)
+		goto corrupt;
+	uc->dir_flags = get_be32(rd.data);
+	rd.data += 4;
+	exclude_per_dir = read_string(&rd);
+	if (!exclude_per_dir)
+		goto corrupt;
+	uc->exclude_per_dir = xstrdup(exclude_per_dir);
+
+	if (read_varint(&rd, &has_root))
+		goto corrupt;
+	if (has_root) {
+		uc->root = read_one_dir(&rd);
+		if (!uc->root)
+			goto corrupt;
+	}
+	if (rd.data != rd.end)
+		goto corrupt;
+	return uc;
+
+corrupt:
+	free_untracked_cache(uc);
+	return NULL;
+}
@@ -64,6 +64,7 @@ struct exclude_stack {
 	struct exclude_stack *prev; /* the struct exclude_stack for the parent directory */
 	int baselen;
 	int exclude_ix; /* index of exclude_list within EXC_DIRS exclude_list_group */
+	struct untracked_cache_dir *ucd;
 };
 
 struct exclude_list_group {
@@ -71,6 +72,78 @@ struct exclude_list_group {
 	struct exclude_list *el;
 };
 
+/*
+ * The stat data and SHA-1 of an exclude file, to tell cheaply whether
+ * it changed.  A null SHA-1 means the file does not exist.
+ */
+struct sha1_stat {
+	struct stat_data stat;
+	unsigned char sha1[20];
+	int valid;
+};
+
+/*
+ * Untracked cache
+ *
+ * The following inputs are sufficient to determine what files in a
+ * directory are excluded:
+ *
+ *  - The list of files and directories of the directory in question
+ *  - The $GIT_DIR/index
+ *  - dir_struct flags
+ *  - The content of $GIT_DIR/info/exclude
+ *  - The content of core.excludesfile
+ *  - The content (or the lack) of .gitignore of all parent directories
+ *    from $GIT_WORK_TREE
+ *  - The check_only flag in read_directory_recursive (for
+ *    DIR_HIDE_EMPTY_DIRECTORIES)
+ *
+ * The first input can be checked using directory mtime.  In many
+ * filesystems, directory mtime (stat_data field) is updated when its
+ * files or direct subdirs are added or removed.
+ *
+ * The second one can be hooked from cache_tree_invalidate_path().
+ * Whenever a file (or a submodule) is added or removed from a
+ * directory, we invalidate that directory.
+ *
+ * The remaining inputs are easy, their SHA-1 could be used to verify
+ * their contents (exclude_sha1[], info_exclude_sha1[] and
+ * excludes_file_sha1[])
+ */
+struct untracked_cache_dir {
+	struct untracked_cache_dir **dirs;
+	char **untracked;
+	struct stat_data stat_data;
+	unsigned int untracked_alloc, dirs_nr, dirs_alloc;
+	unsigned int untracked_nr;
+	unsigned int check_only : 1;
+	/* all data except 'dirs' in this struct are good */
+	unsigned int valid : 1;
+	unsigned int recurse : 1;
+	/* null SHA-1 means this directory does not have .gitignore */
+	unsigned char exclude_sha1[20];
+	char name[FLEX_ARRAY];
+};
+
+struct untracked_cache {
+	struct sha1_stat ss_info_exclude;
+	struct sha1_stat ss_excludes_file;
+	const char *exclude_per_dir;
+	/*
+	 * dir_struct#flags must match dir_flags or the untracked
+	 * cache is ignored.
+	 */
+	unsigned dir_flags;
+	/* the work tree the cache was made for */
+	struct strbuf ident;
+	struct untracked_cache_dir *root;
+	/* Statistics */
+	int dir_created;
+	int gitignore_invalidated;
+	int dir_invalidated;
+	int dir_opened;
+};
+
 struct dir_struct {
 	int nr, alloc;
 	int ignored_nr, ignored_alloc;
@@ -118,6 +191,17 @@ struct dir_struct {
 	struct exclude_stack *exclude_stack;
 	struct exclude *exclude;
 	char basebuf[PATH_MAX];
+
+	/*
+	 * The untracked cache of the index, set by the caller to let
+	 * read_directory() use and update it.  It is only used when
+	 * the traversal is one it can answer; see
+	 * validate_untracked_cache().
+	 */
+	struct untracked_cache *untracked;
+	struct sha1_stat ss_info_exclude;
+	struct sha1_stat ss_excludes_file;
+	unsigned unmanaged_exclude_files;
 };
 
 /*
@@ -193,6 +277,19 @@ extern int remove_dir_recursively(struct strbuf *path, int flag);
 /* tries to remove the path with empty directories along it, ignores ENOENT */
 extern int remove_path(const char *path);
 
+/*
+ * A path was added to or removed from the index: the untracked files
+ * of its directory (and, as untracked directories are listed as a
+ * whole, of its parents) may have changed.
+ */
+extern void untracked_cache_invalidate_path(struct index_state *, const char *);
+
+extern void free_untracked_cache(struct untracked_cache *);
+extern struct untracked_cache *read_untracked_extension(const void *data, unsigned long sz);
+extern void write_untracked_extension(struct strbuf *out, struct untracked_cache *untracked);
+extern void add_untracked_cache(struct index_state *istate);
+extern void remove_untracked_cache(struct index_state *istate);
+
 extern int strcmp_icase(const char *a, const char *b);
 extern int strncmp_icase(const char *a, const char *b, size_t count);
 extern int fnmatch_icase(const char *pattern, const char *string, int flags);
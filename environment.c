@@ -76,6 +76,18 @@ char comment_line_char = '#';
 /* Parallel index stat data preload? */
 int core_preload_index = 0;
 
+/* Read commits from $GIT_OBJECT_DIRECTORY/info/commit-graph? */
+int core_commit_graph = 1;
+
+/* Look up packed objects in $GIT_OBJECT_DIRECTORY/pack/multi-pack-index? */
+int core_multi_pack_index = 1;
+
+/* Write the index as a split index?  (-1: only if it already is one) */
+int core_split_index = -1;
+
+/* Keep an untracked cache in the index?  (-1: leave it as it is) */
+int core_untracked_cache = -1;
+
 /* This is set by setup_git_dir_gently() and/or git_default_config() */
 char *git_work_tree_cfg;
 static char *work_tree;
@@ -0,0 +1,167 @@
+#include "cache.h"
+#include "ewok.h"
+
+#define EWAH_MASK(x) ((eword_t)1 << (x % BITS_IN_EWORD))
+#define EWAH_BLOCK(x) (x / BITS_IN_EWORD)
+
+struct bitmap *bitmap_new(void)
+{
+	struct bitmap *bitmap = xmalloc(sizeof(struct bitmap));
+	bitmap->words = xcalloc(32, sizeof(eword_t));
+	bitmap->word_alloc = 32;
+	return bitmap;
+}
+
+static void bitmap_grow(struct bitmap *self, size_t word_alloc)
+{
+	size_t old_size = self->word_alloc;
+
+	if (word_alloc <= old_size)
+		return;
+	self->word_alloc = alloc_nr(word_alloc);
+	self->words = xrealloc(self->words,
+			       self->word_alloc * sizeof(eword_t));
+	memset(self->words + old_size, 0x0,
+	       (self->word_alloc - old_size) * sizeof(eword_t));
+}
+
+void bitmap_set(struct bitmap *self, size_t pos)
+{
+	size_t block = EWAH_BLOCK(pos);
+
+	bitmap_grow(self, block + 1);
+	self->words[block] |= EWAH_MASK(pos);
+}
+
+void bitmap_clear(struct bitmap *self, size_t pos)
+{
+	size_t block = EWAH_BLOCK(pos);
+
+	if (block < self->word_alloc)
+		self->words[block] &= ~EWAH_MASK(pos);
+}
+
+int bitmap_get(struct bitmap *self, size_t pos)
+{
+	size_t block = EWAH_BLOCK(pos);
+	return block < self->word_alloc &&
+		(self->words[block] & EWAH_MASK(pos)) != 0;
+}
+
+void bitmap_reset(struct bitmap *self)
+{
+	memset(self->words, 0x0, self->word_alloc * sizeof(eword_t));
+}
+
+void bitmap_free(struct bitmap *self)
+{
+	if (!self)
+		return;
+	free(self->words);
+	free(self);
+}
+
+int bitmap_equals(struct bitmap *self, struct bitmap *other)
+{
+	struct bitmap *big, *small;
+	size_t i;
+
+	if (self->word_alloc < other->word_alloc) {
+		small = self;
+		big = other;
+	} else {
+		small = other;
+		big = self;
+	}
+
+	for (i = 0; i < small->word_alloc; ++i) {
+		if (small->words[i] != big->words[i])
+			return 0;
+	}
+	for (; i < big->word_alloc; ++i) {
+		if (big->words[i] != 0)
+			return 0;
+	}
+	return 1;
+}
+
+size_t bitmap_popcount(struct bitmap *self)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < self->word_alloc; ++i)
+		count += ewah_bit_popcount64(self->words[i]);
+	return count;
+}
+
+void bitmap_and_not(struct bitmap *self, struct bitmap *other)
+{
+	const size_t count = (self->word_alloc < other->word_alloc) ?
+		self->word_alloc : other->word_alloc;
+	size_t i;
+
+	for (i = 0; i < count; ++i)
+		self->words[i] &= ~other->words[i];
+}
+
+void bitmap_or(struct bitmap *self, const struct bitmap *other)
+{
+	size_t i;
+
+	bitmap_grow(self, other->word_alloc);
+	for (i = 0; i < other->word_alloc; ++i)
+		self->words[i] |= other->words[i];
+}
+
+void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other)
+{
+	size_t i = 0;
+	struct ewah_iterator it;
+	eword_t word;
+
+	bitmap_grow(self, other->bit_size / BITS_IN_EWORD + 1);
+	ewah_iterator_init(&it, other);
+	while (ewah_iterator_next(&word, &it)) {
+		bitmap_grow(self, i + 1);
+		self->words[i++] |= word;
+	}
+}
+
+struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah)
+{
+	struct bitmap *bitmap = bitmap_new();
+	struct ewah_iterator it;
+	eword_t blowup;
+	size_t i = 0;
+
+	ewah_iterator_init(&it, ewah);
+	while (ewah_iterator_next(&blowup, &it)) {
+		bitmap_grow(bitmap, i + 1);
+		bitmap->words[i++] = blowup;
+	}
+	return bitmap;
+}
+
+struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	size_t i, running_empty_words = 0;
+	size_t used = bitmap->word_alloc;
+
+	/* trailing empty words carry no information */
+	while (used && !bitmap->words[used - 1])
+		used--;
+
+	for (i = 0; i < used; ++i) {
+		if (!bitmap->words[i]) {
+			running_empty_words++;
+			continue;
+		}
+		if (running_empty_words) {
+			ewah_add_empty_words(ewah, 0, running_empty_words);
+			running_empty_words = 0;
+		}
+		ewah_add(ewah, bitmap->words[i]);
+	}
+	return ewah;
+}
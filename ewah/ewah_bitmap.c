@@ -0,0 +1,202 @@
+#include "cache.h"
+#include "ewok.h"
+
+static void buffer_grow(struct ewah_bitmap *self, size_t new_size)
+{
+	if (self->alloc_size >= new_size)
+		return;
+	self->alloc_size = alloc_nr(new_size);
+	if (self->alloc_size < new_size)
+		self->alloc_size = new_size;
+	self->buffer = xrealloc(self->buffer,
+				self->alloc_size * sizeof(eword_t));
+}
+
+static void buffer_push(struct ewah_bitmap *self, eword_t value)
+{
+	buffer_grow(self, self->buffer_size + 1);
+	self->buffer[self->buffer_size++] = value;
+}
+
+static void buffer_push_rlw(struct ewah_bitmap *self, eword_t value)
+{
+	buffer_push(self, value);
+	self->rlw = self->buffer_size - 1;
+}
+
+static void add_empty_words(struct ewah_bitmap *self, int v, size_t number)
+{
+	eword_t *rlw = self->buffer + self->rlw;
+
+	if (!rlw_get_literal_words(rlw) &&
+	    (!rlw_get_running_len(rlw) || rlw_get_run_bit(rlw) == v)) {
+		eword_t run_len = rlw_get_running_len(rlw);
+		eword_t can_add = RLW_LARGEST_RUNNING_COUNT - run_len;
+
+		rlw_set_run_bit(rlw, v);
+		if (number <= can_add) {
+			rlw_set_running_len(rlw, run_len + number);
+			return;
+		}
+		rlw_set_running_len(rlw, RLW_LARGEST_RUNNING_COUNT);
+		number -= can_add;
+	}
+
+	while (number) {
+		eword_t len = number;
+
+		if (len > RLW_LARGEST_RUNNING_COUNT)
+			len = RLW_LARGEST_RUNNING_COUNT;
+		buffer_push_rlw(self, 0);
+		rlw = self->buffer + self->rlw;
+		rlw_set_run_bit(rlw, v);
+		rlw_set_running_len(rlw, len);
+		number -= len;
+	}
+}
+
+void ewah_add_empty_words(struct ewah_bitmap *self, int v, size_t number)
+{
+	if (!number)
+		return;
+	self->bit_size += number * BITS_IN_EWORD;
+	add_empty_words(self, !!v, number);
+}
+
+void ewah_add(struct ewah_bitmap *self, eword_t word)
+{
+	eword_t literals;
+
+	self->bit_size += BITS_IN_EWORD;
+	if (!word) {
+		add_empty_words(self, 0, 1);
+		return;
+	}
+	if (word == (eword_t)(~0ULL)) {
+		add_empty_words(self, 1, 1);
+		return;
+	}
+
+	literals = rlw_get_literal_words(self->buffer + self->rlw);
+	if (literals >= RLW_LARGEST_LITERAL_COUNT) {
+		buffer_push_rlw(self, 0);
+		literals = 0;
+	}
+	buffer_push(self, word);
+	rlw_set_literal_words(self->buffer + self->rlw, literals + 1);
+}
+
+struct ewah_bitmap *ewah_new(void)
+{
+	struct ewah_bitmap *self = xcalloc(1, sizeof(*self));
+	ewah_clear(self);
+	return self;
+}
+
+void ewah_clear(struct ewah_bitmap *self)
+{
+	buffer_grow(self, 32);
+	self->buffer_size = 1;
+	self->buffer[0] = 0;
+	self->rlw = 0;
+	self->bit_size = 0;
+}
+
+void ewah_free(struct ewah_bitmap *self)
+{
+	if (!self)
+		return;
+	free(self->buffer);
+	free(self);
+}
+
+void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent)
+{
+	it->buffer = parent->buffer;
+	it->buffer_size = parent->buffer_size;
+	it->pointer = 0;
+	it->run_len = 0;
+	it->literal_words = 0;
+	it->run_bit = 0;
+}
+
+int ewah_iterator_next(eword_t *word, struct ewah_iterator *it)
+{
+	for (;;) {
+		const eword_t *rlw;
+
+		if (it->run_len) {
+			it->run_len--;
+			*word = it->run_bit ? (eword_t)(~0ULL) : 0;
+			return 1;
+		}
+		if (it->literal_words && it->pointer < it->buffer_size) {
+			it->literal_words--;
+			*word = it->buffer[it->pointer++];
+			return 1;
+		}
+		if (it->pointer >= it->buffer_size)
+			return 0;
+
+		rlw = it->buffer + it->pointer++;
+		it->run_bit = rlw_get_run_bit(rlw);
+		it->run_len = rlw_get_running_len(rlw);
+		it->literal_words = rlw_get_literal_words(rlw);
+	}
+}
+
+void ewah_each_bit(struct ewah_bitmap *self, ewah_callback callback, void *payload)
+{
+	struct ewah_iterator it;
+	eword_t word;
+	size_t pos = 0;
+
+	ewah_iterator_init(&it, self);
+	while (ewah_iterator_next(&word, &it)) {
+		while (word) {
+			int offset = ewah_bit_ctz64(word);
+			callback(pos + offset, payload);
+			word &= word - 1;
+		}
+		pos += BITS_IN_EWORD;
+	}
+}
+
+size_t ewah_popcount(struct ewah_bitmap *self)
+{
+	struct ewah_iterator it;
+	eword_t word;
+	size_t count = 0;
+
+	ewah_iterator_init(&it, self);
+	while (ewah_iterator_next(&word, &it))
+		count += ewah_bit_popcount64(word);
+	return count;
+}
+
+void ewah_xor(struct ewah_bitmap *a, struct ewah_bitmap *b,
+	      struct ewah_bitmap *out)
+{
+	struct ewah_iterator it_a, it_b;
+	eword_t word_a, word_b;
+	int has_a, has_b;
+
+	ewah_clear(out);
+	ewah_iterator_init(&it_a, a);
+	ewah_iterator_init(&it_b, b);
+
+	has_a = ewah_iterator_next(&word_a, &it_a);
+	has_b = ewah_iterator_next(&word_b, &it_b);
+	while (has_a || has_b) {
+		ewah_add(out, (has_a ? word_a : 0) ^ (has_b ? word_b : 0));
+		if (has_a)
+			has_a = ewah_iterator_next(&word_a, &it_a);
+		if (has_b)
+			has_b = ewah_iterator_next(&word_b, &it_b);
+	}
+
+	if (out->bit_size < a->bit_size)
+		out->bit_size = a->bit_size;
+	if (out->bit_size < b->bit_size)
+		out->bit_size = b->bit_size;
+}
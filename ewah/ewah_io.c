@@ -0,0 +1,76 @@
+#include "cache.h"
+#include "ewok.h"
+
+size_t ewah_serialize_size(struct ewah_bitmap *self)
+{
+	return 4 + 4 + self->buffer_size * sizeof(eword_t) + 4;
+}
+
+void ewah_serialize_strbuf(struct ewah_bitmap *self, struct strbuf *out)
+{
+	uint32_t bitsize, word_count, rlw_pos;
+	size_t i;
+
+	bitsize = htonl((uint32_t)self->bit_size);
+	strbuf_add(out, &bitsize, 4);
+
+	word_count = htonl((uint32_t)self->buffer_size);
+	strbuf_add(out, &word_count, 4);
+
+	for (i = 0; i < self->buffer_size; i++) {
+		uint64_t word = htonll(self->buffer[i]);
+		strbuf_add(out, &word, 8);
+	}
+
+	rlw_pos = htonl((uint32_t)self->rlw);
+	strbuf_add(out, &rlw_pos, 4);
+}
+
+int ewah_serialize(struct ewah_bitmap *self, int fd)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int ret;
+
+	ewah_serialize_strbuf(self, &buf);
+	ret = write_in_full(fd, buf.buf, buf.len) == buf.len ? 0 : -1;
+	strbuf_release(&buf);
+	return ret;
+}
+
+ssize_t ewah_read_mmap(struct ewah_bitmap *self, const void *map, size_t len)
+{
+	const unsigned char *ptr = map;
+	uint32_t word_count, rlw_pos;
+	size_t i, needed;
+
+	if (len < 8)
+		return -1;
+
+	self->bit_size = get_be32(ptr);
+	word_count = get_be32(ptr + 4);
+	ptr += 8;
+
+	needed = 8 + (size_t)word_count * sizeof(eword_t) + 4;
+	if (!word_count || len < needed)
+		return -1;
+
+	self->buffer_size = 0;
+	self->alloc_size = 0;
+	free(self->buffer);
+	self->buffer = xmalloc(word_count * sizeof(eword_t));
+	self->alloc_size = self->buffer_size = word_count;
+
+	for (i = 0; i < word_count; i++) {
+		uint64_t word;
+		memcpy(&word, ptr, 8);
+		self->buffer[i] = ntohll(word);
+		ptr += 8;
+	}
+
+	rlw_pos = get_be32(ptr);
+	if (rlw_pos >= word_count)
+		return -1;
+	self->rlw = rlw_pos;
+
+	return needed;
+}
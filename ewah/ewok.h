@@ -0,0 +1,183 @@
+#ifndef EWOK_H
+#define EWOK_H
+
+/*
+ * Compressed and uncompressed bitmaps.
+ *
+ * An EWAH ("Enhanced Word-Aligned Hybrid") bitmap is a sequence of
+ * 64-bit words.  Each "marker" word describes a run of words that
+ * are all zero or all one, followed by a number of literal words
+ * stored verbatim after the marker.  Bitmaps with long stretches of
+ * identical bits (such as the set of objects reachable from a
+ * commit, when the objects are ordered by their position in a pack)
+ * compress very well, and can be combined without inflating them.
+ *
+ * The on-disk representation is compatible with the one used by
+ * the JavaEWAH library:
+ *
+ *	uint32_t bit_size;	number of bits represented
+ *	uint32_t word_count;	number of words that follow
+ *	uint64_t words[];	marker and literal words
+ *	uint32_t rlw;		position of the last marker word
+ *
+ * all in network byte order.
+ */
+
+struct strbuf;
+typedef uint64_t eword_t;
+#define BITS_IN_EWORD (sizeof(eword_t) * 8)
+
+static inline int ewah_bit_popcount64(uint64_t x)
+{
+#if defined(__GNUC__)
+	return __builtin_popcountll(x);
+#else
+	x = (x & 0x5555555555555555ULL) + ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x & 0x0F0F0F0F0F0F0F0FULL) + ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL);
+	return (x * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+/* Index of the lowest set bit; "x" must not be zero. */
+static inline int ewah_bit_ctz64(uint64_t x)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(x);
+#else
+	int n = 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/*
+ * Layout of a marker word: the lowest bit is the value of the run,
+ * the next 32 bits are the length of the run in words, and the top
+ * 31 bits are the number of literal words that follow the marker.
+ */
+#define RLW_RUNNING_BITS 32
+#define RLW_LITERAL_BITS (BITS_IN_EWORD - 1 - RLW_RUNNING_BITS)
+#define RLW_LARGEST_RUNNING_COUNT (((eword_t)1 << RLW_RUNNING_BITS) - 1)
+#define RLW_LARGEST_LITERAL_COUNT (((eword_t)1 << RLW_LITERAL_BITS) - 1)
+
+static inline int rlw_get_run_bit(const eword_t *word)
+{
+	return *word & (eword_t)1;
+}
+
+static inline eword_t rlw_get_running_len(const eword_t *word)
+{
+	return (*word >> 1) & RLW_LARGEST_RUNNING_COUNT;
+}
+
+static inline eword_t rlw_get_literal_words(const eword_t *word)
+{
+	return *word >> (1 + RLW_RUNNING_BITS);
+}
+
+static inline void rlw_set_run_bit(eword_t *word, int b)
+{
+	if (b)
+		*word |= (eword_t)1;
+	else
+		*word &= ~(eword_t)1;
+}
+
+static inline void rlw_set_running_len(eword_t *word, eword_t l)
+{
+	*word &= ~(RLW_LARGEST_RUNNING_COUNT << 1);
+	*word |= l << 1;
+}
+
+static inline void rlw_set_literal_words(eword_t *word, eword_t l)
+{
+	*word &= ((eword_t)1 << (1 + RLW_RUNNING_BITS)) - 1;
+	*word |= l << (1 + RLW_RUNNING_BITS);
+}
+
+struct ewah_bitmap {
+	eword_t *buffer;
+	size_t buffer_size;
+	size_t alloc_size;
+	size_t bit_size;
+	size_t rlw;	/* offset of the last marker word in buffer */
+};
+
+typedef void (*ewah_callback)(size_t pos, void *);
+
+struct ewah_bitmap *ewah_new(void);
+void ewah_clear(struct ewah_bitmap *self);
+void ewah_free(struct ewah_bitmap *self);
+
+/*
+ * Append "number" words that are all zero (v == 0) or all one, or a
+ * single literal word, to the end of the bitmap.
+ */
+void ewah_add_empty_words(struct ewah_bitmap *self, int v, size_t number);
+void ewah_add(struct ewah_bitmap *self, eword_t word);
+
+/* Call "callback" for every set bit, in increasing order. */
+void ewah_each_bit(struct ewah_bitmap *self, ewah_callback callback, void *payload);
+
+/* Number of set bits. */
+size_t ewah_popcount(struct ewah_bitmap *self);
+
+/* out = a ^ b; "out" is cleared first. */
+void ewah_xor(struct ewah_bitmap *a, struct ewah_bitmap *b,
+	      struct ewah_bitmap *out);
+
+/* Word-by-word decompression of an EWAH bitmap. */
+struct ewah_iterator {
+	const eword_t *buffer;
+	size_t buffer_size;
+	size_t pointer;
+	eword_t run_len;
+	eword_t literal_words;
+	int run_bit;
+};
+
+void ewah_iterator_init(struct ewah_iterator *it, struct ewah_bitmap *parent);
+int ewah_iterator_next(eword_t *word, struct ewah_iterator *it);
+
+/* On-disk format; see above. */
+size_t ewah_serialize_size(struct ewah_bitmap *self);
+void ewah_serialize_strbuf(struct ewah_bitmap *self, struct strbuf *out);
+int ewah_serialize(struct ewah_bitmap *self, int fd);
+
+/*
+ * Read a serialized bitmap from "map" (at most "len" bytes).  Returns
+ * the number of bytes consumed, or -1 if the data is truncated.
+ */
+ssize_t ewah_read_mmap(struct ewah_bitmap *self, const void *map, size_t len);
+
+/*
+ * Uncompressed bitmaps, which grow as needed when bits are set.
+ */
+struct bitmap {
+	eword_t *words;
+	size_t word_alloc;
+};
+
+struct bitmap *bitmap_new(void);
+void bitmap_set(struct bitmap *self, size_t pos);
+void bitmap_clear(struct bitmap *self, size_t pos);
+int bitmap_get(struct bitmap *self, size_t pos);
+void bitmap_reset(struct bitmap *self);
+void bitmap_free(struct bitmap *self);
+int bitmap_equals(struct bitmap *self, struct bitmap *other);
+size_t bitmap_popcount(struct bitmap *self);
+
+/* self &= ~other */
+void bitmap_and_not(struct bitmap *self, struct bitmap *other);
+/* self |= other */
+void bitmap_or(struct bitmap *self, const struct bitmap *other);
+void bitmap_or_ewah(struct bitmap *self, struct ewah_bitmap *other);
+
+struct bitmap *ewah_to_bitmap(struct ewah_bitmap *ewah);
+struct ewah_bitmap *bitmap_to_ewah(struct bitmap *bitmap);
+
+#endif
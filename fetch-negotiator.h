@@ -0,0 +1,58 @@
+#ifndef FETCH_NEGOTIATOR_H
+#define FETCH_NEGOTIATOR_H
+
+struct commit;
+
+/*
+ * A fetch negotiator decides which commits fetch-pack tells the server
+ * it "have"s, so that the server can find out what the pack it sends
+ * may leave out.
+ *
+ * After fetch_negotiator_init(), tell it about the commits the server
+ * is known to have with known_common(), then about the local refs with
+ * add_tip().  Then ask it for the commits to send as "have" with
+ * next(), and tell it which of them the server acknowledged with
+ * ack().  When done, call release(); the negotiator cannot be used
+ * after that, until it is initialized again.
+ */
+struct fetch_negotiator {
+	/*
+	 * The server has this commit, as it is the tip of one of its
+	 * refs; it does not have to be sent, but the server has to be
+	 * told about its ancestors we have.  Only before add_tip().
+	 */
+	void (*known_common)(struct fetch_negotiator *, struct commit *);
+
+	/*
+	 * This commit and its ancestors are candidates to send.  Only
+	 * before next().
+	 */
+	void (*add_tip)(struct fetch_negotiator *, struct commit *);
+
+	/*
+	 * Return the name of the next commit to send as "have", or NULL
+	 * when there is no commit left worth sending.
+	 */
+	const unsigned char *(*next)(struct fetch_negotiator *);
+
+	/*
+	 * The server acknowledged that it has this commit, which was
+	 * returned by next() (or is an ancestor of one that was).
+	 * Return 1 if the commit was already known to be common.
+	 */
+	int (*ack)(struct fetch_negotiator *, struct commit *);
+
+	void (*release)(struct fetch_negotiator *);
+
+	/* for the use of the negotiator */
+	void *data;
+};
+
+/*
+ * Initialize the negotiator for the named algorithm, "default" or
+ * "skipping"; NULL means "default".
+ */
+extern void fetch_negotiator_init(struct fetch_negotiator *negotiator,
+				  const char *algorithm);
+
+#endif /* FETCH_NEGOTIATOR_H */
@@ -12,8 +12,8 @@
 #include "connect.h"
 #include "transport.h"
 #include "version.h"
-#include "prio-queue.h"
 #include "sha1-array.h"
+#include "fetch-negotiator.h"
 
 static int transfer_unpack_limit = -1;
 static int fetch_unpack_limit = -1;
@@ -25,14 +25,10 @@ static int transfer_fsck_objects = -1;
 static int agent_supported;
 static struct lock_file shallow_lock;
 static const char *alternate_shallow_file;
+static const char *negotiation_algorithm;
 
+/* negotiator/ uses the bits above this one */
 #define COMPLETE	(1U << 0)
-#define COMMON		(1U << 1)
-#define COMMON_REF	(1U << 2)
-#define SEEN		(1U << 3)
-#define POPPED		(1U << 4)
-
-static int marked;
 
 /*
  * After sending this many "have"s if we do not get any new ACK , we
@@ -40,124 +36,19 @@ static int marked;
  */
 #define MAX_IN_VAIN 256
 
-static struct prio_queue rev_list = { compare_commits_by_commit_date };
-static int non_common_revs, multi_ack, use_sideband, allow_tip_sha1_in_want;
-
-static void rev_list_push(struct commit *commit, int mark)
-{
-	if (!(commit->object.flags & mark)) {
-		commit->object.flags |= mark;
-
-		if (parse_commit(commit))
-			return;
-
-		prio_queue_put(&rev_list, commit);
-
-		if (!(commit->object.flags & COMMON))
-			non_common_revs++;
-	}
-}
+static int multi_ack, use_sideband, allow_tip_sha1_in_want;
 
 static int rev_list_insert_ref(const char *refname, const unsigned char *sha1, int flag, void *cb_data)
 {
+	struct fetch_negotiator *negotiator = cb_data;
 	struct object *o = deref_tag(parse_object(sha1), refname, 0);
 
 	if (o && o->type == OBJ_COMMIT)
-		rev_list_push((struct commit *)o, SEEN);
-
-	return 0;
-}
-
-static int clear_marks(const char *refname, const unsigned char *sha1, int flag, void *cb_data)
-{
-	struct object *o = deref_tag(parse_object(sha1), refname, 0);
+		negotiator->add_tip(negotiator, (struct commit *)o);
 
-	if (o && o->type == OBJ_COMMIT)
-		clear_commit_marks((struct commit *)o,
-				   COMMON | COMMON_REF | SEEN | POPPED);
 	return 0;
 }
 
-/*
-   This function marks a rev and its ancestors as common.
-   In some cases, it is desirable to mark only the ancestors (for example
-   when only the server does not yet know that they are common).
-*/
-
-static void mark_common(struct commit *commit,
-		int ancestors_only, int dont_parse)
-{
-	if (commit != NULL && !(commit->object.flags & COMMON)) {
-		struct object *o = (struct object *)commit;
-
-		if (!ancestors_only)
-			o->flags |= COMMON;
-
-		if (!(o->flags & SEEN))
-			rev_list_push(commit, SEEN);
-		else {
-			struct commit_list *parents;
-
-			if (!ancestors_only && !(o->flags & POPPED))
-				non_common_revs--;
-			if (!o->parsed && !dont_parse)
-				if (parse_commit(commit))
-					return;
-
-			for (parents = commit->parents;
-					parents;
-					parents = parents->next)
-				mark_common(parents->item, 0, dont_parse);
-		}
-	}
-}
-
-/*
-  Get the next rev to send, ignoring the common.
-*/
-
-static const unsigned char *get_rev(void)
-{
-	struct commit *commit = NULL;
-
-	while (commit == NULL) {
-		unsigned int mark;
-		struct commit_list *parents;
-
-		if (rev_list.nr == 0 || non_common_revs == 0)
-			return NULL;
-
-		commit = prio_queue_get(&rev_list);
-		parse_commit(commit);
-		parents = commit->parents;
-
-		commit->object.flags |= POPPED;
-		if (!(commit->object.flags & COMMON))
-			non_common_revs--;
-
-		if (commit->object.flags & COMMON) {
-			/* do not send "have", and ignore ancestors */
-			commit = NULL;
-			mark = COMMON | SEEN;
-		} else if (commit->object.flags & COMMON_REF)
-			/* send "have", and ignore ancestors */
-			mark = COMMON | SEEN;
-		else
-			/* send "have", also for its ancestors */
-			mark = SEEN;
-
-		while (parents) {
-			if (!(parents->item->object.flags & SEEN))
-				rev_list_push(parents->item, mark);
-			if (mark & COMMON)
-				mark_common(parents->item, 1, 0);
-			parents = parents->next;
-		}
-	}
-
-	return commit->object.sha1;
-}
-
 enum ack_type {
 	NAK = 0,
 	ACK,
@@ -219,18 +110,18 @@ static void send_request(struct fetch_pack_args *args,
 		write_or_die(fd, buf->buf, buf->len);
 }
 
-static void insert_one_alternate_ref(const struct ref *ref, void *unused)
+static void insert_one_alternate_ref(const struct ref *ref, void *negotiator)
 {
-	rev_list_insert_ref(NULL, ref->old_sha1, 0, NULL);
+	rev_list_insert_ref(NULL, ref->old_sha1, 0, negotiator);
 }
 
 #define INITIAL_FLUSH 16
 #define PIPESAFE_FLUSH 32
 #define LARGE_FLUSH 1024
 
-static int next_flush(struct fetch_pack_args *args, int count)
+static int next_flush(int stateless_rpc, int count)
 {
-	int flush_limit = args->stateless_rpc ? LARGE_FLUSH : PIPESAFE_FLUSH;
+	int flush_limit = stateless_rpc ? LARGE_FLUSH : PIPESAFE_FLUSH;
 
 	if (count < flush_limit)
 		count <<= 1;
@@ -239,7 +130,8 @@ static int next_flush(struct fetch_pack_args *args, int count)
 	return count;
 }
 
-static int find_common(struct fetch_pack_args *args,
+static int find_common(struct fetch_negotiator *negotiator,
+		       struct fetch_pack_args *args,
 		       int fd[2], unsigned char *result_sha1,
 		       struct ref *refs)
 {
@@ -254,12 +146,9 @@ static int find_common(struct fetch_pack_args *args,
 
 	if (args->stateless_rpc && multi_ack == 1)
 		die("--stateless-rpc requires multi_ack_detailed");
-	if (marked)
-		for_each_ref(clear_marks, NULL);
-	marked = 1;
 
-	for_each_ref(rev_list_insert_ref, NULL);
-	for_each_alternate_ref(insert_one_alternate_ref, NULL);
+	for_each_ref(rev_list_insert_ref, negotiator);
+	for_each_alternate_ref(insert_one_alternate_ref, negotiator);
 
 	fetching = 0;
 	for ( ; refs ; refs = refs->next) {
@@ -355,7 +244,7 @@ static int find_common(struct fetch_pack_args *args,
 
 	flushes = 0;
 	retval = -1;
-	while ((sha1 = get_rev())) {
+	while ((sha1 = negotiator->next(negotiator))) {
 		packet_buf_write(&req_buf, "have %s\n", sha1_to_hex(sha1));
 		if (args->verbose)
 			fprintf(stderr, "have %s\n", sha1_to_hex(sha1));
@@ -367,7 +256,7 @@ static int find_common(struct fetch_pack_args *args,
 			send_request(args, fd[1], &req_buf);
 			strbuf_setlen(&req_buf, state_len);
 			flushes++;
-			flush_at = next_flush(args, count);
+			flush_at = next_flush(args->stateless_rpc, count);
 
 			/*
 			 * We keep one window "ahead" of the other side, and
@@ -393,11 +282,13 @@ static int find_common(struct fetch_pack_args *args,
 				case ACK_continue: {
 					struct commit *commit =
 						lookup_commit(result_sha1);
+					int was_common;
 					if (!commit)
 						die("invalid commit %s", sha1_to_hex(result_sha1));
+					was_common = negotiator->ack(negotiator, commit);
 					if (args->stateless_rpc
 					 && ack == ACK_common
-					 && !(commit->object.flags & COMMON)) {
+					 && !was_common) {
 						/* We need to replay the have for this object
 						 * on the next RPC request so the peer knows
 						 * it is in common with us.
@@ -406,14 +297,11 @@ static int find_common(struct fetch_pack_args *args,
 						packet_buf_write(&req_buf, "have %s\n", hex);
 						state_len = req_buf.len;
 					}
-					mark_common(commit, 0, 1);
 					retval = 0;
 					in_vain = 0;
 					got_continue = 1;
-					if (ack == ACK_ready) {
-						clear_prio_queue(&rev_list);
+					if (ack == ACK_ready)
 						got_ready = 1;
-					}
 					break;
 					}
 				}
@@ -424,6 +312,8 @@ static int find_common(struct fetch_pack_args *args,
 					fprintf(stderr, "giving up\n");
 				break; /* give up */
 			}
+			if (got_ready)
+				break;
 		}
 	}
 done:
@@ -557,7 +447,8 @@ static void mark_alternate_complete(const struct ref *ref, void *unused)
 	mark_complete(NULL, ref->old_sha1, 0, NULL);
 }
 
-static int everything_local(struct fetch_pack_args *args,
+static int everything_local(struct fetch_negotiator *negotiator,
+			    struct fetch_pack_args *args,
 			    struct ref **refs,
 			    struct ref **sought, int nr_sought)
 {
@@ -607,11 +498,7 @@ static int everything_local(struct fetch_pack_args *args,
 		if (!o || o->type != OBJ_COMMIT || !(o->flags & COMPLETE))
 			continue;
 
-		if (!(o->flags & SEEN)) {
-			rev_list_push((struct commit *)o, COMMON_REF | SEEN);
-
-			mark_common((struct commit *)o, 1, 1);
-		}
+		negotiator->known_common(negotiator, (struct commit *)o);
 	}
 
 	filter_refs(args, refs, sought, nr_sought);
@@ -769,7 +656,8 @@ static int cmp_ref_by_name(const void *a_, const void *b_)
 	return strcmp(a->name, b->name);
 }
 
-static struct ref *do_fetch_pack(struct fetch_pack_args *args,
+static struct ref *do_fetch_pack(struct fetch_negotiator *negotiator,
+				 struct fetch_pack_args *args,
 				 int fd[2],
 				 const struct ref *orig_ref,
 				 struct ref **sought, int nr_sought,
@@ -836,11 +724,11 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 				agent_len, agent_feature);
 	}
 
-	if (everything_local(args, &ref, sought, nr_sought)) {
+	if (everything_local(negotiator, args, &ref, sought, nr_sought)) {
 		packet_flush(fd[1]);
 		goto all_done;
 	}
-	if (find_common(args, fd, sha1, ref) < 0)
+	if (find_common(negotiator, args, fd, sha1, ref) < 0)
 		if (!args->keep_pack)
 			/* When cloning, it is not unusual to have
 			 * no common commit.
@@ -863,6 +751,200 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 	return ref;
 }
 
+/*
+ * Add "want" lines for the refs we do not have yet, and return how
+ * many were added.
+ */
+static int add_wants_v2(const struct ref *refs, struct strbuf *req_buf)
+{
+	int wants = 0;
+
+	for ( ; refs ; refs = refs->next) {
+		struct object *o = lookup_object(refs->old_sha1);
+
+		if (o && (o->flags & COMPLETE))
+			continue;
+		packet_buf_write(req_buf, "want %s\n",
+				 sha1_to_hex(refs->old_sha1));
+		wants++;
+	}
+	return wants;
+}
+
+/*
+ * Add up to *haves_to_send "have" lines for the commits we have not
+ * told the server about yet, and grow the window for the next round;
+ * return how many were added.
+ */
+static int add_haves_v2(struct fetch_negotiator *negotiator,
+			struct fetch_pack_args *args, struct strbuf *req_buf,
+			int *haves_to_send)
+{
+	const unsigned char *sha1;
+	int haves_added = 0;
+
+	while (haves_added < *haves_to_send &&
+	       (sha1 = negotiator->next(negotiator))) {
+		packet_buf_write(req_buf, "have %s\n", sha1_to_hex(sha1));
+		if (args->verbose)
+			fprintf(stderr, "have %s\n", sha1_to_hex(sha1));
+		haves_added++;
+	}
+	*haves_to_send = next_flush(1, *haves_to_send);
+	return haves_added;
+}
+
+/*
+ * Read the "acknowledgments" section of the server's response, and
+ * return 1 if the server said it is ready to send the pack, which
+ * then follows in the same response.
+ */
+static int process_acks_v2(struct fetch_negotiator *negotiator,
+			   struct fetch_pack_args *args, int fd,
+			   struct sha1_array *common, int *in_vain,
+			   int *got_continue)
+{
+	enum packet_read_status status;
+	char *line;
+	int len, ready = 0;
+
+	line = packet_read_line(fd, NULL);
+	if (!line || strcmp(line, "acknowledgments"))
+		die("git fetch-pack: expected acknowledgments, got '%s'",
+		    line ? line : "flush");
+
+	while ((status = packet_read_with_status(fd, NULL, NULL,
+						 packet_buffer, sizeof(packet_buffer),
+						 &len, PACKET_READ_CHOMP_NEWLINE)) ==
+	       PACKET_READ_NORMAL) {
+		const char *arg;
+		unsigned char sha1[20];
+
+		line = packet_buffer;
+		if (!strcmp(line, "NAK"))
+			continue;
+		if ((arg = skip_prefix(line, "ACK "))) {
+			struct commit *commit;
+
+			if (get_sha1_hex(arg, sha1))
+				die("git fetch-pack: bad ACK '%s'", line);
+			commit = lookup_commit(sha1);
+			if (!commit)
+				die("invalid commit %s", sha1_to_hex(sha1));
+			if (args->verbose)
+				fprintf(stderr, "got ack %s\n", sha1_to_hex(sha1));
+			if (!negotiator->ack(negotiator, commit)) {
+				/* We need to say so again in the next round */
+				sha1_array_append(common, sha1);
+				*in_vain = 0;
+			}
+			*got_continue = 1;
+			continue;
+		}
+		if (!strcmp(line, "ready")) {
+			ready = 1;
+			continue;
+		}
+		die("git fetch-pack: unexpected acknowledgment '%s'", line);
+	}
+
+	if (ready && status != PACKET_READ_DELIM)
+		die("git fetch-pack: expected the packfile after 'ready'");
+	if (!ready && status != PACKET_READ_FLUSH)
+		die("git fetch-pack: expected flush after acknowledgments");
+	return ready;
+}
+
+/*
+ * Protocol v2 counterpart of find_common() and get_pack(): every round
+ * is a separate "fetch" request, which repeats the wants and the haves
+ * the server acknowledged, and adds more haves, until the server is
+ * ready or we give up and say "done".
+ */
+static struct ref *do_fetch_pack_v2(struct fetch_negotiator *negotiator,
+				    struct fetch_pack_args *args,
+				    int fd[2],
+				    const struct ref *orig_ref,
+				    struct ref **sought, int nr_sought,
+				    char **pack_lockfile)
+{
+	struct ref *ref = copy_ref_list(orig_ref);
+	struct sha1_array common = SHA1_ARRAY_INIT;
+	struct strbuf req_buf = STRBUF_INIT;
+	int haves_to_send = INITIAL_FLUSH;
+	int in_vain = 0, got_continue = 0;
+	char *line;
+
+	sort_ref_list(&ref, ref_compare_name);
+	qsort(sought, nr_sought, sizeof(*sought), cmp_ref_by_name);
+
+	server_supports_v2("fetch", 1);
+	agent_supported = server_supports_v2("agent", 0);
+	use_sideband = 2;
+	/* the server checks that what we want is reachable */
+	allow_tip_sha1_in_want = 1;
+
+	if (everything_local(negotiator, args, &ref, sought, nr_sought))
+		return ref;
+
+	for_each_ref(rev_list_insert_ref, negotiator);
+	for_each_alternate_ref(insert_one_alternate_ref, negotiator);
+
+	for (;;) {
+		int i, haves_added, done = 0;
+
+		packet_buf_write(&req_buf, "command=fetch\n");
+		if (agent_supported)
+			packet_buf_write(&req_buf, "agent=%s\n",
+					 git_user_agent_sanitized());
+		packet_buf_delim(&req_buf);
+		if (args->use_thin_pack)
+			packet_buf_write(&req_buf, "thin-pack\n");
+		if (args->no_progress)
+			packet_buf_write(&req_buf, "no-progress\n");
+		if (args->include_tag)
+			packet_buf_write(&req_buf, "include-tag\n");
+		if (prefer_ofs_delta)
+			packet_buf_write(&req_buf, "ofs-delta\n");
+		if (!add_wants_v2(ref, &req_buf)) {
+			strbuf_release(&req_buf);
+			sha1_array_clear(&common);
+			return ref;
+		}
+		for (i = 0; i < common.nr; i++)
+			packet_buf_write(&req_buf, "have %s\n",
+					 sha1_to_hex(common.sha1[i]));
+		haves_added = add_haves_v2(negotiator, args, &req_buf,
+					   &haves_to_send);
+		in_vain += haves_added;
+		if (!haves_added || (got_continue && MAX_IN_VAIN < in_vain)) {
+			packet_buf_write(&req_buf, "done\n");
+			if (args->verbose)
+				fprintf(stderr, "done\n");
+			done = 1;
+		}
+		packet_buf_flush(&req_buf);
+		write_or_die(fd[1], req_buf.buf, req_buf.len);
+		strbuf_reset(&req_buf);
+
+		if (done ||
+		    process_acks_v2(negotiator, args, fd[0], &common, &in_vain,
+				    &got_continue))
+			break;
+	}
+	strbuf_release(&req_buf);
+	sha1_array_clear(&common);
+
+	line = packet_read_line(fd[0], NULL);
+	if (!line || strcmp(line, "packfile"))
+		die("git fetch-pack: expected packfile, got '%s'",
+		    line ? line : "flush");
+	alternate_shallow_file = NULL;
+	if (get_pack(args, fd, pack_lockfile))
+		die("git fetch-pack: fetch failed.");
+	return ref;
+}
+
 static int fetch_pack_config(const char *var, const char *value, void *cb)
 {
 	if (strcmp(var, "fetch.unpacklimit") == 0) {
@@ -890,6 +972,9 @@ static int fetch_pack_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "fetch.negotiationalgorithm"))
+		return git_config_string(&negotiation_algorithm, var, value);
+
 	return git_default_config(var, value, cb);
 }
 
@@ -1038,10 +1123,12 @@ struct ref *fetch_pack(struct fetch_pack_args *args,
 		       const char *dest,
 		       struct ref **sought, int nr_sought,
 		       struct sha1_array *shallow,
-		       char **pack_lockfile)
+		       char **pack_lockfile,
+		       enum protocol_version version)
 {
 	struct ref *ref_cpy;
 	struct shallow_info si;
+	struct fetch_negotiator negotiator;
 
 	fetch_pack_setup();
 	if (nr_sought)
@@ -1052,8 +1139,14 @@ struct ref *fetch_pack(struct fetch_pack_args *args,
 		die("no matching remote head");
 	}
 	prepare_shallow_info(&si, shallow);
-	ref_cpy = do_fetch_pack(args, fd, ref, sought, nr_sought,
-				&si, pack_lockfile);
+	fetch_negotiator_init(&negotiator, negotiation_algorithm);
+	if (version == protocol_v2)
+		ref_cpy = do_fetch_pack_v2(&negotiator, args, fd, ref,
+					   sought, nr_sought, pack_lockfile);
+	else
+		ref_cpy = do_fetch_pack(&negotiator, args, fd, ref,
+					sought, nr_sought, &si, pack_lockfile);
+	negotiator.release(&negotiator);
 	reprepare_packed_git();
 	update_shallow(args, sought, nr_sought, &si);
 	clear_shallow_info(&si);
@@ -3,6 +3,7 @@
 
 #include "string-list.h"
 #include "run-command.h"
+#include "protocol.h"
 
 struct sha1_array;
 
@@ -30,7 +31,8 @@ struct fetch_pack_args {
 /*
  * sought represents remote references that should be updated from.
  * On return, the names that were found on the remote will have been
- * marked as such.
+ * marked as such.  version is what the server said it speaks when
+ * the connection was made.
  */
 struct ref *fetch_pack(struct fetch_pack_args *args,
 		       int fd[], struct child_process *conn,
@@ -39,6 +41,7 @@ struct ref *fetch_pack(struct fetch_pack_args *args,
 		       struct ref **sought,
 		       int nr_sought,
 		       struct sha1_array *shallow,
-		       char **pack_lockfile);
+		       char **pack_lockfile,
+		       enum protocol_version version);
 
 #endif
@@ -0,0 +1,276 @@
+#include "cache.h"
+#include "dir.h"
+#include "ewah/ewok.h"
+#include "fsmonitor.h"
+#include "run-command.h"
+
+#define INDEX_EXTENSION_VERSION 1
+#define HOOK_INTERFACE_VERSION 1
+
+#define TRACE_KEY "GIT_TRACE_FSMONITOR"
+
+static uint64_t getnanotime(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+}
+
+static const char *core_fsmonitor;
+static int fsmonitor_config_read;
+
+static int read_fsmonitor_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "core.fsmonitor"))
+		return git_config_string(&core_fsmonitor, var, value);
+	return 0;
+}
+
+/*
+ * The index may be read before the command reads its configuration
+ * (e.g. by gitmodules_config()), so look core.fsmonitor up ourselves.
+ */
+static int fsmonitor_enabled(void)
+{
+	if (!fsmonitor_config_read) {
+		fsmonitor_config_read = 1;
+		git_config(read_fsmonitor_config, NULL);
+	}
+	return core_fsmonitor && *core_fsmonitor && !is_bare_repository();
+}
+
+int read_fsmonitor_extension(struct index_state *istate,
+			     const void *data_, unsigned long sz)
+{
+	const unsigned char *data = data_;
+	struct ewah_bitmap *dirty;
+	uint32_t version, ewah_size;
+	ssize_t ret;
+
+	if (sz < 4 + 8 + 4)
+		return error("corrupt fsmonitor extension (too short)");
+	version = get_be32(data);
+	if (version != INDEX_EXTENSION_VERSION)
+		return error("bad fsmonitor extension version %"PRIu32, version);
+	istate->fsmonitor_last_update = get_be64(data + 4);
+	ewah_size = get_be32(data + 12);
+	data += 16;
+	sz -= 16;
+	if (ewah_size > sz)
+		return error("corrupt fsmonitor extension (truncated bitmap)");
+
+	dirty = ewah_new();
+	ret = ewah_read_mmap(dirty, data, ewah_size);
+	if (ret < 0 || ret != ewah_size) {
+		ewah_free(dirty);
+		return error("corrupt fsmonitor bitmap");
+	}
+	if (istate->fsmonitor_dirty)
+		ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = dirty;
+	return 0;
+}
+
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
+{
+	struct bitmap *dirty = bitmap_new();
+	struct ewah_bitmap *ewah;
+	unsigned char buf[8];
+	size_t size_offset, ewah_start;
+	int i, nr;
+
+	/* positions are those of the index as written, without CE_REMOVE */
+	for (i = nr = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (!(ce->ce_flags & CE_FSMONITOR_VALID))
+			bitmap_set(dirty, nr);
+		nr++;
+	}
+	ewah = bitmap_to_ewah(dirty);
+	bitmap_free(dirty);
+
+	put_be32(buf, INDEX_EXTENSION_VERSION);
+	strbuf_add(sb, buf, 4);
+	put_be64(buf, istate->fsmonitor_last_update);
+	strbuf_add(sb, buf, 8);
+
+	size_offset = sb->len;
+	strbuf_add(sb, buf, 4); /* placeholder for the bitmap size */
+	ewah_start = sb->len;
+	ewah_serialize_strbuf(ewah, sb);
+	ewah_free(ewah);
+	put_be32(sb->buf + size_offset, sb->len - ewah_start);
+}
+
+/*
+ * Run the hook: it is given the interface version and the time of
+ * the last query, in nanoseconds since the epoch, and writes the
+ * NUL-terminated paths, relative to the top of the work tree, that
+ * changed since then.
+ */
+static int query_fsmonitor(int version, uint64_t last_update,
+			   struct strbuf *query_result)
+{
+	struct child_process cp;
+	const char *argv[4];
+	char ver[32], date[64];
+	int ret;
+
+	snprintf(ver, sizeof(ver), "%d", version);
+	snprintf(date, sizeof(date), "%"PRIuMAX, (uintmax_t)last_update);
+	argv[0] = core_fsmonitor;
+	argv[1] = ver;
+	argv[2] = date;
+	argv[3] = NULL;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.argv = argv;
+	cp.use_shell = 1;
+	cp.no_stdin = 1;
+	cp.out = -1;
+	cp.dir = get_git_work_tree();
+	if (start_command(&cp))
+		return -1;
+	ret = strbuf_read(query_result, cp.out, 1024) < 0 ? -1 : 0;
+	close(cp.out);
+	if (finish_command(&cp))
+		ret = -1;
+	return ret;
+}
+
+static void invalidate_all(struct index_state *istate)
+{
+	int i;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+}
+
+/*
+ * "name" may be a file or a directory (with or without a trailing
+ * slash); in the latter case, everything in it is invalidated.
+ */
+static void fsmonitor_refresh_callback(struct index_state *istate,
+				       const char *name)
+{
+	int len = strlen(name);
+	int pos;
+
+	if (len && name[len - 1] == '/')
+		len--;
+	pos = index_name_pos(istate, name, len);
+	if (pos >= 0) {
+		istate->cache[pos]->ce_flags &= ~CE_FSMONITOR_VALID;
+	} else {
+		for (pos = -pos - 1; pos < istate->cache_nr; pos++) {
+			struct cache_entry *ce = istate->cache[pos];
+
+			if (ce_namelen(ce) <= len ||
+			    ce->name[len] != '/' ||
+			    memcmp(ce->name, name, len))
+				break;
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+		}
+	}
+
+	/* the untracked cache of its directory is stale, too */
+	if (istate->untracked)
+		untracked_cache_invalidate_path(istate, name);
+}
+
+void refresh_fsmonitor(struct index_state *istate)
+{
+	struct strbuf query_result = STRBUF_INIT;
+	uint64_t last_update;
+	int query_success = 0;
+	size_t bol, i;
+
+	if (!fsmonitor_enabled() || !istate->fsmonitor_last_update ||
+	    istate->fsmonitor_has_run_once)
+		return;
+	istate->fsmonitor_has_run_once = 1;
+
+	/*
+	 * Take the time before asking, so that a change made while the
+	 * hook runs is reported again next time, rather than lost.
+	 */
+	last_update = getnanotime();
+	query_success = !query_fsmonitor(HOOK_INTERFACE_VERSION,
+					 istate->fsmonitor_last_update,
+					 &query_result);
+	trace_printf_key(TRACE_KEY, "fsmonitor: query %s (%"PRIuMAX" bytes)\n",
+			 query_success ? "succeeded" : "failed",
+			 (uintmax_t)query_result.len);
+
+	if (query_success && query_result.len && query_result.buf[0] != '/') {
+		/* NUL-terminate the last path, in case the hook did not */
+		strbuf_addch(&query_result, '\0');
+		for (bol = i = 0; i < query_result.len; i++) {
+			if (query_result.buf[i])
+				continue;
+			if (i > bol)
+				fsmonitor_refresh_callback(istate,
+							   query_result.buf + bol);
+			bol = i + 1;
+		}
+	} else if (!query_success || query_result.len) {
+		/*
+		 * The hook failed, or told us that everything may have
+		 * changed ("/"): fall back to checking every entry.
+		 */
+		invalidate_all(istate);
+	}
+	/* worth writing out, so that we do not have to ask again */
+	if (!query_success || query_result.len)
+		istate->cache_changed = 1;
+	strbuf_release(&query_result);
+
+	istate->fsmonitor_last_update = last_update;
+}
+
+void tweak_fsmonitor(struct index_state *istate)
+{
+	struct ewah_bitmap *dirty = istate->fsmonitor_dirty;
+	int i;
+
+	istate->fsmonitor_dirty = NULL;
+	if (!fsmonitor_enabled()) {
+		/* drop the extension, if any */
+		if (istate->fsmonitor_last_update) {
+			istate->fsmonitor_last_update = 0;
+			istate->cache_changed = 1;
+		}
+		if (dirty)
+			ewah_free(dirty);
+		return;
+	}
+
+	if (dirty) {
+		struct bitmap *bitmap = ewah_to_bitmap(dirty);
+
+		for (i = 0; i < istate->cache_nr; i++)
+			if (!bitmap_get(bitmap, i))
+				istate->cache[i]->ce_flags |= CE_FSMONITOR_VALID;
+		bitmap_free(bitmap);
+		ewah_free(dirty);
+	}
+
+	if (!istate->fsmonitor_last_update) {
+		/*
+		 * Start monitoring the main index: nothing is known to
+		 * be up to date, and the first query will be for the
+		 * changes since now.
+		 */
+		if (istate != &the_index)
+			return;
+		istate->fsmonitor_last_update = getnanotime();
+		istate->fsmonitor_has_run_once = 1;
+		istate->cache_changed = 1;
+		return;
+	}
+	refresh_fsmonitor(istate);
+}
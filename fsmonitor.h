@@ -0,0 +1,49 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+struct index_state;
+struct strbuf;
+
+/*
+ * When core.fsmonitor names a hook, the index records (in the "FSMN"
+ * extension) the time of the last query to the hook, and which of its
+ * entries were known to be up to date with the work tree then.  The
+ * hook tells us the paths that changed since, and only those need to
+ * be lstat()ed by refresh_index() and friends; the others are marked
+ * CE_FSMONITOR_VALID.
+ */
+
+extern int read_fsmonitor_extension(struct index_state *istate,
+				    const void *data, unsigned long sz);
+extern void write_fsmonitor_extension(struct strbuf *sb,
+				      struct index_state *istate);
+
+/*
+ * Called once the index is completely read: apply the extension (or
+ * drop it, if core.fsmonitor is not set) and query the hook.
+ */
+extern void tweak_fsmonitor(struct index_state *istate);
+
+/*
+ * Ask the hook what changed since the last query, and clear
+ * CE_FSMONITOR_VALID on the entries for those paths.  Only the first
+ * call for an index does anything.
+ */
+extern void refresh_fsmonitor(struct index_state *istate);
+
+/*
+ * Record that "ce" was just found to be up to date with the work
+ * tree, so that it need not be checked again until the hook says
+ * it changed.
+ */
+static inline void mark_fsmonitor_valid(struct index_state *istate,
+					struct cache_entry *ce)
+{
+	if (istate->fsmonitor_last_update &&
+	    !(ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce->ce_flags |= CE_FSMONITOR_VALID;
+		istate->cache_changed = 1;
+	}
+}
+
+#endif
@@ -4,9 +4,10 @@
 #include "xdiff-interface.h"
 #include "diff.h"
 #include "diffcore.h"
+#include "trigram-index.h"
 
 static int grep_source_load(struct grep_source *gs);
-static int grep_source_is_binary(struct grep_source *gs);
+static int grep_source_is_binary(struct grep_opt *opt, struct grep_source *gs);
 
 static struct grep_opt grep_defaults;
 
@@ -728,6 +729,196 @@ void compile_grep_patterns(struct grep_opt *opt)
 		dump_grep_expression(opt);
 }
 
+/*
+ * Add to query the strings that a line must contain to match the
+ * regular expression of p.  This errs on the side of finding fewer of
+ * them: anything that is not obviously a literal character outside
+ * of groups and not followed by a repetition ends the string at hand,
+ * whether the pattern is a basic or an extended one.
+ */
+static void regexp_trigram_query(struct grep_pat *p, int ignore_case,
+				 struct trigram_query *query)
+{
+	const char *s = p->pattern, *end = s + p->patternlen;
+	struct strbuf run = STRBUF_INIT;
+	int depth = 0;
+
+	/* alternatives make everything optional */
+	if (memchr(s, '|', p->patternlen))
+		return;
+
+	while (1) {
+		int c = s < end ? (unsigned char)*s++ : -1;
+		int escaped = 0;
+
+		if (c == '\\' && s < end) {
+			c = (unsigned char)*s++;
+			escaped = 1;
+		}
+		if (0 <= c && !depth && !(c & 0x80) &&
+		    (escaped ? !isalnum(c) && !strchr("(){}+?<>`'", c)
+			     : !strchr(".[]^$*+?{}()\\", c)) &&
+		    /* these fold to non-ASCII characters in some locales */
+		    !(ignore_case && strchr("iIkKsS", c))) {
+			strbuf_addch(&run, c);
+			continue;
+		}
+
+		/* a repetition makes the character before it optional */
+		if (c == '*' || c == '+' || c == '?' || c == '{')
+			strbuf_setlen(&run, run.len ? run.len - 1 : 0);
+		if (3 <= run.len) {
+			struct trigram_clause *clause = trigram_query_add(query);
+			trigram_clause_add(clause, run.buf, run.len, ignore_case);
+			if (trigram_clause_is_trivial(clause)) {
+				trigram_clause_release(clause);
+				query->nr--;
+			}
+		}
+		strbuf_reset(&run);
+
+		if (c < 0)
+			break;
+		if (c == '(')
+			depth++;
+		else if (c == ')' && depth)
+			depth--;
+		else if (c == '{')
+			while (s < end && *s++ != '}')
+				; /* skip the count */
+		else if (c == '[' && !escaped) {
+			/* skip the bracket expression */
+			if (s < end && *s == '^')
+				s++;
+			if (s < end && *s == ']')
+				s++;
+			while (s < end && *s != ']') {
+				if (*s == '[' && s + 1 < end &&
+				    (s[1] == ':' || s[1] == '.' || s[1] == '=')) {
+					char close = s[1];
+					for (s += 2; s + 1 < end; s++)
+						if (s[0] == close && s[1] == ']')
+							break;
+					s++;
+				}
+				s++;
+			}
+			s++;
+		}
+	}
+	strbuf_release(&run);
+}
+
+static void pattern_trigram_query(struct grep_pat *p, struct grep_opt *opt,
+				  struct trigram_query *query)
+{
+	int ignore_case = p->ignore_case || (opt->regflags & REG_ICASE);
+
+	if (p->token == GREP_PATTERN_HEAD)
+		return;
+	if (p->fixed) {
+		struct trigram_clause *clause = trigram_query_add(query);
+		trigram_clause_add(clause, p->pattern, p->patternlen,
+				   ignore_case);
+		if (trigram_clause_is_trivial(clause)) {
+			trigram_clause_release(clause);
+			query->nr--;
+		}
+	} else if (!opt->pcre)
+		regexp_trigram_query(p, ignore_case, query);
+}
+
+/* Make query satisfied by what satisfies either a or b */
+/* Keep the first nr clauses of the query, which then asks for less */
+static void trigram_query_truncate(struct trigram_query *query, int nr)
+{
+	while (nr < query->nr)
+		trigram_clause_release(&query->clause[--query->nr]);
+}
+
+static void trigram_query_or(struct trigram_query *query,
+			     struct trigram_query *a, struct trigram_query *b)
+{
+	int i, j;
+
+	if (!a->nr || !b->nr)
+		return;
+	/* keep the cross product small, at the cost of some precision */
+	if (16 < a->nr * b->nr) {
+		trigram_query_truncate(a, 1);
+		trigram_query_truncate(b, 1);
+	}
+	for (i = 0; i < a->nr; i++)
+		for (j = 0; j < b->nr; j++) {
+			struct trigram_clause *clause = trigram_query_add(query);
+			trigram_clause_merge(clause, &a->clause[i]);
+			trigram_clause_merge(clause, &b->clause[j]);
+		}
+}
+
+static void expr_trigram_query(struct grep_expr *x, struct grep_opt *opt,
+			       int all_match, struct trigram_query *query)
+{
+	struct trigram_query a = { 0 }, b = { 0 };
+
+	switch (x->node) {
+	case GREP_NODE_ATOM:
+		pattern_trigram_query(x->u.atom, opt, query);
+		break;
+	case GREP_NODE_AND:
+		expr_trigram_query(x->u.binary.left, opt, 0, query);
+		expr_trigram_query(x->u.binary.right, opt, 0, query);
+		break;
+	case GREP_NODE_OR:
+		if (all_match) {
+			/* every one of them must hit some line */
+			expr_trigram_query(x->u.binary.left, opt, 0, query);
+			expr_trigram_query(x->u.binary.right, opt, 1, query);
+			break;
+		}
+		expr_trigram_query(x->u.binary.left, opt, 0, &a);
+		expr_trigram_query(x->u.binary.right, opt, 0, &b);
+		trigram_query_or(query, &a, &b);
+		trigram_query_release(&a);
+		trigram_query_release(&b);
+		break;
+	default:
+		break;
+	}
+}
+
+int grep_trigram_query(struct grep_opt *opt, struct trigram_query *query)
+{
+	struct grep_pat *p;
+
+	if (opt->invert || opt->unmatch_name_only || opt->allow_textconv)
+		return 0;
+
+	if (opt->extended) {
+		if (opt->pattern_expression)
+			expr_trigram_query(opt->pattern_expression, opt,
+					   opt->all_match, query);
+		return query->nr;
+	}
+
+	for (p = opt->pattern_list; p; p = p->next) {
+		struct trigram_query one = { 0 }, either = { 0 };
+
+		if (p == opt->pattern_list) {
+			pattern_trigram_query(p, opt, query);
+			continue;
+		}
+		if (!query->nr)
+			break;
+		pattern_trigram_query(p, opt, &one);
+		trigram_query_or(&either, query, &one);
+		trigram_query_release(query);
+		trigram_query_release(&one);
+		*query = either;
+	}
+	return query->nr;
+}
+
 static void free_pattern_expr(struct grep_expr *x)
 {
 	switch (x->node) {
@@ -1146,8 +1337,8 @@ static void show_line(struct grep_opt *opt, char *bol, char *eol,
 int grep_use_locks;
 
 /*
- * This lock protects access to the gitattributes machinery, which is
- * not thread-safe.
+ * This lock protects the setup of the textconv cache, which is not
+ * thread-safe.  Attributes are looked up in opt->attr_context.
  */
 pthread_mutex_t grep_attr_mutex;
 
@@ -1163,11 +1354,6 @@ static inline void grep_attr_unlock(void)
 		pthread_mutex_unlock(&grep_attr_mutex);
 }
 
-/*
- * Same as git_attr_mutex, but protecting the thread-unsafe object db access.
- */
-pthread_mutex_t grep_read_mutex;
-
 #else
 #define grep_attr_lock()
 #define grep_attr_unlock()
@@ -1177,7 +1363,7 @@ static int match_funcname(struct grep_opt *opt, struct grep_source *gs, char *bo
 {
 	xdemitconf_t *xecfg = opt->priv;
 	if (xecfg && !xecfg->find_func) {
-		grep_source_load_driver(gs);
+		grep_source_load_driver(gs, opt->attr_context);
 		if (gs->driver->funcname.pattern) {
 			const struct userdiff_funcname *pe = &gs->driver->funcname;
 			xdiff_set_find_func(xecfg, pe->pattern, pe->cflags);
@@ -1409,7 +1595,7 @@ static int grep_source_1(struct grep_opt *opt, struct grep_source *gs, int colle
 	opt->last_shown = 0;
 
 	if (opt->allow_textconv) {
-		grep_source_load_driver(gs);
+		grep_source_load_driver(gs, opt->attr_context);
 		/*
 		 * We might set up the shared textconv cache data here, which
 		 * is not thread-safe.
@@ -1426,11 +1612,11 @@ static int grep_source_1(struct grep_opt *opt, struct grep_source *gs, int colle
 	if (!textconv) {
 		switch (opt->binary) {
 		case GREP_BINARY_DEFAULT:
-			if (grep_source_is_binary(gs))
+			if (grep_source_is_binary(opt, gs))
 				binary_match_only = 1;
 			break;
 		case GREP_BINARY_NOMATCH:
-			if (grep_source_is_binary(gs))
+			if (grep_source_is_binary(opt, gs))
 				return 0; /* Assume unmatch */
 			break;
 		case GREP_BINARY_TEXT:
@@ -1687,9 +1873,7 @@ static int grep_source_load_sha1(struct grep_source *gs)
 {
 	enum object_type type;
 
-	grep_read_lock();
 	gs->buf = read_sha1_file(gs->identifier, &type, &gs->size);
-	grep_read_unlock();
 
 	if (!gs->buf)
 		return error(_("'%s': unable to read %s"),
@@ -1749,22 +1933,21 @@ static int grep_source_load(struct grep_source *gs)
 	die("BUG: invalid grep_source type");
 }
 
-void grep_source_load_driver(struct grep_source *gs)
+void grep_source_load_driver(struct grep_source *gs,
+			     struct git_attr_context *attr_context)
 {
 	if (gs->driver)
 		return;
 
-	grep_attr_lock();
 	if (gs->path)
-		gs->driver = userdiff_find_by_path(gs->path);
+		gs->driver = userdiff_find_by_path_ctx(attr_context, gs->path);
 	if (!gs->driver)
 		gs->driver = userdiff_find_by_name("default");
-	grep_attr_unlock();
 }
 
-static int grep_source_is_binary(struct grep_source *gs)
+static int grep_source_is_binary(struct grep_opt *opt, struct grep_source *gs)
 {
-	grep_source_load_driver(gs);
+	grep_source_load_driver(gs, opt->attr_context);
 	if (gs->driver->binary != -1)
 		return gs->driver->binary;
 
@@ -136,6 +136,9 @@ struct grep_opt {
 	int heading;
 	void *priv;
 
+	/* for the attribute lookups of the thread using this grep_opt */
+	struct git_attr_context *attr_context;
+
 	void (*output)(struct grep_opt *opt, const void *data, size_t size);
 	void *output_priv;
 };
@@ -150,6 +153,13 @@ extern void append_grep_pat(struct grep_opt *opt, const char *pat, size_t patlen
 extern void append_grep_pattern(struct grep_opt *opt, const char *pat, const char *origin, int no, enum grep_pat_token t);
 extern void append_header_grep_pattern(struct grep_opt *, enum grep_header_field, const char *);
 extern void compile_grep_patterns(struct grep_opt *opt);
+
+/*
+ * Fill query with what a blob must contain for the compiled patterns
+ * of opt to match it.  Return 0 if nothing can be said.
+ */
+struct trigram_query;
+extern int grep_trigram_query(struct grep_opt *opt, struct trigram_query *query);
 extern void free_grep_patterns(struct grep_opt *opt);
 extern int grep_buffer(struct grep_opt *opt, char *buf, unsigned long size);
 
@@ -175,7 +185,7 @@ void grep_source_init(struct grep_source *gs, enum grep_source_type type,
 		      const void *identifier);
 void grep_source_clear_data(struct grep_source *gs);
 void grep_source_clear(struct grep_source *gs);
-void grep_source_load_driver(struct grep_source *gs);
+void grep_source_load_driver(struct grep_source *gs, struct git_attr_context *);
 
 
 int grep_source(struct grep_opt *opt, struct grep_source *gs);
@@ -185,28 +195,19 @@ extern int grep_threads_ok(const struct grep_opt *opt);
 
 #ifndef NO_PTHREADS
 /*
- * Mutex used around access to the attributes machinery if
+ * Mutex used around setting up the textconv machinery if
  * opt->use_threads.  Must be initialized/destroyed by callers!
  */
 extern int grep_use_locks;
 extern pthread_mutex_t grep_attr_mutex;
-extern pthread_mutex_t grep_read_mutex;
-
-static inline void grep_read_lock(void)
-{
-	if (grep_use_locks)
-		pthread_mutex_lock(&grep_read_mutex);
-}
-
-static inline void grep_read_unlock(void)
-{
-	if (grep_use_locks)
-		pthread_mutex_unlock(&grep_read_mutex);
-}
-
-#else
-#define grep_read_lock()
-#define grep_read_unlock()
 #endif
 
+/*
+ * The thread-unsafe object db access is protected by the object read
+ * lock, which the callers enable along with grep_use_locks;
+ * read_sha1_file() takes it by itself.
+ */
+#define grep_read_lock() obj_read_lock()
+#define grep_read_unlock() obj_read_unlock()
+
 #endif
@@ -8,6 +8,7 @@
 #include "string-list.h"
 #include "url.h"
 #include "argv-array.h"
+#include "protocol.h"
 
 static const char content_type[] = "Content-Type";
 static const char content_length[] = "Content-Length";
@@ -396,8 +397,15 @@ static void get_info_refs(char *arg)
 		hdr_str(content_type, buf.buf);
 		end_headers();
 
-		packet_write(1, "# service=git-%s\n", svc->name);
-		packet_flush(1);
+		/*
+		 * upload-pack speaking protocol v2 starts with its own
+		 * "version 2" line instead.
+		 */
+		if (strcmp(svc->name, "upload-pack") ||
+		    determine_protocol_version_server() != protocol_v2) {
+			packet_write(1, "# service=git-%s\n", svc->name);
+			packet_flush(1);
+		}
 
 		argv[0] = svc->name;
 		run_service(argv);
@@ -578,6 +586,9 @@ int main(int argc, char **argv)
 
 	if (!method)
 		die("No REQUEST_METHOD from server");
+	/* the web server passes the Git-Protocol header on this way */
+	if (getenv("HTTP_GIT_PROTOCOL"))
+		setenv(GIT_PROTOCOL_ENVIRONMENT, getenv("HTTP_GIT_PROTOCOL"), 1);
 	if (!strcmp(method, "HEAD"))
 		method = "GET";
 	dir = getdir();
@@ -148,6 +148,12 @@ struct http_get_options {
 	 * for details.
 	 */
 	struct strbuf *base_url;
+
+	/*
+	 * If non-NULL, additional "Name: value" headers to send with
+	 * the request.
+	 */
+	struct string_list *extra_headers;
 };
 
 /* Return values for http_get_*() */
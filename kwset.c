@@ -45,6 +45,18 @@
 
 #define U(c) ((unsigned char) (c))
 
+/* The keyword sets git builds hold a single keyword, or a handful.
+   For those, we look 16 positions at a time for the places where
+   the first and the last character of some keyword occur at the
+   right distance from each other, and compare the keywords only
+   there.  This is much faster than walking the trie, or making the
+   Boyer-Moore shifts, one character at a time. */
+#define KWS_VEC_WORDS 4
+#if defined(__GNUC__) && defined(__SSE2__)
+#define KWS_VEC
+#include <emmintrin.h>
+#endif
+
 /* Balanced tree of edges and labels leaving a given trie node. */
 struct tree
 {
@@ -81,6 +93,11 @@ struct kwset
   char *target;			/* Target string if there's only one. */
   int mind2;			/* Used in Boyer-Moore search for one string. */
   char const *trans;		/* Character translation table. */
+  int nvec;			/* Number of keywords for vecexec, or zero. */
+  char *vword[KWS_VEC_WORDS];	/* The first keywords, translated. */
+  int vlen[KWS_VEC_WORDS];	/* Their lengths. */
+  unsigned char vfirst[KWS_VEC_WORDS][2]; /* Characters that translate to */
+  unsigned char vlast[KWS_VEC_WORDS][2];  /* their first and last ones. */
 };
 
 /* Allocate and initialize a keyword set object, returning an opaque
@@ -112,6 +129,7 @@ kwsalloc (char const *trans)
   kwset->maxd = -1;
   kwset->target = NULL;
   kwset->trans = trans;
+  kwset->nvec = 0;
 
   return (kwset_t) kwset;
 }
@@ -136,6 +154,21 @@ kwsincr (kwset_t kws, char const *text, size_t len)
 
   kwset = (struct kwset *) kws;
   trie = kwset->trie;
+
+  /* Keep the first few keywords around for vecexec. */
+  if (kwset->words < KWS_VEC_WORDS)
+    {
+      char *word = obstack_alloc(&kwset->obstack, len + 1);
+      size_t i;
+
+      if (!word)
+	return "memory exhausted";
+      for (i = 0; i < len; ++i)
+	word[i] = kwset->trans ? kwset->trans[U(text[i])] : text[i];
+      kwset->vword[kwset->words] = word;
+      kwset->vlen[kwset->words] = len;
+    }
+
   text += len;
 
   /* Descend the trie (built of reversed keywords) character-by-character,
@@ -373,6 +406,53 @@ treenext (struct tree const *tree, struct trie *next[])
   next[tree->label] = tree->trie;
 }
 
+/* Find the characters that translate to C, and return how many
+   there are if they are one or two, zero otherwise. */
+static int
+vecchars (struct kwset const *kwset, unsigned char c, unsigned char out[2])
+{
+  int i, n = 0;
+
+  if (!kwset->trans)
+    {
+      out[0] = out[1] = c;
+      return 1;
+    }
+  for (i = 0; i < NCHAR; ++i)
+    if (U(kwset->trans[i]) == c)
+      {
+	if (n == 2)
+	  return 0;
+	out[n++] = i;
+      }
+  if (n == 1)
+    out[1] = out[0];
+  return n;
+}
+
+/* Decide whether vecexec can search for the keyword set. */
+static int
+vecprep (struct kwset *kwset)
+{
+  int k;
+
+  if (kwset->words > KWS_VEC_WORDS || kwset->mind <= 0)
+    return 0;
+  /* memchr is as good as it gets for a single character. */
+  if (kwset->words == 1 && !kwset->trans && kwset->mind == 1)
+    return 0;
+  for (k = 0; k < kwset->words; ++k)
+    {
+      char const *word = kwset->vword[k];
+      int len = kwset->vlen[k];
+
+      if (!vecchars(kwset, U(word[0]), kwset->vfirst[k]) ||
+	  !vecchars(kwset, U(word[len - 1]), kwset->vlast[k]))
+	return 0;
+    }
+  return kwset->words;
+}
+
 /* Compute the shift for each trie node, as well as the delta
    table and next cache for the given keyword set. */
 const char *
@@ -487,6 +567,8 @@ kwsprep (kwset_t kws)
   else
     memcpy(kwset->delta, delta, NCHAR);
 
+  kwset->nvec = vecprep(kwset);
+
   return NULL;
 }
 
@@ -732,6 +814,102 @@ cwexec (kwset_t kws, char const *text, size_t len, struct kwsmatch *kwsmatch)
   return mch - text;
 }
 
+#ifdef KWS_VEC
+/* Return the index of the longest keyword that occurs at POS in TEXT,
+   or -1 if none does. */
+static int
+vecmatch (struct kwset const *kwset, char const *text, size_t size,
+	  size_t pos)
+{
+  char const *trans = kwset->trans;
+  int k, j, len, best = -1;
+
+  for (k = 0; k < kwset->nvec; ++k)
+    {
+      len = kwset->vlen[k];
+      if (size - pos < len || (best >= 0 && len <= kwset->vlen[best]))
+	continue;
+      if (!trans)
+	{
+	  if (!memcmp(text + pos, kwset->vword[k], len))
+	    best = k;
+	  continue;
+	}
+      for (j = 0; j < len; ++j)
+	if (trans[U(text[pos + j])] != kwset->vword[k][j])
+	  break;
+      if (j == len)
+	best = k;
+    }
+  return best;
+}
+
+/* Search for a few keywords 16 characters at a time. */
+static size_t
+vecexec (kwset_t kws, char const *text, size_t size,
+	 struct kwsmatch *kwsmatch)
+{
+  struct kwset const *kwset = (struct kwset const *) kws;
+  __m128i first0[KWS_VEC_WORDS], first1[KWS_VEC_WORDS];
+  __m128i last0[KWS_VEC_WORDS], last1[KWS_VEC_WORDS];
+  size_t pos = 0, end;
+  int k, best = -1;
+
+  if (size < kwset->mind)
+    return -1;
+  for (k = 0; k < kwset->nvec; ++k)
+    {
+      first0[k] = _mm_set1_epi8(kwset->vfirst[k][0]);
+      first1[k] = _mm_set1_epi8(kwset->vfirst[k][1]);
+      last0[k] = _mm_set1_epi8(kwset->vlast[k][0]);
+      last1[k] = _mm_set1_epi8(kwset->vlast[k][1]);
+    }
+
+  /* The loads of the last characters must stay within the text. */
+  if (size >= kwset->maxd + 15)
+    for (end = size - kwset->maxd - 15; pos <= end; pos += 16)
+      {
+	__m128i a = _mm_loadu_si128((__m128i const *) (text + pos));
+	unsigned int mask = 0;
+
+	for (k = 0; k < kwset->nvec; ++k)
+	  {
+	    __m128i b = _mm_loadu_si128((__m128i const *)
+					(text + pos + kwset->vlen[k] - 1));
+	    __m128i f = _mm_or_si128(_mm_cmpeq_epi8(a, first0[k]),
+				     _mm_cmpeq_epi8(a, first1[k]));
+	    __m128i l = _mm_or_si128(_mm_cmpeq_epi8(b, last0[k]),
+				     _mm_cmpeq_epi8(b, last1[k]));
+	    mask |= _mm_movemask_epi8(_mm_and_si128(f, l));
+	  }
+	for (; mask; mask &= mask - 1)
+	  {
+	    best = vecmatch(kwset, text, size, pos + __builtin_ctz(mask));
+	    if (best >= 0)
+	      {
+		pos += __builtin_ctz(mask);
+		goto found;
+	      }
+	  }
+      }
+
+  /* Now we have only a few characters left to search. */
+  for (; size - pos >= kwset->mind; ++pos)
+    if ((best = vecmatch(kwset, text, size, pos)) >= 0)
+      goto found;
+  return -1;
+
+ found:
+  if (kwsmatch)
+    {
+      kwsmatch->index = best;
+      kwsmatch->offset[0] = pos;
+      kwsmatch->size[0] = kwset->vlen[best];
+    }
+  return pos;
+}
+#endif
+
 /* Search through the given text for a match of any member of the
    given keyword set.  Return a pointer to the first character of
    the matching substring, or NULL if no match is found.  If FOUNDLEN
@@ -744,6 +922,10 @@ kwsexec (kwset_t kws, char const *text, size_t size,
 	 struct kwsmatch *kwsmatch)
 {
   struct kwset const *kwset = (struct kwset *) kws;
+#ifdef KWS_VEC
+  if (kwset->nvec)
+    return vecexec(kws, text, size, kwsmatch);
+#endif
   if (kwset->words == 1 && kwset->trans == NULL)
     {
       size_t ret = bmexec (kws, text, size);
@@ -0,0 +1,648 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "midx.h"
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_CHUNKID_PACKNAMES 0x504e414d /* "PNAM" */
+#define MIDX_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
+#define MIDX_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
+#define MIDX_CHUNKID_OBJECTOFFSETS 0x4f4f4646 /* "OOFF" */
+#define MIDX_CHUNKID_LARGEOFFSETS 0x4c4f4646 /* "LOFF" */
+
+#define MIDX_VERSION 1
+#define MIDX_OID_VERSION 1 /* SHA-1 */
+#define MIDX_OID_LEN 20
+
+#define MIDX_HEADER_SIZE 12
+#define MIDX_CHUNKLOOKUP_WIDTH 12
+#define MIDX_FANOUT_SIZE (4 * 256)
+#define MIDX_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_WIDTH 8
+#define MIDX_LARGE_OFFSET_NEEDED 0x80000000
+#define MIDX_MIN_SIZE (MIDX_HEADER_SIZE + 5 * MIDX_CHUNKLOOKUP_WIDTH + \
+		       MIDX_FANOUT_SIZE + MIDX_OID_LEN)
+
+struct multi_pack_index {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t num_packs;
+	uint32_t num_objects;
+
+	const unsigned char *chunk_pack_names;
+	const unsigned char *chunk_oid_fanout;
+	const unsigned char *chunk_oid_lookup;
+	const unsigned char *chunk_object_offsets;
+	const unsigned char *chunk_large_offsets;
+	size_t large_offsets_len;
+
+	/* the name of the .idx of each pack, sorted, and the pack itself */
+	const char **pack_names;
+	struct packed_git **packs;
+};
+
+static struct multi_pack_index *midx;
+static int midx_prepared;
+
+static char *get_midx_filename(void)
+{
+	return mkpathdup("%s/pack/multi-pack-index", get_object_directory());
+}
+
+static struct multi_pack_index *load_midx(const char *midx_name)
+{
+	int fd;
+	struct stat st;
+	size_t len, i, chunk_lookup_len, names_len;
+	const unsigned char *data, *chunk_lookup;
+	const char *name;
+	struct multi_pack_index *m;
+	unsigned char num_chunks;
+	const unsigned char *names_end = NULL;
+
+	fd = git_open_noatime(midx_name);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	len = xsize_t(st.st_size);
+	if (len < MIDX_MIN_SIZE) {
+		close(fd);
+		error("multi-pack-index file %s is too small", midx_name);
+		return NULL;
+	}
+	data = xmmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	m = xcalloc(1, sizeof(*m));
+	m->data = data;
+	m->data_len = len;
+
+	if (get_be32(data) != MIDX_SIGNATURE) {
+		error("multi-pack-index signature %X does not match signature %X",
+		      get_be32(data), MIDX_SIGNATURE);
+		goto cleanup_fail;
+	}
+	if (data[4] != MIDX_VERSION) {
+		error("multi-pack-index version %d does not match version %d",
+		      data[4], MIDX_VERSION);
+		goto cleanup_fail;
+	}
+	if (data[5] != MIDX_OID_VERSION) {
+		error("multi-pack-index hash version %d does not match version %d",
+		      data[5], MIDX_OID_VERSION);
+		goto cleanup_fail;
+	}
+	num_chunks = data[6];
+	/* data[7] is the number of base multi-pack-index files, always 0 */
+	m->num_packs = get_be32(data + 8);
+
+	/* the chunk table ends with a terminating entry */
+	chunk_lookup = data + MIDX_HEADER_SIZE;
+	chunk_lookup_len = (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+	if (MIDX_HEADER_SIZE + chunk_lookup_len + MIDX_OID_LEN > len) {
+		error("multi-pack-index chunk lookup table is truncated");
+		goto cleanup_fail;
+	}
+
+	for (i = 0; i < num_chunks; i++) {
+		const unsigned char *entry = chunk_lookup + i * MIDX_CHUNKLOOKUP_WIDTH;
+		uint32_t chunk_id = get_be32(entry);
+		uint64_t chunk_offset = get_be64(entry + 4);
+		uint64_t next_offset = get_be64(entry + 4 + MIDX_CHUNKLOOKUP_WIDTH);
+
+		if (chunk_offset > next_offset ||
+		    next_offset > len - MIDX_OID_LEN) {
+			error("multi-pack-index chunk %08x has an improper offset",
+			      chunk_id);
+			goto cleanup_fail;
+		}
+
+		switch (chunk_id) {
+		case MIDX_CHUNKID_PACKNAMES:
+			m->chunk_pack_names = data + chunk_offset;
+			names_end = data + next_offset;
+			break;
+		case MIDX_CHUNKID_OIDFANOUT:
+			if (next_offset - chunk_offset != MIDX_FANOUT_SIZE)
+				goto bad_chunk;
+			m->chunk_oid_fanout = data + chunk_offset;
+			break;
+		case MIDX_CHUNKID_OIDLOOKUP:
+			m->chunk_oid_lookup = data + chunk_offset;
+			m->num_objects = (next_offset - chunk_offset) / MIDX_OID_LEN;
+			break;
+		case MIDX_CHUNKID_OBJECTOFFSETS:
+			m->chunk_object_offsets = data + chunk_offset;
+			if ((next_offset - chunk_offset) / MIDX_OFFSET_WIDTH !=
+			    m->num_objects)
+				goto bad_chunk;
+			break;
+		case MIDX_CHUNKID_LARGEOFFSETS:
+			m->chunk_large_offsets = data + chunk_offset;
+			m->large_offsets_len = next_offset - chunk_offset;
+			break;
+		}
+		continue;
+
+	bad_chunk:
+		error("multi-pack-index chunk %08x has an improper size", chunk_id);
+		goto cleanup_fail;
+	}
+
+	if (!m->chunk_pack_names || !m->chunk_oid_fanout ||
+	    !m->chunk_oid_lookup || !m->chunk_object_offsets) {
+		error("multi-pack-index is missing a required chunk");
+		goto cleanup_fail;
+	}
+	if (get_be32(m->chunk_oid_fanout + 4 * 255) != m->num_objects) {
+		error("multi-pack-index fanout does not match the number of objects");
+		goto cleanup_fail;
+	}
+
+	m->pack_names = xcalloc(m->num_packs, sizeof(*m->pack_names));
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+	name = (const char *)m->chunk_pack_names;
+	for (i = 0; i < m->num_packs; i++) {
+		names_len = (const char *)names_end - name;
+		if (!memchr(name, '\0', names_len) ||
+		    (i && strcmp(m->pack_names[i - 1], name) >= 0)) {
+			error("multi-pack-index pack names are corrupt");
+			goto cleanup_fail;
+		}
+		m->pack_names[i] = name;
+		name += strlen(name) + 1;
+	}
+
+	return m;
+
+cleanup_fail:
+	munmap((void *)data, len);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+	return NULL;
+}
+
+/* "/path/to/pack-1234.pack" -> "pack-1234.idx" */
+static void pack_idx_name(struct strbuf *sb, struct packed_git *p)
+{
+	const char *base = strrchr(p->pack_name, '/');
+
+	base = base ? base + 1 : p->pack_name;
+	strbuf_reset(sb);
+	strbuf_add(sb, base, strlen(base) - strlen(".pack"));
+	strbuf_addstr(sb, ".idx");
+}
+
+static int midx_pack_pos(struct multi_pack_index *m, const char *idx_name)
+{
+	int lo = 0, hi = m->num_packs;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		int cmp = strcmp(idx_name, m->pack_names[mi]);
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
+
+void prepare_multi_pack_index(void)
+{
+	struct strbuf idx_name = STRBUF_INIT;
+	struct packed_git *p;
+
+	if (!midx_prepared) {
+		char *midx_name;
+
+		midx_prepared = 1;
+		if (!core_multi_pack_index)
+			return;
+		midx_name = get_midx_filename();
+		midx = load_midx(midx_name);
+		free(midx_name);
+	}
+	if (!midx)
+		return;
+
+	for (p = packed_git; p; p = p->next) {
+		int pos;
+
+		if (!p->pack_local || p->multi_pack_index)
+			continue;
+		pack_idx_name(&idx_name, p);
+		pos = midx_pack_pos(midx, idx_name.buf);
+		if (pos < 0 || midx->packs[pos])
+			continue;
+		midx->packs[pos] = p;
+		p->multi_pack_index = 1;
+	}
+	strbuf_release(&idx_name);
+}
+
+void close_midx(void)
+{
+	struct packed_git *p;
+
+	for (p = packed_git; p; p = p->next)
+		p->multi_pack_index = 0;
+	midx_prepared = 0;
+	if (!midx)
+		return;
+	munmap((void *)midx->data, midx->data_len);
+	free(midx->pack_names);
+	free(midx->packs);
+	free(midx);
+	midx = NULL;
+}
+
+static int bsearch_midx(struct multi_pack_index *m, const unsigned char *sha1,
+			uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? get_be32(m->chunk_oid_fanout + 4 * (sha1[0] - 1)) : 0;
+	hi = get_be32(m->chunk_oid_fanout + 4 * sha1[0]);
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, m->chunk_oid_lookup + MIDX_OID_LEN * mi);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+{
+	uint32_t pack_int_id = get_be32(m->chunk_object_offsets +
+					MIDX_OFFSET_WIDTH * pos);
+	if (pack_int_id >= m->num_packs)
+		die("multi-pack-index has an invalid pack id %"PRIu32, pack_int_id);
+	return pack_int_id;
+}
+
+static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+{
+	uint32_t offset = get_be32(m->chunk_object_offsets +
+				   MIDX_OFFSET_WIDTH * pos + 4);
+
+	if (!(offset & MIDX_LARGE_OFFSET_NEEDED))
+		return offset;
+
+	offset &= ~MIDX_LARGE_OFFSET_NEEDED;
+	if (!m->chunk_large_offsets ||
+	    (size_t)offset * MIDX_LARGE_OFFSET_WIDTH +
+	    MIDX_LARGE_OFFSET_WIDTH > m->large_offsets_len)
+		die("multi-pack-index has an invalid large offset");
+	return get_be64(m->chunk_large_offsets + MIDX_LARGE_OFFSET_WIDTH * offset);
+}
+
+int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e)
+{
+	struct packed_git *p;
+	uint32_t pos;
+	unsigned i;
+
+	if (!midx || !bsearch_midx(midx, sha1, &pos))
+		return 0;
+
+	p = midx->packs[nth_midxed_pack_int_id(midx, pos)];
+	if (!p)
+		return -1;
+	for (i = 0; i < p->num_bad_objects; i++)
+		if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+			return -1;
+
+	/*
+	 * As in fill_pack_entry(), make sure the pack is still there
+	 * before telling the caller to look into it.
+	 */
+	if (!is_pack_valid(p)) {
+		warning("packfile %s cannot be accessed", p->pack_name);
+		return -1;
+	}
+	e->offset = nth_midxed_offset(midx, pos);
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
+/* Writing */
+
+struct pack_info {
+	char *idx_name;
+	struct packed_git *p;
+	int orig_pos; /* position in the current index, or -1 */
+};
+
+struct midx_entry {
+	unsigned char sha1[20];
+	uint32_t pack_int_id;
+	time_t pack_mtime;
+	off_t offset;
+};
+
+struct midx_entry_list {
+	struct midx_entry *list;
+	uint32_t nr;
+	uint32_t alloc;
+};
+
+static int pack_info_cmp(const void *a_, const void *b_)
+{
+	const struct pack_info *a = a_, *b = b_;
+	return strcmp(a->idx_name, b->idx_name);
+}
+
+/*
+ * Sort by object name; if an object is in more than one pack, the
+ * youngest pack comes first, as that is the one prepare_packed_git()
+ * would have tried first.
+ */
+static int midx_entry_cmp(const void *a_, const void *b_)
+{
+	const struct midx_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+	if (a->pack_mtime != b->pack_mtime)
+		return a->pack_mtime > b->pack_mtime ? -1 : 1;
+	return a->pack_int_id < b->pack_int_id ? -1 :
+		a->pack_int_id > b->pack_int_id;
+}
+
+static void add_midx_entry(struct midx_entry_list *entries,
+			   const unsigned char *sha1,
+			   const struct pack_info *info, uint32_t pack_int_id,
+			   off_t offset)
+{
+	struct midx_entry *e;
+
+	ALLOC_GROW(entries->list, entries->nr + 1, entries->alloc);
+	e = &entries->list[entries->nr++];
+	hashcpy(e->sha1, sha1);
+	e->pack_int_id = pack_int_id;
+	e->pack_mtime = info->p->mtime;
+	e->offset = offset;
+}
+
+static void collect_packs(struct pack_info **packs_p, uint32_t *nr_p)
+{
+	struct strbuf idx_name = STRBUF_INIT;
+	struct pack_info *packs = NULL;
+	uint32_t nr = 0, alloc = 0;
+	struct packed_git *p;
+
+	for (p = packed_git; p; p = p->next) {
+		if (!p->pack_local)
+			continue;
+		if (!p->multi_pack_index && open_pack_index(p)) {
+			warning("skipping pack %s with an unreadable index",
+				p->pack_name);
+			continue;
+		}
+		pack_idx_name(&idx_name, p);
+		ALLOC_GROW(packs, nr + 1, alloc);
+		packs[nr].idx_name = strbuf_detach(&idx_name, NULL);
+		packs[nr].p = p;
+		packs[nr].orig_pos = p->multi_pack_index ?
+			midx_pack_pos(midx, packs[nr].idx_name) : -1;
+		nr++;
+	}
+	qsort(packs, nr, sizeof(*packs), pack_info_cmp);
+
+	*packs_p = packs;
+	*nr_p = nr;
+}
+
+static void collect_entries(struct midx_entry_list *entries,
+			    struct pack_info *packs, uint32_t nr_packs)
+{
+	uint32_t i, j;
+
+	/* reuse what the current index knows about the packs it covers */
+	if (midx) {
+		int *remap = xmalloc(midx->num_packs * sizeof(*remap));
+
+		for (i = 0; i < midx->num_packs; i++)
+			remap[i] = -1;
+		for (i = 0; i < nr_packs; i++)
+			if (packs[i].orig_pos >= 0)
+				remap[packs[i].orig_pos] = i;
+
+		for (i = 0; i < midx->num_objects; i++) {
+			int pack_int_id = remap[nth_midxed_pack_int_id(midx, i)];
+			if (pack_int_id < 0)
+				continue;
+			add_midx_entry(entries,
+				       midx->chunk_oid_lookup + MIDX_OID_LEN * i,
+				       &packs[pack_int_id], pack_int_id,
+				       nth_midxed_offset(midx, i));
+		}
+		free(remap);
+	}
+
+	for (i = 0; i < nr_packs; i++) {
+		struct packed_git *p = packs[i].p;
+
+		if (packs[i].orig_pos >= 0)
+			continue;
+		for (j = 0; j < p->num_objects; j++)
+			add_midx_entry(entries, nth_packed_object_sha1(p, j),
+				       &packs[i], i,
+				       nth_packed_object_offset(p, j));
+	}
+
+	qsort(entries->list, entries->nr, sizeof(*entries->list),
+	      midx_entry_cmp);
+
+	/* keep only the first (preferred) copy of each object */
+	for (i = j = 0; i < entries->nr; i++) {
+		if (j && !hashcmp(entries->list[j - 1].sha1, entries->list[i].sha1))
+			continue;
+		if (i != j)
+			entries->list[j] = entries->list[i];
+		j++;
+	}
+	entries->nr = j;
+}
+
+static size_t pack_names_size(struct pack_info *packs, uint32_t nr_packs)
+{
+	size_t size = 0;
+	uint32_t i;
+
+	for (i = 0; i < nr_packs; i++)
+		size += strlen(packs[i].idx_name) + 1;
+	/* pad the chunk, so that the following ones are aligned */
+	return (size + 3) & ~3;
+}
+
+static void write_midx_chunk_pack_names(struct sha1file *f,
+					struct pack_info *packs,
+					uint32_t nr_packs)
+{
+	static const unsigned char padding[4];
+	size_t written = 0;
+	uint32_t i;
+
+	for (i = 0; i < nr_packs; i++) {
+		size_t len = strlen(packs[i].idx_name) + 1;
+		sha1write(f, packs[i].idx_name, len);
+		written += len;
+	}
+	sha1write(f, padding, pack_names_size(packs, nr_packs) - written);
+}
+
+static void write_midx_chunk_fanout(struct sha1file *f,
+				    struct midx_entry_list *entries)
+{
+	uint32_t i, count = 0;
+
+	for (i = 0; i < 256; i++) {
+		while (count < entries->nr && entries->list[count].sha1[0] <= i)
+			count++;
+		sha1write_be32(f, count);
+	}
+}
+
+static void write_midx_chunk_oids(struct sha1file *f,
+				  struct midx_entry_list *entries)
+{
+	uint32_t i;
+
+	for (i = 0; i < entries->nr; i++)
+		sha1write(f, entries->list[i].sha1, MIDX_OID_LEN);
+}
+
+static void write_midx_chunk_object_offsets(struct sha1file *f,
+					    struct midx_entry_list *entries)
+{
+	uint32_t i, nr_large = 0;
+
+	for (i = 0; i < entries->nr; i++) {
+		struct midx_entry *e = &entries->list[i];
+
+		sha1write_be32(f, e->pack_int_id);
+		if (e->offset < MIDX_LARGE_OFFSET_NEEDED)
+			sha1write_be32(f, e->offset);
+		else
+			sha1write_be32(f, MIDX_LARGE_OFFSET_NEEDED | nr_large++);
+	}
+}
+
+static void write_midx_chunk_large_offsets(struct sha1file *f,
+					   struct midx_entry_list *entries)
+{
+	uint32_t i;
+
+	for (i = 0; i < entries->nr; i++)
+		if (entries->list[i].offset >= MIDX_LARGE_OFFSET_NEEDED)
+			sha1write_be64(f, entries->list[i].offset);
+}
+
+static int write_midx(struct pack_info *packs, uint32_t nr_packs,
+		      struct midx_entry_list *entries)
+{
+	static struct lock_file lk;
+	struct sha1file *f;
+	char *midx_name;
+	uint32_t chunk_ids[6];
+	uint64_t chunk_offsets[6];
+	uint32_t nr_large = 0, i;
+	int num_chunks, fd;
+
+	for (i = 0; i < entries->nr; i++)
+		if (entries->list[i].offset >= MIDX_LARGE_OFFSET_NEEDED)
+			nr_large++;
+	num_chunks = nr_large ? 5 : 4;
+
+	chunk_ids[0] = MIDX_CHUNKID_PACKNAMES;
+	chunk_ids[1] = MIDX_CHUNKID_OIDFANOUT;
+	chunk_ids[2] = MIDX_CHUNKID_OIDLOOKUP;
+	chunk_ids[3] = MIDX_CHUNKID_OBJECTOFFSETS;
+	chunk_ids[4] = nr_large ? MIDX_CHUNKID_LARGEOFFSETS : 0;
+	chunk_ids[5] = 0;
+
+	chunk_offsets[0] = MIDX_HEADER_SIZE + (num_chunks + 1) * MIDX_CHUNKLOOKUP_WIDTH;
+	chunk_offsets[1] = chunk_offsets[0] + pack_names_size(packs, nr_packs);
+	chunk_offsets[2] = chunk_offsets[1] + MIDX_FANOUT_SIZE;
+	chunk_offsets[3] = chunk_offsets[2] + (uint64_t)MIDX_OID_LEN * entries->nr;
+	chunk_offsets[4] = chunk_offsets[3] + (uint64_t)MIDX_OFFSET_WIDTH * entries->nr;
+	chunk_offsets[5] = chunk_offsets[4] + (uint64_t)MIDX_LARGE_OFFSET_WIDTH * nr_large;
+
+	midx_name = get_midx_filename();
+	fd = hold_lock_file_for_update(&lk, midx_name, LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lk.filename);
+
+	sha1write_be32(f, MIDX_SIGNATURE);
+	sha1write_u8(f, MIDX_VERSION);
+	sha1write_u8(f, MIDX_OID_VERSION);
+	sha1write_u8(f, num_chunks);
+	sha1write_u8(f, 0); /* number of base multi-pack-index files */
+	sha1write_be32(f, nr_packs);
+
+	for (i = 0; i <= num_chunks; i++) {
+		sha1write_be32(f, chunk_ids[i]);
+		sha1write_be64(f, chunk_offsets[i]);
+	}
+
+	write_midx_chunk_pack_names(f, packs, nr_packs);
+	write_midx_chunk_fanout(f, entries);
+	write_midx_chunk_oids(f, entries);
+	write_midx_chunk_object_offsets(f, entries);
+	write_midx_chunk_large_offsets(f, entries);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lk.fd = -1;
+
+	/* our own mapping of the old file would keep it busy on some systems */
+	close_midx();
+	if (commit_lock_file(&lk)) {
+		error("unable to write %s", midx_name);
+		free(midx_name);
+		return -1;
+	}
+	adjust_shared_perm(midx_name);
+	free(midx_name);
+
+	/* let the packs we just indexed use the new file */
+	prepare_multi_pack_index();
+	return 0;
+}
+
+int write_midx_file(void)
+{
+	struct pack_info *packs;
+	struct midx_entry_list entries;
+	uint32_t nr_packs, i;
+	int ret;
+
+	prepare_packed_git();
+	collect_packs(&packs, &nr_packs);
+
+	memset(&entries, 0, sizeof(entries));
+	collect_entries(&entries, packs, nr_packs);
+
+	ret = write_midx(packs, nr_packs, &entries);
+
+	for (i = 0; i < nr_packs; i++)
+		free(packs[i].idx_name);
+	free(packs);
+	free(entries.list);
+	return ret;
+}
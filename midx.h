@@ -0,0 +1,43 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+/*
+ * The multi-pack-index ($GIT_OBJECT_DIRECTORY/pack/multi-pack-index)
+ * lists the objects of all the local packs in a single sorted table,
+ * mapping each object name to the pack and the offset at which it can
+ * be found.  Looking up an object then costs one binary search instead
+ * of one per pack.  See Documentation/technical/multi-pack-index-format.txt.
+ */
+
+struct pack_entry;
+
+/*
+ * Load the multi-pack-index, if there is one, and associate it with
+ * the local packs that are in the packed_git list.  These packs get
+ * their "multi_pack_index" bit set and need not be searched one by one
+ * anymore.  This is called by prepare_packed_git(), also after new
+ * packs have been added to the list.
+ */
+extern void prepare_multi_pack_index(void);
+
+/*
+ * Look up "sha1" in the multi-pack-index.  Returns 1 and fills "e"
+ * if it was found, 0 if it is in none of the packs the index covers,
+ * and -1 if the index knows the object but the pack it points at
+ * cannot be used (e.g. because it has been removed since), in which
+ * case the caller has to search all the packs.
+ */
+extern int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e);
+
+/* Unmap the multi-pack-index, e.g. before replacing it. */
+extern void close_midx(void);
+
+/*
+ * Write a multi-pack-index covering every local pack.  The entries of
+ * packs that the current index already covers are copied from it;
+ * only the .idx files of the packs added since are read.  Returns 0
+ * on success and -1 (after reporting an error) otherwise.
+ */
+extern int write_midx_file(void);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef NEGOTIATOR_DEFAULT_H
+#define NEGOTIATOR_DEFAULT_H
+
+struct fetch_negotiator;
+
+extern void default_negotiator_init(struct fetch_negotiator *negotiator);
+
+#endif /* NEGOTIATOR_DEFAULT_H */
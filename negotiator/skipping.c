@@ -0,0 +1,242 @@
+#include "cache.h"
+#include "commit.h"
+#include "fetch-negotiator.h"
+#include "prio-queue.h"
+#include "refs.h"
+#include "tag.h"
+#include "skipping.h"
+
+/*
+ * Like the default negotiator, walk our history newest first, but do
+ * not send every commit as "have": along a line of history, skip 1,
+ * 2, 4, 7, 11... commits between two "have"s (the distance grows by
+ * half of itself plus one each time).  When the server acknowledges a
+ * commit, the walk stops there, as the server has all its ancestors.
+ *
+ * A long history the server does not know about then costs a number
+ * of "have"s logarithmic in its length, instead of linear.  In return
+ * the server may not learn about up to the last distance skipped of
+ * commits we have, and send them again.
+ */
+
+/* fetch-pack.c uses 1U << 0 */
+/* The server has this commit, as it advertised it in a ref */
+#define ADVERTISED	(1U << 1)
+/* The server has this commit */
+#define COMMON		(1U << 2)
+/* The commit is in the queue, or was in it */
+#define SEEN		(1U << 3)
+/* The commit was taken out of the queue */
+#define POPPED		(1U << 4)
+
+static int marked;
+
+/*
+ * An entry in the queue.  "ttl" is the number of commits still to
+ * skip before one is sent; "original_ttl" what it was set to after the
+ * last commit sent on this line of history.
+ */
+struct entry {
+	struct commit *commit;
+	uint16_t original_ttl;
+	uint16_t ttl;
+};
+
+struct negotiation_state {
+	struct prio_queue rev_list;
+	int non_common_revs;
+};
+
+static int compare(const void *a_, const void *b_, void *unused)
+{
+	const struct entry *a = a_;
+	const struct entry *b = b_;
+	return compare_commits_by_commit_date(a->commit, b->commit, NULL);
+}
+
+static struct entry *rev_list_push(struct negotiation_state *ns,
+				   struct commit *commit, int mark)
+{
+	struct entry *entry;
+
+	commit->object.flags |= mark | SEEN;
+
+	entry = xcalloc(1, sizeof(*entry));
+	entry->commit = commit;
+	prio_queue_put(&ns->rev_list, entry);
+
+	if (!(mark & COMMON))
+		ns->non_common_revs++;
+	return entry;
+}
+
+static int clear_marks(const char *refname, const unsigned char *sha1, int flag, void *cb_data)
+{
+	struct object *o = deref_tag(parse_object(sha1), refname, 0);
+
+	if (o && o->type == OBJ_COMMIT)
+		clear_commit_marks((struct commit *)o,
+				   COMMON | ADVERTISED | SEEN | POPPED);
+	return 0;
+}
+
+/*
+ * Mark this SEEN commit, and its ancestors that are SEEN, COMMON.
+ */
+static void mark_common(struct negotiation_state *ns, struct commit *c)
+{
+	struct commit_list *p;
+
+	if (c->object.flags & COMMON)
+		return;
+	c->object.flags |= COMMON;
+	if (!(c->object.flags & POPPED))
+		ns->non_common_revs--;
+
+	if (!c->object.parsed)
+		return;
+	for (p = c->parents; p; p = p->next)
+		if (p->item->object.flags & SEEN)
+			mark_common(ns, p->item);
+}
+
+/*
+ * Make sure "to_push", a parent of the commit of "entry", is in the
+ * queue, and how many commits to skip before sending one is right.
+ * Return 0 if it is not, because it was already taken out of it (the
+ * parent is newer than its child, as clocks are not always right).
+ */
+static int push_parent(struct negotiation_state *ns, struct entry *entry,
+		       struct commit *to_push)
+{
+	struct entry *parent_entry = NULL;
+
+	if (to_push->object.flags & SEEN) {
+		int i;
+
+		if (to_push->object.flags & POPPED)
+			return 0;
+		for (i = 0; i < ns->rev_list.nr; i++) {
+			parent_entry = ns->rev_list.array[i];
+			if (parent_entry->commit == to_push)
+				break;
+		}
+		if (i == ns->rev_list.nr)
+			die("BUG: commit %s missing from the queue",
+			    sha1_to_hex(to_push->object.sha1));
+	} else
+		parent_entry = rev_list_push(ns, to_push, 0);
+
+	if (entry->commit->object.flags & (COMMON | ADVERTISED))
+		mark_common(ns, to_push);
+	else {
+		uint16_t new_original_ttl = entry->ttl
+			? entry->original_ttl : entry->original_ttl * 3 / 2 + 1;
+		uint16_t new_ttl = entry->ttl
+			? entry->ttl - 1 : new_original_ttl;
+
+		if (parent_entry->original_ttl < new_original_ttl) {
+			parent_entry->original_ttl = new_original_ttl;
+			parent_entry->ttl = new_ttl;
+		}
+	}
+	return 1;
+}
+
+static const unsigned char *get_rev(struct negotiation_state *ns)
+{
+	struct commit *to_send = NULL;
+
+	while (!to_send) {
+		struct entry *entry;
+		struct commit *commit;
+		struct commit_list *p;
+		int parent_pushed = 0;
+
+		if (ns->rev_list.nr == 0 || ns->non_common_revs == 0)
+			return NULL;
+
+		entry = prio_queue_get(&ns->rev_list);
+		commit = entry->commit;
+		commit->object.flags |= POPPED;
+		if (!(commit->object.flags & COMMON))
+			ns->non_common_revs--;
+
+		if (!(commit->object.flags & COMMON) && !entry->ttl)
+			to_send = commit;
+
+		parse_commit(commit);
+		for (p = commit->parents; p; p = p->next)
+			parent_pushed |= push_parent(ns, entry, p->item);
+
+		/*
+		 * Send the last commit of a line of history, even if
+		 * it was to be skipped.
+		 */
+		if (!(commit->object.flags & COMMON) && !parent_pushed)
+			to_send = commit;
+
+		free(entry);
+	}
+
+	return to_send->object.sha1;
+}
+
+static void known_common(struct fetch_negotiator *n, struct commit *c)
+{
+	if (c->object.flags & SEEN)
+		return;
+	rev_list_push(n->data, c, ADVERTISED);
+}
+
+static void add_tip(struct fetch_negotiator *n, struct commit *c)
+{
+	if (c->object.flags & SEEN)
+		return;
+	rev_list_push(n->data, c, 0);
+}
+
+static const unsigned char *next(struct fetch_negotiator *n)
+{
+	return get_rev(n->data);
+}
+
+static int ack(struct fetch_negotiator *n, struct commit *c)
+{
+	int known_to_be_common = !!(c->object.flags & COMMON);
+
+	if (!(c->object.flags & SEEN))
+		die("received ack for commit %s not sent as 'have'",
+		    sha1_to_hex(c->object.sha1));
+	mark_common(n->data, c);
+	return known_to_be_common;
+}
+
+static void release(struct fetch_negotiator *n)
+{
+	struct negotiation_state *ns = n->data;
+	int i;
+
+	for (i = 0; i < ns->rev_list.nr; i++)
+		free(ns->rev_list.array[i]);
+	clear_prio_queue(&ns->rev_list);
+	free(ns);
+	n->data = NULL;
+}
+
+void skipping_negotiator_init(struct fetch_negotiator *negotiator)
+{
+	struct negotiation_state *ns;
+
+	negotiator->known_common = known_common;
+	negotiator->add_tip = add_tip;
+	negotiator->next = next;
+	negotiator->ack = ack;
+	negotiator->release = release;
+	negotiator->data = ns = xcalloc(1, sizeof(*ns));
+	ns->rev_list.compare = compare;
+
+	if (marked)
+		for_each_ref(clear_marks, NULL);
+	marked = 1;
+}
@@ -0,0 +1,8 @@
+#ifndef NEGOTIATOR_SKIPPING_H
+#define NEGOTIATOR_SKIPPING_H
+
+struct fetch_negotiator;
+
+extern void skipping_negotiator_init(struct fetch_negotiator *negotiator);
+
+#endif /* NEGOTIATOR_SKIPPING_H */
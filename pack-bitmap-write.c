@@ -0,0 +1,520 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "refs.h"
+#include "decorate.h"
+#include "progress.h"
+#include "pack.h"
+#include "pack-objects.h"
+#include "pack-bitmap.h"
+#include "prio-queue.h"
+#include "sha1-lookup.h"
+#include "tree-walk.h"
+#include "csum-file.h"
+
+/*
+ * Commits picked by bitmap_writer_select_commits() are marked with
+ * this flag, so that ref tips are not selected twice.
+ */
+#define BITMAP_SELECTED (1u<<21)
+
+/*
+ * When writing a bitmap, try XORing it against this many of the
+ * bitmaps written just before it, and keep the smallest result.
+ */
+#define MAX_XOR_OFFSET_SEARCH 10
+
+struct bitmapped_commit {
+	struct commit *commit;
+	struct ewah_bitmap *bitmap;
+	struct ewah_bitmap *write_as;
+	int flags;
+	int xor_offset;
+	uint32_t commit_pos;
+};
+
+struct bitmap_writer {
+	struct ewah_bitmap *commits;
+	struct ewah_bitmap *trees;
+	struct ewah_bitmap *blobs;
+	struct ewah_bitmap *tags;
+
+	/* bitmaps computed so far, by commit */
+	struct decoration bitmaps;
+	struct packing_data *to_pack;
+
+	struct bitmapped_commit *selected;
+	unsigned int selected_nr, selected_alloc;
+
+	struct progress *progress;
+	int show_progress;
+	unsigned char pack_checksum[20];
+};
+
+static struct bitmap_writer writer;
+
+void bitmap_writer_show_progress(int show)
+{
+	writer.show_progress = show;
+}
+
+/*
+ * Build the initial type index for the packfile, and record the
+ * position of each object in the pack, which is what the bits of
+ * all the other bitmaps refer to.  "index" must be in pack order.
+ */
+void bitmap_writer_build_type_index(struct packing_data *to_pack,
+				    struct pack_idx_entry **index,
+				    uint32_t index_nr)
+{
+	struct bitmap *commits = bitmap_new();
+	struct bitmap *trees = bitmap_new();
+	struct bitmap *blobs = bitmap_new();
+	struct bitmap *tags = bitmap_new();
+	uint32_t i;
+
+	writer.to_pack = to_pack;
+
+	for (i = 0; i < index_nr; ++i) {
+		struct object_entry *entry = (struct object_entry *)index[i];
+		enum object_type real_type;
+
+		entry->in_pack_pos = i;
+
+		switch (entry->type) {
+		case OBJ_COMMIT:
+		case OBJ_TREE:
+		case OBJ_BLOB:
+		case OBJ_TAG:
+			real_type = entry->type;
+			break;
+
+		default:
+			real_type = sha1_object_info(entry->idx.sha1, NULL);
+			break;
+		}
+
+		switch (real_type) {
+		case OBJ_COMMIT:
+			bitmap_set(commits, i);
+			break;
+
+		case OBJ_TREE:
+			bitmap_set(trees, i);
+			break;
+
+		case OBJ_BLOB:
+			bitmap_set(blobs, i);
+			break;
+
+		case OBJ_TAG:
+			bitmap_set(tags, i);
+			break;
+
+		default:
+			die("Missing type information for %s (%d/%d)",
+			    sha1_to_hex(entry->idx.sha1), real_type, entry->type);
+		}
+	}
+
+	writer.commits = bitmap_to_ewah(commits);
+	writer.trees = bitmap_to_ewah(trees);
+	writer.blobs = bitmap_to_ewah(blobs);
+	writer.tags = bitmap_to_ewah(tags);
+
+	bitmap_free(commits);
+	bitmap_free(trees);
+	bitmap_free(blobs);
+	bitmap_free(tags);
+}
+
+static void push_bitmapped_commit(struct commit *commit)
+{
+	if (commit->object.flags & BITMAP_SELECTED)
+		return;
+	commit->object.flags |= BITMAP_SELECTED;
+
+	ALLOC_GROW(writer.selected, writer.selected_nr + 1,
+		   writer.selected_alloc);
+
+	memset(&writer.selected[writer.selected_nr], 0,
+	       sizeof(writer.selected[0]));
+	writer.selected[writer.selected_nr].commit = commit;
+	writer.selected_nr++;
+}
+
+/*
+ * Recent history is where most fetches end, so we want bitmaps
+ * densely there; older history gets a bitmap every so often, with
+ * the spacing growing as we go back in time.
+ */
+static inline unsigned int next_commit_index(unsigned int idx)
+{
+	static const unsigned int MIN_COMMITS = 100;
+	static const unsigned int MAX_COMMITS = 5000;
+
+	static const unsigned int MUST_REGION = 100;
+	static const unsigned int MIN_REGION = 20000;
+
+	unsigned int offset, next;
+
+	if (idx <= MUST_REGION)
+		return 0;
+
+	if (idx <= MIN_REGION) {
+		offset = idx - MUST_REGION;
+		return (offset < MIN_COMMITS) ? offset : MIN_COMMITS;
+	}
+
+	offset = idx - MIN_REGION;
+	next = (offset < MAX_COMMITS) ? offset : MAX_COMMITS;
+
+	return (next > MIN_COMMITS) ? next : MIN_COMMITS;
+}
+
+static int select_ref_tip(const char *refname, const unsigned char *sha1,
+			  int flags, void *cb_data)
+{
+	struct object *obj = parse_object(sha1);
+
+	obj = deref_tag(obj, refname, 0);
+	if (!obj || obj->type != OBJ_COMMIT)
+		return 0;
+	if (!packlist_find(writer.to_pack, obj->sha1, NULL))
+		return 0;
+	push_bitmapped_commit((struct commit *)obj);
+	return 0;
+}
+
+/*
+ * Choose the commits that get a bitmap: the tips of all branches and
+ * tags (these are what clients ask for), and a selection of the other
+ * commits in "indexed_commits", which must be in traversal order
+ * (newest first).
+ */
+void bitmap_writer_select_commits(struct commit **indexed_commits,
+				  unsigned int indexed_commits_nr)
+{
+	unsigned int i = 0;
+
+	if (writer.show_progress)
+		writer.progress = start_progress("Selecting bitmap commits", 0);
+
+	for_each_branch_ref(select_ref_tip, NULL);
+	for_each_tag_ref(select_ref_tip, NULL);
+
+	while (i < indexed_commits_nr) {
+		push_bitmapped_commit(indexed_commits[i]);
+		display_progress(writer.progress, writer.selected_nr);
+
+		if (indexed_commits_nr < 100)
+			i++;
+		else
+			i += next_commit_index(i) + 1;
+	}
+
+	stop_progress(&writer.progress);
+}
+
+static int object_pos(const unsigned char *sha1, uint32_t *pos)
+{
+	struct object_entry *entry = packlist_find(writer.to_pack, sha1, NULL);
+
+	if (!entry || entry->preferred_base)
+		return error("object %s is not in the pack", sha1_to_hex(sha1));
+	*pos = entry->in_pack_pos;
+	return 0;
+}
+
+/* Returns 1 if the bit was newly set, 0 if it was set, -1 on error. */
+static int mark_object(struct bitmap *base, const unsigned char *sha1)
+{
+	uint32_t pos;
+
+	if (object_pos(sha1, &pos))
+		return -1;
+	if (bitmap_get(base, pos))
+		return 0;
+	bitmap_set(base, pos);
+	return 1;
+}
+
+static int fill_bitmap_tree(struct bitmap *base, const unsigned char *sha1)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+	int ret;
+
+	ret = mark_object(base, sha1);
+	if (ret <= 0)
+		return ret;
+
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf || type != OBJ_TREE) {
+		free(buf);
+		return error("bad tree object %s", sha1_to_hex(sha1));
+	}
+
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		if (S_ISDIR(entry.mode))
+			ret = fill_bitmap_tree(base, entry.sha1);
+		else if (!S_ISGITLINK(entry.mode))
+			ret = mark_object(base, entry.sha1);
+		else
+			continue;
+		if (ret < 0)
+			break;
+	}
+	free(buf);
+	return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Fill "base" with everything reachable from "tip", reusing the
+ * bitmaps of the selected commits we have already computed.
+ */
+static int fill_bitmap_commit(struct bitmap *base, struct commit *tip)
+{
+	struct prio_queue queue = { compare_commits_by_commit_date };
+	struct commit *commit;
+	int ret = 0;
+
+	prio_queue_put(&queue, tip);
+	while (!ret && (commit = prio_queue_get(&queue))) {
+		struct ewah_bitmap *stored;
+		struct commit_list *p;
+
+		if (commit != tip &&
+		    (stored = lookup_decoration(&writer.bitmaps, &commit->object))) {
+			bitmap_or_ewah(base, stored);
+			continue;
+		}
+
+		ret = mark_object(base, commit->object.sha1);
+		if (ret <= 0)
+			continue;
+
+		if (parse_commit(commit)) {
+			ret = error("bad commit object %s",
+				    sha1_to_hex(commit->object.sha1));
+			break;
+		}
+		ret = fill_bitmap_tree(base, commit->tree->object.sha1);
+
+		for (p = commit->parents; p; p = p->next) {
+			if (parse_commit(p->item)) {
+				ret = error("bad commit object %s",
+					    sha1_to_hex(p->item->object.sha1));
+				break;
+			}
+			prio_queue_put(&queue, p->item);
+		}
+	}
+
+	clear_prio_queue(&queue);
+	return ret < 0 ? -1 : 0;
+}
+
+static int date_compare(const void *_a, const void *_b)
+{
+	const struct bitmapped_commit *a = _a, *b = _b;
+
+	if (a->commit->date < b->commit->date)
+		return -1;
+	if (a->commit->date > b->commit->date)
+		return 1;
+	return 0;
+}
+
+static void compute_xor_offsets(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < writer.selected_nr; ++i) {
+		struct bitmapped_commit *stored = &writer.selected[i];
+		struct ewah_bitmap *best = stored->bitmap;
+		struct ewah_bitmap *test_xor = ewah_new();
+		int best_offset = 0, offset;
+
+		for (offset = 1; offset <= MAX_XOR_OFFSET_SEARCH; ++offset) {
+			if ((int)i < offset)
+				break;
+
+			ewah_xor(writer.selected[i - offset].bitmap,
+				 stored->bitmap, test_xor);
+
+			if (test_xor->buffer_size < best->buffer_size) {
+				if (best != stored->bitmap)
+					ewah_free(best);
+				best = test_xor;
+				best_offset = offset;
+				test_xor = ewah_new();
+			}
+		}
+		ewah_free(test_xor);
+
+		stored->xor_offset = best_offset;
+		stored->write_as = best;
+	}
+}
+
+/*
+ * Compute the bitmaps of all the selected commits.  This needs every
+ * object reachable from them to be in the pack; if that is not the
+ * case (e.g. some objects are borrowed from an alternate), an error
+ * is returned and no bitmap index should be written.
+ */
+int bitmap_writer_build(struct packing_data *to_pack)
+{
+	struct bitmap *base = bitmap_new();
+	unsigned int i;
+
+	writer.to_pack = to_pack;
+
+	/* older commits first, so that newer ones can reuse them */
+	for (i = 0; i < writer.selected_nr; i++)
+		if (parse_commit(writer.selected[i].commit))
+			return error("bad commit object %s",
+				     sha1_to_hex(writer.selected[i].commit->object.sha1));
+	qsort(writer.selected, writer.selected_nr,
+	      sizeof(*writer.selected), date_compare);
+
+	if (writer.show_progress)
+		writer.progress = start_progress("Building bitmaps",
+						 writer.selected_nr);
+
+	for (i = 0; i < writer.selected_nr; i++) {
+		struct bitmapped_commit *stored = &writer.selected[i];
+
+		bitmap_reset(base);
+		if (fill_bitmap_commit(base, stored->commit) < 0) {
+			bitmap_free(base);
+			stop_progress(&writer.progress);
+			return -1;
+		}
+
+		stored->bitmap = bitmap_to_ewah(base);
+		add_decoration(&writer.bitmaps, &stored->commit->object,
+			       stored->bitmap);
+		display_progress(writer.progress, i + 1);
+	}
+
+	bitmap_free(base);
+	stop_progress(&writer.progress);
+
+	compute_xor_offsets();
+	return 0;
+}
+
+void bitmap_writer_set_checksum(unsigned char *sha1)
+{
+	hashcpy(writer.pack_checksum, sha1);
+}
+
+static const unsigned char *sha1_access(size_t pos, void *table)
+{
+	struct pack_idx_entry **index = table;
+	return index[pos]->sha1;
+}
+
+static void write_selected_commits_v1(struct sha1file *f,
+				      struct pack_idx_entry **index,
+				      uint32_t index_nr)
+{
+	struct strbuf buf = STRBUF_INIT;
+	unsigned int i;
+
+	for (i = 0; i < writer.selected_nr; ++i) {
+		struct bitmapped_commit *stored = &writer.selected[i];
+		unsigned char header[6];
+		int commit_pos;
+
+		commit_pos = sha1_pos(stored->commit->object.sha1, index,
+				      index_nr, sha1_access);
+		if (commit_pos < 0)
+			die("BUG: trying to write commit not in index");
+
+		put_be32(header, commit_pos);
+		header[4] = stored->xor_offset;
+		header[5] = stored->flags;
+		sha1write(f, header, sizeof(header));
+
+		strbuf_reset(&buf);
+		ewah_serialize_strbuf(stored->write_as, &buf);
+		sha1write(f, buf.buf, buf.len);
+	}
+	strbuf_release(&buf);
+}
+
+static void write_hash_cache(struct sha1file *f,
+			     struct pack_idx_entry **index,
+			     uint32_t index_nr)
+{
+	uint32_t i;
+
+	for (i = 0; i < index_nr; ++i) {
+		struct object_entry *entry = (struct object_entry *)index[i];
+		uint32_t hash_value = htonl(entry->hash);
+		sha1write(f, &hash_value, sizeof(hash_value));
+	}
+}
+
+static void dump_bitmap(struct sha1file *f, struct ewah_bitmap *bitmap)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	ewah_serialize_strbuf(bitmap, &buf);
+	sha1write(f, buf.buf, buf.len);
+	strbuf_release(&buf);
+}
+
+/*
+ * Write the bitmap index to "filename".  "index" must be sorted by
+ * object name, i.e. in the order of the pack's .idx file.
+ */
+void bitmap_writer_finish(struct pack_idx_entry **index,
+			  uint32_t index_nr,
+			  const char *filename,
+			  uint16_t options)
+{
+	static char tmp_file[PATH_MAX];
+	static uint16_t default_version = 1;
+	static uint16_t flags = BITMAP_OPT_FULL_DAG;
+	struct sha1file *f;
+
+	struct bitmap_disk_header header;
+
+	int fd = odb_mkstemp(tmp_file, sizeof(tmp_file), "pack/tmp_bitmap_XXXXXX");
+
+	if (fd < 0)
+		die_errno("unable to create '%s'", tmp_file);
+	f = sha1fd(fd, tmp_file);
+
+	memcpy(header.magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE));
+	header.version = htons(default_version);
+	header.options = htons(flags | options);
+	header.entry_count = htonl(writer.selected_nr);
+	memcpy(header.checksum, writer.pack_checksum, 20);
+
+	sha1write(f, &header, sizeof(header));
+	dump_bitmap(f, writer.commits);
+	dump_bitmap(f, writer.trees);
+	dump_bitmap(f, writer.blobs);
+	dump_bitmap(f, writer.tags);
+	write_selected_commits_v1(f, index, index_nr);
+
+	if (options & BITMAP_OPT_HASH_CACHE)
+		write_hash_cache(f, index, index_nr);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	if (adjust_shared_perm(tmp_file))
+		die_errno("unable to make temporary bitmap file readable");
+
+	if (rename(tmp_file, filename))
+		die_errno("unable to rename temporary bitmap file");
+}
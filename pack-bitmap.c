@@ -0,0 +1,950 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "diff.h"
+#include "revision.h"
+#include "list-objects.h"
+#include "progress.h"
+#include "pack.h"
+#include "pack-revindex.h"
+#include "pack-bitmap.h"
+#include "hashmap.h"
+#include "prio-queue.h"
+#include "tree-walk.h"
+
+/*
+ * An entry on the bitmap index, representing the bitmap for a given
+ * commit.  Bitmaps may be stored XORed against an earlier entry, in
+ * which case they are only composed when first needed.
+ */
+struct stored_bitmap {
+	struct hashmap_entry ent;
+	unsigned char sha1[20];
+	struct ewah_bitmap *root;
+	struct stored_bitmap *xor;
+	int flags;
+};
+
+/*
+ * Objects that are reachable from the walk but are not in the
+ * bitmapped pack get positions after the end of the pack, so that
+ * they can be part of the same result bitmaps.
+ */
+struct ext_entry {
+	struct hashmap_entry ent;
+	unsigned char sha1[20];
+	enum object_type type;
+	uint32_t pos;
+};
+
+static struct bitmap_index {
+	/* Packfile to which this bitmap index belongs to */
+	struct packed_git *pack;
+
+	/* reverse index for the packfile */
+	struct pack_revindex *reverse_index;
+
+	/* mmapped buffer of the whole bitmap index file */
+	unsigned char *map;
+	size_t map_size;
+
+	/* current position when loading the index */
+	size_t map_pos;
+
+	/* number of bitmapped commits */
+	uint32_t entry_count;
+
+	/* name-hash cache (or NULL if not present), in index order */
+	const unsigned char *hashes;
+
+	/* type indexes: one bit set for each object of the given type */
+	struct ewah_bitmap *commits;
+	struct ewah_bitmap *trees;
+	struct ewah_bitmap *blobs;
+	struct ewah_bitmap *tags;
+
+	/* stored_bitmap entries, keyed by commit name */
+	struct hashmap bitmaps;
+
+	/* objects outside of the pack */
+	struct hashmap ext_index;
+	struct ext_entry **ext;
+	uint32_t ext_nr, ext_alloc;
+
+	/* result of the last prepare_bitmap_walk() */
+	struct bitmap *result;
+
+	/* leading objects of the pack to be copied out of it verbatim */
+	uint32_t reuse_objects;
+
+	/* version of the bitmap index */
+	unsigned int version;
+
+	unsigned loaded : 1;
+} bitmap_git;
+
+static int ignore_missing_links;
+
+static unsigned int sha1_hash(const unsigned char *sha1)
+{
+	unsigned int hash;
+	memcpy(&hash, sha1, sizeof(hash));
+	return hash;
+}
+
+static int stored_bitmap_cmp(const struct stored_bitmap *a,
+			     const struct stored_bitmap *b,
+			     const unsigned char *sha1)
+{
+	return hashcmp(a->sha1, sha1 ? sha1 : b->sha1);
+}
+
+static int ext_entry_cmp(const struct ext_entry *a,
+			 const struct ext_entry *b,
+			 const unsigned char *sha1)
+{
+	return hashcmp(a->sha1, sha1 ? sha1 : b->sha1);
+}
+
+static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
+{
+	struct ewah_bitmap *parent;
+	struct ewah_bitmap *composed;
+
+	if (st->xor == NULL)
+		return st->root;
+
+	composed = ewah_new();
+	parent = lookup_stored_bitmap(st->xor);
+	ewah_xor(st->root, parent, composed);
+
+	ewah_free(st->root);
+	st->root = composed;
+	st->xor = NULL;
+
+	return composed;
+}
+
+static struct ewah_bitmap *bitmap_for_commit(const unsigned char *sha1)
+{
+	struct hashmap_entry key;
+	struct stored_bitmap *st;
+
+	hashmap_entry_init(&key, sha1_hash(sha1));
+	st = hashmap_get(&bitmap_git.bitmaps, &key, sha1);
+	if (!st)
+		return NULL;
+	return lookup_stored_bitmap(st);
+}
+
+/*
+ * Read a bitmap from the current read position on the mmaped
+ * index, and increase the read position accordingly
+ */
+static struct ewah_bitmap *read_bitmap_1(struct bitmap_index *index)
+{
+	struct ewah_bitmap *b = ewah_new();
+
+	ssize_t bitmap_size = ewah_read_mmap(b,
+		index->map + index->map_pos,
+		index->map_size - index->map_pos);
+
+	if (bitmap_size < 0) {
+		error("Failed to load bitmap index (corrupted?)");
+		ewah_free(b);
+		return NULL;
+	}
+
+	index->map_pos += bitmap_size;
+	return b;
+}
+
+static int load_bitmap_header(struct bitmap_index *index)
+{
+	struct bitmap_disk_header *header = (void *)index->map;
+	const unsigned char *pack_checksum;
+
+	if (index->map_size < sizeof(*header) + 20)
+		return error("Corrupted bitmap index (missing header data)");
+
+	if (memcmp(header->magic, BITMAP_IDX_SIGNATURE, sizeof(BITMAP_IDX_SIGNATURE)) != 0)
+		return error("Corrupted bitmap index file (wrong header)");
+
+	index->version = ntohs(header->version);
+	if (index->version != 1)
+		return error("Unsupported version for bitmap index file (%d)", index->version);
+
+	/* Parse known bitmap format options */
+	{
+		uint32_t flags = ntohs(header->options);
+
+		if ((flags & BITMAP_OPT_FULL_DAG) == 0)
+			return error("Unsupported options for bitmap index file "
+				"(Git requires BITMAP_OPT_FULL_DAG)");
+
+		if (flags & BITMAP_OPT_HASH_CACHE) {
+			size_t cache_size = index->pack->num_objects * 4;
+			if (index->map_size < sizeof(*header) + 20 + cache_size)
+				return error("Corrupted bitmap index (hash cache too short)");
+			index->hashes = index->map + index->map_size - 20 - cache_size;
+		}
+	}
+
+	/* The idx file records the checksum of its pack before its own. */
+	pack_checksum = (const unsigned char *)index->pack->index_data +
+		index->pack->index_size - 40;
+	if (hashcmp(header->checksum, pack_checksum))
+		return error("Bitmap index does not match %s",
+			     index->pack->pack_name);
+
+	index->entry_count = ntohl(header->entry_count);
+	index->map_pos += sizeof(*header);
+	return 0;
+}
+
+static struct stored_bitmap *store_bitmap(struct bitmap_index *index,
+					  struct ewah_bitmap *root,
+					  const unsigned char *sha1,
+					  struct stored_bitmap *xor_with,
+					  int flags)
+{
+	struct stored_bitmap *stored;
+
+	stored = xmalloc(sizeof(struct stored_bitmap));
+	hashmap_entry_init(stored, sha1_hash(sha1));
+	stored->root = root;
+	stored->xor = xor_with;
+	stored->flags = flags;
+	hashcpy(stored->sha1, sha1);
+
+	/* A commit can only have one bitmap; ignore duplicates. */
+	if (hashmap_get(&index->bitmaps, stored, NULL)) {
+		error("Duplicate entry in bitmap index: %s", sha1_to_hex(sha1));
+		free(stored);
+		return NULL;
+	}
+
+	hashmap_add(&index->bitmaps, stored);
+	return stored;
+}
+
+static int load_bitmap_entries_v1(struct bitmap_index *index)
+{
+	static const size_t MAX_XOR_OFFSET = 160;
+
+	uint32_t i;
+	struct stored_bitmap **recent_bitmaps;
+
+	recent_bitmaps = xcalloc(MAX_XOR_OFFSET, sizeof(*recent_bitmaps));
+
+	for (i = 0; i < index->entry_count; ++i) {
+		int xor_offset, flags;
+		struct ewah_bitmap *bitmap = NULL;
+		struct stored_bitmap *xor_bitmap = NULL;
+		uint32_t commit_idx_pos;
+		const unsigned char *sha1;
+
+		if (index->map_size - index->map_pos < 6)
+			goto corrupt;
+
+		commit_idx_pos = get_be32(index->map + index->map_pos);
+		xor_offset = (int)index->map[index->map_pos + 4];
+		flags = (int)index->map[index->map_pos + 5];
+		index->map_pos += 6;
+
+		if (commit_idx_pos >= index->pack->num_objects)
+			goto corrupt;
+		sha1 = nth_packed_object_sha1(index->pack, commit_idx_pos);
+
+		bitmap = read_bitmap_1(index);
+		if (!bitmap)
+			goto corrupt;
+
+		if (xor_offset > MAX_XOR_OFFSET || xor_offset > i) {
+			ewah_free(bitmap);
+			error("Corrupted bitmap pack index");
+			goto corrupt;
+		}
+
+		if (xor_offset > 0) {
+			xor_bitmap = recent_bitmaps[(i - xor_offset) % MAX_XOR_OFFSET];
+
+			if (xor_bitmap == NULL) {
+				ewah_free(bitmap);
+				error("Invalid XOR offset in bitmap pack index");
+				goto corrupt;
+			}
+		}
+
+		recent_bitmaps[i % MAX_XOR_OFFSET] = store_bitmap(
+			index, bitmap, sha1, xor_bitmap, flags);
+	}
+
+	free(recent_bitmaps);
+	return 0;
+
+corrupt:
+	free(recent_bitmaps);
+	return -1;
+}
+
+static char *pack_bitmap_filename(struct packed_git *p)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t len = strlen(p->pack_name);
+
+	if (len < 5 || strcmp(p->pack_name + len - 5, ".pack"))
+		die("BUG: pack_name does not end in .pack");
+	strbuf_add(&buf, p->pack_name, len - 5);
+	strbuf_addstr(&buf, ".bitmap");
+	return strbuf_detach(&buf, NULL);
+}
+
+static int open_pack_bitmap_1(struct packed_git *packfile)
+{
+	int fd;
+	struct stat st;
+	char *idx_name;
+
+	if (open_pack_index(packfile))
+		return -1;
+
+	idx_name = pack_bitmap_filename(packfile);
+	fd = git_open_noatime(idx_name);
+	free(idx_name);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	if (bitmap_git.pack) {
+		warning("ignoring extra bitmap file: %s", packfile->pack_name);
+		close(fd);
+		return -1;
+	}
+
+	bitmap_git.pack = packfile;
+	bitmap_git.map_size = xsize_t(st.st_size);
+	bitmap_git.map = xmmap(NULL, bitmap_git.map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	bitmap_git.map_pos = 0;
+	close(fd);
+
+	if (load_bitmap_header(&bitmap_git) < 0) {
+		munmap(bitmap_git.map, bitmap_git.map_size);
+		bitmap_git.map = NULL;
+		bitmap_git.map_size = 0;
+		bitmap_git.hashes = NULL;
+		bitmap_git.pack = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int load_pack_bitmap(void)
+{
+	assert(bitmap_git.map && !bitmap_git.loaded);
+
+	hashmap_init(&bitmap_git.bitmaps, (hashmap_cmp_fn)stored_bitmap_cmp, 0);
+	hashmap_init(&bitmap_git.ext_index, (hashmap_cmp_fn)ext_entry_cmp, 0);
+	bitmap_git.reverse_index = revindex_for_pack(bitmap_git.pack);
+
+	if (!(bitmap_git.commits = read_bitmap_1(&bitmap_git)) ||
+	    !(bitmap_git.trees = read_bitmap_1(&bitmap_git)) ||
+	    !(bitmap_git.blobs = read_bitmap_1(&bitmap_git)) ||
+	    !(bitmap_git.tags = read_bitmap_1(&bitmap_git)))
+		goto failed;
+
+	if (load_bitmap_entries_v1(&bitmap_git) < 0)
+		goto failed;
+
+	bitmap_git.loaded = 1;
+	return 0;
+
+failed:
+	munmap(bitmap_git.map, bitmap_git.map_size);
+	bitmap_git.map = NULL;
+	bitmap_git.map_size = 0;
+	bitmap_git.pack = NULL;
+	return -1;
+}
+
+static int open_pack_bitmap(void)
+{
+	struct packed_git *p;
+	int ret = -1;
+
+	assert(!bitmap_git.map && !bitmap_git.loaded);
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (open_pack_bitmap_1(p) == 0)
+			ret = 0;
+	}
+
+	return ret;
+}
+
+int prepare_bitmap_git(void)
+{
+	if (bitmap_git.loaded)
+		return 0;
+
+	if (!open_pack_bitmap())
+		return load_pack_bitmap();
+
+	return -1;
+}
+
+static int bitmap_position_extended(const unsigned char *sha1)
+{
+	struct hashmap_entry key;
+	struct ext_entry *e;
+
+	hashmap_entry_init(&key, sha1_hash(sha1));
+	e = hashmap_get(&bitmap_git.ext_index, &key, sha1);
+	if (e)
+		return e->pos + bitmap_git.pack->num_objects;
+	return -1;
+}
+
+static int bitmap_position_packfile(const unsigned char *sha1)
+{
+	off_t offset = find_pack_entry_one(sha1, bitmap_git.pack);
+	if (!offset)
+		return -1;
+
+	return find_revindex_position(bitmap_git.reverse_index, offset);
+}
+
+static int bitmap_position(const unsigned char *sha1)
+{
+	int pos = bitmap_position_packfile(sha1);
+	return (pos >= 0) ? pos : bitmap_position_extended(sha1);
+}
+
+static int ext_index_add_object(const unsigned char *sha1, enum object_type type)
+{
+	struct ext_entry *e;
+	int pos = bitmap_position(sha1);
+
+	if (pos >= 0)
+		return pos;
+
+	e = xmalloc(sizeof(*e));
+	hashmap_entry_init(e, sha1_hash(sha1));
+	hashcpy(e->sha1, sha1);
+	e->type = type;
+	e->pos = bitmap_git.ext_nr;
+	hashmap_add(&bitmap_git.ext_index, e);
+
+	ALLOC_GROW(bitmap_git.ext, bitmap_git.ext_nr + 1, bitmap_git.ext_alloc);
+	bitmap_git.ext[bitmap_git.ext_nr++] = e;
+
+	return e->pos + bitmap_git.pack->num_objects;
+}
+
+/*
+ * Mark "sha1" in "base" unless it is already there or in "seen".
+ * Returns 1 when the bit was newly set.
+ */
+static int mark_object(struct bitmap *base, struct bitmap *seen,
+		       const unsigned char *sha1, enum object_type type)
+{
+	int pos = ext_index_add_object(sha1, type);
+
+	if (bitmap_get(base, pos) || (seen && bitmap_get(seen, pos)))
+		return 0;
+	bitmap_set(base, pos);
+	return 1;
+}
+
+static void fill_bitmap_tree(struct bitmap *base, struct bitmap *seen,
+			     const unsigned char *sha1)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+
+	if (!mark_object(base, seen, sha1, OBJ_TREE))
+		return;
+
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf || type != OBJ_TREE) {
+		free(buf);
+		if (ignore_missing_links)
+			return;
+		die("bad tree object %s", sha1_to_hex(sha1));
+	}
+
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		if (S_ISDIR(entry.mode))
+			fill_bitmap_tree(base, seen, entry.sha1);
+		else if (!S_ISGITLINK(entry.mode))
+			mark_object(base, seen, entry.sha1, OBJ_BLOB);
+	}
+	free(buf);
+}
+
+static void queue_commit(struct prio_queue *queue, struct commit *commit)
+{
+	if (parse_commit(commit)) {
+		if (ignore_missing_links)
+			return;
+		die("bad commit object %s", sha1_to_hex(commit->object.sha1));
+	}
+	prio_queue_put(queue, commit);
+}
+
+/*
+ * Compute the bitmap of everything reachable from "roots", skipping
+ * what is already in "seen".  Commits that have a stored bitmap are
+ * not walked; their bitmap is ORed into the result instead.  The walk
+ * goes in commit date order, so that we are likely to reach the
+ * bitmapped tips of older history before walking into it.
+ */
+static struct bitmap *find_objects(struct object_list *roots,
+				   struct bitmap *seen)
+{
+	struct bitmap *base = bitmap_new();
+	struct prio_queue queue = { compare_commits_by_commit_date };
+
+	for (; roots; roots = roots->next) {
+		struct object *object = roots->item;
+
+		while (object && object->type == OBJ_TAG) {
+			struct tag *tag = (struct tag *)object;
+
+			mark_object(base, seen, object->sha1, OBJ_TAG);
+			if (parse_tag(tag) < 0) {
+				if (!ignore_missing_links)
+					die("bad tag object %s", sha1_to_hex(object->sha1));
+				object = NULL;
+				break;
+			}
+			object = tag->tagged;
+			if (object && !object->parsed)
+				object = parse_object(object->sha1);
+		}
+		if (!object)
+			continue;
+
+		switch (object->type) {
+		case OBJ_COMMIT:
+			queue_commit(&queue, (struct commit *)object);
+			break;
+		case OBJ_TREE:
+			fill_bitmap_tree(base, seen, object->sha1);
+			break;
+		case OBJ_BLOB:
+			mark_object(base, seen, object->sha1, OBJ_BLOB);
+			break;
+		default:
+			break;
+		}
+	}
+
+	for (;;) {
+		struct commit *commit = prio_queue_get(&queue);
+		struct commit_list *parents;
+		struct ewah_bitmap *stored;
+		int pos;
+
+		if (!commit)
+			break;
+
+		pos = ext_index_add_object(commit->object.sha1, OBJ_COMMIT);
+		if (bitmap_get(base, pos) || (seen && bitmap_get(seen, pos)))
+			continue;
+
+		stored = bitmap_for_commit(commit->object.sha1);
+		if (stored) {
+			bitmap_or_ewah(base, stored);
+			continue;
+		}
+
+		bitmap_set(base, pos);
+		if (commit->tree)
+			fill_bitmap_tree(base, seen, commit->tree->object.sha1);
+
+		for (parents = commit->parents; parents; parents = parents->next)
+			queue_commit(&queue, parents->item);
+	}
+
+	clear_prio_queue(&queue);
+	return base;
+}
+
+static void free_object_list(struct object_list *list)
+{
+	while (list) {
+		struct object_list *next = list->next;
+		free(list);
+		list = next;
+	}
+}
+
+static int in_bitmapped_pack(struct object_list *roots)
+{
+	while (roots) {
+		struct object *object = roots->item;
+		roots = roots->next;
+
+		if (find_pack_entry_one(object->sha1, bitmap_git.pack) > 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+int prepare_bitmap_walk(struct rev_info *revs)
+{
+	unsigned int i;
+	struct object_list *wants = NULL;
+	struct object_list *haves = NULL;
+	struct bitmap *wants_bitmap = NULL;
+	struct bitmap *haves_bitmap = NULL;
+
+	if (!bitmap_git.loaded) {
+		/*
+		 * if we have a bitmap index for this pack, load it into
+		 * memory; otherwise there is nothing we can do
+		 */
+		if (prepare_bitmap_git() < 0)
+			return -1;
+	}
+
+	for (i = 0; i < revs->pending.nr; ++i) {
+		struct object *object = revs->pending.objects[i].item;
+
+		if (object->flags & UNINTERESTING)
+			object_list_insert(object, &haves);
+		else
+			object_list_insert(object, &wants);
+	}
+
+	/*
+	 * if we have a HAVES list, but none of those haves is contained
+	 * in the packfile that has a bitmap, we don't have anything to
+	 * optimize here
+	 */
+	if ((haves && !in_bitmapped_pack(haves)) || !wants) {
+		free_object_list(wants);
+		free_object_list(haves);
+		return -1;
+	}
+
+	bitmap_free(bitmap_git.result);
+	bitmap_git.result = NULL;
+	bitmap_git.reuse_objects = 0;
+
+	if (haves) {
+		ignore_missing_links = 1;
+		haves_bitmap = find_objects(haves, NULL);
+		ignore_missing_links = 0;
+	}
+
+	wants_bitmap = find_objects(wants, haves_bitmap);
+
+	if (haves_bitmap) {
+		bitmap_and_not(wants_bitmap, haves_bitmap);
+		bitmap_free(haves_bitmap);
+	}
+
+	bitmap_git.result = wants_bitmap;
+
+	free_object_list(wants);
+	free_object_list(haves);
+	return 0;
+}
+
+static void show_objects_for_type(struct bitmap *objects,
+				  struct ewah_bitmap *type_filter,
+				  enum object_type object_type,
+				  show_reachable_fn show_reach)
+{
+	size_t pos = 0, i = 0;
+	uint32_t offset;
+
+	struct ewah_iterator it;
+	eword_t filter;
+
+	ewah_iterator_init(&it, type_filter);
+
+	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
+		eword_t word = objects->words[i] & filter;
+
+		for (offset = 0; offset < BITS_IN_EWORD; ++offset) {
+			const unsigned char *sha1;
+			struct revindex_entry *entry;
+			uint32_t hash = 0;
+
+			if ((word >> offset) == 0)
+				break;
+
+			offset += ewah_bit_ctz64(word >> offset);
+
+			if (pos + offset >= bitmap_git.pack->num_objects)
+				break;
+
+			/* the caller copies these out of the pack itself */
+			if (pos + offset < bitmap_git.reuse_objects)
+				continue;
+
+			entry = &bitmap_git.reverse_index->revindex[pos + offset];
+			sha1 = nth_packed_object_sha1(bitmap_git.pack, entry->nr);
+
+			if (bitmap_git.hashes)
+				hash = get_be32(bitmap_git.hashes + 4 * entry->nr);
+
+			show_reach(sha1, object_type, 0, hash, bitmap_git.pack, entry->offset);
+		}
+
+		pos += BITS_IN_EWORD;
+		i++;
+	}
+}
+
+int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+				       uint32_t *entries,
+				       off_t *up_to)
+{
+	/*
+	 * Reuse the packfile content if we need more than
+	 * 90% of its objects
+	 */
+	static const double REUSE_PERCENT = 0.9;
+
+	struct bitmap *result = bitmap_git.result;
+	uint32_t reuse_threshold;
+	uint32_t i, reuse_objects = 0;
+
+	if (!result)
+		die("BUG: reuse_partial_packfile_from_bitmap called without a walk");
+
+	for (i = 0; i < result->word_alloc; ++i) {
+		if (result->words[i] != (eword_t)~0) {
+			reuse_objects += ewah_bit_ctz64(~result->words[i]);
+			break;
+		}
+
+		reuse_objects += BITS_IN_EWORD;
+	}
+
+	if (!reuse_objects)
+		return -1;
+
+	if (reuse_objects >= bitmap_git.pack->num_objects) {
+		bitmap_git.reuse_objects = *entries = bitmap_git.pack->num_objects;
+		*up_to = -1; /* reuse the full pack */
+		*packfile = bitmap_git.pack;
+		return 0;
+	}
+
+	reuse_threshold = bitmap_popcount(result) * REUSE_PERCENT;
+
+	if (reuse_objects < reuse_threshold)
+		return -1;
+
+	bitmap_git.reuse_objects = *entries = reuse_objects;
+	*up_to = bitmap_git.reverse_index->revindex[reuse_objects].offset;
+	*packfile = bitmap_git.pack;
+
+	return 0;
+}
+
+int bitmap_object_is_reused(const unsigned char *sha1)
+{
+	int pos;
+
+	if (!bitmap_git.reuse_objects)
+		return 0;
+	pos = bitmap_position_packfile(sha1);
+	return pos >= 0 && pos < bitmap_git.reuse_objects;
+}
+
+static void show_extended_objects(struct bitmap *objects,
+				  show_reachable_fn show_reach)
+{
+	uint32_t i;
+
+	for (i = 0; i < bitmap_git.ext_nr; ++i) {
+		struct ext_entry *e = bitmap_git.ext[i];
+
+		if (!bitmap_get(objects, bitmap_git.pack->num_objects + i))
+			continue;
+		show_reach(e->sha1, e->type, 0, 0, NULL, 0);
+	}
+}
+
+void traverse_bitmap_commit_list(show_reachable_fn show_reachable)
+{
+	if (!bitmap_git.result)
+		die("BUG: traverse_bitmap_commit_list called without a walk");
+
+	show_objects_for_type(bitmap_git.result, bitmap_git.commits,
+		OBJ_COMMIT, show_reachable);
+	show_objects_for_type(bitmap_git.result, bitmap_git.trees,
+		OBJ_TREE, show_reachable);
+	show_objects_for_type(bitmap_git.result, bitmap_git.blobs,
+		OBJ_BLOB, show_reachable);
+	show_objects_for_type(bitmap_git.result, bitmap_git.tags,
+		OBJ_TAG, show_reachable);
+
+	show_extended_objects(bitmap_git.result, show_reachable);
+
+	bitmap_free(bitmap_git.result);
+	bitmap_git.result = NULL;
+}
+
+static uint32_t count_object_type(struct bitmap *objects,
+				  enum object_type type)
+{
+	struct ewah_bitmap *type_filter = NULL;
+	uint32_t i = 0, count = 0;
+	struct ewah_iterator it;
+	eword_t filter;
+
+	switch (type) {
+	case OBJ_COMMIT:
+		type_filter = bitmap_git.commits;
+		break;
+	case OBJ_TREE:
+		type_filter = bitmap_git.trees;
+		break;
+	case OBJ_BLOB:
+		type_filter = bitmap_git.blobs;
+		break;
+	case OBJ_TAG:
+		type_filter = bitmap_git.tags;
+		break;
+	default:
+		return 0;
+	}
+
+	ewah_iterator_init(&it, type_filter);
+
+	while (i < objects->word_alloc && ewah_iterator_next(&filter, &it)) {
+		eword_t word = objects->words[i++] & filter;
+		count += ewah_bit_popcount64(word);
+	}
+
+	for (i = 0; i < bitmap_git.ext_nr; ++i) {
+		if (bitmap_git.ext[i]->type == type &&
+		    bitmap_get(objects, bitmap_git.pack->num_objects + i))
+			count++;
+	}
+
+	return count;
+}
+
+void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees,
+			      uint32_t *blobs, uint32_t *tags)
+{
+	if (!bitmap_git.result)
+		die("BUG: count_bitmap_commit_list called without a walk");
+
+	if (commits)
+		*commits = count_object_type(bitmap_git.result, OBJ_COMMIT);
+	if (trees)
+		*trees = count_object_type(bitmap_git.result, OBJ_TREE);
+	if (blobs)
+		*blobs = count_object_type(bitmap_git.result, OBJ_BLOB);
+	if (tags)
+		*tags = count_object_type(bitmap_git.result, OBJ_TAG);
+}
+
+struct bitmap_test_data {
+	struct bitmap *base;
+	struct progress *prg;
+	size_t seen;
+};
+
+static void test_show_object(struct object *object,
+			     const struct name_path *path,
+			     const char *last, void *data)
+{
+	struct bitmap_test_data *tdata = data;
+	int bitmap_pos;
+
+	bitmap_pos = bitmap_position(object->sha1);
+	if (bitmap_pos < 0)
+		die("Object not in bitmap: %s\n", sha1_to_hex(object->sha1));
+
+	bitmap_set(tdata->base, bitmap_pos);
+	display_progress(tdata->prg, ++tdata->seen);
+}
+
+static void test_show_commit(struct commit *commit, void *data)
+{
+	struct bitmap_test_data *tdata = data;
+	int bitmap_pos;
+
+	bitmap_pos = bitmap_position(commit->object.sha1);
+	if (bitmap_pos < 0)
+		die("Object not in bitmap: %s\n", sha1_to_hex(commit->object.sha1));
+
+	bitmap_set(tdata->base, bitmap_pos);
+	display_progress(tdata->prg, ++tdata->seen);
+}
+
+void test_bitmap_walk(struct rev_info *revs)
+{
+	struct object *root;
+	struct bitmap *result = NULL;
+	struct ewah_bitmap *stored;
+	size_t result_popcnt;
+	struct bitmap_test_data tdata;
+
+	if (prepare_bitmap_git())
+		die("failed to load bitmap indexes");
+
+	if (revs->pending.nr != 1)
+		die("you must specify exactly one commit to test");
+
+	fprintf(stderr, "Bitmap v%d test (%d entries loaded)\n",
+		bitmap_git.version, bitmap_git.entry_count);
+
+	root = revs->pending.objects[0].item;
+	stored = bitmap_for_commit(root->sha1);
+	if (!stored)
+		die("Commit %s doesn't have an indexed bitmap",
+		    sha1_to_hex(root->sha1));
+
+	fprintf(stderr, "Found bitmap for %s. %d bits / %d set\n",
+		sha1_to_hex(root->sha1), (int)stored->bit_size,
+		(int)ewah_popcount(stored));
+
+	result = ewah_to_bitmap(stored);
+	result_popcnt = bitmap_popcount(result);
+
+	revs->tag_objects = 1;
+	revs->tree_objects = 1;
+	revs->blob_objects = 1;
+
+	if (prepare_revision_walk(revs))
+		die("revision walk setup failed");
+
+	tdata.base = bitmap_new();
+	tdata.prg = start_progress("Verifying bitmap entries", result_popcnt);
+	tdata.seen = 0;
+
+	traverse_commit_list(revs, &test_show_commit, &test_show_object, &tdata);
+
+	stop_progress(&tdata.prg);
+
+	if (bitmap_equals(result, tdata.base))
+		fprintf(stderr, "OK!\n");
+	else
+		die("mismatch in bitmap results");
+
+	bitmap_free(result);
+	bitmap_free(tdata.base);
+}
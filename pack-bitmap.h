@@ -0,0 +1,97 @@
+#ifndef PACK_BITMAP_H
+#define PACK_BITMAP_H
+
+#include "ewah/ewok.h"
+
+/*
+ * A reachability bitmap index (".bitmap") sits next to a packfile and
+ * its ".idx".  For a set of selected commits it stores, as an EWAH
+ * bitmap, every object reachable from that commit; bit "i" stands for
+ * the i-th object of the pack in pack (offset) order.  See
+ * Documentation/technical/bitmap-format.txt for the file format.
+ */
+
+struct commit;
+struct rev_info;
+struct packing_data;
+struct pack_idx_entry;
+
+static const char BITMAP_IDX_SIGNATURE[] = {'B', 'I', 'T', 'M'};
+
+struct bitmap_disk_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t options;
+	uint32_t entry_count;
+	unsigned char checksum[20];
+};
+
+enum pack_bitmap_opts {
+	BITMAP_OPT_FULL_DAG = 1,
+	BITMAP_OPT_HASH_CACHE = 4
+};
+
+typedef int (*show_reachable_fn)(
+	const unsigned char *sha1,
+	enum object_type type,
+	int flags,
+	uint32_t hash,
+	struct packed_git *found_pack,
+	off_t found_offset);
+
+/*
+ * Open the bitmap index of the first pack that has one.  Returns 0
+ * on success, and -1 if there is no usable bitmap.
+ */
+int prepare_bitmap_git(void);
+
+/*
+ * Compute the objects reachable from the interesting pending objects
+ * of "revs" minus those reachable from the uninteresting ones, using
+ * the bitmap index.  Returns -1 (leaving "revs" untouched) when the
+ * bitmaps cannot help, in which case the caller has to fall back to
+ * a regular traversal.
+ */
+int prepare_bitmap_walk(struct rev_info *revs);
+
+/*
+ * After prepare_bitmap_walk(), check whether the objects to send begin
+ * with a run of the objects of the bitmapped pack, in pack order, that
+ * is long enough to be worth copying out of the pack as-is.  If so,
+ * return 0 with the pack, the number of those objects, and the offset
+ * where they end (-1 for all of the pack) in the out parameters; the
+ * traversal below then leaves them out.  Return -1 otherwise.
+ */
+int reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+				       uint32_t *entries,
+				       off_t *up_to);
+
+/* Whether the object is among those to be copied out of the pack */
+int bitmap_object_is_reused(const unsigned char *sha1);
+
+/* Walk the result of prepare_bitmap_walk(). */
+void traverse_bitmap_commit_list(show_reachable_fn show_reachable);
+void count_bitmap_commit_list(uint32_t *commits, uint32_t *trees,
+			      uint32_t *blobs, uint32_t *tags);
+
+/*
+ * Compare the bitmap stored for the single commit in "revs" with the
+ * result of a regular traversal, and die if they differ.
+ */
+void test_bitmap_walk(struct rev_info *revs);
+
+/* Writing, from pack-objects. */
+void bitmap_writer_show_progress(int show);
+void bitmap_writer_set_checksum(unsigned char *sha1);
+void bitmap_writer_build_type_index(struct packing_data *to_pack,
+				    struct pack_idx_entry **index,
+				    uint32_t index_nr);
+void bitmap_writer_select_commits(struct commit **indexed_commits,
+				  unsigned int indexed_commits_nr);
+int bitmap_writer_build(struct packing_data *to_pack);
+void bitmap_writer_finish(struct pack_idx_entry **index,
+			  uint32_t index_nr,
+			  const char *filename,
+			  uint16_t options);
+
+#endif
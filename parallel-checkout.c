@@ -0,0 +1,409 @@
+#include "cache.h"
+#include "convert.h"
+#include "parallel-checkout.h"
+#include "run-command.h"
+#include "streaming.h"
+#include "thread-utils.h"
+
+enum item_status {
+	ITEM_PENDING = 0,
+	ITEM_WRITTEN,
+	ITEM_COLLIDED,
+	ITEM_FAILED
+};
+
+struct checkout_item {
+	struct cache_entry *ce;		/* NULL in a worker */
+	const char *path;
+	unsigned int mode;
+	unsigned char sha1[20];
+	struct conv_attrs ca;
+	enum item_status status;
+	struct stat_data sd;		/* of the file written */
+};
+
+static struct checkout_item *items;
+static int nr_items, alloc_items;
+static int parallel_checkout_active;
+
+static int checkout_workers = 1;
+static int checkout_threshold = 100;
+static int parallel_checkout_config_read;
+
+static int read_parallel_checkout_config(const char *var, const char *value,
+					 void *cb)
+{
+	if (!strcmp(var, "checkout.workers")) {
+		checkout_workers = git_config_int(var, value);
+#ifndef NO_PTHREADS
+		if (checkout_workers < 1)
+			checkout_workers = online_cpus();
+#endif
+		return 0;
+	}
+	if (!strcmp(var, "checkout.thresholdforparallelism")) {
+		checkout_threshold = git_config_int(var, value);
+		return 0;
+	}
+	return 0;
+}
+
+int init_parallel_checkout(void)
+{
+	if (!parallel_checkout_config_read) {
+		parallel_checkout_config_read = 1;
+		git_config(read_parallel_checkout_config, NULL);
+	}
+	nr_items = 0;
+	parallel_checkout_active = checkout_workers > 1;
+	return parallel_checkout_active;
+}
+
+int enqueue_checkout(struct cache_entry *ce)
+{
+	struct checkout_item *item;
+	struct conv_attrs ca;
+
+	if (!parallel_checkout_active || !S_ISREG(ce->ce_mode))
+		return -1;
+	/* filter drivers run commands; keep them in index order */
+	convert_attrs(&ca, ce->name);
+	if (ca.drv)
+		return -1;
+
+	ALLOC_GROW(items, nr_items + 1, alloc_items);
+	item = &items[nr_items++];
+	memset(item, 0, sizeof(*item));
+	item->ce = ce;
+	item->path = ce->name;
+	item->mode = ce->ce_mode;
+	hashcpy(item->sha1, ce->sha1);
+	item->ca = ca;
+	return 0;
+}
+
+static int open_item(const struct checkout_item *item)
+{
+	return open(item->path, O_WRONLY | O_CREAT | O_EXCL,
+		    (item->mode & 0100) ? 0777 : 0666);
+}
+
+static int write_item_in_core(const struct checkout_item *item, int fd)
+{
+	struct strbuf buf = STRBUF_INIT;
+	enum object_type type;
+	unsigned long size;
+	size_t newsize;
+	char *new;
+	int ret = 0;
+
+	new = read_sha1_file(item->sha1, &type, &size);
+	if (!new || type != OBJ_BLOB) {
+		free(new);
+		return error("unable to read sha1 file of %s (%s)",
+			     item->path, sha1_to_hex(item->sha1));
+	}
+	if (convert_to_working_tree_ca(&item->ca, item->path, new, size, &buf)) {
+		free(new);
+		new = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+	if (write_in_full(fd, new, size) != size)
+		ret = error("unable to write file %s", item->path);
+	free(new);
+	return ret;
+}
+
+/*
+ * This is write_entry() for a regular file whose path has already
+ * been prepared by checkout_entry(); since nothing may exist there,
+ * finding something there, or a leading directory gone or replaced by
+ * a symbolic link, means that another entry was checked out over it
+ * (e.g. "A/file" and "a" on a case insensitive file system).  Such an
+ * item is left for checkout_entry() to redo in index order.
+ */
+static void write_item(struct cache_def *cache, struct checkout_item *item)
+{
+	struct stream_filter *filter;
+	struct stat st;
+	int fd, ret = -1;
+
+	if (threaded_has_symlink_leading_path(cache, item->path,
+					      strlen(item->path))) {
+		item->status = ITEM_COLLIDED;
+		return;
+	}
+	fd = open_item(item);
+	if (fd < 0) {
+		if (errno == EEXIST || errno == ENOENT || errno == ENOTDIR) {
+			item->status = ITEM_COLLIDED;
+			return;
+		}
+		error("unable to create file %s (%s)",
+		      item->path, strerror(errno));
+		item->status = ITEM_FAILED;
+		return;
+	}
+
+	filter = get_stream_filter_ca(&item->ca, item->sha1);
+	if (filter) {
+		ret = stream_blob_to_fd(fd, item->sha1, filter, 1);
+		if (ret) {
+			/* fall back to doing it in core, like write_entry() */
+			close(fd);
+			unlink(item->path);
+			fd = open_item(item);
+			if (fd < 0) {
+				error("unable to create file %s (%s)",
+				      item->path, strerror(errno));
+				item->status = ITEM_FAILED;
+				return;
+			}
+		}
+	}
+	if (ret)
+		ret = write_item_in_core(item, fd);
+
+	if (!ret && fstat_is_reliable())
+		ret = fstat(fd, &st);
+	if (close(fd) && !ret)
+		ret = error("unable to write file %s", item->path);
+	if (!ret && !fstat_is_reliable())
+		ret = lstat(item->path, &st);
+	if (ret) {
+		item->status = ITEM_FAILED;
+		return;
+	}
+	fill_stat_data(&item->sd, &st);
+	item->status = ITEM_WRITTEN;
+}
+
+/*
+ * The items are sent to a worker NUL-terminated, as
+ *
+ *   <id> <mode> <sha1> <crlf_action> <eol_attr> <ident> <path>
+ *
+ * and the results come back as
+ *
+ *   <id> <status> <ctime.sec> <ctime.nsec> <mtime.sec> <mtime.nsec>
+ *   <dev> <ino> <uid> <gid> <size>
+ *
+ * A worker reads all of its items before it writes anything, so
+ * neither side can block the other.
+ */
+static void send_item(struct strbuf *out, int id,
+		      const struct checkout_item *item)
+{
+	strbuf_addf(out, "%d %o %s %d %d %d %s", id, item->mode,
+		    sha1_to_hex(item->sha1), item->ca.crlf_action,
+		    item->ca.eol_attr, item->ca.ident, item->path);
+	strbuf_addch(out, '\0');
+}
+
+static void send_result(struct strbuf *out, int id,
+			const struct checkout_item *item)
+{
+	const struct stat_data *sd = &item->sd;
+
+	strbuf_addf(out, "%d %d %u %u %u %u %u %u %u %u %u", id, item->status,
+		    sd->sd_ctime.sec, sd->sd_ctime.nsec,
+		    sd->sd_mtime.sec, sd->sd_mtime.nsec,
+		    sd->sd_dev, sd->sd_ino, sd->sd_uid, sd->sd_gid,
+		    sd->sd_size);
+	strbuf_addch(out, '\0');
+}
+
+static int parse_result(const char *line)
+{
+	struct checkout_item *item;
+	struct stat_data sd;
+	int id, status;
+
+	if (sscanf(line, "%d %d %u %u %u %u %u %u %u %u %u", &id, &status,
+		   &sd.sd_ctime.sec, &sd.sd_ctime.nsec,
+		   &sd.sd_mtime.sec, &sd.sd_mtime.nsec,
+		   &sd.sd_dev, &sd.sd_ino, &sd.sd_uid, &sd.sd_gid,
+		   &sd.sd_size) != 11 ||
+	    id < 0 || id >= nr_items ||
+	    status <= ITEM_PENDING || status > ITEM_FAILED)
+		return error("checkout worker sent a bad result: '%s'", line);
+	item = &items[id];
+	item->status = status;
+	item->sd = sd;
+	return 0;
+}
+
+static void run_workers(int nr_workers)
+{
+	struct child_process *workers;
+	const char *argv[] = { "checkout--worker", NULL };
+	const char *env[3];
+	struct strbuf buf = STRBUF_INIT;
+	int i, j;
+
+	/* the workers write to the same paths, relative to our cwd */
+	env[0] = xstrdup(mkpath("%s=%s", GIT_DIR_ENVIRONMENT,
+				absolute_path(get_git_dir())));
+	env[1] = xstrdup(mkpath("%s=%s", GIT_WORK_TREE_ENVIRONMENT,
+				absolute_path(get_git_work_tree())));
+	env[2] = NULL;
+
+	workers = xcalloc(nr_workers, sizeof(*workers));
+	for (i = 0; i < nr_workers; i++) {
+		struct child_process *cp = &workers[i];
+
+		cp->argv = argv;
+		cp->env = env;
+		cp->git_cmd = 1;
+		cp->in = -1;
+		cp->out = -1;
+		if (start_command(cp)) {
+			/* the items left pending are written by us */
+			nr_workers = i;
+			break;
+		}
+	}
+
+	/* round-robin, so that every worker gets some of each directory */
+	for (i = 0; i < nr_workers; i++) {
+		strbuf_reset(&buf);
+		for (j = i; j < nr_items; j += nr_workers)
+			send_item(&buf, j, &items[j]);
+		if (write_in_full(workers[i].in, buf.buf, buf.len) != buf.len)
+			error("unable to send entries to checkout worker: %s",
+			      strerror(errno));
+		close(workers[i].in);
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		char *line, *end;
+
+		strbuf_reset(&buf);
+		if (strbuf_read(&buf, workers[i].out, 0) < 0)
+			error("unable to read from checkout worker: %s",
+			      strerror(errno));
+		close(workers[i].out);
+		if (finish_command(&workers[i]))
+			error("checkout worker %d failed", i);
+		for (line = buf.buf, end = buf.buf + buf.len; line < end;
+		     line += strlen(line) + 1)
+			parse_result(line);
+	}
+
+	strbuf_release(&buf);
+	free(workers);
+	free((char *)env[0]);
+	free((char *)env[1]);
+}
+
+int run_parallel_checkout(struct checkout *state)
+{
+	struct cache_def cache;
+	int i, nr_workers, first_collided = -1, errs = 0;
+
+	if (!parallel_checkout_active)
+		return 0;
+	parallel_checkout_active = 0;
+
+	nr_workers = checkout_workers;
+	if (nr_workers > nr_items)
+		nr_workers = nr_items;
+	if (nr_workers > 1 && nr_items >= checkout_threshold)
+		run_workers(nr_workers);
+
+	/* whatever the workers did not do (if any), we do ourselves */
+	memset(&cache, 0, sizeof(cache));
+	for (i = 0; i < nr_items; i++)
+		if (items[i].status == ITEM_PENDING)
+			write_item(&cache, &items[i]);
+
+	for (i = 0; i < nr_items; i++) {
+		struct checkout_item *item = &items[i];
+		struct cache_entry *ce = item->ce;
+
+		switch (item->status) {
+		case ITEM_WRITTEN:
+			if (!state->refresh_cache)
+				break;
+			/* what fill_stat_cache_info() does */
+			ce->ce_stat_data = item->sd;
+			if (assume_unchanged)
+				ce->ce_flags |= CE_VALID;
+			ce_mark_uptodate(ce);
+			break;
+		case ITEM_COLLIDED:
+			if (first_collided < 0)
+				first_collided = i;
+			break;
+		default:
+			errs = -1;
+			break;
+		}
+	}
+
+	/*
+	 * When entries collided, which one ended up in the file depends on
+	 * the order the workers wrote them in.  Check out everything from
+	 * the first collision on again, one at a time and in index order,
+	 * so that the result is the same as without workers: the last
+	 * entry wins.
+	 */
+	for (i = first_collided; 0 <= i && i < nr_items; i++) {
+		struct checkout_item *item = &items[i];
+
+		if (item->status == ITEM_WRITTEN)
+			unlink(item->path);
+		else if (item->status != ITEM_COLLIDED)
+			continue;
+		errs |= checkout_entry(item->ce, state, NULL);
+	}
+	nr_items = 0;
+	return errs ? -1 : 0;
+}
+
+int checkout_worker(int in, int out)
+{
+	struct strbuf buf = STRBUF_INIT, result = STRBUF_INIT;
+	struct cache_def cache;
+	char *line, *end;
+	int i, *ids = NULL, alloc_ids = 0;
+
+	if (strbuf_read(&buf, in, 0) < 0)
+		die_errno("unable to read the entries to check out");
+
+	nr_items = 0;
+	for (line = buf.buf, end = buf.buf + buf.len; line < end;
+	     line += strlen(line) + 1) {
+		struct checkout_item *item;
+		int id, crlf_action, eol_attr, ident, consumed;
+		char hex[41];
+
+		ALLOC_GROW(items, nr_items + 1, alloc_items);
+		ALLOC_GROW(ids, nr_items + 1, alloc_ids);
+		item = &items[nr_items];
+		memset(item, 0, sizeof(*item));
+		if (sscanf(line, "%d %o %40s %d %d %d %n", &id, &item->mode,
+			   hex, &crlf_action, &eol_attr, &ident,
+			   &consumed) != 6 ||
+		    get_sha1_hex(hex, item->sha1) || !line[consumed])
+			die("bad entry to check out: '%s'", line);
+		item->ca.crlf_action = crlf_action;
+		item->ca.eol_attr = eol_attr;
+		item->ca.ident = ident;
+		item->path = line + consumed;
+		ids[nr_items++] = id;
+	}
+
+	memset(&cache, 0, sizeof(cache));
+	for (i = 0; i < nr_items; i++) {
+		write_item(&cache, &items[i]);
+		send_result(&result, ids[i], &items[i]);
+	}
+	if (write_in_full(out, result.buf, result.len) != result.len)
+		die_errno("unable to report the checked out entries");
+
+	strbuf_release(&result);
+	strbuf_release(&buf);
+	free(ids);
+	return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+struct cache_entry;
+struct checkout;
+
+/*
+ * Parallel checkout: while it is active, checkout_entry() only
+ * prepares the path of a regular file (removing what was there and
+ * creating the leading directories) and queues the entry; the files
+ * are then written by run_parallel_checkout(), spread over
+ * checkout.workers "git checkout--worker" processes, each of which
+ * reads the blobs, converts them and writes them out.
+ *
+ * Entries that need a filter driver, symbolic links and submodules are
+ * still checked out right away, in index order.
+ */
+
+/*
+ * Start queueing entries, if checkout.workers asks for more than one
+ * worker.  Returns 1 if it does.
+ */
+extern int init_parallel_checkout(void);
+
+/*
+ * Queue "ce" to be written to its (already prepared) path.  Returns 0
+ * if it was queued, or -1 if it must be checked out right away.
+ */
+extern int enqueue_checkout(struct cache_entry *ce);
+
+/*
+ * Write out all queued entries, and stop queueing.  Entries whose
+ * path turned out to collide with another one (e.g. on a case
+ * insensitive file system) are checked out again, one at a time, with
+ * "state".  Returns 0 on success, or -1 if any entry failed.
+ */
+extern int run_parallel_checkout(struct checkout *state);
+
+/*
+ * The worker side: read the entries to write from "in", and report
+ * the results to "out".
+ */
+extern int checkout_worker(int in, int out);
+
+#endif
@@ -57,12 +57,24 @@ void packet_flush(int fd)
 	write_or_die(fd, "0000", 4);
 }
 
+void packet_delim(int fd)
+{
+	packet_trace("0001", 4, 1);
+	write_or_die(fd, "0001", 4);
+}
+
 void packet_buf_flush(struct strbuf *buf)
 {
 	packet_trace("0000", 4, 1);
 	strbuf_add(buf, "0000", 4);
 }
 
+void packet_buf_delim(struct strbuf *buf)
+{
+	packet_trace("0001", 4, 1);
+	strbuf_add(buf, "0001", 4);
+}
+
 #define hex(a) (hexchar[(a) & 15])
 static char buffer[1000];
 static unsigned format_packet(const char *fmt, va_list args)
@@ -93,6 +105,31 @@ void packet_write(int fd, const char *fmt, ...)
 	write_or_die(fd, buffer, n);
 }
 
+int packet_flush_gently(int fd)
+{
+	packet_trace("0000", 4, 1);
+	return write_in_full(fd, "0000", 4) == 4 ? 0 : -1;
+}
+
+int packet_write_gently(int fd, const char *buf, size_t size)
+{
+	static char hexchar[] = "0123456789abcdef";
+	char header[4];
+	size_t n = size + 4;
+
+	if (size > LARGE_PACKET_MAX - 4)
+		return error("packet write failed: data exceeds max packet size");
+	header[0] = hex(n >> 12);
+	header[1] = hex(n >> 8);
+	header[2] = hex(n >> 4);
+	header[3] = hex(n);
+	packet_trace(buf, size, 1);
+	if (write_in_full(fd, header, 4) != 4 ||
+	    write_in_full(fd, buf, size) != size)
+		return -1;
+	return 0;
+}
+
 void packet_buf_write(struct strbuf *buf, const char *fmt, ...)
 {
 	va_list args;
@@ -107,21 +144,20 @@ void packet_buf_write(struct strbuf *buf, const char *fmt, ...)
 static int get_packet_data(int fd, char **src_buf, size_t *src_size,
 			   void *dst, unsigned size, int options)
 {
-	ssize_t ret;
+	ssize_t ret = 0;
 
-	if (fd >= 0 && src_buf && *src_buf)
-		die("BUG: multiple sources given to packet_read");
-
-	/* Read up to "size" bytes from our source, whatever it is. */
+	/* Read up to "size" bytes from our sources, the buffer first. */
 	if (src_buf && *src_buf) {
 		ret = size < *src_size ? size : *src_size;
 		memcpy(dst, *src_buf, ret);
 		*src_buf += ret;
 		*src_size -= ret;
-	} else {
-		ret = read_in_full(fd, dst, size);
-		if (ret < 0)
+	}
+	if (ret < size && fd >= 0) {
+		ssize_t n = read_in_full(fd, (char *)dst + ret, size - ret);
+		if (n < 0)
 			die_errno("read error");
+		ret += n;
 	}
 
 	/* And complain if we didn't get enough bytes to satisfy the read. */
@@ -160,28 +196,38 @@ static int packet_length(const char *linelen)
 	return len;
 }
 
-int packet_read(int fd, char **src_buf, size_t *src_len,
-		char *buffer, unsigned size, int options)
+enum packet_read_status packet_read_with_status(int fd, char **src_buf,
+						size_t *src_len, char *buffer,
+						unsigned size, int *pktlen,
+						int options)
 {
 	int len, ret;
 	char linelen[4];
 
 	ret = get_packet_data(fd, src_buf, src_len, linelen, 4, options);
 	if (ret < 0)
-		return ret;
+		return PACKET_READ_EOF;
 	len = packet_length(linelen);
 	if (len < 0)
 		die("protocol error: bad line length character: %.4s", linelen);
 	if (!len) {
 		packet_trace("0000", 4, 0);
-		return 0;
+		*pktlen = 0;
+		return PACKET_READ_FLUSH;
 	}
+	if (len == 1) {
+		packet_trace("0001", 4, 0);
+		*pktlen = 0;
+		return PACKET_READ_DELIM;
+	}
+	if (len < 4)
+		die("protocol error: bad line length %d", len);
 	len -= 4;
 	if (len >= size)
 		die("protocol error: bad line length %d", len);
 	ret = get_packet_data(fd, src_buf, src_len, buffer, len, options);
 	if (ret < 0)
-		return ret;
+		return PACKET_READ_EOF;
 
 	if ((options & PACKET_READ_CHOMP_NEWLINE) &&
 	    len && buffer[len-1] == '\n')
@@ -189,7 +235,24 @@ int packet_read(int fd, char **src_buf, size_t *src_len,
 
 	buffer[len] = 0;
 	packet_trace(buffer, len, 0);
-	return len;
+	*pktlen = len;
+	return PACKET_READ_NORMAL;
+}
+
+int packet_read(int fd, char **src_buf, size_t *src_len,
+		char *buffer, unsigned size, int options)
+{
+	int len;
+
+	switch (packet_read_with_status(fd, src_buf, src_len, buffer, size,
+					&len, options)) {
+	case PACKET_READ_EOF:
+		return -1;
+	case PACKET_READ_DELIM:
+		die("protocol error: unexpected delim packet");
+	default:
+		return len;
+	}
 }
 
 static char *packet_read_line_generic(int fd,
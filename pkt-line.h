@@ -20,10 +20,20 @@
  * side can't, we stay with pure read/write interfaces.
  */
 void packet_flush(int fd);
+void packet_delim(int fd);
 void packet_write(int fd, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
 void packet_buf_flush(struct strbuf *buf);
+void packet_buf_delim(struct strbuf *buf);
 void packet_buf_write(struct strbuf *buf, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
 
+/*
+ * Like packet_flush(), and writing a packet with the given contents
+ * (at most LARGE_PACKET_MAX - 4 bytes), but return -1 instead of
+ * dying when the write fails, e.g. because the other end went away.
+ */
+int packet_flush_gently(int fd);
+int packet_write_gently(int fd, const char *buf, size_t size);
+
 /*
  * Read a packetized line into the buffer, which must be at least size bytes
  * long. The return value specifies the number of bytes read into the buffer.
@@ -34,7 +44,8 @@ void packet_buf_write(struct strbuf *buf, const char *fmt, ...) __attribute__((f
  * decremented by the number of bytes consumed.
  *
  * If src_buffer (or *src_buffer) is NULL, then data is read from the
- * descriptor "fd".
+ * descriptor "fd".  If both are given, the buffer is consumed first, and
+ * the rest of the data is read from the descriptor.
  *
  * If options does not contain PACKET_READ_GENTLE_ON_EOF, we will die under any
  * of the following conditions:
@@ -60,6 +71,24 @@ void packet_buf_write(struct strbuf *buf, const char *fmt, ...) __attribute__((f
 int packet_read(int fd, char **src_buffer, size_t *src_len, char
 		*buffer, unsigned size, int options);
 
+/*
+ * Protocol v2 separates the sections of a message with a delim packet
+ * ("0001"), which packet_read() does not expect.  This reads a packet
+ * like packet_read(), but tells the caller what kind of packet it was;
+ * for PACKET_READ_NORMAL, the length of the data is stored in *pktlen.
+ * PACKET_READ_EOF is only returned with PACKET_READ_GENTLE_ON_EOF.
+ */
+enum packet_read_status {
+	PACKET_READ_EOF,
+	PACKET_READ_NORMAL,
+	PACKET_READ_FLUSH,
+	PACKET_READ_DELIM
+};
+enum packet_read_status packet_read_with_status(int fd, char **src_buffer,
+						size_t *src_len, char *buffer,
+						unsigned size, int *pktlen,
+						int options);
+
 /*
  * Convenience wrapper for packet_read that is not gentle, and sets the
  * CHOMP_NEWLINE option. The return value is NULL for a flush packet,
@@ -0,0 +1,65 @@
+#include "cache.h"
+#include "commit.h"
+#include "protocol.h"
+#include "string-list.h"
+
+static enum protocol_version parse_protocol_version(const char *value)
+{
+	if (!strcmp(value, "0"))
+		return protocol_v0;
+	else if (!strcmp(value, "2"))
+		return protocol_v2;
+	else
+		return protocol_unknown_version;
+}
+
+static int protocol_config(const char *var, const char *value, void *cb)
+{
+	enum protocol_version *version = cb;
+
+	if (!strcmp(var, "protocol.version")) {
+		if (!value)
+			return config_error_nonbool(var);
+		*version = parse_protocol_version(value);
+		if (*version == protocol_unknown_version)
+			die("unknown value for config '%s': %s", var, value);
+	}
+	return 0;
+}
+
+enum protocol_version get_protocol_version_config(void)
+{
+	enum protocol_version version = protocol_v0;
+
+	git_config(protocol_config, &version);
+	return version;
+}
+
+enum protocol_version determine_protocol_version_server(void)
+{
+	const char *git_protocol = getenv(GIT_PROTOCOL_ENVIRONMENT);
+	struct string_list list = STRING_LIST_INIT_DUP;
+	struct string_list_item *item;
+	enum protocol_version version = protocol_v0;
+
+	if (!git_protocol || is_repository_shallow())
+		return protocol_v0;
+
+	/*
+	 * Ignore what we do not understand; if the client asks for
+	 * more than one version, speak the highest one we know.
+	 */
+	string_list_split(&list, git_protocol, ':', -1);
+	for_each_string_list_item(item, &list) {
+		const char *value = skip_prefix(item->string, "version=");
+		enum protocol_version v;
+
+		if (!value)
+			continue;
+		v = parse_protocol_version(value);
+		if (v > version)
+			version = v;
+	}
+	string_list_clear(&list, 0);
+	return version;
+}
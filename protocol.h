@@ -0,0 +1,41 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+/*
+ * The version of the protocol spoken between fetch-pack and
+ * upload-pack.  Protocol v0 starts with the server advertising all of
+ * its refs and capabilities; in protocol v2 the server only
+ * advertises its capabilities, and the client then sends commands
+ * ("ls-refs", "fetch"), each of which is a self-contained request
+ * answered by a self-contained response.
+ *
+ * The client asks for v2 out of band, so that a server that does not
+ * know about it does not notice: in $GIT_PROTOCOL for local and ssh
+ * connections, in an extra argument of the git:// request, and in a
+ * Git-Protocol header over http.  In all three cases, the value is a
+ * colon-separated list of key=value pairs, e.g. "version=2".
+ */
+enum protocol_version {
+	protocol_unknown_version = -1,
+	protocol_v0 = 0,
+	protocol_v2 = 2
+};
+
+#define GIT_PROTOCOL_ENVIRONMENT "GIT_PROTOCOL"
+#define GIT_PROTOCOL_HEADER "Git-Protocol"
+
+/*
+ * The version the client asks for, as configured with
+ * protocol.version (protocol_v0 if it is not set).
+ */
+extern enum protocol_version get_protocol_version_config(void);
+
+/*
+ * The version the server speaks: the one the client asked for in
+ * $GIT_PROTOCOL, if we know it.  A shallow repository is always served
+ * with protocol v0, whose ref advertisement tells the client about the
+ * shallow commits.  The repository must have been entered already.
+ */
+extern enum protocol_version determine_protocol_version_server(void);
+
+#endif /* PROTOCOL_H */
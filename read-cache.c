@@ -14,6 +14,10 @@
 #include "resolve-undo.h"
 #include "strbuf.h"
 #include "varint.h"
+#include "split-index.h"
+#include "ewah/ewok.h"
+#include "fsmonitor.h"
+#include "thread-utils.h"
 
 static struct cache_entry *refresh_cache_entry(struct cache_entry *ce, int really);
 
@@ -33,6 +37,11 @@ static struct cache_entry *refresh_cache_entry(struct cache_entry *ce, int reall
 #define CACHE_EXT(s) ( (s[0]<<24)|(s[1]<<16)|(s[2]<<8)|(s[3]) )
 #define CACHE_EXT_TREE 0x54524545	/* "TREE" */
 #define CACHE_EXT_RESOLVE_UNDO 0x52455543 /* "REUC" */
+#define CACHE_EXT_LINK 0x6c696e6b	  /* "link" */
+#define CACHE_EXT_UNTRACKED 0x554E5452	  /* "UNTR" */
+#define CACHE_EXT_FSMONITOR 0x46534D4E	  /* "FSMN" */
+#define CACHE_EXT_INDEXENTRYOFFSETTABLE 0x49454F54 /* "IEOT" */
+#define CACHE_EXT_ENDOFINDEXENTRIES 0x454F4945	  /* "EOIE" */
 
 struct index_state the_index;
 
@@ -289,6 +298,8 @@ int ie_match_stat(const struct index_state *istate,
 		return 0;
 	if (!ignore_valid && (ce->ce_flags & CE_VALID))
 		return 0;
+	if (!ignore_valid && (ce->ce_flags & CE_FSMONITOR_VALID))
+		return 0;
 
 	/*
 	 * Intent-to-add entries have not been added, so the index entry
@@ -478,6 +489,7 @@ int remove_index_entry_at(struct index_state *istate, int pos)
 
 	record_resolve_undo(istate, ce);
 	remove_name_hash(istate, ce);
+	untracked_cache_invalidate_path(istate, ce->name);
 	istate->cache_changed = 1;
 	istate->cache_nr--;
 	if (pos >= istate->cache_nr)
@@ -499,9 +511,10 @@ void remove_marked_cache_entries(struct index_state *istate)
 	unsigned int i, j;
 
 	for (i = j = 0; i < istate->cache_nr; i++) {
-		if (ce_array[i]->ce_flags & CE_REMOVE)
+		if (ce_array[i]->ce_flags & CE_REMOVE) {
 			remove_name_hash(istate, ce_array[i]);
-		else
+			untracked_cache_invalidate_path(istate, ce_array[i]->name);
+		} else
 			ce_array[j++] = ce_array[i];
 	}
 	istate->cache_changed = 1;
@@ -949,6 +962,7 @@ static int add_index_entry_with_check(struct index_state *istate, struct cache_e
 		return 0;
 	}
 	pos = -pos-1;
+	untracked_cache_invalidate_path(istate, ce->name);
 
 	/*
 	 * Inserting a merged entry ("stage 0") into the index
@@ -1048,6 +1062,11 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 		ce_mark_uptodate(ce);
 		return ce;
 	}
+	/* core.fsmonitor says it has not been touched */
+	if (!ignore_valid && (ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce_mark_uptodate(ce);
+		return ce;
+	}
 
 	if (lstat(ce->name, &st) < 0) {
 		if (err)
@@ -1074,9 +1093,13 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 			 * We do not mark the index itself "modified"
 			 * because CE_UPTODATE flag is in-core only;
 			 * we are not going to write this change out.
+			 * Only with core.fsmonitor is there anything
+			 * worth remembering about it.
 			 */
-			if (!S_ISGITLINK(ce->ce_mode))
+			if (!S_ISGITLINK(ce->ce_mode)) {
 				ce_mark_uptodate(ce);
+				mark_fsmonitor_valid(istate, ce);
+			}
 			return ce;
 		}
 	}
@@ -1100,6 +1123,8 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 	if (!ignore_valid && assume_unchanged &&
 	    !(ce->ce_flags & CE_VALID))
 		updated->ce_flags &= ~CE_VALID;
+	if (!S_ISGITLINK(updated->ce_mode))
+		mark_fsmonitor_valid(istate, updated);
 
 	return updated;
 }
@@ -1298,6 +1323,21 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_RESOLVE_UNDO:
 		istate->resolve_undo = resolve_undo_read(data, sz);
 		break;
+	case CACHE_EXT_LINK:
+		if (read_link_extension(istate, data, sz))
+			return -1;
+		break;
+	case CACHE_EXT_UNTRACKED:
+		istate->untracked = read_untracked_extension(data, sz);
+		break;
+	case CACHE_EXT_FSMONITOR:
+		if (read_fsmonitor_extension(istate, data, sz))
+			return -1;
+		break;
+	case CACHE_EXT_INDEXENTRYOFFSETTABLE:
+	case CACHE_EXT_ENDOFINDEXENTRIES:
+		/* already used, if at all, before reading the entries */
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1370,8 +1410,16 @@ static unsigned long expand_name_field(struct strbuf *name, const char *cp_)
 	const unsigned char *ep, *cp = (const unsigned char *)cp_;
 	size_t len = decode_varint(&cp);
 
-	if (name->len < len)
-		die("malformed name field in the index");
+	if (name->len < len) {
+		/*
+		 * The first entry of a block of the offset table strips
+		 * all of the previous name, which a thread starting at
+		 * that block does not know.
+		 */
+		if (name->len)
+			die("malformed name field in the index");
+		len = 0;
+	}
 	strbuf_remove(name, name->len - len, len);
 	for (ep = cp; *ep; ep++)
 		; /* find the end */
@@ -1425,16 +1473,510 @@ static struct cache_entry *create_from_disk(struct ondisk_cache_entry *ondisk,
 	return ce;
 }
 
+static int ce_name_stage_cmp(const struct cache_entry *a,
+			     const struct cache_entry *b)
+{
+	return cache_name_stage_compare(a->name, ce_namelen(a), ce_stage(a),
+					b->name, ce_namelen(b), ce_stage(b));
+}
+
+/*
+ * Iterate over the entries of the shared index of a split index,
+ * straight from its mapped file.
+ */
+struct shared_index_walker {
+	const char *map;
+	unsigned long offset;
+	unsigned int nr, pos;
+	struct strbuf previous_name_buf, *previous_name;
+};
+
+static void init_shared_index_walker(struct shared_index_walker *w,
+				     struct split_index *si)
+{
+	struct cache_header *hdr = si->base_mmap;
+
+	w->map = si->base_mmap;
+	w->offset = sizeof(*hdr);
+	w->nr = ntohl(hdr->hdr_entries);
+	w->pos = 0;
+	strbuf_init(&w->previous_name_buf, 0);
+	w->previous_name = ntohl(hdr->hdr_version) == 4 ?
+		&w->previous_name_buf : NULL;
+}
+
+/* Returns the next entry (to be freed by the caller), or NULL at the end */
+static struct cache_entry *next_shared_entry(struct shared_index_walker *w)
+{
+	struct cache_entry *ce;
+	unsigned long consumed;
+
+	if (w->pos >= w->nr) {
+		strbuf_release(&w->previous_name_buf);
+		return NULL;
+	}
+	ce = create_from_disk((struct ondisk_cache_entry *)(w->map + w->offset),
+			      &consumed, w->previous_name);
+	w->offset += consumed;
+	w->pos++;
+	return ce;
+}
+
+/*
+ * Add the entries of the shared index to those read from the split
+ * index, except for those it deletes or replaces.  Both lists are
+ * sorted, so this is a simple merge.
+ */
+static void merge_shared_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	struct cache_entry **own = istate->cache, *ce;
+	unsigned int nr_own = istate->cache_nr, i = 0;
+	struct bitmap *deleted = NULL;
+	struct shared_index_walker w;
+
+	if (si->delete_bitmap)
+		deleted = ewah_to_bitmap(si->delete_bitmap);
+	si->nr_own_entries = nr_own;
+
+	init_shared_index_walker(&w, si);
+	istate->cache_alloc = alloc_nr(w.nr + nr_own);
+	istate->cache = xcalloc(istate->cache_alloc, sizeof(*istate->cache));
+	istate->cache_nr = 0;
+
+	while ((ce = next_shared_entry(&w)) != NULL) {
+		int cmp = 1;
+
+		if (deleted && bitmap_get(deleted, w.pos - 1)) {
+			free(ce);
+			continue;
+		}
+		while (i < nr_own && (cmp = ce_name_stage_cmp(own[i], ce)) < 0)
+			istate->cache[istate->cache_nr++] = own[i++];
+		if (!cmp) {
+			/* replaced by own[i] */
+			free(ce);
+			continue;
+		}
+		set_index_entry(istate, istate->cache_nr++, ce);
+	}
+	while (i < nr_own)
+		istate->cache[istate->cache_nr++] = own[i++];
+
+	free(own);
+	if (deleted)
+		bitmap_free(deleted);
+}
+
+/*
+ * The shared index is written to $GIT_DIR, but look next to the split
+ * index that refers to it first, so that $GIT_INDEX_FILE can name the
+ * index of another repository (e.g. "git check-attr --cached").
+ */
+static void read_shared_index(struct index_state *istate, const char *index_path)
+{
+	struct split_index *si = istate->split_index;
+	struct strbuf path = STRBUF_INIT;
+	const char *slash = strrchr(index_path, '/');
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd;
+
+	if (slash)
+		strbuf_add(&path, index_path, slash - index_path + 1);
+	strbuf_addf(&path, "sharedindex.%s", sha1_to_hex(si->base_sha1));
+	fd = open(path.buf, O_RDONLY);
+	if (fd < 0 && errno == ENOENT) {
+		strbuf_reset(&path);
+		strbuf_addstr(&path, git_path("sharedindex.%s",
+					      sha1_to_hex(si->base_sha1)));
+		fd = open(path.buf, O_RDONLY);
+	}
+	if (fd < 0)
+		die_errno("unable to open shared index file %s", path.buf);
+	if (fstat(fd, &st))
+		die_errno("cannot stat the shared index file %s", path.buf);
+	size = xsize_t(st.st_size);
+	if (size < sizeof(struct cache_header) + 20)
+		die("shared index file %s is smaller than expected", path.buf);
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (verify_hdr(map, size) < 0 ||
+	    hashcmp(si->base_sha1, (unsigned char *)map + size - 20))
+		die("shared index file %s is corrupt", path.buf);
+	strbuf_release(&path);
+
+	si->base_mmap = map;
+	si->base_mmap_size = size;
+	merge_shared_index(istate);
+}
+
+/*
+ * The extensions start right after the entries.  After an array of
+ * istate->cache_nr index entries, there can be arbitrary number of
+ * extended sections, each of which is prefixed with extension name
+ * (4-byte) and section length in 4-byte network byte order.
+ */
+static int read_index_extensions(struct index_state *istate,
+				 const char *mmap, size_t mmap_size,
+				 unsigned long src_offset)
+{
+	while (src_offset <= mmap_size - 20 - 8) {
+		uint32_t extsize = get_be32(mmap + src_offset + 4);
+
+		if (read_index_extension(istate, mmap + src_offset,
+					 (char *)mmap + src_offset + 8,
+					 extsize) < 0)
+			return -1;
+		src_offset += 8;
+		src_offset += extsize;
+	}
+	return 0;
+}
+
+/*
+ * Read "nr" entries starting with the "first" one from "offset",
+ * and return the offset just past them.
+ */
+static unsigned long load_cache_entry_block(struct index_state *istate,
+					    const char *mmap,
+					    unsigned long offset,
+					    int first, int nr)
+{
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	int i;
+
+	previous_name = istate->version == 4 ? &previous_name_buf : NULL;
+	for (i = first; i < first + nr; i++) {
+		struct ondisk_cache_entry *disk_ce;
+		struct cache_entry *ce;
+		unsigned long consumed;
+
+		disk_ce = (struct ondisk_cache_entry *)(mmap + offset);
+		ce = create_from_disk(disk_ce, &consumed, previous_name);
+		set_index_entry(istate, i, ce);
+
+		offset += consumed;
+	}
+	strbuf_release(&previous_name_buf);
+	return offset;
+}
+
+/*
+ * Mostly randomly chosen: below this many entries per thread, it is
+ * not worth starting one to parse them.
+ */
+#define THREAD_COST (10000)
+
+static int index_threads_config = 0;
+static int index_threads_config_read;
+
+static int read_index_threads_config(const char *var, const char *value,
+				     void *cb)
+{
+	if (!strcmp(var, "index.threads")) {
+		int is_bool;
+
+		index_threads_config = git_config_bool_or_int(var, value,
+							      &is_bool);
+		if (is_bool)
+			index_threads_config = !index_threads_config;
+		else if (index_threads_config < 0)
+			return error("index.threads cannot be negative (%d)",
+				     index_threads_config);
+	}
+	return 0;
+}
+
+/*
+ * How many threads to read (or, when writing, to lay out the offset
+ * table for) an index of "nr" entries with.  index.threads is read
+ * here, as the index is often read before the configuration.
+ */
+static int index_threads(unsigned int nr)
+{
+#ifdef NO_PTHREADS
+	return 1;
+#else
+	int threads;
+
+	if (!index_threads_config_read) {
+		index_threads_config_read = 1;
+		git_config(read_index_threads_config, NULL);
+	}
+	threads = index_threads_config;
+	if (!threads) {
+		threads = online_cpus();
+		if (threads > nr / THREAD_COST)
+			threads = nr / THREAD_COST;
+	}
+	return threads > 1 ? threads : 1;
+#endif
+}
+
+/*
+ * The "EOIE" extension, always the last one, records where the
+ * entries end so that the extensions can be read without parsing the
+ * entries first.  Returns that offset, or 0 if there is no (valid)
+ * such extension.
+ */
+#define EOIE_SIZE (4 + 20)
+#define EOIE_SIZE_WITH_HEADER (4 + 4 + EOIE_SIZE)
+
+static unsigned long read_eoie_extension(const char *mmap, size_t mmap_size)
+{
+	const char *eoie, *index;
+	unsigned char sha1[20];
+	unsigned long offset;
+	git_SHA_CTX c;
+
+	if (mmap_size < sizeof(struct cache_header) + EOIE_SIZE_WITH_HEADER + 20)
+		return 0;
+	eoie = mmap + mmap_size - EOIE_SIZE_WITH_HEADER - 20;
+	if (CACHE_EXT(eoie) != CACHE_EXT_ENDOFINDEXENTRIES ||
+	    get_be32(eoie + 4) != EOIE_SIZE)
+		return 0;
+	offset = get_be32(eoie + 8);
+	if (offset < sizeof(struct cache_header) || offset > eoie - mmap)
+		return 0;
+
+	/* the names and sizes of the extensions in between must match */
+	git_SHA1_Init(&c);
+	for (index = mmap + offset; index < eoie; ) {
+		uint32_t extsize;
+
+		if (index + 8 > eoie)
+			return 0;
+		extsize = get_be32(index + 4);
+		git_SHA1_Update(&c, index, 8);
+		index += 8;
+		if (extsize > eoie - index)
+			return 0;
+		index += extsize;
+	}
+	git_SHA1_Final(sha1, &c);
+	if (hashcmp(sha1, (const unsigned char *)eoie + 12))
+		return 0;
+	return offset;
+}
+
+/*
+ * The "IEOT" extension splits the entries into blocks, each of which
+ * can be parsed by its own thread.
+ */
+#define IEOT_VERSION (1)
+
+struct index_entry_offset {
+	unsigned long offset;
+	int nr;
+};
+
+struct index_entry_offset_table {
+	int nr;
+	struct index_entry_offset entries[FLEX_ARRAY];
+};
+
+static struct index_entry_offset_table *read_ieot_extension(
+		struct index_state *istate, const char *mmap,
+		size_t mmap_size, unsigned long offset)
+{
+	struct index_entry_offset_table *ieot;
+	const char *index = NULL, *eoie;
+	uint32_t extsize = 0;
+	unsigned long end = offset, prev_offset = 0;
+	int i, nr, total = 0;
+
+	eoie = mmap + mmap_size - EOIE_SIZE_WITH_HEADER - 20;
+	while (mmap + offset < eoie) {
+		const char *ext = mmap + offset;
+
+		extsize = get_be32(ext + 4);
+		if (CACHE_EXT(ext) == CACHE_EXT_INDEXENTRYOFFSETTABLE) {
+			index = ext + 8;
+			break;
+		}
+		offset += 8 + extsize;
+	}
+	if (!index)
+		return NULL;
+
+	if (extsize < 4 || get_be32(index) != IEOT_VERSION ||
+	    (extsize - 4) % 8)
+		return NULL;
+	index += 4;
+	nr = (extsize - 4) / 8;
+	if (!nr)
+		return NULL;
+
+	ieot = xmalloc(sizeof(*ieot) + nr * sizeof(struct index_entry_offset));
+	ieot->nr = nr;
+	for (i = 0; i < nr; i++) {
+		struct index_entry_offset *e = &ieot->entries[i];
+
+		e->offset = get_be32(index);
+		e->nr = get_be32(index + 4);
+		index += 8;
+		/* blocks are in order, and together hold all entries */
+		if (i ? e->offset <= prev_offset :
+			e->offset != sizeof(struct cache_header))
+			break;
+		if (e->offset >= end || e->nr < 0 ||
+		    e->nr > istate->cache_nr - total)
+			break;
+		prev_offset = e->offset;
+		total += e->nr;
+	}
+	if (i < nr || total != istate->cache_nr) {
+		free(ieot);
+		return NULL;
+	}
+	return ieot;
+}
+
+#ifndef NO_PTHREADS
+struct extension_thread {
+	pthread_t pthread;
+	int started;
+	struct index_state *istate;
+	const char *mmap;
+	size_t mmap_size;
+	unsigned long offset;
+	int ret;
+};
+
+static void *load_index_extensions(void *_data)
+{
+	struct extension_thread *p = _data;
+
+	p->ret = read_index_extensions(p->istate, p->mmap, p->mmap_size,
+				       p->offset);
+	return NULL;
+}
+
+static void start_extension_thread(struct extension_thread *p,
+				   struct index_state *istate,
+				   const char *mmap, size_t mmap_size,
+				   unsigned long offset)
+{
+	p->istate = istate;
+	p->mmap = mmap;
+	p->mmap_size = mmap_size;
+	p->offset = offset;
+	p->ret = 0;
+	p->started = !pthread_create(&p->pthread, NULL,
+				     load_index_extensions, p);
+	if (!p->started)
+		load_index_extensions(p);
+}
+
+static int finish_extension_thread(struct extension_thread *p)
+{
+	if (p->started && pthread_join(p->pthread, NULL))
+		die("unable to join extension loading thread");
+	return p->ret;
+}
+
+struct load_entries_thread {
+	pthread_t pthread;
+	struct index_state *istate;
+	const char *mmap;
+	struct index_entry_offset_table *ieot;
+	int first_block, nr_blocks;
+};
+
+static void *load_cache_entries_thread(void *_data)
+{
+	struct load_entries_thread *p = _data;
+	int i, first = 0;
+
+	for (i = 0; i < p->first_block; i++)
+		first += p->ieot->entries[i].nr;
+	for (i = p->first_block; i < p->first_block + p->nr_blocks; i++) {
+		struct index_entry_offset *e = &p->ieot->entries[i];
+
+		load_cache_entry_block(p->istate, p->mmap, e->offset,
+				       first, e->nr);
+		first += e->nr;
+	}
+	return NULL;
+}
+
+/*
+ * Spread the blocks of the offset table over (at most) "nr_threads"
+ * threads.
+ */
+static void load_cache_entries_threaded(struct index_state *istate,
+					const char *mmap, int nr_threads,
+					struct index_entry_offset_table *ieot)
+{
+	struct load_entries_thread *data;
+	int i, first_block = 0, blocks_per_thread;
+
+	if (nr_threads > ieot->nr)
+		nr_threads = ieot->nr;
+	blocks_per_thread = DIV_ROUND_UP(ieot->nr, nr_threads);
+	data = xcalloc(nr_threads, sizeof(*data));
+	for (i = 0; i < nr_threads && first_block < ieot->nr; i++) {
+		struct load_entries_thread *p = &data[i];
+
+		p->istate = istate;
+		p->mmap = mmap;
+		p->ieot = ieot;
+		p->first_block = first_block;
+		p->nr_blocks = blocks_per_thread;
+		if (first_block + p->nr_blocks > ieot->nr)
+			p->nr_blocks = ieot->nr - first_block;
+		first_block += p->nr_blocks;
+		if (pthread_create(&p->pthread, NULL,
+				   load_cache_entries_thread, p))
+			die("unable to create index loading thread");
+	}
+	nr_threads = i;
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_join(data[i].pthread, NULL))
+			die("unable to join index loading thread");
+	free(data);
+}
+#else
+struct extension_thread {
+	int ret;
+};
+
+static void start_extension_thread(struct extension_thread *p,
+				   struct index_state *istate,
+				   const char *mmap, size_t mmap_size,
+				   unsigned long offset)
+{
+	p->ret = read_index_extensions(istate, mmap, mmap_size, offset);
+}
+
+static int finish_extension_thread(struct extension_thread *p)
+{
+	return p->ret;
+}
+
+static void load_cache_entries_threaded(struct index_state *istate,
+					const char *mmap, int nr_threads,
+					struct index_entry_offset_table *ieot)
+{
+	load_cache_entry_block(istate, mmap, sizeof(struct cache_header),
+			       0, istate->cache_nr);
+}
+#endif
+
 /* remember to discard_cache() before reading a different cache! */
 int read_index_from(struct index_state *istate, const char *path)
 {
-	int fd, i;
+	int fd, nr_threads;
 	struct stat st;
-	unsigned long src_offset;
+	unsigned long src_offset, extension_offset = 0;
 	struct cache_header *hdr;
 	void *mmap;
 	size_t mmap_size;
-	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
+	struct index_entry_offset_table *ieot = NULL;
+	struct extension_thread ext;
 
 	if (istate->initialized)
 		return istate->cache_nr;
@@ -1470,46 +2012,37 @@ int read_index_from(struct index_state *istate, const char *path)
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(*istate->cache));
 	istate->initialized = 1;
 
-	if (istate->version == 4)
-		previous_name = &previous_name_buf;
-	else
-		previous_name = NULL;
-
 	src_offset = sizeof(*hdr);
-	for (i = 0; i < istate->cache_nr; i++) {
-		struct ondisk_cache_entry *disk_ce;
-		struct cache_entry *ce;
-		unsigned long consumed;
-
-		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
-		ce = create_from_disk(disk_ce, &consumed, previous_name);
-		set_index_entry(istate, i, ce);
-
-		src_offset += consumed;
+	nr_threads = index_threads(istate->cache_nr);
+	if (nr_threads > 1)
+		extension_offset = read_eoie_extension(mmap, mmap_size);
+	if (extension_offset) {
+		ieot = read_ieot_extension(istate, mmap, mmap_size,
+					   extension_offset);
+		start_extension_thread(&ext, istate, mmap, mmap_size,
+				       extension_offset);
 	}
-	strbuf_release(&previous_name_buf);
+
+	if (ieot)
+		load_cache_entries_threaded(istate, mmap, nr_threads, ieot);
+	else
+		src_offset = load_cache_entry_block(istate, mmap, src_offset,
+						    0, istate->cache_nr);
+	free(ieot);
 	istate->timestamp.sec = st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
-	while (src_offset <= mmap_size - 20 - 8) {
-		/* After an array of active_nr index entries,
-		 * there can be arbitrary number of extended
-		 * sections, each of which is prefixed with
-		 * extension name (4-byte) and section length
-		 * in 4-byte network byte order.
-		 */
-		uint32_t extsize;
-		memcpy(&extsize, (char *)mmap + src_offset + 4, 4);
-		extsize = ntohl(extsize);
-		if (read_index_extension(istate,
-					 (const char *) mmap + src_offset,
-					 (char *) mmap + src_offset + 8,
-					 extsize) < 0)
+	if (extension_offset) {
+		if (finish_extension_thread(&ext) < 0)
 			goto unmap;
-		src_offset += 8;
-		src_offset += extsize;
+	} else if (read_index_extensions(istate, mmap, mmap_size,
+					 src_offset) < 0) {
+		goto unmap;
 	}
 	munmap(mmap, mmap_size);
+	if (istate->split_index)
+		read_shared_index(istate, path);
+	tweak_fsmonitor(istate);
 	return istate->cache_nr;
 
 unmap:
@@ -1535,6 +2068,14 @@ int discard_index(struct index_state *istate)
 	istate->timestamp.nsec = 0;
 	free_name_hash(istate);
 	cache_tree_free(&(istate->cache_tree));
+	discard_split_index(istate);
+	free_untracked_cache(istate->untracked);
+	istate->untracked = NULL;
+	if (istate->fsmonitor_dirty)
+		ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+	istate->fsmonitor_last_update = 0;
+	istate->fsmonitor_has_run_once = 0;
 	istate->initialized = 0;
 	free(istate->cache);
 	istate->cache = NULL;
@@ -1590,16 +2131,21 @@ static int ce_write(git_SHA_CTX *context, int fd, void *data, unsigned int len)
 	return 0;
 }
 
-static int write_index_ext_header(git_SHA_CTX *context, int fd,
+static int write_index_ext_header(git_SHA_CTX *context,
+				  git_SHA_CTX *eoie_context, int fd,
 				  unsigned int ext, unsigned int sz)
 {
 	ext = htonl(ext);
 	sz = htonl(sz);
+	if (eoie_context) {
+		git_SHA1_Update(eoie_context, &ext, 4);
+		git_SHA1_Update(eoie_context, &sz, 4);
+	}
 	return ((ce_write(context, fd, &ext, 4) < 0) ||
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
 
-static int ce_flush(git_SHA_CTX *context, int fd)
+static int ce_flush(git_SHA_CTX *context, int fd, unsigned char *sha1)
 {
 	unsigned int left = write_buffer_len;
 
@@ -1617,6 +2163,8 @@ static int ce_flush(git_SHA_CTX *context, int fd)
 
 	/* Append the SHA1 signature at the end */
 	git_SHA1_Final(write_buffer + left, context);
+	if (sha1)
+		hashcpy(sha1, write_buffer + left);
 	left += 20;
 	return (write_in_full(fd, write_buffer, left) != left) ? -1 : 0;
 }
@@ -1744,7 +2292,7 @@ static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce,
 
 	result = ce_write(c, fd, ondisk, size);
 	free(ondisk);
-	return result;
+	return result < 0 ? result : size;
 }
 
 static int has_racy_timestamp(struct index_state *istate)
@@ -1772,13 +2320,50 @@ void update_index_if_able(struct index_state *istate, struct lock_file *lockfile
 		rollback_lock_file(lockfile);
 }
 
-int write_index(struct index_state *istate, int newfd)
+static void write_ieot_extension(struct strbuf *sb,
+				 struct index_entry_offset_table *ieot)
 {
-	git_SHA_CTX c;
+	unsigned char buf[4];
+	int i;
+
+	put_be32(buf, IEOT_VERSION);
+	strbuf_add(sb, buf, 4);
+	for (i = 0; i < ieot->nr; i++) {
+		put_be32(buf, ieot->entries[i].offset);
+		strbuf_add(sb, buf, 4);
+		put_be32(buf, ieot->entries[i].nr);
+		strbuf_add(sb, buf, 4);
+	}
+}
+
+static void write_eoie_extension(struct strbuf *sb, git_SHA_CTX *eoie_context,
+				 unsigned long offset)
+{
+	unsigned char buf[4];
+
+	put_be32(buf, offset);
+	strbuf_add(sb, buf, 4);
+	strbuf_grow(sb, 20);
+	git_SHA1_Final((unsigned char *)sb->buf + sb->len, eoie_context);
+	strbuf_setlen(sb, sb->len + 20);
+}
+
+/*
+ * Write the "entries" of "cache" (all of istate's, or only those of a
+ * split index), followed by the extensions.  When "shared_sha1" is
+ * given, we are writing the shared index of a split index, which has
+ * no extensions, and its checksum is stored there.
+ */
+static int do_write_index(struct index_state *istate, int newfd,
+			  struct cache_entry **cache, int entries,
+			  const struct strbuf *link, unsigned char *shared_sha1)
+{
+	git_SHA_CTX c, eoie_c;
 	struct cache_header hdr;
 	int i, err, removed, extended, hdr_version;
-	struct cache_entry **cache = istate->cache;
-	int entries = istate->cache_nr;
+	int nr_blocks, block_size = 0, nr_written = 0;
+	unsigned long offset, entries_end;
+	struct index_entry_offset_table *ieot = NULL;
 	struct stat st;
 	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
 
@@ -1811,11 +2396,40 @@ int write_index(struct index_state *istate, int newfd)
 	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
 
+	/*
+	 * Split the entries into blocks for threads to read them; the
+	 * shared index of a split index has no extensions to say so.
+	 */
+	nr_blocks = shared_sha1 ? 1 : index_threads(entries - removed);
+	if (nr_blocks > 1 && entries > removed) {
+		block_size = DIV_ROUND_UP(entries - removed, nr_blocks);
+		nr_blocks = DIV_ROUND_UP(entries - removed, block_size);
+		ieot = xcalloc(1, sizeof(*ieot) +
+			       nr_blocks * sizeof(struct index_entry_offset));
+	} else {
+		nr_blocks = 1;
+	}
+
+	offset = sizeof(hdr);
 	previous_name = (hdr_version == 4) ? &previous_name_buf : NULL;
 	for (i = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
+		int size;
+
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
+		if (ieot && !(nr_written % block_size)) {
+			ieot->entries[ieot->nr].offset = offset;
+			ieot->entries[ieot->nr].nr = 0;
+			ieot->nr++;
+			/*
+			 * Start the block with a whole name: stripping all
+			 * of the previous one keeps the prefix compression
+			 * readable in a single pass, too.
+			 */
+			if (previous_name && previous_name->len)
+				previous_name->buf[0] = '\0';
+		}
 		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
 			ce_smudge_racily_clean_entry(ce);
 		if (is_null_sha1(ce->sha1)) {
@@ -1826,20 +2440,55 @@ int write_index(struct index_state *istate, int newfd)
 				allow = git_env_bool("GIT_ALLOW_NULL_SHA1", 0);
 			if (allow)
 				warning(msg, ce->name);
-			else
+			else {
+				free(ieot);
 				return error(msg, ce->name);
+			}
 		}
-		if (ce_write_entry(&c, newfd, ce, previous_name) < 0)
+		size = ce_write_entry(&c, newfd, ce, previous_name);
+		if (size < 0) {
+			free(ieot);
 			return -1;
+		}
+		offset += size;
+		nr_written++;
+		if (ieot)
+			ieot->entries[ieot->nr - 1].nr++;
 	}
 	strbuf_release(&previous_name_buf);
+	entries_end = offset;
+
+	if (shared_sha1)
+		return ce_flush(&c, newfd, shared_sha1);
 
 	/* Write extension data here */
+	git_SHA1_Init(&eoie_c);
+	if (ieot) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_ieot_extension(&sb, ieot);
+		free(ieot);
+		err = write_index_ext_header(&c, &eoie_c, newfd,
+					     CACHE_EXT_INDEXENTRYOFFSETTABLE,
+					     sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (link) {
+		err = write_index_ext_header(&c, &eoie_c, newfd,
+					     CACHE_EXT_LINK, link->len) < 0
+			|| ce_write(&c, newfd, link->buf, link->len) < 0;
+		if (err)
+			return -1;
+	}
 	if (istate->cache_tree) {
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_TREE, sb.len) < 0
+		err = write_index_ext_header(&c, &eoie_c, newfd,
+					     CACHE_EXT_TREE, sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
 		if (err)
@@ -1849,7 +2498,42 @@ int write_index(struct index_state *istate, int newfd)
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
-		err = write_index_ext_header(&c, newfd, CACHE_EXT_RESOLVE_UNDO,
+		err = write_index_ext_header(&c, &eoie_c, newfd,
+					     CACHE_EXT_RESOLVE_UNDO, sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (istate->untracked) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_untracked_extension(&sb, istate->untracked);
+		err = write_index_ext_header(&c, &eoie_c, newfd,
+					     CACHE_EXT_UNTRACKED, sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (istate->fsmonitor_last_update) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_fsmonitor_extension(&sb, istate);
+		err = write_index_ext_header(&c, &eoie_c, newfd,
+					     CACHE_EXT_FSMONITOR, sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	/* must be the last one, see read_eoie_extension() */
+	if (nr_blocks > 1) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_eoie_extension(&sb, &eoie_c, entries_end);
+		err = write_index_ext_header(&c, NULL, newfd,
+					     CACHE_EXT_ENDOFINDEXENTRIES,
 					     sb.len) < 0
 			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
 		strbuf_release(&sb);
@@ -1857,13 +2541,168 @@ int write_index(struct index_state *istate, int newfd)
 			return -1;
 	}
 
-	if (ce_flush(&c, newfd) || fstat(newfd, &st))
+	if (ce_flush(&c, newfd, NULL) || fstat(newfd, &st))
 		return -1;
 	istate->timestamp.sec = (unsigned int)st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 	return 0;
 }
 
+static int same_ondisk_entry(const struct cache_entry *a,
+			     const struct cache_entry *b)
+{
+	const unsigned int ondisk_flags = CE_STAGEMASK | CE_VALID | CE_EXTENDED_FLAGS;
+
+	return a->ce_mode == b->ce_mode &&
+		!((a->ce_flags ^ b->ce_flags) & ondisk_flags) &&
+		!hashcmp(a->sha1, b->sha1) &&
+		!memcmp(&a->ce_stat_data, &b->ce_stat_data, sizeof(a->ce_stat_data));
+}
+
+/*
+ * Write all the entries to a new $GIT_DIR/sharedindex.<SHA-1>, and
+ * make it the shared index of "istate".
+ */
+static int write_shared_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	struct strbuf tmp = STRBUF_INIT;
+	unsigned char sha1[20];
+	const char *path;
+	struct stat st;
+	int fd, ret;
+
+	strbuf_addstr(&tmp, git_path("sharedindex_XXXXXX"));
+	fd = git_mkstemp_mode(tmp.buf, 0666);
+	if (fd < 0) {
+		ret = error("unable to create temporary shared index file %s: %s",
+			    tmp.buf, strerror(errno));
+		strbuf_release(&tmp);
+		return ret;
+	}
+	ret = do_write_index(istate, fd, istate->cache, istate->cache_nr,
+			     NULL, sha1);
+	if (close(fd) && !ret)
+		ret = error("unable to write shared index file: %s",
+			    strerror(errno));
+	path = git_path("sharedindex.%s", sha1_to_hex(sha1));
+	if (!ret && adjust_shared_perm(tmp.buf))
+		ret = error("unable to set permissions of %s", tmp.buf);
+	if (!ret && rename(tmp.buf, path))
+		ret = error("unable to rename %s to %s: %s",
+			    tmp.buf, path, strerror(errno));
+	if (ret) {
+		unlink_or_warn(tmp.buf);
+		strbuf_release(&tmp);
+		return ret;
+	}
+	strbuf_release(&tmp);
+
+	/* map the new file, to tell what changes in later writes */
+	if (si->base_mmap)
+		munmap(si->base_mmap, si->base_mmap_size);
+	si->base_mmap = NULL;
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		if (fd >= 0)
+			close(fd);
+		return error("unable to read back %s", path);
+	}
+	si->base_mmap_size = xsize_t(st.st_size);
+	si->base_mmap = xmmap(NULL, si->base_mmap_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	hashcpy(si->base_sha1, sha1);
+
+	clean_shared_index_files(sha1);
+	return 0;
+}
+
+/*
+ * Write "istate" as a split index: only the entries that differ from
+ * the shared index, and the positions of the shared entries that are
+ * gone, are written to "newfd".  If that is too large a part of the
+ * index, a new shared index is written instead.
+ */
+static int write_split_index(struct index_state *istate, int newfd)
+{
+	struct split_index *si = init_split_index(istate);
+	struct cache_entry **own = NULL;
+	unsigned int nr_own = 0, alloc_own = 0, nr_deleted = 0, nr_shared = 0;
+	struct bitmap *deleted = NULL;
+	struct ewah_bitmap *delete_bitmap = NULL;
+	struct strbuf link = STRBUF_INIT;
+	int i, ret;
+
+	if (si->base_mmap) {
+		struct shared_index_walker w;
+		struct cache_entry *base;
+
+		deleted = bitmap_new();
+		init_shared_index_walker(&w, si);
+		nr_shared = w.nr;
+		base = next_shared_entry(&w);
+		for (i = 0; i < istate->cache_nr; i++) {
+			struct cache_entry *ce = istate->cache[i];
+
+			if (ce->ce_flags & CE_REMOVE)
+				continue;
+			while (base && ce_name_stage_cmp(base, ce) < 0) {
+				bitmap_set(deleted, w.pos - 1);
+				nr_deleted++;
+				free(base);
+				base = next_shared_entry(&w);
+			}
+			if (base && !ce_name_stage_cmp(base, ce)) {
+				int same = same_ondisk_entry(ce, base);
+				free(base);
+				base = next_shared_entry(&w);
+				if (same)
+					continue;
+			}
+			ALLOC_GROW(own, nr_own + 1, alloc_own);
+			own[nr_own++] = ce;
+		}
+		while (base) {
+			bitmap_set(deleted, w.pos - 1);
+			nr_deleted++;
+			free(base);
+			base = next_shared_entry(&w);
+		}
+	}
+
+	if (!si->base_mmap || too_many_changes(nr_shared, nr_own + nr_deleted)) {
+		ret = write_shared_index(istate);
+		if (ret)
+			goto out;
+		nr_own = 0;
+	} else {
+		if (nr_deleted)
+			delete_bitmap = bitmap_to_ewah(deleted);
+		freshen_shared_index(si->base_sha1);
+	}
+
+	write_link_extension(&link, si->base_sha1, delete_bitmap);
+	ret = do_write_index(istate, newfd, own, nr_own, &link, NULL);
+
+out:
+	strbuf_release(&link);
+	if (delete_bitmap)
+		ewah_free(delete_bitmap);
+	if (deleted)
+		bitmap_free(deleted);
+	free(own);
+	return ret;
+}
+
+int write_index(struct index_state *istate, int newfd)
+{
+	if (want_split_index(istate))
+		return write_split_index(istate, newfd);
+	discard_split_index(istate);
+	return do_write_index(istate, newfd, istate->cache, istate->cache_nr,
+			      NULL, NULL);
+}
+
 /*
  * Read the index file that is potentially unmerged into given
  * index_state, dropping any unmerged entries.  Returns true if
@@ -4,6 +4,7 @@
 #include "tag.h"
 #include "dir.h"
 #include "string-list.h"
+#include "argv-array.h"
 
 /*
  * Make sure "ref" is something reasonable to have under ".git/refs/";
@@ -826,8 +827,28 @@ static int is_refname_available(const char *refname, const char *oldrefname,
 }
 
 struct packed_ref_cache {
+	/*
+	 * The packed references; this is only filled from the file
+	 * by get_packed_ref_dir().
+	 */
 	struct ref_entry *root;
 
+	/*
+	 * The contents of the packed-refs file, kept around until
+	 * root has been filled, so that single references and ranges
+	 * of references can be looked up without parsing the rest.
+	 * buf is NULL if the file is empty, missing or fully parsed.
+	 */
+	char *buf, *eof;
+	/* The first reference in buf, just past the header line */
+	const char *start;
+	/* Whether buf is mmapped (as opposed to allocated) */
+	unsigned int mmapped : 1;
+	/* Whether the header says the references are sorted */
+	unsigned int sorted : 1;
+	/* The peeling trait from the header; see read_packed_refs() */
+	int peeled;
+
 	/*
 	 * Count of references to the data structure in this instance,
 	 * including the pointer from ref_cache::packed if any.  The
@@ -868,6 +889,22 @@ static struct ref_cache {
 /* Lock used for the main packed-refs file: */
 static struct lock_file packlock;
 
+/*
+ * Let go of the contents of the packed-refs file held by
+ * *packed_refs, if any.
+ */
+static void release_packed_ref_buffer(struct packed_ref_cache *packed_refs)
+{
+	if (!packed_refs->buf)
+		return;
+	if (packed_refs->mmapped)
+		munmap(packed_refs->buf, packed_refs->eof - packed_refs->buf);
+	else
+		free(packed_refs->buf);
+	packed_refs->buf = packed_refs->eof = NULL;
+	packed_refs->start = NULL;
+}
+
 /*
  * Increment the reference count of *packed_refs.
  */
@@ -884,6 +921,7 @@ static int release_packed_ref_cache(struct packed_ref_cache *packed_refs)
 {
 	if (!--packed_refs->referrers) {
 		free_ref_entry(packed_refs->root);
+		release_packed_ref_buffer(packed_refs);
 		stat_validity_clear(&packed_refs->validity);
 		free(packed_refs);
 		return 1;
@@ -912,6 +950,11 @@ static void clear_loose_ref_cache(struct ref_cache *refs)
 	}
 }
 
+void invalidate_loose_ref_cache(void)
+{
+	clear_loose_ref_cache(&ref_cache);
+}
+
 static struct ref_cache *create_ref_cache(const char *submodule)
 {
 	int len;
@@ -955,7 +998,7 @@ static struct ref_cache *get_ref_cache(const char *submodule)
  * traits will be added later.  The trailing space is required.
  */
 static const char PACKED_REFS_HEADER[] =
-	"# pack-refs with: peeled fully-peeled \n";
+	"# pack-refs with: peeled fully-peeled sorted \n";
 
 /*
  * Parse one line from a packed-refs file.  Write the SHA1 to sha1.
@@ -990,8 +1033,14 @@ static const char *parse_ref_line(char *line, unsigned char *sha1)
 	return line;
 }
 
+enum { PEELED_NONE, PEELED_TAGS, PEELED_FULLY };
+
 /*
- * Read f, which is a packed-refs file, into dir.
+ * Read the packed-refs file in the range [pos, eof) into dir.  peeled
+ * is the trait given by the header line (see below).  If prefix is
+ * non-NULL, the references in the range are known to be sorted and
+ * reading stops at the first reference that does not start with
+ * prefix.
  *
  * A comment line of the form "# pack-refs with: " may contain zero or
  * more traits. We interpret the traits as follows:
@@ -1016,20 +1065,33 @@ static const char *parse_ref_line(char *line, unsigned char *sha1)
  *      trait should typically be written alongside "peeled" for
  *      compatibility with older clients, but we do not require it
  *      (i.e., "peeled" is a no-op if "fully-peeled" is set).
+ *
+ *   sorted:
+ *
+ *      The references are sorted by refname, and nothing but
+ *      references and their peeled values follows the header.  This
+ *      lets us look up a single reference, or the references with a
+ *      given prefix, by binary search without parsing the whole file.
  */
-static void read_packed_refs(FILE *f, struct ref_dir *dir)
+static void read_packed_refs(const char *pos, const char *eof, int peeled,
+			     const char *prefix, struct ref_dir *dir)
 {
 	struct ref_entry *last = NULL;
-	char refline[PATH_MAX];
-	enum { PEELED_NONE, PEELED_TAGS, PEELED_FULLY } peeled = PEELED_NONE;
+	struct strbuf line = STRBUF_INIT;
 
-	while (fgets(refline, sizeof(refline), f)) {
+	while (pos < eof) {
 		unsigned char sha1[20];
 		const char *refname;
+		const char *eol = memchr(pos, '\n', eof - pos);
 		static const char header[] = "# pack-refs with:";
 
-		if (!strncmp(refline, header, sizeof(header)-1)) {
-			const char *traits = refline + sizeof(header) - 1;
+		eol = eol ? eol + 1 : eof;
+		strbuf_reset(&line);
+		strbuf_add(&line, pos, eol - pos);
+		pos = eol;
+
+		if (starts_with(line.buf, header)) {
+			const char *traits = line.buf + sizeof(header) - 1;
 			if (strstr(traits, " fully-peeled "))
 				peeled = PEELED_FULLY;
 			else if (strstr(traits, " peeled "))
@@ -1038,8 +1100,10 @@ static void read_packed_refs(FILE *f, struct ref_dir *dir)
 			continue;
 		}
 
-		refname = parse_ref_line(refline, sha1);
+		refname = parse_ref_line(line.buf, sha1);
 		if (refname) {
+			if (prefix && !starts_with(refname, prefix))
+				break;
 			last = create_ref_entry(refname, sha1, REF_ISPACKED, 1);
 			if (peeled == PEELED_FULLY ||
 			    (peeled == PEELED_TAGS && starts_with(refname, "refs/tags/")))
@@ -1048,10 +1112,10 @@ static void read_packed_refs(FILE *f, struct ref_dir *dir)
 			continue;
 		}
 		if (last &&
-		    refline[0] == '^' &&
-		    strlen(refline) == PEELED_LINE_LENGTH &&
-		    refline[PEELED_LINE_LENGTH - 1] == '\n' &&
-		    !get_sha1_hex(refline + 1, sha1)) {
+		    line.buf[0] == '^' &&
+		    line.len == PEELED_LINE_LENGTH &&
+		    line.buf[PEELED_LINE_LENGTH - 1] == '\n' &&
+		    !get_sha1_hex(line.buf + 1, sha1)) {
 			hashcpy(last->u.value.peeled, sha1);
 			/*
 			 * Regardless of what the file header said,
@@ -1061,11 +1125,68 @@ static void read_packed_refs(FILE *f, struct ref_dir *dir)
 			last->flag |= REF_KNOWS_PEELED;
 		}
 	}
+	strbuf_release(&line);
+}
+
+/*
+ * Load the contents of the packed-refs file open as fd into
+ * packed_refs, and interpret its header line.
+ */
+static void load_packed_ref_buffer(struct packed_ref_cache *packed_refs,
+				   int fd)
+{
+	static const char header[] = "# pack-refs with:";
+	struct strbuf traits = STRBUF_INIT;
+	struct stat st;
+	size_t size;
+	const char *eol;
+
+	if (fstat(fd, &st) < 0)
+		die_errno("unable to stat packed-refs");
+	size = xsize_t(st.st_size);
+	if (!size)
+		return;
+#ifdef MMAP_PREVENTS_DELETE
+	/*
+	 * Keeping the file mapped would keep others (and ourselves)
+	 * from replacing it; read it into core instead.
+	 */
+	packed_refs->buf = xmalloc(size);
+	if (read_in_full(fd, packed_refs->buf, size) != size)
+		die_errno("unable to read packed-refs");
+#else
+	packed_refs->buf = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	packed_refs->mmapped = 1;
+#endif
+	packed_refs->eof = packed_refs->buf + size;
+	packed_refs->start = packed_refs->buf;
+
+	if (size < sizeof(header) - 1 ||
+	    memcmp(packed_refs->buf, header, sizeof(header) - 1))
+		return;
+	eol = memchr(packed_refs->buf, '\n', size);
+	if (!eol)
+		return;
+	packed_refs->start = eol + 1;
+	strbuf_add(&traits, packed_refs->buf + sizeof(header) - 1,
+		   eol - packed_refs->buf - (sizeof(header) - 1));
+	if (strstr(traits.buf, " fully-peeled "))
+		packed_refs->peeled = PEELED_FULLY;
+	else if (strstr(traits.buf, " peeled "))
+		packed_refs->peeled = PEELED_TAGS;
+	/*
+	 * The binary search relies on every line being terminated,
+	 * so that it cannot run off the end of the buffer.
+	 */
+	if (strstr(traits.buf, " sorted ") && packed_refs->eof[-1] == '\n')
+		packed_refs->sorted = 1;
+	strbuf_release(&traits);
 }
 
 /*
  * Get the packed_ref_cache for the specified ref_cache, creating it
- * if necessary.
+ * if necessary.  The file is not parsed until get_packed_ref_dir()
+ * is called.
  */
 static struct packed_ref_cache *get_packed_ref_cache(struct ref_cache *refs)
 {
@@ -1081,16 +1202,16 @@ static struct packed_ref_cache *get_packed_ref_cache(struct ref_cache *refs)
 		clear_packed_ref_cache(refs);
 
 	if (!refs->packed) {
-		FILE *f;
+		int fd;
 
 		refs->packed = xcalloc(1, sizeof(*refs->packed));
 		acquire_packed_ref_cache(refs->packed);
 		refs->packed->root = create_dir_entry(refs, "", 0, 0);
-		f = fopen(packed_refs_file, "r");
-		if (f) {
-			stat_validity_update(&refs->packed->validity, fileno(f));
-			read_packed_refs(f, get_ref_dir(refs->packed->root));
-			fclose(f);
+		fd = open(packed_refs_file, O_RDONLY);
+		if (fd >= 0) {
+			stat_validity_update(&refs->packed->validity, fd);
+			load_packed_ref_buffer(refs->packed, fd);
+			close(fd);
 		}
 	}
 	return refs->packed;
@@ -1098,6 +1219,12 @@ static struct packed_ref_cache *get_packed_ref_cache(struct ref_cache *refs)
 
 static struct ref_dir *get_packed_ref_dir(struct packed_ref_cache *packed_ref_cache)
 {
+	if (packed_ref_cache->buf) {
+		read_packed_refs(packed_ref_cache->start, packed_ref_cache->eof,
+				 packed_ref_cache->peeled, NULL,
+				 get_ref_dir(packed_ref_cache->root));
+		release_packed_ref_buffer(packed_ref_cache);
+	}
 	return get_ref_dir(packed_ref_cache->root);
 }
 
@@ -1106,6 +1233,152 @@ static struct ref_dir *get_packed_refs(struct ref_cache *refs)
 	return get_packed_ref_dir(get_packed_ref_cache(refs));
 }
 
+/*
+ * Return true if the packed references in packed_refs can be looked
+ * up by binary search over the file contents, i.e. the file is sorted
+ * and has not been parsed into the ref_dir tree yet.
+ */
+static int packed_refs_searchable(struct packed_ref_cache *packed_refs)
+{
+	return packed_refs->buf && packed_refs->sorted;
+}
+
+/*
+ * Find the start of the record (a reference line, together with the
+ * peeled line that may follow it) that contains p.
+ */
+static const char *find_start_of_record(const char *buf, const char *p)
+{
+	while (p > buf && (p[-1] != '\n' || p[0] == '^'))
+		p--;
+	return p;
+}
+
+/*
+ * Find the end of the record that contains p; this is the start of
+ * the next record, or end.
+ */
+static const char *find_end_of_record(const char *p, const char *end)
+{
+	while (++p < end && (p[-1] != '\n' || p[0] == '^'))
+		;
+	return p;
+}
+
+/*
+ * Compare the refname in the record starting at rec with refname, as
+ * strcmp() would.  Set *corrupt if rec does not start with a
+ * reference line.
+ */
+static int cmp_record_to_refname(const char *rec, const char *eof,
+				 const char *refname, int *corrupt)
+{
+	const char *eol = memchr(rec, '\n', eof - rec);
+	const char *r = rec + 41;
+
+	if (!eol || eol - rec < 42 || rec[40] != ' ') {
+		*corrupt = 1;
+		return 0;
+	}
+	for (;;) {
+		if (r == eol)
+			return *refname ? -1 : 0;
+		if (!*refname)
+			return 1;
+		if (*r != *refname)
+			return (unsigned char)*r - (unsigned char)*refname;
+		r++;
+		refname++;
+	}
+}
+
+/*
+ * Binary search the sorted records in [buf, eof) for refname.  Return
+ * the start of its record if found.  Otherwise return NULL if
+ * mustexist is set, or else the start of the first record that sorts
+ * after refname (possibly eof).  Set *corrupt if the file turns out
+ * not to be in the expected format.
+ */
+static const char *find_packed_ref_record(const char *buf, const char *eof,
+					  const char *refname, int mustexist,
+					  int *corrupt)
+{
+	const char *lo = buf, *hi = eof;
+
+	while (lo < hi) {
+		const char *mid = lo + (hi - lo) / 2;
+		const char *rec = find_start_of_record(lo, mid);
+		int cmp = cmp_record_to_refname(rec, eof, refname, corrupt);
+
+		if (*corrupt)
+			return NULL;
+		if (cmp < 0)
+			lo = find_end_of_record(mid, hi);
+		else if (cmp > 0)
+			hi = rec;
+		else
+			return rec;
+	}
+	return mustexist ? NULL : lo;
+}
+
+/*
+ * Look up refname among the packed references of refs, by binary
+ * search if the packed-refs file allows it.  Return 0 and store its
+ * value in sha1 if found, or -1 if it is not a packed reference.
+ */
+static int find_packed_ref(struct ref_cache *refs, const char *refname,
+			   unsigned char *sha1)
+{
+	struct packed_ref_cache *packed_refs = get_packed_ref_cache(refs);
+	struct ref_entry *entry;
+
+	if (packed_refs_searchable(packed_refs)) {
+		int corrupt = 0;
+		const char *rec = find_packed_ref_record(packed_refs->start,
+							 packed_refs->eof,
+							 refname, 1, &corrupt);
+		if (!corrupt) {
+			if (!rec)
+				return -1;
+			if (!get_sha1_hex(rec, sha1))
+				return 0;
+		}
+		/* Let the full parse sort it out */
+	}
+
+	entry = find_ref(get_packed_ref_dir(packed_refs), refname);
+	if (!entry)
+		return -1;
+	hashcpy(sha1, entry->u.value.sha1);
+	return 0;
+}
+
+/*
+ * Read only the packed references of packed_refs that start with
+ * prefix into a new ref_dir tree, which the caller must free.  Return
+ * NULL if the file does not allow it; the caller should then use the
+ * whole of get_packed_ref_dir().
+ */
+static struct ref_entry *read_packed_refs_prefix(struct packed_ref_cache *packed_refs,
+						 const char *prefix)
+{
+	struct ref_entry *root;
+	const char *rec;
+	int corrupt = 0;
+
+	if (!packed_refs_searchable(packed_refs))
+		return NULL;
+	rec = find_packed_ref_record(packed_refs->start, packed_refs->eof,
+				     prefix, 0, &corrupt);
+	if (corrupt)
+		return NULL;
+	root = create_dir_entry(packed_refs->root->u.subdir.ref_cache, "", 0, 0);
+	read_packed_refs(rec, packed_refs->eof, packed_refs->peeled, prefix,
+			 get_ref_dir(root));
+	return root;
+}
+
 void add_packed_ref(const char *refname, const unsigned char *sha1)
 {
 	struct packed_ref_cache *packed_ref_cache =
@@ -1301,15 +1574,11 @@ static const char *handle_missing_loose_ref(const char *refname,
 					    int reading,
 					    int *flag)
 {
-	struct ref_entry *entry;
-
 	/*
 	 * The loose reference file does not exist; check for a packed
 	 * reference.
 	 */
-	entry = get_packed_ref(refname);
-	if (entry) {
-		hashcpy(sha1, entry->u.value.sha1);
+	if (!find_packed_ref(&ref_cache, refname, sha1)) {
 		if (flag)
 			*flag |= REF_ISPACKED;
 		return refname;
@@ -1654,6 +1923,7 @@ static int do_for_each_entry(struct ref_cache *refs, const char *base,
 			     each_ref_entry_fn fn, void *cb_data)
 {
 	struct packed_ref_cache *packed_ref_cache;
+	struct ref_entry *packed_prefix = NULL;
 	struct ref_dir *loose_dir;
 	struct ref_dir *packed_dir;
 	int retval = 0;
@@ -1675,7 +1945,24 @@ static int do_for_each_entry(struct ref_cache *refs, const char *base,
 
 	packed_ref_cache = get_packed_ref_cache(refs);
 	acquire_packed_ref_cache(packed_ref_cache);
-	packed_dir = get_packed_ref_dir(packed_ref_cache);
+	if (base && *base) {
+		/*
+		 * Only the references in the containing directory of
+		 * base are wanted; if the file allows it, read just
+		 * those rather than all of them.
+		 */
+		const char *slash = strrchr(base, '/');
+		if (slash) {
+			char *dirname = xmemdupz(base, slash + 1 - base);
+			packed_prefix = read_packed_refs_prefix(packed_ref_cache,
+								dirname);
+			free(dirname);
+		}
+	}
+	if (packed_prefix)
+		packed_dir = get_ref_dir(packed_prefix);
+	else
+		packed_dir = get_packed_ref_dir(packed_ref_cache);
 	if (base && *base) {
 		packed_dir = find_containing_dir(packed_dir, base, 0);
 	}
@@ -1695,6 +1982,8 @@ static int do_for_each_entry(struct ref_cache *refs, const char *base,
 				loose_dir, 0, fn, cb_data);
 	}
 
+	if (packed_prefix)
+		free_ref_entry(packed_prefix);
 	release_packed_ref_cache(packed_ref_cache);
 	return retval;
 }
@@ -1820,16 +2109,21 @@ int head_ref_namespaced(each_ref_fn fn, void *cb_data)
 	return ret;
 }
 
-int for_each_namespaced_ref(each_ref_fn fn, void *cb_data)
+int for_each_namespaced_ref_in(const char *prefix, each_ref_fn fn, void *cb_data)
 {
 	struct strbuf buf = STRBUF_INIT;
 	int ret;
-	strbuf_addf(&buf, "%srefs/", get_git_namespace());
+	strbuf_addf(&buf, "%s%s", get_git_namespace(), prefix);
 	ret = do_for_each_ref(&ref_cache, buf.buf, fn, 0, 0, cb_data);
 	strbuf_release(&buf);
 	return ret;
 }
 
+int for_each_namespaced_ref(each_ref_fn fn, void *cb_data)
+{
+	return for_each_namespaced_ref_in("refs/", fn, cb_data);
+}
+
 int for_each_glob_ref_in(each_ref_fn fn, const char *pattern,
 	const char *prefix, void *cb_data)
 {
@@ -1904,6 +2198,15 @@ int refname_match(const char *abbrev_name, const char *full_name)
 	return 0;
 }
 
+void expand_ref_prefix(struct argv_array *prefixes, const char *abbrev_name)
+{
+	const char **p;
+	const int abbrev_name_len = strlen(abbrev_name);
+
+	for (p = ref_rev_parse_rules; *p; p++)
+		argv_array_pushf(prefixes, *p, abbrev_name_len, abbrev_name);
+}
+
 static struct ref_lock *verify_lock(struct ref_lock *lock,
 	const unsigned char *old_sha1, int mustexist)
 {
@@ -79,6 +79,12 @@ extern int for_each_remote_ref_submodule(const char *submodule, each_ref_fn fn,
 
 extern int head_ref_namespaced(each_ref_fn fn, void *cb_data);
 extern int for_each_namespaced_ref(each_ref_fn fn, void *cb_data);
+/*
+ * Like for_each_namespaced_ref(), but only for the refs whose names
+ * (without the namespace) start with prefix, which need not end at a
+ * slash; the callback sees the full names, as above.
+ */
+extern int for_each_namespaced_ref_in(const char *prefix, each_ref_fn fn, void *cb_data);
 
 static inline const char *has_glob_specials(const char *pattern)
 {
@@ -90,6 +96,13 @@ extern int for_each_rawref(each_ref_fn, void *);
 
 extern void warn_dangling_symref(FILE *fp, const char *msg_fmt, const char *refname);
 
+/*
+ * Forget the loose refs of the repository read so far, so that they
+ * are read again when next needed.  The packed refs are kept, and
+ * read again only if the packed-refs file changed.
+ */
+extern void invalidate_loose_ref_cache(void);
+
 /*
  * Lock the packed-refs file for writing.  Flags is passed to
  * hold_lock_file_for_update().  Return 0 on success.
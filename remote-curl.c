@@ -11,6 +11,7 @@
 #include "argv-array.h"
 #include "credential.h"
 #include "sha1-array.h"
+#include "protocol.h"
 
 static struct remote *remote;
 /* always ends with a trailing slash */
@@ -119,6 +120,7 @@ struct discovery {
 	struct ref *refs;
 	struct sha1_array shallow;
 	unsigned proto_git : 1;
+	unsigned proto_v2 : 1;
 };
 static struct discovery *last_discovery;
 
@@ -221,7 +223,8 @@ static int show_http_message(struct strbuf *type, struct strbuf *msg)
 	return 0;
 }
 
-static struct discovery* discover_refs(const char *service, int for_push)
+static struct discovery* discover_refs(const char *service, int for_push,
+				       int protocol_v2)
 {
 	struct strbuf exp = STRBUF_INIT;
 	struct strbuf type = STRBUF_INIT;
@@ -231,6 +234,7 @@ static struct discovery* discover_refs(const char *service, int for_push)
 	struct discovery *last = last_discovery;
 	int http_ret, maybe_smart = 0;
 	struct http_get_options options;
+	struct string_list extra_headers = STRING_LIST_INIT_NODUP;
 
 	if (last && !strcmp(service, last->service))
 		return last;
@@ -253,6 +257,11 @@ static struct discovery* discover_refs(const char *service, int for_push)
 	options.base_url = &url;
 	options.no_cache = 1;
 	options.keep_error = 1;
+	if (protocol_v2) {
+		string_list_append(&extra_headers,
+				   GIT_PROTOCOL_HEADER ": version=2");
+		options.extra_headers = &extra_headers;
+	}
 
 	http_ret = http_get_strbuf(refs_url.buf, &buffer, &options);
 	switch (http_ret) {
@@ -275,7 +284,17 @@ static struct discovery* discover_refs(const char *service, int for_push)
 	last->buf = last->buf_alloc;
 
 	strbuf_addf(&exp, "application/x-%s-advertisement", service);
-	if (maybe_smart &&
+	if (maybe_smart && protocol_v2 &&
+	    14 <= last->len && !memcmp(last->buf, "000eversion 2\n", 14) &&
+	    !strbuf_cmp(&exp, &type)) {
+		/*
+		 * The server speaks protocol v2; what it sent are its
+		 * capabilities, which stateless_connect() passes on,
+		 * and not the refs.
+		 */
+		last->proto_git = 1;
+		last->proto_v2 = 1;
+	} else if (maybe_smart &&
 	    (5 <= last->len && last->buf[4] == '#') &&
 	    !strbuf_cmp(&exp, &type)) {
 		char *line;
@@ -302,7 +321,9 @@ static struct discovery* discover_refs(const char *service, int for_push)
 		last->proto_git = 1;
 	}
 
-	if (last->proto_git)
+	if (last->proto_v2)
+		; /* the refs are asked for with "ls-refs" */
+	else if (last->proto_git)
 		last->refs = parse_git_refs(last, for_push);
 	else
 		last->refs = parse_info_refs(last);
@@ -312,6 +333,7 @@ static struct discovery* discover_refs(const char *service, int for_push)
 	strbuf_release(&type);
 	strbuf_release(&effective_url);
 	strbuf_release(&buffer);
+	string_list_clear(&extra_headers, 0);
 	last_discovery = last;
 	return last;
 }
@@ -321,9 +343,9 @@ static struct ref *get_refs(int for_push)
 	struct discovery *heads;
 
 	if (for_push)
-		heads = discover_refs("git-receive-pack", for_push);
+		heads = discover_refs("git-receive-pack", for_push, 0);
 	else
-		heads = discover_refs("git-upload-pack", for_push);
+		heads = discover_refs("git-upload-pack", for_push, 0);
 
 	return heads->refs;
 }
@@ -348,6 +370,7 @@ struct rpc_state {
 	char *service_url;
 	char *hdr_content_type;
 	char *hdr_accept;
+	char *hdr_git_protocol;
 	char *buf;
 	size_t alloc;
 	size_t len;
@@ -357,6 +380,8 @@ struct rpc_state {
 	struct strbuf result;
 	unsigned gzip_request : 1;
 	unsigned initial_buffer : 1;
+	/* buf already holds the whole request; do not read more */
+	unsigned whole_request : 1;
 };
 
 static size_t rpc_out(void *ptr, size_t eltsize,
@@ -479,7 +504,7 @@ static int post_rpc(struct rpc_state *rpc)
 	 * allocated buffer space we can use HTTP/1.0 and avoid the
 	 * chunked encoding mess.
 	 */
-	while (1) {
+	while (!rpc->whole_request) {
 		size_t left = rpc->alloc - rpc->len;
 		char *buf = rpc->buf + rpc->len;
 		int n;
@@ -515,6 +540,8 @@ static int post_rpc(struct rpc_state *rpc)
 	headers = curl_slist_append(headers, rpc->hdr_accept);
 	headers = curl_slist_append(headers, needs_100_continue ?
 		"Expect: 100-continue" : "Expect:");
+	if (rpc->hdr_git_protocol)
+		headers = curl_slist_append(headers, rpc->hdr_git_protocol);
 
 retry:
 	slot = get_active_slot();
@@ -685,6 +712,94 @@ static int rpc_service(struct rpc_state *rpc, struct discovery *heads)
 	return err;
 }
 
+/*
+ * Read one request of a stateless connection from our stdin: the
+ * pkt-lines up to and including the flush packet that ends it, with
+ * their length headers.  Return 0 when there is nothing to send, at
+ * the end of the input or for a lone flush packet, which ends the
+ * session.
+ */
+static int read_stateless_request(struct strbuf *req)
+{
+	strbuf_reset(req);
+	for (;;) {
+		int len;
+
+		switch (packet_read_with_status(0, NULL, NULL, packet_buffer,
+						sizeof(packet_buffer), &len,
+						PACKET_READ_GENTLE_ON_EOF)) {
+		case PACKET_READ_EOF:
+			return 0;
+		case PACKET_READ_FLUSH:
+			strbuf_add(req, "0000", 4);
+			return req->len > 4;
+		case PACKET_READ_DELIM:
+			strbuf_add(req, "0001", 4);
+			break;
+		case PACKET_READ_NORMAL:
+			strbuf_addf(req, "%04x", len + 4);
+			strbuf_add(req, packet_buffer, len);
+			break;
+		}
+	}
+}
+
+/*
+ * Connect git to a server that speaks protocol v2 over HTTP, by
+ * turning each request git writes to us into a POST, and passing the
+ * response back.  Return 0 if the server does not speak protocol v2,
+ * in which case we said "fallback", and otherwise 1 when git closes
+ * the connection or -1 on errors.
+ */
+static int stateless_connect(const char *service_name)
+{
+	struct discovery *discover;
+	struct rpc_state rpc;
+	struct strbuf buf = STRBUF_INIT;
+	int err = 0;
+
+	discover = discover_refs(service_name, 0, 1);
+	if (!discover->proto_v2) {
+		printf("fallback\n");
+		fflush(stdout);
+		return 0;
+	}
+	printf("\n");
+	fflush(stdout);
+	write_or_die(1, discover->buf, discover->len);
+
+	memset(&rpc, 0, sizeof(rpc));
+	rpc.service_name = service_name;
+	rpc.gzip_request = 1;
+	rpc.whole_request = 1;
+	rpc.in = 1;
+
+	strbuf_addf(&buf, "%s%s", url.buf, service_name);
+	rpc.service_url = strbuf_detach(&buf, NULL);
+
+	strbuf_addf(&buf, "Content-Type: application/x-%s-request", service_name);
+	rpc.hdr_content_type = strbuf_detach(&buf, NULL);
+
+	strbuf_addf(&buf, "Accept: application/x-%s-result", service_name);
+	rpc.hdr_accept = strbuf_detach(&buf, NULL);
+
+	rpc.hdr_git_protocol = xstrdup(GIT_PROTOCOL_HEADER ": version=2");
+
+	while (!err && read_stateless_request(&buf)) {
+		rpc.buf = buf.buf;
+		rpc.len = buf.len;
+		rpc.pos = 0;
+		err = post_rpc(&rpc);
+	}
+
+	free(rpc.service_url);
+	free(rpc.hdr_content_type);
+	free(rpc.hdr_accept);
+	free(rpc.hdr_git_protocol);
+	strbuf_release(&buf);
+	return err ? -1 : 1;
+}
+
 static int fetch_dumb(int nr_heads, struct ref **to_fetch)
 {
 	struct walker *walker;
@@ -776,7 +891,7 @@ static int fetch_git(struct discovery *heads,
 
 static int fetch(int nr_heads, struct ref **to_fetch)
 {
-	struct discovery *d = discover_refs("git-upload-pack", 0);
+	struct discovery *d = discover_refs("git-upload-pack", 0, 0);
 	if (d->proto_git)
 		return fetch_git(d, nr_heads, to_fetch);
 	else
@@ -897,7 +1012,7 @@ static int push_git(struct discovery *heads, int nr_spec, char **specs)
 
 static int push(int nr_spec, char **specs)
 {
-	struct discovery *heads = discover_refs("git-receive-pack", 1);
+	struct discovery *heads = discover_refs("git-receive-pack", 1, 0);
 	int ret;
 
 	if (heads->proto_git)
@@ -1009,11 +1124,20 @@ int main(int argc, char **av)
 				printf("unsupported\n");
 			fflush(stdout);
 
+		} else if (starts_with(buf.buf, "stateless-connect ")) {
+			int ret = stateless_connect(buf.buf +
+						    strlen("stateless-connect "));
+			if (ret) {
+				http_cleanup();
+				return ret < 0;
+			}
+
 		} else if (!strcmp(buf.buf, "capabilities")) {
 			printf("fetch\n");
 			printf("option\n");
 			printf("push\n");
 			printf("check-connectivity\n");
+			printf("stateless-connect\n");
 			printf("\n");
 			fflush(stdout);
 		} else {
@@ -8,6 +8,7 @@
 #include "tag.h"
 #include "string-list.h"
 #include "mergesort.h"
+#include "argv-array.h"
 
 enum map_direction { FROM_SRC, FROM_DST };
 
@@ -648,6 +649,30 @@ struct refspec *parse_fetch_refspec(int nr_refspec, const char **refspec)
 	return parse_refspec_internal(nr_refspec, refspec, 1, 0);
 }
 
+int refspec_ref_prefixes(const struct refspec *refspec, int nr,
+			 struct argv_array *prefixes)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (refspec[i].matching || !refspec[i].src || !*refspec[i].src)
+			return -1;
+
+	for (i = 0; i < nr; i++) {
+		const struct refspec *rs = &refspec[i];
+
+		if (rs->exact_sha1)
+			continue;
+		if (rs->pattern) {
+			const char *glob = strchr(rs->src, '*');
+			argv_array_pushf(prefixes, "%.*s",
+					 (int)(glob - rs->src), rs->src);
+		} else
+			expand_ref_prefix(prefixes, rs->src);
+	}
+	return 0;
+}
+
 static struct refspec *parse_push_refspec(int nr_refspec, const char **refspec)
 {
 	return parse_refspec_internal(nr_refspec, refspec, 0, 0);
@@ -144,6 +144,9 @@ extern struct ref **get_remote_heads(int in, char *src_buf, size_t src_len,
 				     struct ref **list, unsigned int flags,
 				     struct sha1_array *extra_have,
 				     struct sha1_array *shallow);
+struct argv_array;
+extern struct ref **get_remote_refs(int fd_out, int fd_in, struct ref **list,
+				    const struct argv_array *ref_prefixes);
 
 int resolve_remote_symref(struct ref *ref, struct ref *list);
 int ref_newer(const unsigned char *new_sha1, const unsigned char *old_sha1);
@@ -162,6 +165,15 @@ struct refspec *parse_fetch_refspec(int nr_refspec, const char **refspec);
 
 void free_refspec(int nr_refspec, struct refspec *refspec);
 
+/*
+ * Add to prefixes the prefixes of the remote refs that the fetch
+ * refspecs may match, e.g. to ask a server that speaks protocol v2 to
+ * list only those.  Return -1, leaving prefixes untouched, if some of
+ * the refspecs may match any ref.
+ */
+extern int refspec_ref_prefixes(const struct refspec *refspec, int nr,
+				struct argv_array *prefixes);
+
 extern int query_refspecs(struct refspec *specs, int nr, struct refspec *query);
 char *apply_refspecs(struct refspec *refspecs, int nr_refspec,
 		     const char *name);
@@ -22,6 +22,8 @@
 #include "bulk-checkin.h"
 #include "streaming.h"
 #include "dir.h"
+#include "midx.h"
+#include "thread-utils.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -62,6 +64,45 @@ static struct cached_object empty_tree = {
 
 static struct packed_git *last_found_pack;
 
+#ifndef NO_PTHREADS
+/*
+ * Once enabled, read_sha1_file() holds this lock while it looks at
+ * the packs and the caches, and drops it while it inflates the data,
+ * which is where the time goes.  It is recursive, so that callers can
+ * hold it around other accesses to the object database.
+ */
+static pthread_mutex_t obj_read_mutex;
+static int obj_read_use_lock;
+
+void enable_obj_read_lock(void)
+{
+	if (obj_read_use_lock++)
+		return;
+	init_recursive_mutex(&obj_read_mutex);
+}
+
+void disable_obj_read_lock(void)
+{
+	if (!obj_read_use_lock)
+		die("BUG: unbalanced disable_obj_read_lock()");
+	if (--obj_read_use_lock)
+		return;
+	pthread_mutex_destroy(&obj_read_mutex);
+}
+
+void obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&obj_read_mutex);
+}
+
+void obj_read_unlock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&obj_read_mutex);
+}
+#endif
+
 static struct cached_object *find_cached_object(const unsigned char *sha1)
 {
 	int i;
@@ -252,7 +293,6 @@ char *sha1_pack_index_name(const unsigned char *sha1)
 struct alternate_object_database *alt_odb_list;
 static struct alternate_object_database **alt_odb_tail;
 
-static int git_open_noatime(const char *name);
 
 /*
  * Prepare alternate object database registry.
@@ -799,6 +839,8 @@ void free_pack_by_name(const char *pack_name)
 	while (*pp) {
 		p = *pp;
 		if (strcmp(pack_name, p->pack_name) == 0) {
+			if (p->multi_pack_index)
+				close_midx();
 			clear_delta_base_cache();
 			close_pack_windows(p);
 			if (p->pack_fd != -1) {
@@ -1232,8 +1274,11 @@ static void prepare_packed_git_one(char *objdir, int local)
 
 		if (has_extension(de->d_name, ".idx") ||
 		    has_extension(de->d_name, ".pack") ||
+		    has_extension(de->d_name, ".bitmap") ||
 		    has_extension(de->d_name, ".keep"))
 			string_list_append(&garbage, path);
+		else if (!strcmp(de->d_name, "multi-pack-index"))
+			continue;
 		else
 			report_garbage("garbage found", path);
 	}
@@ -1304,6 +1349,7 @@ void prepare_packed_git(void)
 	if (prepare_packed_git_run_once)
 		return;
 	prepare_packed_git_one(get_object_directory(), 1);
+	prepare_multi_pack_index();
 	prepare_alt_odb();
 	for (alt = alt_odb_list; alt; alt = alt->next) {
 		alt->name[-1] = 0;
@@ -1393,7 +1439,7 @@ int check_sha1_signature(const unsigned char *sha1, void *map,
 	return hashcmp(sha1, real_sha1) ? -1 : 0;
 }
 
-static int git_open_noatime(const char *name)
+int git_open_noatime(const char *name)
 {
 	static int sha1_file_open_flag = O_NOATIME;
 
@@ -1544,8 +1590,10 @@ static void *unpack_sha1_rest(git_zstream *stream, void *buffer, unsigned long s
 		 */
 		stream->next_out = buf + bytes;
 		stream->avail_out = size - bytes;
+		obj_read_unlock();
 		while (status == Z_OK)
 			status = git_inflate(stream, Z_FINISH);
+		obj_read_lock();
 	}
 	if (status == Z_STREAM_END && !stream->avail_in) {
 		git_inflate_end(stream);
@@ -1931,7 +1979,13 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		/*
+		 * The window cannot go away while we use it, so others
+		 * may look at the packs in the meantime.
+		 */
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -2221,13 +2275,12 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		void *delta_data;
 		void *base = data;
 		unsigned long delta_size, base_size = size;
+		off_t base_offset = obj_offset;
+		int cache_base = !!base;
 		int i;
 
 		data = NULL;
 
-		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
-
 		if (!base) {
 			/*
 			 * We're probably in deep shit, but let's try to fetch
@@ -2259,6 +2312,18 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 
 		delta_data = unpack_compressed_entry(p, &w_curs, curpos, delta_size);
 
+		/*
+		 * Hand the base to the cache only now: while inflating,
+		 * the lock was dropped, and other threads could have
+		 * evicted it from there and freed it.
+		 */
+		if (delta_data)
+			data = patch_delta(base, base_size,
+					   delta_data, delta_size,
+					   &size);
+		if (cache_base)
+			add_delta_base_cache(p, base_offset, base, base_size, type);
+
 		if (!delta_data) {
 			error("failed to unpack compressed delta "
 			      "at offset %"PRIuMAX" from %s",
@@ -2267,10 +2332,6 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 			continue;
 		}
 
-		data = patch_delta(base, base_size,
-				   delta_data, delta_size,
-				   &size);
-
 		/*
 		 * We could not apply the delta; warn the user, but keep going.
 		 * Our failure will be noticed either in the next iteration of
@@ -2451,16 +2512,32 @@ static int fill_pack_entry(const unsigned char *sha1,
 static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
 	struct packed_git *p;
+	int skip_midx_packs = 0;
 
 	prepare_packed_git();
 	if (!packed_git)
 		return 0;
 
+	/*
+	 * The multi-pack-index answers for all the packs it covers at
+	 * once; we only need to look into them one by one if it points
+	 * at a pack that went away.
+	 */
+	switch (fill_midx_entry(sha1, e)) {
+	case 1:
+		return 1;
+	case 0:
+		skip_midx_packs = 1;
+		break;
+	}
+
 	if (last_found_pack && fill_pack_entry(sha1, e, last_found_pack))
 		return 1;
 
 	for (p = packed_git; p; p = p->next) {
-		if (p == last_found_pack || !fill_pack_entry(sha1, e, p))
+		if (p == last_found_pack ||
+		    (skip_midx_packs && p->multi_pack_index) ||
+		    !fill_pack_entry(sha1, e, p))
 			continue;
 
 		last_found_pack = p;
@@ -2681,10 +2758,13 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 	void *data;
 	char *path;
 	const struct packed_git *p;
-	const unsigned char *repl = lookup_replace_object_extended(sha1, flag);
+	const unsigned char *repl;
 
+	obj_read_lock();
+	repl = lookup_replace_object_extended(sha1, flag);
 	errno = 0;
 	data = read_object(repl, type, size);
+	obj_read_unlock();
 	if (data)
 		return data;
 
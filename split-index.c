@@ -0,0 +1,144 @@
+#include "cache.h"
+#include "split-index.h"
+#include "ewah/ewok.h"
+
+static int max_percent_change = 20;
+static const char *shared_index_expire = "2.weeks.ago";
+static int split_index_config_read;
+
+static int read_split_index_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "splitindex.maxpercentchange")) {
+		max_percent_change = git_config_int(var, value);
+		if (max_percent_change < 0 || max_percent_change > 100)
+			return error(_("splitIndex.maxPercentChange value '%d' "
+				       "should be between 0 and 100"),
+				     max_percent_change);
+		return 0;
+	}
+	if (!strcmp(var, "splitindex.sharedindexexpire"))
+		return git_config_string(&shared_index_expire, var, value);
+	return 0;
+}
+
+static void read_split_index_config_once(void)
+{
+	if (split_index_config_read)
+		return;
+	split_index_config_read = 1;
+	git_config(read_split_index_config, NULL);
+}
+
+struct split_index *init_split_index(struct index_state *istate)
+{
+	if (!istate->split_index)
+		istate->split_index = xcalloc(1, sizeof(*istate->split_index));
+	return istate->split_index;
+}
+
+void discard_split_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+
+	if (!si)
+		return;
+	if (si->base_mmap)
+		munmap(si->base_mmap, si->base_mmap_size);
+	if (si->delete_bitmap)
+		ewah_free(si->delete_bitmap);
+	free(si);
+	istate->split_index = NULL;
+}
+
+int read_link_extension(struct index_state *istate,
+			const void *data_, unsigned long sz)
+{
+	const unsigned char *data = data_;
+	struct split_index *si;
+	ssize_t ret;
+
+	if (sz < 20)
+		return error("corrupt link extension (too short)");
+	si = init_split_index(istate);
+	hashcpy(si->base_sha1, data);
+	data += 20;
+	sz -= 20;
+	if (!sz)
+		return 0;
+	si->delete_bitmap = ewah_new();
+	ret = ewah_read_mmap(si->delete_bitmap, data, sz);
+	if (ret < 0 || ret != sz)
+		return error("corrupt delete bitmap in link extension");
+	return 0;
+}
+
+void write_link_extension(struct strbuf *sb,
+			  const unsigned char *base_sha1,
+			  struct ewah_bitmap *delete_bitmap)
+{
+	strbuf_add(sb, base_sha1, 20);
+	if (delete_bitmap)
+		ewah_serialize_strbuf(delete_bitmap, sb);
+}
+
+int want_split_index(struct index_state *istate)
+{
+	if (!core_split_index)
+		return 0;
+	if (istate->split_index)
+		return 1;
+	return core_split_index > 0 && istate == &the_index;
+}
+
+int too_many_changes(unsigned int base_nr, unsigned int changed)
+{
+	read_split_index_config_once();
+	return (uint64_t)changed * 100 > (uint64_t)base_nr * max_percent_change;
+}
+
+void freshen_shared_index(const unsigned char *base_sha1)
+{
+	const char *path = git_path("sharedindex.%s", sha1_to_hex(base_sha1));
+
+	if (utime(path, NULL) && errno != ENOENT)
+		warning(_("could not freshen shared index '%s'"), path);
+}
+
+void clean_shared_index_files(const unsigned char *keep)
+{
+	struct strbuf path = STRBUF_INIT;
+	unsigned long expire;
+	struct dirent *de;
+	size_t baselen;
+	DIR *dir;
+
+	read_split_index_config_once();
+	if (!shared_index_expire || !strcmp(shared_index_expire, "never"))
+		return;
+	expire = approxidate(shared_index_expire);
+
+	strbuf_addstr(&path, get_git_dir());
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+	strbuf_addch(&path, '/');
+	baselen = path.len;
+
+	while ((de = readdir(dir)) != NULL) {
+		struct stat st;
+
+		if (prefixcmp(de->d_name, "sharedindex.") ||
+		    !strcmp(de->d_name + strlen("sharedindex."), sha1_to_hex(keep)))
+			continue;
+		strbuf_setlen(&path, baselen);
+		strbuf_addstr(&path, de->d_name);
+		if (stat(path.buf, &st) || st.st_mtime > expire)
+			continue;
+		if (unlink(path.buf))
+			warning(_("could not remove '%s'"), path.buf);
+	}
+	closedir(dir);
+	strbuf_release(&path);
+}
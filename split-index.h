@@ -0,0 +1,63 @@
+#ifndef SPLIT_INDEX_H
+#define SPLIT_INDEX_H
+
+struct index_state;
+struct strbuf;
+struct ewah_bitmap;
+
+/*
+ * A split index stores most of its entries in a shared index file,
+ * $GIT_DIR/sharedindex.<SHA-1>, and only the entries that were added
+ * or changed since, plus the positions of the shared entries that
+ * were removed, in the index file itself.  Updating a few entries
+ * then only writes (and hashes) a small file.  See the "link"
+ * extension in Documentation/technical/index-format.txt.
+ */
+struct split_index {
+	/* the trailer checksum, and name, of the shared index */
+	unsigned char base_sha1[20];
+
+	/*
+	 * The shared index file, kept mapped so that we can tell which
+	 * entries changed when writing the index out again.
+	 */
+	void *base_mmap;
+	size_t base_mmap_size;
+
+	/* read from the "link" extension */
+	struct ewah_bitmap *delete_bitmap;
+	unsigned int nr_own_entries;
+};
+
+extern struct split_index *init_split_index(struct index_state *istate);
+extern void discard_split_index(struct index_state *istate);
+
+extern int read_link_extension(struct index_state *istate,
+			       const void *data, unsigned long sz);
+extern void write_link_extension(struct strbuf *sb,
+				 const unsigned char *base_sha1,
+				 struct ewah_bitmap *delete_bitmap);
+
+/*
+ * Should "istate" be written as a split index?  This is the case when
+ * it was read from one, unless core.splitIndex is false, and for the
+ * main index when core.splitIndex is true.
+ */
+extern int want_split_index(struct index_state *istate);
+
+/*
+ * Should the shared index be rewritten, given the number of its
+ * "base_nr" entries that "changed" since?  (splitIndex.maxPercentChange)
+ */
+extern int too_many_changes(unsigned int base_nr, unsigned int changed);
+
+/* Keep the shared index of "istate" from being expired. */
+extern void freshen_shared_index(const unsigned char *base_sha1);
+
+/*
+ * Remove the shared index files, other than the one named "keep",
+ * that have not been used for splitIndex.sharedIndexExpire.
+ */
+extern void clean_shared_index_files(const unsigned char *keep);
+
+#endif
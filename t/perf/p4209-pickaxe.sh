@@ -0,0 +1,34 @@
+#!/bin/sh
+
+test_description="Tests pickaxe and fixed-string search performance
+
+These spend most of their time in kwset; compare the two versions
+with ./run <old> <new> p4209-pickaxe.sh.
+"
+
+. ./perf-lib.sh
+
+test_perf_default_repo
+
+test_perf 'log -S (long string)' '
+	git log -S some_nonexistent_string --format=%H >/dev/null
+'
+
+test_perf 'log -S (short string)' '
+	git log -S zq --format=%H >/dev/null
+'
+
+test_perf 'log -S --regexp-ignore-case' '
+	git log -S Some_Nonexistent_String --regexp-ignore-case \
+		--format=%H >/dev/null
+'
+
+test_perf 'grep -F' '
+	git grep -F some_nonexistent_string HEAD >/dev/null || :
+'
+
+test_perf 'grep -F -i' '
+	git grep -F -i Some_Nonexistent_String HEAD >/dev/null || :
+'
+
+test_done
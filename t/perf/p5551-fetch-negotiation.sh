@@ -0,0 +1,54 @@
+#!/bin/sh
+
+test_description='Tests fetch negotiation with a lot of local history
+
+The client has many branches of history the server does not know
+about, and fetches one new commit.  Run with -v to see how many
+requests each algorithm makes and how many "have" lines it sends.
+'
+
+. ./perf-lib.sh
+
+test_perf_default_repo server
+
+test_expect_success 'setup' '
+	head=$(git -C server rev-parse HEAD) &&
+	when=$(git -C server log -1 --format=%ct HEAD) &&
+	git clone -q --bare server client.orig &&
+	for b in $(test_seq 1 20)
+	do
+		echo "reset refs/heads/local-$b" &&
+		echo "from $(git -C server rev-parse HEAD~$b)" &&
+		for i in $(test_seq 1 250)
+		do
+			when=$(($when + 1)) &&
+			echo "commit refs/heads/local-$b" &&
+			echo "committer C O Mitter <committer@example.com> $when +0000" &&
+			echo "data <<EOF" &&
+			echo "local $b-$i" &&
+			echo "EOF" || return 1
+		done || return 1
+	done >input &&
+	git --git-dir=client.orig fast-import --quiet <input &&
+	new=$(git -C server commit-tree -p $head -m new "$head^{tree}") &&
+	git -C server update-ref refs/heads/perf-new $new
+'
+
+for algo in default skipping
+do
+	test_perf "fetch (fetch.negotiationAlgorithm=$algo)" "
+		rm -rf client.git trace.$algo &&
+		git clone -q --bare --shared client.orig client.git &&
+		GIT_TRACE_PACKET=\"\$(pwd)/trace.$algo\" \
+			git --git-dir=client.git \
+			-c fetch.negotiationAlgorithm=$algo \
+			fetch -q --no-tags server perf-new:perf-new
+	"
+
+	test_expect_success "requests and haves ($algo)" "
+		echo \$(grep -c 'fetch> 0000' trace.$algo) requests &&
+		echo \$(grep -c 'fetch> have' trace.$algo) haves
+	"
+done
+
+test_done
@@ -243,6 +243,108 @@ EOF
 	test_line_count = 0 err
 '
 
+test_expect_success 'the last matching rule wins across kinds of patterns' '
+	cat >.gitattributes <<-\EOF &&
+	*.gz test=gz
+	doc/** test=doc
+	*.tar.gz test=tgz
+	Makefile test=make
+	doc/sub/*.txt test=subtxt
+	/top/ test=top
+	x* test=x
+	*.txt test=txt
+	EOF
+	mkdir -p doc/sub top &&
+	cat >expect <<-\EOF &&
+	a.gz: test: gz
+	a.tar.gz: test: tgz
+	doc/a.gz: test: doc
+	doc/a.tar.gz: test: tgz
+	doc/Makefile: test: make
+	doc/sub/a.txt: test: txt
+	doc/sub/a.c: test: doc
+	doc/sub/xa.c: test: x
+	Makefile: test: make
+	makefile: test: unspecified
+	top: test: unspecified
+	top/: test: top
+	sub/top/: test: unspecified
+	gz: test: unspecified
+	.gz: test: gz
+	EOF
+	sed -e "s/: test: .*//" expect |
+	git check-attr --stdin test >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rules looked up by directory and extension' '
+	cat >.gitattributes <<-\EOF &&
+	doc/sub/*.c test=subc
+	*.tar.gz test=tgz
+	EOF
+	cat >doc/.gitattributes <<-\EOF &&
+	sub/*.txt test=subtxt
+	/sub/Makefile test=make
+	EOF
+	cat >expect <<-\EOF &&
+	doc/sub/a.c: test: subc
+	doc/sub/a.txt: test: subtxt
+	doc/sub/Makefile: test: make
+	doc/subx/a.c: test: unspecified
+	doc/sub/deeper/a.c: test: unspecified
+	doc/a.txt: test: unspecified
+	sub/a.txt: test: unspecified
+	doc/sub/a.gz: test: unspecified
+	doc/sub/a.tar.gz: test: tgz
+	doc/sub/tar.gz: test: unspecified
+	EOF
+	sed -e "s/: test: .*//" expect |
+	git check-attr --stdin test >actual &&
+	test_cmp expect actual &&
+	rm doc/.gitattributes
+'
+
+test_expect_success 'rules looked up by name obey core.ignorecase' '
+	cat >.gitattributes <<-\EOF &&
+	Makefile test=make
+	*.TXT test=txt
+	Doc/*.c test=docc
+	EOF
+	cat >expect <<-\EOF &&
+	makefile: test: make
+	doc/a.txt: test: txt
+	doc/a.c: test: docc
+	EOF
+	sed -e "s/: test: .*//" expect |
+	git -c core.ignorecase=1 check-attr --stdin test >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'checking many paths at once' '
+	cat >.gitattributes <<-\EOF &&
+	*.c test=c
+	sub/** test=sub
+	EOF
+	mkdir -p sub/dir &&
+	echo "x.c test=subc" >sub/dir/.gitattributes &&
+	cat >expect <<-\EOF &&
+	a.c: test: c
+	sub/a.c: test: sub
+	sub/dir/x.c: test: subc
+	sub/dir/y.c: test: sub
+	b.c: test: c
+	sub/dir/x.c: test: subc
+	x.c: test: c
+	d: test: unspecified
+	EOF
+	git check-attr test -- $(sed -e "s/: test: .*//" expect) >actual &&
+	test_cmp expect actual &&
+	sed -e "s/: test: .*//" expect |
+	git check-attr --stdin test >actual &&
+	test_cmp expect actual &&
+	rm -r sub
+'
+
 test_expect_success 'setup bare' '
 	git clone --bare . bare.git &&
 	cd bare.git
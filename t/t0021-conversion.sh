@@ -190,6 +190,106 @@ test_expect_success 'required filter clean failure' '
 	test_must_fail git add test.fc
 '
 
+test_expect_success 'setup process filter' '
+	write_script rot13-filter.pl "$PERL_PATH" \
+		<"$TEST_DIRECTORY"/t0021/rot13-filter.pl &&
+	filter="\"$(pwd)/rot13-filter.pl\" \"$(pwd)/filter.log\"" &&
+	git init process &&
+	(
+		cd process &&
+		git config filter.protocol.process "$filter clean smudge" &&
+		git config filter.protocol.required true &&
+		git config filter.cleanonly.process "$filter clean" &&
+		echo "*.r filter=protocol" >.gitattributes &&
+		echo "*.c filter=cleanonly" >>.gitattributes &&
+		for i in 1 2 3
+		do
+			echo "content $i" >test$i.r || return 1
+		done &&
+		echo "only cleaned" >test.c &&
+		echo "not filtered" >plain.txt
+	)
+'
+
+test_expect_success 'process filter cleans all files in one process' '
+	rm -f filter.log &&
+	(
+		cd process &&
+		git add . &&
+		echo "pbagrag 1" >expect &&
+		git cat-file blob :test1.r >actual &&
+		test_cmp expect actual &&
+		echo "bayl pyrnarq" >expect &&
+		git cat-file blob :test.c >actual &&
+		test_cmp expect actual &&
+		echo "not filtered" >expect &&
+		git cat-file blob :plain.txt >actual &&
+		test_cmp expect actual
+	) &&
+	test "$(grep -c START filter.log)" = 2 &&
+	test "$(grep -c "IN: clean .*\.r" filter.log)" = 3 &&
+	test "$(grep -c "IN: clean test\.c" filter.log)" = 1 &&
+	grep STOP filter.log &&
+	(
+		cd process &&
+		test_tick &&
+		git commit -m "filtered files"
+	)
+'
+
+test_expect_success 'process filter smudges all files in one process' '
+	rm -f filter.log &&
+	(
+		cd process &&
+		rm -f test*.r test.c &&
+		git checkout -- . &&
+		echo "content 2" >expect &&
+		test_cmp expect test2.r &&
+		echo "bayl pyrnarq" >expect &&
+		test_cmp expect test.c
+	) &&
+	test "$(grep -c START filter.log)" = 2 &&
+	test "$(grep -c "IN: smudge" filter.log)" = 3
+'
+
+test_expect_success 'process filter reports an error' '
+	(
+		cd process &&
+		echo "error" >error.r &&
+		test_must_fail git add error.r &&
+		git -c filter.protocol.required=false add error.r &&
+		echo error >expect &&
+		git cat-file blob :error.r >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'process filter can abort a capability' '
+	rm -f filter.log &&
+	(
+		cd process &&
+		echo "abort" >abort.r &&
+		echo "after abort" >test4.r &&
+		git config filter.protocol.required false &&
+		git add abort.r test4.r &&
+		git config filter.protocol.required true &&
+		echo "after abort" >expect &&
+		git cat-file blob :test4.r >actual &&
+		test_cmp expect actual
+	) &&
+	grep "IN: clean abort.r" filter.log &&
+	! grep "IN: clean test4.r" filter.log
+'
+
+test_expect_success 'required process filter that cannot start' '
+	(
+		cd process &&
+		echo "more content" >test5.r &&
+		test_must_fail git -c filter.protocol.process=false add test5.r &&
+		test_must_fail git -c filter.protocol.process="echo garbage" add test5.r
+	)
+'
+
 test -n "$GIT_TEST_LONG" && test_set_prereq EXPENSIVE
 
 test_expect_success EXPENSIVE 'filter large file' '
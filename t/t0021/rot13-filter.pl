@@ -0,0 +1,141 @@
+#
+# Example implementation for the Git filter protocol version 2
+# See Documentation/gitattributes.txt, section "Long Running Filter Process"
+#
+# Usage: rot13-filter.pl <log> <capabilities>...
+#
+# The filter rot13s the content of every file, and appends the
+# commands it gets to <log>, together with a line for each start and
+# exit of the process.  It only advertises the given capabilities.
+#
+# A file named "error.r" is answered with "status=error", and
+# "abort.r" with "status=abort".
+#
+
+use strict;
+use warnings;
+
+my $MAX_PACKET_CONTENT_SIZE = 65516;
+my $log_file = shift @ARGV;
+my @capabilities = @ARGV;
+
+open my $debug, ">>", $log_file or die "cannot open log file: $!";
+$debug->autoflush(1);
+print $debug "START\n";
+
+sub rot13 {
+	my $str = shift;
+	$str =~ y/A-Za-z/N-ZA-Mn-za-m/;
+	return $str;
+}
+
+sub packet_bin_read {
+	my $buffer;
+	my $bytes_read = read STDIN, $buffer, 4;
+	if ($bytes_read == 0) {
+		# EOF - Git stopped talking to us!
+		print $debug "STOP\n";
+		exit();
+	} elsif ($bytes_read != 4) {
+		die "invalid packet: '$buffer'";
+	}
+	my $pkt_size = hex $buffer;
+	if ($pkt_size == 0) {
+		return (1, "");
+	} elsif ($pkt_size > 4) {
+		my $content_size = $pkt_size - 4;
+		$bytes_read = read STDIN, $buffer, $content_size;
+		if ($bytes_read != $content_size) {
+			die "invalid packet ($content_size bytes expected; $bytes_read bytes read)";
+		}
+		return (0, $buffer);
+	} else {
+		die "invalid packet size: $pkt_size";
+	}
+}
+
+sub packet_txt_read {
+	my ($res, $buf) = packet_bin_read();
+	unless ($res == 1 || $buf =~ s/\n$//) {
+		die "A non-binary line MUST be terminated by an LF.";
+	}
+	return ($res, $buf);
+}
+
+sub packet_bin_write {
+	my $buf = shift;
+	print STDOUT sprintf("%04x", length($buf) + 4);
+	print STDOUT $buf;
+	STDOUT->flush();
+}
+
+sub packet_txt_write {
+	packet_bin_write($_[0] . "\n");
+}
+
+sub packet_flush {
+	print STDOUT sprintf("%04x", 0);
+	STDOUT->flush();
+}
+
+(packet_txt_read() eq (0, "git-filter-client")) || die "bad initialization";
+(packet_txt_read() eq (0, "version=2")) || die "bad version";
+(packet_bin_read() eq (1, "")) || die "bad version end";
+
+packet_txt_write("git-filter-server");
+packet_txt_write("version=2");
+packet_flush();
+
+my %supported;
+while (1) {
+	my ($done, $line) = packet_txt_read();
+	last if $done;
+	$line =~ s/^capability=// || die "bad capability: '$line'";
+	$supported{$line} = 1;
+}
+foreach my $cap (@capabilities) {
+	packet_txt_write("capability=$cap") if $supported{$cap};
+}
+packet_flush();
+print $debug "init handshake complete\n";
+
+while (1) {
+	my ($command) = packet_txt_read() =~ /^command=(.+)$/;
+	my ($pathname) = packet_txt_read() =~ /^pathname=(.+)$/;
+	(packet_bin_read() eq (1, "")) || die "bad request end";
+	print $debug "IN: $command $pathname";
+
+	my $input = "";
+	while (1) {
+		my ($done, $buffer) = packet_bin_read();
+		last if $done;
+		$input .= $buffer;
+	}
+	print $debug " " . length($input) . " [OK] -- ";
+
+	if ($pathname eq "error.r") {
+		print $debug "[ERROR]\n";
+		packet_txt_write("status=error");
+		packet_flush();
+	} elsif ($pathname eq "abort.r") {
+		print $debug "[ABORT]\n";
+		packet_txt_write("status=abort");
+		packet_flush();
+	} else {
+		my $output = rot13($input);
+		packet_txt_write("status=success");
+		packet_flush();
+		while (length($output) > 0) {
+			my $packet = substr($output, 0, $MAX_PACKET_CONTENT_SIZE);
+			packet_bin_write($packet);
+			if (length($output) > $MAX_PACKET_CONTENT_SIZE) {
+				$output = substr($output, $MAX_PACKET_CONTENT_SIZE);
+			} else {
+				$output = "";
+			}
+		}
+		packet_flush();
+		packet_flush(); # empty list, keep "status=success"
+		print $debug "OUT: " . length(rot13($input)) . " [OK]\n";
+	}
+}
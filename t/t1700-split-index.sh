@@ -0,0 +1,115 @@
+#!/bin/sh
+
+test_description='split index mode tests'
+
+. ./test-lib.sh
+
+test_expect_success 'enable split index' '
+	# the repository is tiny; do not rewrite the shared index on every change
+	git config splitIndex.maxPercentChange 100 &&
+	for i in one two three
+	do
+		echo $i >$i || return 1
+	done &&
+	git add one two three &&
+	git ls-files --stage >expect &&
+	git update-index --split-index &&
+	test-dump-split-index >actual &&
+	base=$(sed -n "s/^base //p" actual) &&
+	test_path_is_file .git/sharedindex.$base &&
+	grep "^own entries 0$" actual &&
+	git ls-files --stage >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'add a new file' '
+	echo four >four &&
+	git update-index --add four &&
+	test-dump-split-index >actual &&
+	grep "^own entries 1$" actual &&
+	git ls-files >actual &&
+	printf "%s\n" four one three two >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'modify a shared entry' '
+	echo changed >one &&
+	git update-index one &&
+	test-dump-split-index >actual &&
+	grep "^own entries 2$" actual &&
+	git ls-files --stage one >actual &&
+	echo "100644 $(git hash-object one) 0	one" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'delete a shared entry' '
+	git update-index --force-remove two &&
+	test-dump-split-index >actual &&
+	grep "^deletions: 2$" actual &&
+	git ls-files >actual &&
+	printf "%s\n" four one three >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'split index reads back like a full index' '
+	git ls-files --stage >expect &&
+	cp .git/index split-index &&
+	git update-index --no-split-index &&
+	test-dump-split-index >actual &&
+	grep "not a split index" actual &&
+	git ls-files --stage >actual &&
+	test_cmp expect actual &&
+	GIT_INDEX_FILE=split-index git ls-files --stage >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'core.splitIndex enables split index' '
+	git -c core.splitIndex=true update-index --add two &&
+	test-dump-split-index >actual &&
+	grep "^own entries 0$" actual &&
+	git -c core.splitIndex=true commit -m initial &&
+	git diff-index --cached --exit-code HEAD
+'
+
+test_expect_success 'many changes rewrite the shared index' '
+	test-dump-split-index >before &&
+	echo again >>one &&
+	git -c splitIndex.maxPercentChange=0 update-index one &&
+	test-dump-split-index >actual &&
+	grep "^own entries 0$" actual &&
+	! test_cmp before actual &&
+	test_when_finished "git checkout one" &&
+	echo more >>one &&
+	test_must_fail git -c splitIndex.maxPercentChange=101 \
+		update-index one 2>err &&
+	grep maxPercentChange err
+'
+
+test_expect_success 'checkout and reset keep the split index' '
+	git checkout -b side &&
+	echo side >five &&
+	git add five &&
+	git commit -m side &&
+	git checkout master &&
+	test-dump-split-index >actual &&
+	grep "^base " actual &&
+	test_path_is_missing five &&
+	git reset --hard side &&
+	test-dump-split-index >actual &&
+	grep "^base " actual &&
+	git ls-files >actual &&
+	printf "%s\n" five four one three two >expect &&
+	test_cmp expect actual &&
+	git status --porcelain -uno >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'unused shared indexes expire' '
+	echo expire >>one &&
+	git -c splitIndex.sharedIndexExpire=now \
+		-c splitIndex.maxPercentChange=0 update-index one &&
+	ls .git/sharedindex.* >actual &&
+	test_line_count = 1 actual
+'
+
+test_done
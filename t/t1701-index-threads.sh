@@ -0,0 +1,88 @@
+#!/bin/sh
+
+test_description='reading the index with several threads'
+
+. ./test-lib.sh
+
+# Read the index both in a single thread, skipping the offset table,
+# and with several threads; the results must be the same.
+test_threaded_read () {
+	git -c index.threads=1 ls-files --stage --debug >expect &&
+	git -c index.threads=1 ls-files --resolve-undo >>expect &&
+	test-dump-cache-tree >>expect &&
+	git -c index.threads=3 ls-files --stage --debug >actual &&
+	git -c index.threads=3 ls-files --resolve-undo >>actual &&
+	git -c index.threads=3 -c core.untrackedcache=false \
+		status --porcelain >status &&
+	git -c index.threads=1 -c core.untrackedcache=false \
+		status --porcelain >status.expect &&
+	test_cmp status.expect status &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	git config index.threads 3 &&
+	printf "expect\nactual\nstatus*\n" >>.git/info/exclude &&
+	mkdir -p a/b c &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		echo $i >file$i &&
+		echo $i >a/file$i &&
+		echo $i >a/b/file$i &&
+		echo $i >c/longer-file-name-$i || return 1
+	done &&
+	git add . &&
+	test_tick &&
+	git commit -m initial
+'
+
+test_expect_success 'the offset table is written with index.threads' '
+	grep IEOT .git/index >/dev/null &&
+	grep EOIE .git/index >/dev/null
+'
+
+test_expect_success 'threaded read gives the same index' '
+	test_threaded_read
+'
+
+test_expect_success 'with more threads than blocks' '
+	git -c index.threads=40 ls-files --stage >actual &&
+	git ls-files --stage >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'extensions are read alongside the entries' '
+	git write-tree &&
+	echo changed >a/file1 &&
+	git add a/file1 &&
+	git commit -m second &&
+	git checkout -b side HEAD^ &&
+	echo side >a/file1 &&
+	git commit -a -m side &&
+	test_must_fail git merge master &&
+	echo resolved >a/file1 &&
+	git add a/file1 &&
+	git ls-files --resolve-undo >actual &&
+	test -s actual &&
+	test_threaded_read
+'
+
+test_expect_success 'index version 4' '
+	git update-index --index-version 4 &&
+	grep IEOT .git/index >/dev/null &&
+	test_threaded_read &&
+	git update-index --index-version 2
+'
+
+test_expect_success 'a single thread does not write the table' '
+	git -c index.threads=false update-index --force-remove file0 &&
+	! grep IEOT .git/index >/dev/null &&
+	! grep EOIE .git/index >/dev/null &&
+	test_threaded_read
+'
+
+test_expect_success 'bad index.threads value' '
+	test_must_fail git -c index.threads=-1 ls-files
+'
+
+test_done
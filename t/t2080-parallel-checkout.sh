@@ -0,0 +1,148 @@
+#!/bin/sh
+
+test_description='checkout with worker processes'
+
+. ./test-lib.sh
+
+# Compare the working tree of two repositories, leaving .git alone.
+test_cmp_worktree () {
+	(cd "$1" && find . -name .git -prune -o -print | sort) >"$1.list" &&
+	(cd "$2" && find . -name .git -prune -o -print | sort) >"$2.list" &&
+	test_cmp "$1.list" "$2.list" &&
+	while read f
+	do
+		if test -h "$1/$f"
+		then
+			test "$(readlink "$1/$f")" = "$(readlink "$2/$f")" ||
+			return 1
+		elif test -f "$1/$f"
+		then
+			test_cmp "$1/$f" "$2/$f" || return 1
+		fi
+	done <"$1.list"
+}
+
+test_expect_success 'setup' '
+	mkdir -p dir/sub other &&
+	for i in 1 2 3 4 5 6 7 8 9
+	do
+		echo "file $i" >file$i &&
+		echo "dir file $i" >dir/file$i &&
+		echo "sub file $i" >dir/sub/file$i || return 1
+	done &&
+	printf "one\ntwo\n" >crlf.txt &&
+	echo "\$Id\$" >ident.txt &&
+	echo "to be smudged" >smudge.txt &&
+	echo "executable" >other/exec &&
+	chmod +x other/exec &&
+	test_chmod +x other/exec &&
+	cat >.gitattributes <<-\EOF &&
+	crlf.txt eol=crlf
+	ident.txt ident
+	smudge.txt filter=upcase
+	EOF
+	git config --global filter.upcase.smudge "tr a-z A-Z" &&
+	git config --global filter.upcase.clean "tr A-Z a-z" &&
+	test_ln_s_add dir/file1 link &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	git branch initial &&
+
+	echo changed >dir/file5 &&
+	git rm -q file9 &&
+	echo new >other/new &&
+	printf "three\nfour\n" >crlf.txt &&
+	git add . &&
+	test_tick &&
+	git commit -m second
+'
+
+test_expect_success 'clone with workers writes the same tree' '
+	git clone -q . sequential &&
+	GIT_TRACE="$(pwd)/trace" git -c checkout.workers=2 \
+		-c checkout.thresholdForParallelism=0 clone -q . parallel &&
+	grep "checkout--worker" trace &&
+	test_cmp_worktree sequential parallel &&
+	printf "three\r\nfour\r\n" >expect &&
+	test_cmp expect parallel/crlf.txt &&
+	grep "\\\$Id: [0-9a-f]* \\\$" parallel/ident.txt &&
+	echo "TO BE SMUDGED" >expect &&
+	test_cmp expect parallel/smudge.txt &&
+	test -x parallel/other/exec
+'
+
+test_expect_success 'files written by workers are up to date in the index' '
+	(
+		cd parallel &&
+		git diff-files --exit-code &&
+		git status --porcelain >../actual
+	) &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'switching branches with workers' '
+	rm -f trace &&
+	(
+		cd sequential &&
+		git checkout -q origin/initial
+	) &&
+	(
+		cd parallel &&
+		git config checkout.workers 3 &&
+		git config checkout.thresholdForParallelism 0 &&
+		GIT_TRACE="$(pwd)/../trace" git checkout -q origin/initial &&
+		git diff-files --exit-code
+	) &&
+	grep "checkout--worker" trace &&
+	test_cmp_worktree sequential parallel
+'
+
+test_expect_success 'reset --hard with workers' '
+	(
+		cd parallel &&
+		rm -r dir &&
+		echo garbage >file1 &&
+		git reset -q --hard origin/master &&
+		git diff-files --exit-code &&
+		git status --porcelain >../actual
+	) &&
+	test_must_be_empty actual &&
+	(
+		cd sequential &&
+		git reset -q --hard origin/master
+	) &&
+	test_cmp_worktree sequential parallel
+'
+
+test_expect_success 'no workers below the threshold' '
+	rm -f trace &&
+	(
+		cd parallel &&
+		git config --unset checkout.thresholdForParallelism &&
+		GIT_TRACE="$(pwd)/../trace" git checkout -q origin/initial
+	) &&
+	! grep "checkout--worker" trace &&
+	(
+		cd sequential &&
+		git checkout -q origin/initial
+	) &&
+	test_cmp_worktree sequential parallel
+'
+
+test_expect_success CASE_INSENSITIVE_FS 'colliding paths are checked out in index order' '
+	git init collide &&
+	(
+		cd collide &&
+		blob1=$(echo upper | git hash-object -w --stdin) &&
+		blob2=$(echo lower | git hash-object -w --stdin) &&
+		printf "100644 %s 0\t%s\n" $blob1 FILE $blob2 file |
+		git update-index --index-info &&
+		git -c checkout.workers=2 -c checkout.thresholdForParallelism=0 \
+			read-tree -u --reset $(git write-tree) &&
+		echo lower >expect &&
+		test_cmp expect FILE
+	)
+'
+
+test_done
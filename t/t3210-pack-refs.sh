@@ -151,4 +151,65 @@ test_expect_success 'delete ref while another dangling packed ref' '
 	test_cmp /dev/null result
 '
 
+test_expect_success 'pack-refs writes the sorted trait' '
+	git pack-refs --all &&
+	head -n 1 .git/packed-refs >header &&
+	grep " sorted " header
+'
+
+test_expect_success 'set up many packed refs' '
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		git tag -a -m "tag $i" sorted/tag$i &&
+		git branch sorted/branch$i &&
+		git branch sorted-$i &&
+		git branch sorted$i || return 1
+	done &&
+	git pack-refs --all &&
+	git show-ref >all-refs &&
+	git show-ref -d >all-refs-peeled
+'
+
+test_expect_success 'look up packed refs by binary search' '
+	while read sha1 refname
+	do
+		echo "$sha1" >expect &&
+		git rev-parse --verify "$refname" >actual &&
+		test_cmp expect actual || return 1
+	done <all-refs &&
+	test_must_fail git rev-parse --verify refs/heads/sorted &&
+	test_must_fail git rev-parse --verify refs/heads/sorted/branch &&
+	test_must_fail git rev-parse --verify refs/heads/sorted0a &&
+	test_must_fail git rev-parse --verify refs/aaa &&
+	test_must_fail git rev-parse --verify refs/zzz
+'
+
+test_expect_success 'iterate over a prefix of packed refs' '
+	grep " refs/heads/sorted/" all-refs >expect &&
+	git for-each-ref --format="%(objectname) %(refname)" \
+		refs/heads/sorted/ >actual &&
+	test_cmp expect actual &&
+	grep " refs/tags/sorted/" all-refs-peeled >expect &&
+	git show-ref -d --tags >actual.all &&
+	grep " refs/tags/sorted/" actual.all >actual &&
+	test_cmp expect actual &&
+	git branch -r >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'packed refs without the sorted trait are still read' '
+	echo "# pack-refs with: " >unsorted &&
+	grep -v "^[#^]" .git/packed-refs | sort -r >>unsorted &&
+	mv unsorted .git/packed-refs &&
+	git show-ref >actual &&
+	test_cmp all-refs actual &&
+	git show-ref -d >actual &&
+	test_cmp all-refs-peeled actual &&
+	git rev-parse --verify refs/tags/sorted/tag9 &&
+	git pack-refs --all &&
+	grep " sorted " .git/packed-refs &&
+	git show-ref >actual &&
+	test_cmp all-refs actual
+'
+
 test_done
@@ -0,0 +1,67 @@
+#!/bin/sh
+
+test_description='splitting and hashing of xdiff records'
+
+. ./test-lib.sh
+
+# Print the length of each record of the file, counting its newline
+record_lengths () {
+	"$PERL_PATH" -ne 'print length($_), "\n"' "$1"
+}
+
+# Fail if the same line is hashed to different values
+check_hashes () {
+	test-xdiff-hash $2 dump "$1" >dump &&
+	cut -d" " -f2 dump >hashes &&
+	paste "$1" hashes | sort -u |
+	cut -f1 | uniq -d >duplicates &&
+	test_must_be_empty duplicates
+}
+
+test_expect_success setup '
+	line=abcdefghijklmnopqrstuvwxyz0123456789 &&
+	for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17
+	do
+		printf "%s\n%s\n\n" "$(echo $line | cut -c 1-$(($i + 1)))" "$line"
+	done >lines &&
+	printf "%s\n" "" "a" "abcdefg" "abcdefgh" "abcdefghi" >short &&
+	printf "%s\n%s\n%s" "one line" "" "without a newline" >partial &&
+	cat lines >partial-long &&
+	printf "%s" "$line$line" >>partial-long
+'
+
+for f in lines short partial partial-long
+do
+	test_expect_success "records of $f end at the newlines" '
+		record_lengths $f >expect &&
+		test-xdiff-hash dump $f >dump &&
+		cut -d" " -f1 dump >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "the same records of $f hash the same" '
+		check_hashes $f &&
+		check_hashes $f -b &&
+		check_hashes $f -w
+	'
+done
+
+test_expect_success 'different records hash differently' '
+	test-xdiff-hash dump short >dump &&
+	cut -d" " -f2 dump | sort | uniq -d >duplicates &&
+	test_must_be_empty duplicates
+'
+
+test_expect_success 'whitespace is ignored with -w' '
+	printf "%s\n" "a b" "ab" " a  b " >ws &&
+	test-xdiff-hash -w dump ws >dump &&
+	cut -d" " -f2 dump | sort -u >hashes &&
+	test_line_count = 1 hashes
+'
+
+test_expect_success 'perf mode counts the records' '
+	test-xdiff-hash perf lines 3 >out &&
+	grep "^54 records\$" out
+'
+
+test_done
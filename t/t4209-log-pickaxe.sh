@@ -144,4 +144,51 @@ test_expect_success 'log -S --no-textconv (missing textconv tool)' '
 	rm .gitattributes
 '
 
+test_expect_success 'setup blobs that come back' '
+	git checkout -b revert &&
+	printf "%s\n" one needle two >file &&
+	git commit -a -m add-needle &&
+	printf "%s\n" one two >file &&
+	git commit -a -m remove-needle &&
+	printf "%s\n" one needle two >file &&
+	git commit -a -m re-add-needle &&
+	printf "%s\n" one needle two needle >file &&
+	git commit -a -m add-another-needle &&
+	printf "%s\n" one two needle needle >file &&
+	git commit -a -m move-needle
+'
+
+test_expect_success 'log -S sees blobs that come back' '
+	git log -Sneedle --format=%s master..revert >actual &&
+	printf "%s\n" add-another-needle re-add-needle remove-needle \
+		add-needle >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'log -G sees blobs that come back' '
+	git log -Gneedle --format=%s master..revert >actual &&
+	printf "%s\n" move-needle add-another-needle re-add-needle \
+		remove-needle add-needle >expect &&
+	test_cmp expect actual &&
+	git log -Gne.dle --format=%s master..revert >actual &&
+	test_cmp expect actual &&
+	git log -Gthree --format=%s master..revert >actual &&
+	>expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'log -G looks past a NUL in the blobs' '
+	git checkout -b nul master &&
+	printf "a\0b\nline one\n" >binary &&
+	git add binary &&
+	git commit -m add-binary &&
+	printf "foo bar\n" >>binary &&
+	git commit -a -m append &&
+	git log -G"fo+ bar" --format=%s master..nul >actual &&
+	echo append >expect &&
+	test_cmp expect actual &&
+	git log -i -G"FOO bar" --format=%s master..nul >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -333,6 +333,41 @@ test_expect_success 'unpacking with --strict' '
 	)
 '
 
+test_expect_success 'unpack.toPack writes a single pack' '
+	git cat-file --batch <obj-list >expect.batch &&
+	for pack in test-2-$packname_2.pack test-3-$packname_3.pack
+	do
+		rm -rf topack &&
+		test_create_repo topack &&
+		(
+			cd topack &&
+			git config unpack.toPack true &&
+			git unpack-objects <../$pack &&
+			git count-objects -v >count &&
+			grep "^count: 0$" count &&
+			grep "^packs: 1$" count &&
+			git cat-file --batch <../obj-list >../actual.batch
+		) &&
+		test_cmp expect.batch actual.batch || return 1
+	done
+'
+
+test_expect_success 'unpack.toPack with --strict' '
+	rm -rf topack &&
+	test_create_repo topack &&
+	(
+		cd topack &&
+		git config unpack.toPack true &&
+		git unpack-objects --strict <../test-5-$PACK5.pack &&
+		git count-objects -v >count &&
+		grep "^count: 0$" count &&
+		grep "^packs: 1$" count &&
+		git ls-tree -r $LIST &&
+		git ls-tree -r $LI &&
+		git ls-tree -r $ST
+	)
+'
+
 test_expect_success 'index-pack with --strict' '
 
 	for j in a b c d e f g
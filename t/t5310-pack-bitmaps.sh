@@ -0,0 +1,152 @@
+#!/bin/sh
+
+test_description='exercise basic bitmap functionality'
+. ./test-lib.sh
+
+test_expect_success 'setup repo with moderate-sized history' '
+	for i in $(test_seq 1 10)
+	do
+		test_commit $i
+	done &&
+	git checkout -b other HEAD~5 &&
+	for i in $(test_seq 1 10)
+	do
+		test_commit side-$i
+	done &&
+	git checkout master &&
+	blob=$(echo tagged-blob | git hash-object -w --stdin) &&
+	git tag tagged-blob $blob &&
+	git config pack.writebitmaps true
+'
+
+test_expect_success 'full repack creates bitmaps' '
+	git repack -ad &&
+	ls .git/objects/pack/ | grep bitmap >output &&
+	test_line_count = 1 output
+'
+
+test_expect_success 'rev-list --test-bitmap verifies bitmaps' '
+	git rev-list --test-bitmap HEAD
+'
+
+rev_list_tests() {
+	state=$1
+
+	test_expect_success "counting commits via bitmap ($state)" '
+		git rev-list --count HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting partial commits via bitmap ($state)" '
+		git rev-list --count HEAD~5..HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD~5..HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerate --objects ($state)" '
+		git rev-list --objects --use-bitmap-index HEAD >tmp &&
+		cut -d" " -f1 <tmp >tmp2 &&
+		sort <tmp2 >actual &&
+		git rev-list --objects HEAD >tmp &&
+		cut -d" " -f1 <tmp >tmp2 &&
+		sort <tmp2 >expect &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "bitmap --objects handles non-commit objects ($state)" '
+		git rev-list --objects --use-bitmap-index --all >actual &&
+		grep $blob actual
+	'
+}
+
+rev_list_tests 'full bitmap'
+
+test_expect_success 'clone from bitmapped repository' '
+	git clone --no-local --bare . clone.git &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'setup further non-bitmapped commits' '
+	for i in $(test_seq 1 10)
+	do
+		test_commit further-$i
+	done
+'
+
+rev_list_tests 'partial bitmap'
+
+test_expect_success 'fetch (partial bitmap)' '
+	git --git-dir=clone.git fetch origin master:master &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'incremental repack does not create bitmaps' '
+	git repack -d &&
+	ls .git/objects/pack/ | grep bitmap >output &&
+	test_line_count = 1 output
+'
+
+test_expect_success 'full repack, reusing previous bitmaps' '
+	git repack -ad &&
+	ls .git/objects/pack/ | grep bitmap >output &&
+	test_line_count = 1 output
+'
+
+test_expect_success 'fetch (full bitmap)' '
+	git --git-dir=clone.git fetch origin master:master &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects copies a wholly wanted pack verbatim' '
+	git pack-objects --all --delta-base-offset --stdout </dev/null >all.pack &&
+	cmp all.pack .git/objects/pack/pack-*.pack
+'
+
+test_expect_success 'objects outside the reused pack are appended to it' '
+	test_commit after-repack &&
+	git pack-objects --all --delta-base-offset --stdout </dev/null >reuse.pack &&
+	git -c pack.allowPackReuse=false pack-objects --all --delta-base-offset \
+		--stdout </dev/null >noreuse.pack &&
+	git index-pack -o reuse.idx reuse.pack &&
+	git index-pack -o noreuse.idx noreuse.pack &&
+	git show-index <reuse.idx | cut -d" " -f2 | sort >actual &&
+	git show-index <noreuse.idx | cut -d" " -f2 | sort >expect &&
+	test_cmp expect actual &&
+	git rev-list --objects --all | cut -d" " -f1 | sort >all &&
+	test_cmp all actual
+'
+
+test_expect_success 'clone reusing the bitmapped pack' '
+	git clone --no-local --bare . reuse-clone.git &&
+	git for-each-ref >expect &&
+	git --git-dir=reuse-clone.git for-each-ref >actual &&
+	test_cmp expect actual &&
+	git --git-dir=reuse-clone.git fsck
+'
+
+test_expect_success 'pack-objects --use-bitmap-index matches a plain walk' '
+	echo HEAD >revs &&
+	echo ^HEAD~7 >>revs &&
+	git pack-objects --use-bitmap-index --revs --stdout <revs >bitmap.pack &&
+	git pack-objects --no-use-bitmap-index --revs --stdout <revs >walk.pack &&
+	git index-pack -o bitmap.idx bitmap.pack &&
+	git index-pack -o walk.idx walk.pack &&
+	git show-index <bitmap.idx | cut -d" " -f2 | sort >actual &&
+	git show-index <walk.idx | cut -d" " -f2 | sort >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'repack -b without -a is an error' '
+	test_must_fail git repack -b
+'
+
+test_done
@@ -0,0 +1,134 @@
+#!/bin/sh
+
+test_description='commit-graph file with generation numbers'
+. ./test-lib.sh
+
+graph=.git/objects/info/commit-graph
+
+test_expect_success 'setup history with merges' '
+	for i in $(test_seq 1 10)
+	do
+		test_commit $i
+	done &&
+	git checkout -b left HEAD~6 &&
+	test_commit left-1 &&
+	test_commit left-2 &&
+	git checkout -b right master~8 &&
+	test_commit right-1 &&
+	git checkout -b third master~4 &&
+	test_commit third-1 &&
+	git checkout master &&
+	git merge -m octopus left right third &&
+	test_commit 11 &&
+	git tag -a -m annotated annotated master~2
+'
+
+test_expect_success 'write graph' '
+	git commit-graph write &&
+	test_path_is_file $graph
+'
+
+graph_compare () {
+	git -c core.commitGraph=false "$@" >expect &&
+	git "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'rev-list --topo-order --parents matches' '
+	graph_compare rev-list --topo-order --parents master
+'
+
+test_expect_success 'rev-list --date-order --all matches' '
+	graph_compare rev-list --date-order --all
+'
+
+test_expect_success 'merge-base matches' '
+	graph_compare merge-base --all left right &&
+	graph_compare merge-base --octopus left right third master~3 &&
+	graph_compare merge-base --independent left right third master
+'
+
+test_expect_success 'merge-base --is-ancestor uses generations correctly' '
+	git merge-base --is-ancestor left master &&
+	git merge-base --is-ancestor 1 left &&
+	test_must_fail git merge-base --is-ancestor master left &&
+	test_must_fail git merge-base --is-ancestor left right
+'
+
+test_expect_success 'tag and branch --contains match' '
+	graph_compare tag --contains 3 &&
+	graph_compare tag --contains left-1 &&
+	graph_compare branch --contains right-1 &&
+	graph_compare branch --contains 9
+'
+
+test_expect_success 'name-rev matches' '
+	graph_compare name-rev left-1 right-1 third-1 2
+'
+
+test_expect_success 'log output is unaffected' '
+	graph_compare log --graph --oneline --all
+'
+
+test_expect_success 'commits are read from the graph' '
+	git init missing &&
+	(
+		cd missing &&
+		test_commit a &&
+		test_commit b &&
+		test_commit c &&
+		git commit-graph write &&
+		commit=$(git rev-parse b) &&
+		rm .git/objects/$(echo $commit | sed -e "s|^..|&/|") &&
+		git rev-list c >actual &&
+		test_line_count = 3 actual &&
+		test_must_fail git -c core.commitGraph=false rev-list c
+	)
+'
+
+test_expect_success 'new commits not in the graph' '
+	test_commit 12 &&
+	graph_compare rev-list --topo-order --parents master &&
+	graph_compare merge-base --all 12 left &&
+	git merge-base --is-ancestor left 12 &&
+	test_must_fail git merge-base --is-ancestor 12 left
+'
+
+test_expect_success 'grafts disable the graph' '
+	test_when_finished "rm -f .git/info/grafts" &&
+	mkdir -p .git/info &&
+	echo "$(git rev-parse master~1) $(git rev-parse 1)" >.git/info/grafts &&
+	graph_compare rev-list master &&
+	git rev-list master >actual &&
+	test_line_count = 3 actual
+'
+
+test_expect_success 'replace refs disable the graph' '
+	test_when_finished "git replace -d $(git rev-parse 5)" &&
+	git replace 5 3 &&
+	graph_compare rev-list --parents master &&
+	test_must_fail git commit-graph write
+'
+
+test_expect_success 'gc writes the graph' '
+	rm -f $graph &&
+	git gc &&
+	test_path_is_file $graph
+'
+
+test_expect_success 'gc.writeCommitGraph=false' '
+	rm -f $graph &&
+	git -c gc.writeCommitGraph=false gc &&
+	test_path_is_missing $graph
+'
+
+test_expect_success 'corrupt graph is ignored' '
+	git commit-graph write &&
+	printf "XXXX" | dd of=$graph bs=1 seek=0 conv=notrunc 2>/dev/null &&
+	git rev-list master >actual 2>err &&
+	git -c core.commitGraph=false rev-list master >expect &&
+	test_cmp expect actual &&
+	grep "signature" err
+'
+
+test_done
@@ -0,0 +1,93 @@
+#!/bin/sh
+
+test_description='multi-pack-index'
+. ./test-lib.sh
+
+midx=.git/objects/pack/multi-pack-index
+
+all_objects () {
+	git rev-list --objects --all | cut -d" " -f1 | sort
+}
+
+# Check that every object can be read, and that none of them was
+# looked up in the .idx of a single pack.
+objects_found_in_midx () {
+	all_objects >objects &&
+	GIT_DEBUG_LOOKUP=1 git cat-file --batch-check <objects >lookup &&
+	! grep missing lookup &&
+	! grep "^lo " lookup &&
+	test_line_count = $(wc -l <objects) lookup
+}
+
+test_expect_success 'setup packs' '
+	for i in 1 2 3
+	do
+		test_commit $i &&
+		git repack -d || return 1
+	done &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 3 packs
+'
+
+test_expect_success 'write multi-pack-index' '
+	git multi-pack-index write &&
+	test_path_is_file $midx
+'
+
+test_expect_success 'objects are looked up in the multi-pack-index' '
+	objects_found_in_midx &&
+	all_objects >objects &&
+	GIT_DEBUG_LOOKUP=1 git -c core.multiPackIndex=false \
+		cat-file --batch-check <objects >lookup &&
+	grep "^lo " lookup
+'
+
+test_expect_success 'cat-file output is unaffected' '
+	all_objects >objects &&
+	git -c core.multiPackIndex=false cat-file --batch <objects >expect &&
+	git cat-file --batch <objects >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'packs added later are still searched' '
+	test_commit 4 &&
+	git repack -d &&
+	git rev-parse 4:4.t >expect &&
+	git cat-file -e $(cat expect) &&
+	git fsck
+'
+
+test_expect_success 'incremental write covers the new pack' '
+	git multi-pack-index write &&
+	objects_found_in_midx
+'
+
+test_expect_success 'count-objects does not report the file as garbage' '
+	git count-objects -v >out &&
+	grep "^garbage: 0" out
+'
+
+test_expect_success 'stale multi-pack-index falls back to the packs' '
+	cp $midx midx.old &&
+	git repack -a -d &&
+	cp midx.old $midx &&
+	git fsck &&
+	all_objects >objects &&
+	git cat-file --batch-check <objects >lookup &&
+	! grep missing lookup
+'
+
+test_expect_success 'repack refreshes the multi-pack-index' '
+	git repack -a -d &&
+	objects_found_in_midx
+'
+
+test_expect_success 'corrupt multi-pack-index is ignored' '
+	printf "XXXX" | dd of=$midx bs=1 seek=0 conv=notrunc 2>/dev/null &&
+	all_objects >objects &&
+	git cat-file --batch-check <objects >lookup 2>err &&
+	! grep missing lookup &&
+	grep "signature" err
+'
+
+test_done
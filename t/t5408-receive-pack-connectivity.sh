@@ -0,0 +1,135 @@
+#!/bin/sh
+
+test_description='receive-pack with receive.checkConnectivityInPack'
+. ./test-lib.sh
+
+Z=$_z40
+
+# Send the objects listed in "objects" to receive-pack of "dst.git", in a
+# pack, to update the ref $2 to $1
+push_pack () {
+	line="$Z $1 $2" &&
+	{
+		printf "%04x%s\0report-status" $((${#line} + 18)) "$line" &&
+		printf 0000 &&
+		git pack-objects --stdout <objects
+	} >request &&
+	git receive-pack dst.git <request >out &&
+	tr "\0" " " <out >response
+}
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git init --bare dst.git &&
+	git -C dst.git config receive.checkConnectivityInPack true &&
+	git -C dst.git config receive.unpackLimit 1 &&
+	git -C dst.git config pack.threads 4
+'
+
+test_expect_success 'push is checked in the pack' '
+	GIT_TRACE="$(pwd)/trace" git push dst.git master &&
+	! grep "rev-list" trace &&
+	git -C dst.git fsck &&
+	git rev-parse master >expect &&
+	git -C dst.git rev-parse master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'push on top of what was pushed before' '
+	test_commit three &&
+	git -C dst.git config pack.threads 1 &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git push dst.git master &&
+	! grep "rev-list" trace &&
+	git -C dst.git fsck
+'
+
+test_expect_success 'missing blob is found' '
+	echo unsent >file &&
+	git add file &&
+	test_tick &&
+	git commit -m "unsent blob" &&
+	{
+		git rev-parse HEAD HEAD^{tree} &&
+		git rev-parse HEAD:one.t
+	} >objects &&
+	push_pack $(git rev-parse HEAD) refs/heads/broken &&
+	grep "ng refs/heads/broken missing necessary objects" response &&
+	test_must_fail git -C dst.git rev-parse --verify refs/heads/broken
+'
+
+test_expect_success 'blob we have loose is enough' '
+	git cat-file blob HEAD:file | git -C dst.git hash-object -w --stdin &&
+	push_pack $(git rev-parse HEAD) refs/heads/loose &&
+	grep "ok refs/heads/loose" response &&
+	git -C dst.git fsck
+'
+
+test_expect_success 'missing parent is found' '
+	git checkout -b side HEAD~1 &&
+	test_commit four &&
+	test_commit five &&
+	git rev-list --objects HEAD~1..HEAD | cut -c1-40 >objects &&
+	push_pack $(git rev-parse HEAD) refs/heads/side &&
+	grep "ng refs/heads/side missing necessary objects" response &&
+	test_must_fail git -C dst.git rev-parse --verify refs/heads/side
+'
+
+test_expect_success 'a rejected pack is removed' '
+	git checkout -b rejected master &&
+	test_commit six &&
+	git rev-parse HEAD >objects &&
+	push_pack $(git rev-parse HEAD) refs/heads/rejected &&
+	grep "ng refs/heads/rejected missing necessary objects" response &&
+	test_must_fail git -C dst.git cat-file -e $(git rev-parse HEAD)
+'
+
+test_expect_success 'cannot build on top of a rejected commit' '
+	git revert --no-edit HEAD &&
+	git rev-parse HEAD >objects &&
+	push_pack $(git rev-parse HEAD) refs/heads/rejected &&
+	grep "ng refs/heads/rejected missing necessary objects" response &&
+	test_must_fail git -C dst.git rev-parse --verify refs/heads/rejected
+'
+
+test_expect_success 'objects the tips do not reach are checked' '
+	git rev-parse HEAD^ >objects &&
+	git commit-tree -p master -m extra master^{tree} >>objects &&
+	push_pack $(tail -n 1 objects) refs/heads/extra &&
+	grep "ng refs/heads/extra missing necessary objects" response &&
+	test_must_fail git -C dst.git cat-file -e $(git rev-parse HEAD^)
+'
+
+test_expect_success 'objects in a kept pack are not trusted' '
+	git -C dst.git config pack.threads 4 &&
+	git checkout -b kept master &&
+	test_commit eight &&
+	pack=$(git rev-parse HEAD | git pack-objects dst.git/objects/pack/pack) &&
+	test_when_finished "rm -f dst.git/objects/pack/pack-$pack.*" &&
+	>dst.git/objects/pack/pack-$pack.keep &&
+	git commit-tree -p HEAD -m on-kept master^{tree} >objects &&
+	push_pack $(cat objects) refs/heads/kept &&
+	grep "ng refs/heads/kept missing necessary objects" response &&
+	test_must_fail git -C dst.git rev-parse --verify refs/heads/kept
+'
+
+test_expect_success 'objects in a kept pack are walked' '
+	pack=$(git rev-list --objects master..HEAD |
+	       git pack-objects dst.git/objects/pack/pack) &&
+	test_when_finished "rm -f dst.git/objects/pack/pack-$pack.keep" &&
+	>dst.git/objects/pack/pack-$pack.keep &&
+	git commit-tree -p HEAD -m on-kept master^{tree} >objects &&
+	push_pack $(cat objects) refs/heads/kept &&
+	grep "ok refs/heads/kept" response
+'
+
+test_expect_success 'small pushes are checked by rev-list' '
+	git -C dst.git config receive.unpackLimit 100 &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git push dst.git side &&
+	grep "rev-list" trace &&
+	git -C dst.git fsck
+'
+
+test_done
@@ -0,0 +1,122 @@
+#!/bin/sh
+
+test_description='fetch.negotiationAlgorithm=skipping'
+. ./test-lib.sh
+
+# Make a commit in the repository $1 on its current branch, with the
+# message $2, and tag it with the message
+make_commit () {
+	test_tick &&
+	git -C "$1" commit -q --allow-empty -m "$2" &&
+	git -C "$1" tag "$2"
+}
+
+# Fetch the master branch of "server" into "client", and record the
+# conversation in "trace"
+fetch_with_skipping () {
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client \
+		-c fetch.negotiationAlgorithm=skipping "$@" \
+		fetch --no-tags "$(pwd)/server" master:refs/remotes/server/master
+}
+
+have_sent () {
+	while test "$#" -ne 0
+	do
+		grep "fetch> have $(git -C client rev-parse "$1")" trace || {
+			echo >&2 "'have' not sent for $1"
+			return 1
+		}
+		shift
+	done
+}
+
+have_not_sent () {
+	while test "$#" -ne 0
+	do
+		! grep "fetch> have $(git -C client rev-parse "$1")" trace || {
+			echo >&2 "'have' sent for $1"
+			return 1
+		}
+		shift
+	done
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	make_commit server base &&
+	git init client &&
+	git -C client fetch --no-tags --update-head-ok \
+		../server master:refs/heads/master &&
+	for i in $(test_seq 1 30)
+	do
+		make_commit client c$i || return 1
+	done &&
+	make_commit server s1
+'
+
+test_expect_success 'commits are skipped at growing distances' '
+	fetch_with_skipping &&
+	have_sent c30 c28 c25 c20 c12 c1^ &&
+	have_not_sent c29 c27 c26 c24 c21 c19 c13 c11 c1 &&
+	test "$(grep -c "fetch> have" trace)" = 6 &&
+	git -C server rev-parse master >expect &&
+	git -C client rev-parse server/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the default algorithm sends every commit' '
+	git -C client update-ref -d refs/remotes/server/master &&
+	git -C client prune &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client \
+		fetch --no-tags "$(pwd)/server" master:refs/remotes/server/master &&
+	test "$(grep -c "fetch> have" trace)" = 31
+'
+
+test_expect_success 'the last commit of a history is always sent' '
+	git -C client checkout -q --orphan orphan &&
+	for i in $(test_seq 1 4)
+	do
+		make_commit client o$i || return 1
+	done &&
+	git -C client update-ref -d refs/remotes/server/master &&
+	git -C client prune &&
+	fetch_with_skipping &&
+	have_sent o4 o2 o1 &&
+	have_not_sent o3
+'
+
+test_expect_success 'the ancestors of advertised commits are not sent' '
+	git -C server tag advertised s1 &&
+	make_commit server s2 &&
+	git -C client checkout -q master &&
+	git -C client reset -q --hard server/master &&
+	for i in $(test_seq 1 3)
+	do
+		make_commit client d$i || return 1
+	done &&
+	fetch_with_skipping &&
+	have_sent d3 d1 &&
+	have_not_sent d2 d1^ c1^
+'
+
+test_expect_success 'skipping negotiation with protocol v2' '
+	make_commit server s3 &&
+	fetch_with_skipping -c protocol.version=2 &&
+	grep "fetch> command=fetch" trace &&
+	have_sent d3 d1 &&
+	have_not_sent d2 &&
+	git -C server rev-parse master >expect &&
+	git -C client rev-parse server/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unknown negotiation algorithm' '
+	make_commit server s4 &&
+	test_must_fail git -C client -c fetch.negotiationAlgorithm=bogus \
+		fetch --no-tags "$(pwd)/server" master:refs/remotes/server/master 2>err &&
+	test_i18ngrep "unknown fetch negotiation algorithm" err
+'
+
+test_done
@@ -48,6 +48,18 @@ test_expect_success 'remote detects correct HEAD' '
 	)
 '
 
+test_expect_success 'clone and fetch with protocol v2' '
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c protocol.version=2 clone "$GIT_DAEMON_URL/repo.git" clone-v2 &&
+	test_cmp file clone-v2/file &&
+	grep "clone< version 2" trace &&
+	echo content >>file &&
+	git commit -a -m three &&
+	git push public &&
+	(cd clone-v2 && git -c protocol.version=2 pull) &&
+	test_cmp file clone-v2/file
+'
+
 test_expect_success 'prepare pack objects' '
 	cp -R "$GIT_DAEMON_DOCUMENT_ROOT_PATH"/repo.git "$GIT_DAEMON_DOCUMENT_ROOT_PATH"/repo_pack.git &&
 	(cd "$GIT_DAEMON_DOCUMENT_ROOT_PATH"/repo_pack.git &&
@@ -142,5 +154,109 @@ test_expect_success 'push disabled'      "test_remote_error    'service not enab
 test_expect_success 'read access denied' "test_remote_error -x 'no such repository'      fetch repo.git       "
 test_expect_success 'not exported'       "test_remote_error -n 'repository not exported' fetch repo.git       "
 
+stop_git_daemon
+GIT_TRACE="$(pwd)/daemon-trace" &&
+export GIT_TRACE &&
+start_git_daemon --worker-pool --max-connections=2
+sane_unset GIT_TRACE
+
+# How many workers the daemon started, and how many times upload-pack
+# was run without one
+workers_started () {
+	grep -c "run_command: .upload-pack. .--worker." daemon-trace
+}
+
+run_without_worker () {
+	grep -c "run_command: .upload-pack. .--strict." daemon-trace
+}
+
+test_expect_success 'fetch through the worker pool' '
+	: >"$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git/git-daemon-export-ok" &&
+	git clone "$GIT_DAEMON_URL/repo.git" clone-pool &&
+	test_cmp file clone-pool/file &&
+	echo content >>file &&
+	git commit -a -m four &&
+	git push public &&
+	(cd clone-pool && git pull) &&
+	test_cmp file clone-pool/file &&
+	test 1 = $(workers_started) &&
+	test 0 = $(run_without_worker)
+'
+
+test_expect_success 'protocol v2 through the worker pool' '
+	echo content >>file &&
+	git commit -a -m five &&
+	git push public &&
+	(cd clone-pool &&
+	 GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 pull &&
+	 grep "fetch< version 2" trace) &&
+	test_cmp file clone-pool/file &&
+	test 1 = $(workers_started)
+'
+
+test_expect_success 'worker is replaced when the configuration changes' '
+	git --git-dir="$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git" \
+		config uploadpack.hiderefs refs/heads/other &&
+	git ls-remote "$GIT_DAEMON_URL/repo.git" >refs &&
+	grep refs/heads/master refs &&
+	! grep refs/heads/other refs &&
+	test 1 = $(run_without_worker) &&
+	git ls-remote "$GIT_DAEMON_URL/repo.git" >refs &&
+	! grep refs/heads/other refs &&
+	test 2 = $(workers_started)
+'
+
+test_expect_success 'worker is replaced when the user configuration changes' '
+	git config --global uploadpack.hiderefs refs/heads/master &&
+	git ls-remote "$GIT_DAEMON_URL/repo.git" >refs &&
+	! grep refs/heads/master refs &&
+	test 2 = $(run_without_worker) &&
+	git config --global --unset uploadpack.hiderefs &&
+	git ls-remote "$GIT_DAEMON_URL/repo.git" >refs &&
+	grep refs/heads/master refs &&
+	test 3 = $(workers_started)
+'
+
+test_expect_success 'worker is replaced when the alternates change' '
+	echo "$(pwd)/.git/objects" \
+		>"$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git/objects/info/alternates" &&
+	git ls-remote "$GIT_DAEMON_URL/repo.git" &&
+	test 3 = $(run_without_worker) &&
+	rm "$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git/objects/info/alternates" &&
+	git ls-remote "$GIT_DAEMON_URL/repo.git" &&
+	test 4 = $(workers_started)
+'
+
+test_expect_success 'worker is replaced when a pack goes away' '
+	git --git-dir="$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git" repack -a -d &&
+	echo content >>file &&
+	git commit -a -m six &&
+	git push public &&
+	(cd clone-pool && git pull) &&
+	test_cmp file clone-pool/file &&
+	test 4 = $(workers_started) &&
+	git --git-dir="$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git" repack -a -d &&
+	echo content >>file &&
+	git commit -a -m seven &&
+	git push public &&
+	(cd clone-pool && git pull) &&
+	test_cmp file clone-pool/file &&
+	test 4 = $(run_without_worker) &&
+	git ls-remote "$GIT_DAEMON_URL/repo.git" >refs &&
+	test 5 = $(workers_started)
+'
+
+test_expect_success 'no more workers than --max-connections' '
+	git ls-remote "$GIT_DAEMON_URL/repo_pack.git" &&
+	git ls-remote "$GIT_DAEMON_URL/repo_pack.git" &&
+	test 6 = $(workers_started) &&
+	cp -R "$GIT_DAEMON_DOCUMENT_ROOT_PATH"/repo_pack.git \
+		"$GIT_DAEMON_DOCUMENT_ROOT_PATH"/repo_pool.git &&
+	git ls-remote "$GIT_DAEMON_URL/repo_pool.git" &&
+	test 7 = $(workers_started) &&
+	git ls-remote "$GIT_DAEMON_URL/repo.git" &&
+	test 8 = $(workers_started)
+'
+
 stop_git_daemon
 test_done
@@ -0,0 +1,185 @@
+#!/bin/sh
+
+test_description='fetching with protocol v2'
+. ./test-lib.sh
+
+# Like test_commit, in "server", with the clock of this shell so that
+# the commits made by later tests are newer
+server_commit () {
+	test_tick &&
+	echo "$1" >"server/$1.t" &&
+	git -C server add "$1.t" &&
+	git -C server commit -q -m "$1" &&
+	git -C server tag "$1"
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	server_commit one &&
+	server_commit two &&
+	git -C server branch side &&
+	git -C server tag -a -m annotated annotated &&
+	server_commit three
+'
+
+test_expect_success 'ls-remote with protocol v2' '
+	git ls-remote "file://$(pwd)/server" >expect &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c protocol.version=2 ls-remote "file://$(pwd)/server" >actual &&
+	test_cmp expect actual &&
+	grep "< version 2" trace &&
+	grep "> command=ls-refs" trace
+'
+
+test_expect_success 'ls-remote --heads asks only for branches' '
+	git ls-remote --heads "file://$(pwd)/server" >expect &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c protocol.version=2 ls-remote --heads "file://$(pwd)/server" >actual &&
+	test_cmp expect actual &&
+	grep "> ref-prefix refs/heads/" trace &&
+	! grep "< .* refs/tags/" trace
+'
+
+test_expect_success 'clone with protocol v2' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c protocol.version=2 clone "file://$(pwd)/server" client &&
+	grep "clone< version 2" trace &&
+	grep "clone> command=fetch" trace &&
+	git -C server rev-parse master side annotated >expect &&
+	git -C client rev-parse origin/master origin/side annotated >actual &&
+	test_cmp expect actual &&
+	git -C client fsck
+'
+
+test_expect_success 'fetch with protocol v2 negotiates' '
+	server_commit four &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -C client -c protocol.version=2 fetch &&
+	grep "fetch< acknowledgments" trace &&
+	grep "fetch< ACK $(git -C server rev-parse three)" trace &&
+	grep "fetch< ready" trace &&
+	git -C server rev-parse master four >expect &&
+	git -C client rev-parse origin/master four >actual &&
+	test_cmp expect actual &&
+	git -C client fsck
+'
+
+test_expect_success 'fetch with a refspec lists only the refs it needs' '
+	server_commit five &&
+	git -C server checkout side &&
+	server_commit side-one &&
+	git -C server checkout master &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client -c protocol.version=2 \
+		fetch --no-tags origin master:refs/heads/fetched &&
+	grep "> ref-prefix refs/heads/master" trace &&
+	! grep "< [0-9a-f]* refs/heads/side" trace &&
+	git -C server rev-parse master >expect &&
+	git -C client rev-parse fetched >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch with protocol v2 when everything is local' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -C client -c protocol.version=2 fetch origin master &&
+	! grep "> command=fetch" trace
+'
+
+test_expect_success 'shallow fetches use protocol v0' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		clone --depth 1 "file://$(pwd)/server" shallow &&
+	! grep "version 2" trace &&
+	server_commit six &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -C shallow -c protocol.version=2 fetch &&
+	! grep "version 2" trace &&
+	git -C server rev-parse master >expect &&
+	git -C shallow rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'a shallow server answers in protocol v0' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" git -c protocol.version=2 \
+		clone "file://$(pwd)/shallow" from-shallow &&
+	! grep "version 2" trace &&
+	git -C shallow rev-parse HEAD >expect &&
+	git -C from-shallow rev-parse HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'ssh passes the protocol request on' '
+	write_script fake-ssh <<-\EOF &&
+	echo "$@" >>"$TRASH_DIRECTORY/ssh-args"
+	echo "GIT_PROTOCOL=$GIT_PROTOCOL" >>"$TRASH_DIRECTORY/ssh-args"
+	while test "$1" = "-o"
+	do
+		shift 2
+	done
+	shift
+	eval "$1"
+	EOF
+	export TRASH_DIRECTORY &&
+	rm -f trace &&
+	GIT_SSH="$(pwd)/fake-ssh" GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c protocol.version=2 clone "myhost:$(pwd)/server" ssh-client &&
+	grep "^-o SendEnv=GIT_PROTOCOL myhost " ssh-args &&
+	grep "^GIT_PROTOCOL=version=2\$" ssh-args &&
+	grep "clone< version 2" trace &&
+	git -C server rev-parse master >expect &&
+	git -C ssh-client rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'push uses protocol v0' '
+	git -C client checkout -b pushed origin/master &&
+	git -C client commit --allow-empty -m pushed &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -C client -c protocol.version=2 push origin pushed &&
+	! grep "version 2" trace &&
+	git -C client rev-parse pushed >expect &&
+	git -C server rev-parse pushed >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'upload-pack rejects unknown commands' '
+	printf "0017command=frobnicate\n0000" >request &&
+	test_must_fail env GIT_PROTOCOL=version=2 \
+		git upload-pack --stateless-rpc server <request 2>err &&
+	test_i18ngrep "unknown command" err
+'
+
+test_expect_success 'http-backend answers a protocol v2 request' '
+	(
+		GIT_PROJECT_ROOT="$(pwd)" &&
+		GIT_HTTP_EXPORT_ALL=1 &&
+		HTTP_GIT_PROTOCOL=version=2 &&
+		PATH_INFO=/server/info/refs &&
+		QUERY_STRING=service=git-upload-pack &&
+		REQUEST_METHOD=GET &&
+		export GIT_PROJECT_ROOT GIT_HTTP_EXPORT_ALL HTTP_GIT_PROTOCOL &&
+		export PATH_INFO QUERY_STRING REQUEST_METHOD &&
+		git http-backend >out &&
+		! grep "# service=" out &&
+		grep "^000eversion 2\$" out &&
+
+		printf "0014command=ls-refs\n00010000" >request &&
+		PATH_INFO=/server/git-upload-pack &&
+		CONTENT_TYPE=application/x-git-upload-pack-request &&
+		QUERY_STRING= &&
+		REQUEST_METHOD=POST &&
+		export CONTENT_TYPE &&
+		git http-backend <request >out &&
+		grep "$(git -C server rev-parse master) refs/heads/master" out
+	)
+'
+
+test_done
@@ -0,0 +1,210 @@
+#!/bin/sh
+
+test_description='test untracked cache'
+
+. ./test-lib.sh
+
+# The untracked cache trusts the mtime of directories; make sure that
+# whatever we change is not in the same second as the index that
+# recorded the previous state, or it is (rightly) considered racy.
+avoid_racy () {
+	sleep 1
+}
+
+status_with_stats () {
+	: >../trace &&
+	GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+		git status --porcelain "$@" >../actual
+}
+
+test_expect_success 'setup' '
+	git init worktree &&
+	cd worktree &&
+	mkdir done dtwo dthree &&
+	touch one two three done/one dtwo/two dthree/three &&
+	git add one two done/one &&
+	: >.git/info/exclude &&
+	git update-index --untracked-cache &&
+	test-dump-untracked-cache >../actual &&
+	grep "^exclude_per_dir .gitignore$" ../actual &&
+	! grep "^/" ../actual
+'
+
+test_expect_success 'status first time (empty cache)' '
+	avoid_racy &&
+	cat >../trace.expect <<EOF &&
+node creation: 4
+gitignore invalidation: 1
+directory invalidation: 1
+opendir: 4
+EOF
+	status_with_stats &&
+	test_cmp ../trace.expect ../trace &&
+	cat >../expect <<EOF &&
+A  done/one
+A  one
+A  two
+?? dthree/
+?? dtwo/
+?? three
+EOF
+	test_cmp ../expect ../actual
+'
+
+test_expect_success 'untracked cache is written to the index' '
+	test-dump-untracked-cache >../actual &&
+	grep "^/ .* recurse valid$" ../actual &&
+	grep "^/dtwo/ .* recurse check_only valid$" ../actual
+'
+
+test_expect_success 'status second time (fully populated cache)' '
+	cat >../trace.expect <<EOF &&
+node creation: 0
+gitignore invalidation: 0
+directory invalidation: 0
+opendir: 0
+EOF
+	status_with_stats &&
+	test_cmp ../trace.expect ../trace &&
+	test_cmp ../expect ../actual
+'
+
+test_expect_success 'same result without the untracked cache' '
+	GIT_DISABLE_UNTRACKED_CACHE=1 git status --porcelain >../actual &&
+	test_cmp ../expect ../actual
+'
+
+test_expect_success 'new file in a subdirectory invalidates only it' '
+	avoid_racy &&
+	touch done/two &&
+	avoid_racy &&
+	cat >../trace.expect <<EOF &&
+node creation: 0
+gitignore invalidation: 0
+directory invalidation: 1
+opendir: 1
+EOF
+	status_with_stats &&
+	test_cmp ../trace.expect ../trace &&
+	cat >../expect <<EOF &&
+A  done/one
+A  one
+A  two
+?? done/two
+?? dthree/
+?? dtwo/
+?? three
+EOF
+	test_cmp ../expect ../actual
+'
+
+test_expect_success 'modify .gitignore' '
+	avoid_racy &&
+	echo "two" >done/.gitignore &&
+	avoid_racy &&
+	status_with_stats &&
+	cat >../expect <<EOF &&
+A  done/one
+A  one
+A  two
+?? done/.gitignore
+?? dthree/
+?? dtwo/
+?? three
+EOF
+	test_cmp ../expect ../actual &&
+	status_with_stats &&
+	test_cmp ../expect ../actual &&
+	grep "^opendir: 0$" ../trace
+'
+
+test_expect_success 'modify info/exclude' '
+	echo three >.git/info/exclude &&
+	status_with_stats &&
+	cat >../expect <<EOF &&
+A  done/one
+A  one
+A  two
+?? done/.gitignore
+?? dtwo/
+EOF
+	test_cmp ../expect ../actual &&
+	: >.git/info/exclude
+'
+
+test_expect_success 'git add invalidates the directory' '
+	git add done/.gitignore &&
+	avoid_racy &&
+	status_with_stats &&
+	cat >../expect <<EOF &&
+A  done/.gitignore
+A  done/one
+A  one
+A  two
+?? dthree/
+?? dtwo/
+?? three
+EOF
+	test_cmp ../expect ../actual
+'
+
+test_expect_success 'git rm --cached invalidates the directory' '
+	git rm --cached done/one &&
+	avoid_racy &&
+	status_with_stats &&
+	cat >../expect <<EOF &&
+A  done/.gitignore
+A  one
+A  two
+?? done/one
+?? dthree/
+?? dtwo/
+?? three
+EOF
+	test_cmp ../expect ../actual
+'
+
+test_expect_success 'empty subdirectory becomes non-empty' '
+	mkdir dfour &&
+	avoid_racy &&
+	status_with_stats &&
+	! grep dfour ../actual &&
+	avoid_racy &&
+	touch dfour/four &&
+	avoid_racy &&
+	status_with_stats &&
+	grep "^?? dfour/$" ../actual
+'
+
+test_expect_success 'status -uall does not use the cache' '
+	GIT_DISABLE_UNTRACKED_CACHE=1 git status --porcelain -uall >../expect &&
+	status_with_stats -uall &&
+	test_cmp ../expect ../actual &&
+	! test -s ../trace
+'
+
+test_expect_success 'unpack_trees() keeps the untracked cache' '
+	git reset --hard &&
+	test-dump-untracked-cache >../actual &&
+	grep "^/ .* recurse" ../actual &&
+	status_with_stats &&
+	grep "^?? dthree/$" ../actual
+'
+
+test_expect_success 'core.untrackedCache=false removes the cache' '
+	git -c core.untrackedCache=false status &&
+	echo "no untracked cache" >../expect &&
+	test-dump-untracked-cache >../actual &&
+	test_cmp ../expect ../actual
+'
+
+test_expect_success 'update-index --[no-]untracked-cache' '
+	git update-index --untracked-cache &&
+	test-dump-untracked-cache >../actual &&
+	! grep "^no untracked cache" ../actual &&
+	git update-index --no-untracked-cache &&
+	test-dump-untracked-cache >../actual &&
+	test_cmp ../expect ../actual
+'
+
+test_done
@@ -0,0 +1,122 @@
+#!/bin/sh
+
+test_description='git status with a file system monitor hook'
+
+. ./test-lib.sh
+
+# The hook reports whatever the test put in .git/fsmonitor-output
+# (NUL-separated), or fails if there is no such file.
+test_expect_success 'setup' '
+	mkdir dir1 dir2 &&
+	for f in modified dir1/modified dir2/modified unchanged dir1/unchanged
+	do
+		echo initial >$f || return 1
+	done &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	write_script .git/fsmonitor-test <<-\EOF &&
+	test "$1" = 1 || exit 1
+	test "$2" -gt 0 || exit 1
+	echo "$2" >>.git/fsmonitor-log &&
+	cat .git/fsmonitor-output
+	EOF
+	: >.git/fsmonitor-output &&
+	git config core.fsmonitor .git/fsmonitor-test
+'
+
+test_expect_success 'the first status starts monitoring' '
+	git status &&
+	test_path_is_missing .git/fsmonitor-log &&
+	test-dump-fsmonitor >actual &&
+	grep "^fsmonitor last update" actual &&
+	test_path_is_file .git/fsmonitor-log &&
+	cat >expect <<-\EOF &&
+	+ dir1/modified
+	+ dir1/unchanged
+	+ dir2/modified
+	+ modified
+	+ unchanged
+	EOF
+	grep -v "^fsmonitor" actual >actual.entries &&
+	test_cmp expect actual.entries
+'
+
+test_expect_success 'changes the hook does not report are not seen' '
+	echo changed >modified &&
+	git status --porcelain -uno >actual &&
+	test_must_be_empty actual
+'
+
+test_expect_success 'changes the hook reports are seen' '
+	printf "modified\0dir1/modified\0" >.git/fsmonitor-output &&
+	echo changed >dir1/modified &&
+	git status --porcelain -uno >actual &&
+	cat >expect <<-\EOF &&
+	 M dir1/modified
+	 M modified
+	EOF
+	test_cmp expect actual &&
+	: >.git/fsmonitor-output &&
+	test-dump-fsmonitor >actual &&
+	grep "^- dir1/modified$" actual &&
+	grep "^- modified$" actual &&
+	grep "^+ unchanged$" actual
+'
+
+test_expect_success 'a reported directory invalidates its entries' '
+	git reset --hard &&
+	printf "dir2\0" >.git/fsmonitor-output &&
+	test-dump-fsmonitor >actual &&
+	grep "^- dir2/modified$" actual &&
+	grep "^+ dir1/unchanged$" actual &&
+	echo changed >dir2/modified &&
+	git status --porcelain -uno >actual &&
+	echo " M dir2/modified" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success '"/" invalidates everything' '
+	git reset --hard &&
+	: >.git/fsmonitor-output &&
+	git status &&
+	printf "/\0" >.git/fsmonitor-output &&
+	test-dump-fsmonitor >actual &&
+	! grep "^+" actual
+'
+
+test_expect_success 'a failing hook invalidates everything' '
+	: >.git/fsmonitor-output &&
+	git status &&
+	test-dump-fsmonitor >actual &&
+	grep "^+ unchanged$" actual &&
+	rm .git/fsmonitor-output &&
+	test-dump-fsmonitor >actual &&
+	! grep "^+" actual &&
+	echo changed >unchanged &&
+	git status --porcelain -uno >actual &&
+	echo " M unchanged" >expect &&
+	test_cmp expect actual &&
+	git checkout unchanged
+'
+
+test_expect_success 'same status as without the hook' '
+	printf "modified\0dir1/new\0" >.git/fsmonitor-output &&
+	echo changed >modified &&
+	echo new >dir1/new &&
+	git status --porcelain >actual &&
+	git config core.fsmonitor "" &&
+	git status --porcelain >expect &&
+	git config core.fsmonitor .git/fsmonitor-test &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the extension is dropped without core.fsmonitor' '
+	git config --unset core.fsmonitor &&
+	git status &&
+	echo "no fsmonitor" >expect &&
+	test-dump-fsmonitor >actual &&
+	test_cmp expect actual
+'
+
+test_done
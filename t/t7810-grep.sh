@@ -742,6 +742,29 @@ test_expect_success 'grep -W with userdiff' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep -p with userdiff from per-directory attributes' '
+	test_when_finished "rm -rf .gitattributes ud" &&
+	git config diff.hash.funcname "^#" &&
+	echo "*.c diff=hash" >.gitattributes &&
+	for d in a b c d e f g h
+	do
+		mkdir -p ud/$d &&
+		cp hello.c ud/$d/hello.c &&
+		cp hello.c ud/$d/other.c &&
+		echo "other.c -diff" >ud/$d/.gitattributes || return 1
+	done &&
+	git add ud &&
+	for d in a b c d e f g h
+	do
+		echo "ud/$d/hello.c=#include <stdio.h>" &&
+		echo "ud/$d/hello.c:	return 0;" || return 1
+	done >expected &&
+	git grep -p return -- "ud/*/hello.c" >actual &&
+	test_cmp expected actual &&
+	git grep -I -p return -- ud >actual &&
+	test_cmp expected actual
+'
+
 test_expect_success 'grep from a subdirectory to search wider area (1)' '
 	mkdir -p s &&
 	(
@@ -1195,4 +1218,42 @@ test_expect_success LIBPCRE 'grep -P "^ "' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep -F finds fixed strings anywhere in long lines' '
+	line= &&
+	for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17
+	do
+		echo "${line}NeedleX${line}" >long &&
+		echo "long:${line}NeedleX${line}" >expect &&
+		git grep --no-index -F NeedleX long >actual &&
+		test_cmp expect actual &&
+		git grep --no-index -F -i needlex long >actual &&
+		test_cmp expect actual &&
+		test_must_fail git grep --no-index -F -i needley long &&
+		line=${line}x$i || return 1
+	done
+'
+
+test_expect_success 'grep with worker threads' '
+	for opts in "-n -e mmap" "-c -e mmap" "-C1 -e mmap" "--heading -n -e mmap"
+	do
+		git grep --threads=1 $opts >expect &&
+		git grep --threads=1 --cached $opts >expect.cached &&
+		git grep --threads=1 $opts HEAD >expect.rev &&
+		for n in 2 5 40
+		do
+			git grep --threads=$n $opts >actual &&
+			test_cmp expect actual &&
+			git -c grep.threads=$n grep --cached $opts >actual &&
+			test_cmp expect.cached actual &&
+			git grep --threads=$n $opts HEAD >actual &&
+			test_cmp expect.rev actual || return 1
+		done
+	done
+'
+
+test_expect_success 'grep with a negative number of threads' '
+	test_must_fail git grep --threads=-1 mmap &&
+	test_must_fail git -c grep.threads=-1 grep mmap
+'
+
 test_done
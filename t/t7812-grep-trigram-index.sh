@@ -0,0 +1,114 @@
+#!/bin/sh
+
+test_description='git grep with grep.trigramIndex'
+
+. ./test-lib.sh
+
+# Search with and without the index; the output must be the same.
+test_indexed_grep () {
+	test_might_fail git grep "$@" >expect &&
+	test_might_fail git -c grep.trigramIndex=true grep "$@" >actual &&
+	test_cmp expect actual
+}
+
+# Zero the filters in .git/trigram-index, leaving its checksum alone
+zero_trigram_filters () {
+	"$PERL_PATH" -e '
+		open(my $fh, "+<", ".git/trigram-index") or die;
+		binmode $fh;
+		local $/;
+		my $data = <$fh>;
+		my $start = 12 + 28 * unpack("N", substr($data, 8, 4));
+		my $len = length($data) - 20 - $start;
+		substr($data, $start, $len) = "\0" x $len;
+		seek($fh, 0, 0);
+		print $fh $data;
+		close($fh) or die;
+	'
+}
+
+test_expect_success setup '
+	printf "%s\n" "int main(void)" "{" "	return needle();" "}" >main.c &&
+	printf "%s\n" "static int needle(void)" "{" "	return 42;" "}" >needle.c &&
+	printf "%s\n" "Haystack" "NEEDLE in caps" >README &&
+	printf "%s\n" "nothing to see" "here" >other.txt &&
+	mkdir sub &&
+	printf "%s\n" "more straw" "and hay" >sub/straw &&
+	printf "%s\n" "a needle, again" >sub/needle.txt &&
+	git add . &&
+	test_tick &&
+	git commit -m initial
+'
+
+test_expect_success 'grep without grep.trigramIndex writes no index' '
+	git grep --cached needle >/dev/null &&
+	test_path_is_missing .git/trigram-index
+'
+
+test_expect_success 'grep with grep.trigramIndex writes the index' '
+	test_indexed_grep --cached needle &&
+	test_path_is_file .git/trigram-index
+'
+
+test_expect_success 'the index skips blobs without reading them' '
+	test_indexed_grep --cached needle &&
+	test_indexed_grep needle HEAD &&
+	straw=$(git rev-parse HEAD:sub/straw) &&
+	file=$(echo $straw | sed -e "s|^..|&/|") &&
+	mv .git/objects/$file straw-object &&
+	git grep --cached needle >actual 2>err &&
+	test_i18ngrep "unable to read" err &&
+	git -c grep.trigramIndex=true grep --cached needle >actual 2>err &&
+	test_must_be_empty err &&
+	git -c grep.trigramIndex=true grep needle HEAD >actual 2>err &&
+	test_must_be_empty err &&
+	test_must_fail git -c grep.trigramIndex=true grep --cached straw 2>err &&
+	test_i18ngrep "unable to read" err &&
+	mv straw-object .git/objects/$file
+'
+
+test_expect_success 'patterns are checked against the index as they should' '
+	for p in needle "-i needle" "-F needle()" "-w needle" "-e needle --and -e return" \
+		"-e straw --or -e needle" "--all-match -e needle -e return" \
+		"-e needle --and --not -e return" "-E ne+dle" "-E (needle|straw)" \
+		"nee[d]le" "ne.dle" "needle*" "-v needle" "-L needle" "-c needle" \
+		"-l -i haystack" "-i -E hay(stack)?" "-F -e xyz -e needle"
+	do
+		test_indexed_grep --cached $p &&
+		test_indexed_grep $p HEAD -- sub || return 1
+	done
+'
+
+test_expect_success 'blobs that are new to the index are searched and added' '
+	printf "%s\n" "another needle" >new &&
+	git add new &&
+	test_indexed_grep --cached needle &&
+	git -c grep.trigramIndex=true grep --cached -l needle >actual &&
+	grep "^new\$" actual &&
+	new=$(git rev-parse :new) &&
+	file=$(echo $new | sed -e "s|^..|&/|") &&
+	mv .git/objects/$file new-object &&
+	git -c grep.trigramIndex=true grep --cached straw >actual 2>err &&
+	test_must_be_empty err &&
+	mv new-object .git/objects/$file
+'
+
+test_expect_success 'a broken index is ignored' '
+	echo garbage >.git/trigram-index &&
+	git -c grep.trigramIndex=true grep --cached needle >actual 2>err &&
+	git grep --cached needle >expect &&
+	test_cmp expect actual &&
+	test_i18ngrep "ignoring" err &&
+	test_indexed_grep --cached needle
+'
+
+test_expect_success 'an index with a bad checksum is ignored' '
+	test_indexed_grep --cached needle &&
+	zero_trigram_filters &&
+	git -c grep.trigramIndex=true grep --cached needle >actual 2>err &&
+	git grep --cached needle >expect &&
+	test_cmp expect actual &&
+	test_i18ngrep "bad checksum" err
+'
+
+test_done
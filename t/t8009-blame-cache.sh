@@ -0,0 +1,138 @@
+#!/bin/sh
+
+test_description='git blame with blame.cache'
+. ./test-lib.sh
+
+# Blame with and without the cache; the output must be the same.
+test_cached_blame () {
+	git blame -p "$@" >expect &&
+	git -c blame.cache=true blame -p "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success setup '
+	printf "%s\n" 1 2 3 4 5 6 7 8 9 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m initial &&
+	git tag one &&
+
+	printf "%s\n" 1 2 three 4 5 6 7 8 9 10 >file &&
+	test_tick &&
+	git commit -a -m second &&
+	git tag two &&
+
+	git mv file renamed &&
+	printf "%s\n" 0 1 2 three 4 5 six 7 8 9 10 >renamed &&
+	test_tick &&
+	git commit -a -m third &&
+	git tag three &&
+
+	git checkout -b side two &&
+	printf "%s\n" 1 2 three 4 5 6 7 eight 9 10 >file &&
+	test_tick &&
+	git commit -a -m side &&
+	git checkout master &&
+	test_tick &&
+	git merge side &&
+	git tag merged &&
+
+	printf "%s\n" 0 1 2 three 4 5 six 7 eight 9 10 11 >renamed &&
+	test_tick &&
+	git commit -a -m fifth &&
+	git tag five
+'
+
+test_expect_success 'blame without blame.cache writes no cache' '
+	git blame two -- file >/dev/null &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_expect_success 'blame writes the cache' '
+	test_cached_blame two -- file &&
+	test -d .git/blame-cache &&
+	test "$(find .git/blame-cache -type f | wc -l)" = 1
+'
+
+test_expect_success 'blaming a cached commit again digs no history' '
+	git -c blame.cache=true blame --show-stats two -- file >stats &&
+	grep "^num commits: 0" stats &&
+	test_cached_blame two -- file
+'
+
+test_expect_success 'blaming a descendant reuses the cached result' '
+	test_cached_blame merged -- renamed &&
+	test_cached_blame five -- renamed &&
+	git blame --show-stats five -- renamed >stats &&
+	grep "^num commits: [^01]" stats &&
+	git -c blame.cache=true blame --show-stats five -- renamed >stats &&
+	grep "^num commits: 0" stats &&
+	rm -rf .git/blame-cache/?? &&
+	git -c blame.cache=true blame merged -- renamed >/dev/null &&
+	git -c blame.cache=true blame --show-stats five -- renamed >stats &&
+	grep "^num commits: 1\$" stats
+'
+
+test_expect_success 'the working tree is blamed using the cache' '
+	echo 12 >>renamed &&
+	test_cached_blame renamed &&
+	# incremental output comes in a different order
+	git blame --incremental renamed >output &&
+	grep "^[0-9a-f]\{40\} " output | sort >expect &&
+	git -c blame.cache=true blame --incremental renamed >output &&
+	grep "^[0-9a-f]\{40\} " output | sort >actual &&
+	test_cmp expect actual &&
+	git checkout renamed
+'
+
+test_expect_success 'options that change the result use their own cache' '
+	test_cached_blame -w five -- renamed &&
+	test_cached_blame --root five -- renamed &&
+	test_cached_blame -L 3,5 five -- renamed
+'
+
+test_expect_success 'the cache is not used with -M or -C' '
+	rm -rf .git/blame-cache &&
+	test_cached_blame -M five -- renamed &&
+	test_cached_blame -C -C five -- renamed &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_expect_success 'lines moved by -M are found even after a cached blame' '
+	for i in a b c d e f g h i j
+	do
+		echo "line $i is long enough to be found when moved" || return 1
+	done >moved &&
+	git add moved &&
+	test_tick &&
+	git commit -m base &&
+	{ sed -n 7,10p moved && sed -n 1,6p moved; } >moved.new &&
+	mv moved.new moved &&
+	test_tick &&
+	git commit -a -m "move to the top" &&
+	sed "3s/line/LINE/" moved >moved.new &&
+	mv moved.new moved &&
+	test_tick &&
+	git commit -a -m "edit a moved line" &&
+	git -c blame.cache=true blame -M HEAD~1 -- moved >/dev/null &&
+	test_cached_blame -M HEAD -- moved
+'
+
+test_expect_success 'the cache is not used with a bottom commit' '
+	rm -rf .git/blame-cache &&
+	test_cached_blame two..five -- renamed &&
+	test_path_is_missing .git/blame-cache &&
+	test_cached_blame --reverse one..three -- file &&
+	test_path_is_missing .git/blame-cache
+'
+
+test_expect_success 'a broken cache file is ignored' '
+	test_cached_blame three -- renamed &&
+	for f in $(find .git/blame-cache -type f)
+	do
+		echo garbage >"$f" || return 1
+	done &&
+	test_cached_blame five -- renamed
+'
+
+test_done
@@ -0,0 +1,82 @@
+#include "cache.h"
+#include "xdiff-interface.h"
+#include "xdiff/xtypes.h"
+#include "xdiff/xutils.h"
+
+static const char usage_str[] =
+	"test-xdiff-hash [-b | -w] (dump <file> | perf <file> [<rounds>])";
+
+/*
+ * Split the file into records and hash them the way xdl_prepare_ctx()
+ * does, and return the number of records.  With "out", print the
+ * length and the hash of each record.
+ */
+static long hash_records(const char *buf, long size, long flags, FILE *out)
+{
+	const char *cur = buf, *top = buf + size;
+	long nrec = 0;
+
+	while (cur < top) {
+		const char *prev = cur;
+		unsigned long ha = xdl_hash_record(&cur, top, flags);
+
+		if (out)
+			fprintf(out, "%ld %lx\n", (long)(cur - prev), ha);
+		nrec++;
+	}
+	return nrec;
+}
+
+/*
+ * Usage: test-xdiff-hash perf <file> <rounds>
+ * prints the number of records and how many records per second are
+ * split and hashed.
+ */
+static void perf_hash(const char *buf, long size, long flags, int rounds)
+{
+	struct timeval start, end;
+	double elapsed;
+	long nrec = 0;
+	int i;
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < rounds; i++)
+		nrec += hash_records(buf, size, flags, NULL);
+	gettimeofday(&end, NULL);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("%ld records\n", nrec / rounds);
+	printf("%.0f records/s\n", elapsed > 0 ? nrec / elapsed : 0);
+}
+
+int main(int argc, char **argv)
+{
+	struct strbuf buf = STRBUF_INIT;
+	long flags = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "-b")) {
+		flags = XDF_IGNORE_WHITESPACE_CHANGE;
+		argc--;
+		argv++;
+	} else if (argc > 1 && !strcmp(argv[1], "-w")) {
+		flags = XDF_IGNORE_WHITESPACE;
+		argc--;
+		argv++;
+	}
+	if (argc < 3)
+		usage(usage_str);
+	if (strbuf_read_file(&buf, argv[2], 0) < 0)
+		die_errno("unable to read '%s'", argv[2]);
+
+	if (!strcmp(argv[1], "dump") && argc == 3)
+		hash_records(buf.buf, buf.len, flags, stdout);
+	else if (!strcmp(argv[1], "perf") && argc <= 4)
+		perf_hash(buf.buf, buf.len, flags,
+			  argc == 4 ? atoi(argv[3]) : 100);
+	else
+		usage(usage_str);
+
+	strbuf_release(&buf);
+	return 0;
+}
@@ -28,6 +28,7 @@ struct helper_data {
 		option : 1,
 		push : 1,
 		connect : 1,
+		stateless_connect : 1,
 		signed_tags : 1,
 		check_connectivity : 1,
 		no_disconnect_req : 1,
@@ -199,6 +200,8 @@ static struct child_process *get_helper(struct transport *transport)
 			refspecs[refspec_nr++] = xstrdup(capname + strlen("refspec "));
 		} else if (!strcmp(capname, "connect")) {
 			data->connect = 1;
+		} else if (!strcmp(capname, "stateless-connect")) {
+			data->stateless_connect = 1;
 		} else if (!strcmp(capname, "signed-tags")) {
 			data->signed_tags = 1;
 		} else if (starts_with(capname, "export-marks ")) {
@@ -583,6 +586,10 @@ static int process_connect_service(struct transport *transport,
 
 	if (data->connect)
 		strbuf_addf(&cmdbuf, "connect %s\n", name);
+	else if (data->stateless_connect &&
+		 !strcmp(name, "git-upload-pack") &&
+		 transport_use_protocol_v2(&data->transport_options))
+		strbuf_addf(&cmdbuf, "stateless-connect %s\n", name);
 	else
 		goto exit;
 
@@ -967,7 +974,8 @@ static int has_attribute(const char *attrs, const char *attr) {
 	}
 }
 
-static struct ref *get_refs_list(struct transport *transport, int for_push)
+static struct ref *get_refs_list(struct transport *transport, int for_push,
+				 const struct argv_array *ref_prefixes)
 {
 	struct helper_data *data = transport->data;
 	struct child_process *helper;
@@ -980,7 +988,8 @@ static struct ref *get_refs_list(struct transport *transport, int for_push)
 
 	if (process_connect(transport, for_push)) {
 		do_take_over(transport);
-		return transport->get_refs_list(transport, for_push);
+		return transport->get_refs_list(transport, for_push,
+						ref_prefixes);
 	}
 
 	if (data->push && for_push)
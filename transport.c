@@ -15,6 +15,8 @@
 #include "submodule.h"
 #include "string-list.h"
 #include "sha1-array.h"
+#include "protocol.h"
+#include "commit.h"
 
 /* rsync support */
 
@@ -195,7 +197,8 @@ static const char *rsync_url(const char *url)
 	return !starts_with(url, "rsync://") ? skip_prefix(url, "rsync:") : url;
 }
 
-static struct ref *get_refs_via_rsync(struct transport *transport, int for_push)
+static struct ref *get_refs_via_rsync(struct transport *transport, int for_push,
+				      const struct argv_array *ref_prefixes)
 {
 	struct strbuf buf = STRBUF_INIT, temp_dir = STRBUF_INIT;
 	struct ref dummy = {NULL}, *tail = &dummy;
@@ -409,7 +412,8 @@ struct bundle_transport_data {
 	struct bundle_header header;
 };
 
-static struct ref *get_refs_from_bundle(struct transport *transport, int for_push)
+static struct ref *get_refs_from_bundle(struct transport *transport, int for_push,
+					const struct argv_array *ref_prefixes)
 {
 	struct bundle_transport_data *data = transport->data;
 	struct ref *result = NULL;
@@ -455,6 +459,7 @@ struct git_transport_data {
 	struct child_process *conn;
 	int fd[2];
 	unsigned got_remote_heads : 1;
+	enum protocol_version version;
 	struct sha1_array extra_have;
 	struct sha1_array shallow;
 };
@@ -494,32 +499,55 @@ static int set_git_option(struct git_transport_options *opts,
 	return 1;
 }
 
+int transport_use_protocol_v2(const struct git_transport_options *opts)
+{
+	/*
+	 * Shallow clones and fetches need the shallow information
+	 * that only protocol v0 carries.
+	 */
+	return get_protocol_version_config() == protocol_v2 &&
+		!opts->depth && !is_repository_shallow();
+}
+
 static int connect_setup(struct transport *transport, int for_push, int verbose)
 {
 	struct git_transport_data *data = transport->data;
+	int flags = verbose ? CONNECT_VERBOSE : 0;
 
 	if (data->conn)
 		return 0;
 
+	if (!for_push && transport_use_protocol_v2(&data->options))
+		flags |= CONNECT_PROTOCOL_V2;
+
 	data->conn = git_connect(data->fd, transport->url,
 				 for_push ? data->options.receivepack :
 				 data->options.uploadpack,
-				 verbose ? CONNECT_VERBOSE : 0);
+				 flags);
 
 	return 0;
 }
 
-static struct ref *get_refs_via_connect(struct transport *transport, int for_push)
+static struct ref *get_refs_via_connect(struct transport *transport, int for_push,
+					const struct argv_array *ref_prefixes)
 {
 	struct git_transport_data *data = transport->data;
+	struct strbuf pushback = STRBUF_INIT;
 	struct ref *refs;
 
 	connect_setup(transport, for_push, 0);
-	get_remote_heads(data->fd[0], NULL, 0, &refs,
-			 for_push ? REF_NORMAL : 0,
-			 &data->extra_have,
-			 &data->shallow);
+	data->version = discover_version(data->fd[0], &pushback);
+	if (data->version == protocol_v2) {
+		if (for_push)
+			die("the server answered a push in protocol v2");
+		get_remote_refs(data->fd[1], data->fd[0], &refs, ref_prefixes);
+	} else
+		get_remote_heads(data->fd[0], pushback.buf, pushback.len, &refs,
+				 for_push ? REF_NORMAL : 0,
+				 &data->extra_have,
+				 &data->shallow);
 	data->got_remote_heads = 1;
+	strbuf_release(&pushback);
 
 	return refs;
 }
@@ -549,16 +577,23 @@ static int fetch_refs_via_pack(struct transport *transport,
 	args.update_shallow = data->options.update_shallow;
 
 	if (!data->got_remote_heads) {
+		struct strbuf pushback = STRBUF_INIT;
+
 		connect_setup(transport, 0, 0);
-		get_remote_heads(data->fd[0], NULL, 0, &refs_tmp, 0,
-				 NULL, &data->shallow);
+		data->version = discover_version(data->fd[0], &pushback);
+		if (data->version != protocol_v2)
+			get_remote_heads(data->fd[0], pushback.buf, pushback.len,
+					 &refs_tmp, 0, NULL, &data->shallow);
+		else if (!transport->remote_refs)
+			get_remote_refs(data->fd[1], data->fd[0], &refs_tmp, NULL);
 		data->got_remote_heads = 1;
+		strbuf_release(&pushback);
 	}
 
 	refs = fetch_pack(&args, data->fd, data->conn,
 			  refs_tmp ? refs_tmp : transport->remote_refs,
 			  dest, to_fetch, nr_heads, &data->shallow,
-			  &transport->pack_lockfile);
+			  &transport->pack_lockfile, data->version);
 	close(data->fd[0]);
 	close(data->fd[1]);
 	if (finish_connect(data->conn))
@@ -1133,7 +1168,7 @@ int transport_push(struct transport *transport,
 		return transport->push(transport, refspec_nr, refspec, flags);
 	} else if (transport->push_refs) {
 		struct ref *remote_refs =
-			transport->get_refs_list(transport, 1);
+			transport->get_refs_list(transport, 1, NULL);
 		struct ref *local_refs = get_local_heads();
 		int match_flags = MATCH_REFS_NONE;
 		int verbose = (transport->verbose > 0);
@@ -1221,10 +1256,12 @@ int transport_push(struct transport *transport,
 	return 1;
 }
 
-const struct ref *transport_get_remote_refs(struct transport *transport)
+const struct ref *transport_get_remote_refs(struct transport *transport,
+					    const struct argv_array *ref_prefixes)
 {
 	if (!transport->got_remote_refs) {
-		transport->remote_refs = transport->get_refs_list(transport, 0);
+		transport->remote_refs = transport->get_refs_list(transport, 0,
+								  ref_prefixes);
 		transport->got_remote_refs = 1;
 	}
 
@@ -1373,7 +1410,7 @@ static int refs_from_alternate_cb(struct alternate_object_database *e,
 	other[len - 8] = '\0';
 	remote = remote_get(other);
 	transport = transport_get(remote, other);
-	for (extra = transport_get_remote_refs(transport);
+	for (extra = transport_get_remote_refs(transport, NULL);
 	     extra;
 	     extra = extra->next)
 		cb->fn(extra, cb->data);
@@ -5,6 +5,8 @@
 #include "run-command.h"
 #include "remote.h"
 
+struct argv_array;
+
 struct git_transport_options {
 	unsigned thin : 1;
 	unsigned keep : 1;
@@ -58,8 +60,13 @@ struct transport {
 	 * If the transport is able to determine the remote hash for
 	 * the ref without a huge amount of effort, it should store it
 	 * in the ref's old_sha1 field; otherwise it should be all 0.
+	 *
+	 * ref_prefixes, if not NULL and not empty, says that the caller
+	 * is only interested in the refs that start with one of them;
+	 * the transport may, but need not, leave the others out.
 	 **/
-	struct ref *(*get_refs_list)(struct transport *transport, int for_push);
+	struct ref *(*get_refs_list)(struct transport *transport, int for_push,
+				     const struct argv_array *ref_prefixes);
 
 	/**
 	 * Fetch the objects for the given refs. Note that this gets
@@ -175,7 +182,19 @@ int transport_push(struct transport *connection,
 		   int refspec_nr, const char **refspec, int flags,
 		   unsigned int * reject_reasons);
 
-const struct ref *transport_get_remote_refs(struct transport *transport);
+/*
+ * Retrieve the refs of the remote; see get_refs_list() above for what
+ * ref_prefixes means.  Only the first call talks to the remote, and
+ * the later ones return the same list.
+ */
+const struct ref *transport_get_remote_refs(struct transport *transport,
+					    const struct argv_array *ref_prefixes);
+
+/*
+ * Whether to ask the server to speak protocol v2 when fetching with
+ * these options.
+ */
+int transport_use_protocol_v2(const struct git_transport_options *opts);
 
 int transport_fetch_refs(struct transport *transport, struct ref *refs);
 void transport_unlock_pack(struct transport *transport);
@@ -0,0 +1,476 @@
+/*
+ * An index of the trigrams in blobs, for "git grep" to skip the blobs
+ * that cannot contain what it looks for.
+ *
+ * The file $GIT_DIR/trigram-index consists of
+ *
+ *   - a header: the signature "TGIX", the version (1) and the number
+ *     of blobs, each as a 4-byte number in network byte order;
+ *
+ *   - for each blob, sorted by object name: its 20-byte object name,
+ *     the 4-byte offset of its filter from the start of the file, and
+ *     the 4-byte base-2 logarithm of the size of the filter in bits;
+ *     a size of 0 stands for a blob that has too many different
+ *     trigrams for a filter to be of any use;
+ *
+ *   - the filters, each a bitmap in which a trigram is represented
+ *     by the bit at its hash modulo the size of the filter;
+ *
+ *   - the SHA-1 checksum of all of the above.
+ *
+ * Trigrams are taken over the bytes of a blob with the ASCII
+ * letters folded to lowercase, so that the same filter serves case
+ * sensitive and insensitive searches.
+ */
+#include "cache.h"
+#include "trigram-index.h"
+#include "csum-file.h"
+
+#define TRIGRAM_INDEX_SIGNATURE 0x54474958 /* "TGIX" */
+#define TRIGRAM_INDEX_VERSION 1
+#define TRIGRAM_HEADER_SIZE 12
+#define TRIGRAM_ENTRY_SIZE 28
+
+#define TRIGRAM_MIN_BITS 8
+#define TRIGRAM_MAX_BITS 20
+
+struct trigram_filter {
+	unsigned bits;
+	unsigned char *map;
+};
+
+struct trigram_entry {
+	unsigned char sha1[20];
+	unsigned bits;
+	const unsigned char *map;
+};
+
+struct trigram_index {
+	unsigned char *data;
+	size_t size;
+	uint32_t nr;
+
+	struct trigram_new {
+		unsigned char sha1[20];
+		struct trigram_filter *filter;
+	} *added;
+	int added_nr, added_alloc;
+};
+
+static inline uint32_t fold_byte(unsigned char c)
+{
+	return ('A' <= c && c <= 'Z') ? c + 'a' - 'A' : c;
+}
+
+/* The hash of a trigram, as an index into a filter of the largest size */
+static inline uint32_t trigram_hash(uint32_t trigram)
+{
+	return (trigram * 2654435761u) >> (32 - TRIGRAM_MAX_BITS);
+}
+
+void trigram_clause_add(struct trigram_clause *clause,
+			const char *s, size_t len, int ignore_case)
+{
+	struct trigram_literal *lit;
+	size_t i;
+
+	ALLOC_GROW(clause->literal, clause->nr + 1, clause->alloc);
+	lit = &clause->literal[clause->nr++];
+	lit->nr = 0;
+	lit->trigram = len < 3 ? NULL : xmalloc((len - 2) * sizeof(uint32_t));
+	for (i = 0; i + 2 < len; i++) {
+		const unsigned char *p = (const unsigned char *)s + i;
+		if (ignore_case && (p[0] & 0x80 || p[1] & 0x80 || p[2] & 0x80))
+			continue;
+		lit->trigram[lit->nr++] = (fold_byte(p[0]) << 16) |
+			(fold_byte(p[1]) << 8) | fold_byte(p[2]);
+	}
+}
+
+void trigram_clause_merge(struct trigram_clause *dst,
+			  const struct trigram_clause *src)
+{
+	int i;
+
+	ALLOC_GROW(dst->literal, dst->nr + src->nr, dst->alloc);
+	for (i = 0; i < src->nr; i++) {
+		const struct trigram_literal *from = &src->literal[i];
+		struct trigram_literal *to = &dst->literal[dst->nr++];
+
+		to->nr = from->nr;
+		to->trigram = xmalloc(from->nr * sizeof(uint32_t));
+		memcpy(to->trigram, from->trigram, from->nr * sizeof(uint32_t));
+	}
+}
+
+int trigram_clause_is_trivial(const struct trigram_clause *clause)
+{
+	int i;
+
+	for (i = 0; i < clause->nr; i++)
+		if (!clause->literal[i].nr)
+			return 1;
+	return 0;
+}
+
+void trigram_clause_release(struct trigram_clause *clause)
+{
+	int i;
+
+	for (i = 0; i < clause->nr; i++)
+		free(clause->literal[i].trigram);
+	free(clause->literal);
+	clause->literal = NULL;
+	clause->nr = clause->alloc = 0;
+}
+
+struct trigram_clause *trigram_query_add(struct trigram_query *query)
+{
+	struct trigram_clause *clause;
+
+	ALLOC_GROW(query->clause, query->nr + 1, query->alloc);
+	clause = &query->clause[query->nr++];
+	memset(clause, 0, sizeof(*clause));
+	return clause;
+}
+
+void trigram_query_release(struct trigram_query *query)
+{
+	int i;
+
+	for (i = 0; i < query->nr; i++)
+		trigram_clause_release(&query->clause[i]);
+	free(query->clause);
+	query->clause = NULL;
+	query->nr = query->alloc = 0;
+}
+
+static int filter_has_literal(const unsigned char *map, unsigned bits,
+			      const struct trigram_literal *lit)
+{
+	uint32_t mask = (1u << bits) - 1;
+	int i;
+
+	for (i = 0; i < lit->nr; i++) {
+		uint32_t h = trigram_hash(lit->trigram[i]) & mask;
+		if (!(map[h >> 3] & (1 << (h & 7))))
+			return 0;
+	}
+	return 1;
+}
+
+static int filter_may_match(const unsigned char *map, unsigned bits,
+			    const struct trigram_query *query)
+{
+	int i, j;
+
+	if (!bits)
+		return 1;
+	for (i = 0; i < query->nr; i++) {
+		const struct trigram_clause *clause = &query->clause[i];
+		for (j = 0; j < clause->nr; j++)
+			if (filter_has_literal(map, bits, &clause->literal[j]))
+				break;
+		if (j == clause->nr)
+			return 0;
+	}
+	return 1;
+}
+
+struct trigram_filter *trigram_filter_compute(const char *buf,
+					      unsigned long size)
+{
+	struct trigram_filter *f = xcalloc(1, sizeof(*f));
+	size_t bytes = 1 << (TRIGRAM_MAX_BITS - 3);
+	unsigned char *map = xcalloc(1, bytes);
+	const unsigned char *p = (const unsigned char *)buf;
+	unsigned long i, set = 0;
+	uint32_t trigram = 0;
+	unsigned bits;
+
+	for (i = 0; i < size; i++) {
+		uint32_t h;
+
+		trigram = ((trigram << 8) | fold_byte(p[i])) & 0xffffff;
+		if (i < 2)
+			continue;
+		h = trigram_hash(trigram);
+		if (!(map[h >> 3] & (1 << (h & 7)))) {
+			map[h >> 3] |= 1 << (h & 7);
+			set++;
+		}
+	}
+
+	if ((1 << TRIGRAM_MAX_BITS) / 2 < set) {
+		/* it would let almost anything through */
+		free(map);
+		return f;
+	}
+
+	/*
+	 * Give the filter about two bits for every trigram, and fold the
+	 * bitmap down to that size; as a trigram is looked up at its hash
+	 * modulo the size of the filter, the bits of the upper half of a
+	 * filter go to the same bits of the lower half.
+	 */
+	for (bits = TRIGRAM_MIN_BITS; bits < TRIGRAM_MAX_BITS; bits++)
+		if (2 * set <= (1 << bits))
+			break;
+	while (bytes > (1 << (bits - 3))) {
+		bytes /= 2;
+		for (i = 0; i < bytes; i++)
+			map[i] |= map[i + bytes];
+	}
+	f->bits = bits;
+	f->map = xrealloc(map, bytes);
+	return f;
+}
+
+static void trigram_filter_free(struct trigram_filter *f)
+{
+	if (!f)
+		return;
+	free(f->map);
+	free(f);
+}
+
+static const char *trigram_index_path(void)
+{
+	return git_path("trigram-index");
+}
+
+static void release_trigram_data(struct trigram_index *idx)
+{
+	if (idx->data)
+		munmap(idx->data, idx->size);
+	idx->data = NULL;
+	idx->size = 0;
+	idx->nr = 0;
+}
+
+/*
+ * A filter that was corrupted would make grep skip blobs that match;
+ * check the file against its trailing checksum before using it.
+ */
+static int verify_trigram_checksum(const struct trigram_index *idx)
+{
+	git_SHA_CTX c;
+	unsigned char sha1[20];
+
+	git_SHA1_Init(&c);
+	git_SHA1_Update(&c, idx->data, idx->size - 20);
+	git_SHA1_Final(sha1, &c);
+	return !hashcmp(sha1, idx->data + idx->size - 20);
+}
+
+struct trigram_index *trigram_index_open(void)
+{
+	struct trigram_index *idx = xcalloc(1, sizeof(*idx));
+	const char *path = trigram_index_path();
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			warning("unable to open %s: %s", path, strerror(errno));
+		return idx;
+	}
+	if (fstat(fd, &st)) {
+		close(fd);
+		return idx;
+	}
+	idx->size = xsize_t(st.st_size);
+	if (idx->size < TRIGRAM_HEADER_SIZE + 20) {
+		close(fd);
+		warning("ignoring truncated %s", path);
+		idx->size = 0;
+		return idx;
+	}
+	idx->data = xmmap(NULL, idx->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(idx->data) != TRIGRAM_INDEX_SIGNATURE ||
+	    get_be32(idx->data + 4) != TRIGRAM_INDEX_VERSION) {
+		warning("ignoring %s of an unknown format", path);
+		release_trigram_data(idx);
+		return idx;
+	}
+	if (!verify_trigram_checksum(idx)) {
+		warning("ignoring %s with a bad checksum", path);
+		release_trigram_data(idx);
+		return idx;
+	}
+	idx->nr = get_be32(idx->data + 8);
+	if ((idx->size - TRIGRAM_HEADER_SIZE - 20) / TRIGRAM_ENTRY_SIZE < idx->nr) {
+		warning("ignoring truncated %s", path);
+		release_trigram_data(idx);
+	}
+	return idx;
+}
+
+void trigram_index_free(struct trigram_index *idx)
+{
+	int i;
+
+	if (!idx)
+		return;
+	release_trigram_data(idx);
+	for (i = 0; i < idx->added_nr; i++)
+		trigram_filter_free(idx->added[i].filter);
+	free(idx->added);
+	free(idx);
+}
+
+/*
+ * Fill e with the i-th entry of the file; return -1 if its filter
+ * does not lie within the file.
+ */
+static int read_trigram_entry(struct trigram_index *idx, uint32_t i,
+			      struct trigram_entry *e)
+{
+	const unsigned char *p = idx->data + TRIGRAM_HEADER_SIZE +
+		i * TRIGRAM_ENTRY_SIZE;
+	uint32_t offset = get_be32(p + 20);
+	size_t end = idx->size - 20;
+
+	hashcpy(e->sha1, p);
+	e->bits = get_be32(p + 24);
+	e->map = idx->data + offset;
+	if (!e->bits)
+		return 0;
+	if (e->bits < TRIGRAM_MIN_BITS || TRIGRAM_MAX_BITS < e->bits ||
+	    offset > end || end - offset < (1 << (e->bits - 3)))
+		return -1;
+	return 0;
+}
+
+static int find_trigram_entry(struct trigram_index *idx,
+			      const unsigned char *sha1)
+{
+	uint32_t lo = 0, hi = idx->nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *p = idx->data + TRIGRAM_HEADER_SIZE +
+			mi * TRIGRAM_ENTRY_SIZE;
+		int cmp = hashcmp(p, sha1);
+
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return -1;
+}
+
+int trigram_index_may_match(struct trigram_index *idx,
+			    const unsigned char *sha1,
+			    const struct trigram_query *query)
+{
+	struct trigram_entry e;
+	int pos = find_trigram_entry(idx, sha1);
+
+	if (pos < 0)
+		return -1;
+	if (read_trigram_entry(idx, pos, &e))
+		return 1;
+	return filter_may_match(e.map, e.bits, query);
+}
+
+void trigram_index_add(struct trigram_index *idx, const unsigned char *sha1,
+		       struct trigram_filter *filter)
+{
+	ALLOC_GROW(idx->added, idx->added_nr + 1, idx->added_alloc);
+	hashcpy(idx->added[idx->added_nr].sha1, sha1);
+	idx->added[idx->added_nr].filter = filter;
+	idx->added_nr++;
+}
+
+static int trigram_new_cmp(const void *a_, const void *b_)
+{
+	const struct trigram_new *a = a_, *b = b_;
+	return hashcmp(a->sha1, b->sha1);
+}
+
+static void write_be32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, 4);
+}
+
+int trigram_index_write(struct trigram_index *idx)
+{
+	static struct lock_file lock;
+	struct trigram_entry *entry;
+	uint32_t i, nr = 0, offset;
+	int j, fd;
+	struct sha1file *f;
+
+	if (!idx->added_nr)
+		return 0;
+
+	fd = hold_lock_file_for_update(&lock, trigram_index_path(), 0);
+	if (fd < 0)
+		/* somebody else is at it; let them */
+		return errno == EEXIST ? 0 : -1;
+
+	/* merge what we read with what was added, dropping duplicates */
+	qsort(idx->added, idx->added_nr, sizeof(*idx->added), trigram_new_cmp);
+	entry = xmalloc((idx->nr + idx->added_nr) * sizeof(*entry));
+	for (i = 0, j = 0; i < idx->nr || j < idx->added_nr; ) {
+		struct trigram_entry *e = &entry[nr];
+		int cmp;
+
+		if (i < idx->nr && read_trigram_entry(idx, i, e)) {
+			i++; /* corrupt; drop it */
+			continue;
+		}
+		if (j >= idx->added_nr)
+			cmp = -1;
+		else if (i >= idx->nr)
+			cmp = 1;
+		else
+			cmp = hashcmp(e->sha1, idx->added[j].sha1);
+		if (cmp <= 0) {
+			i++;
+			if (!cmp)
+				j++;
+		} else {
+			struct trigram_new *n = &idx->added[j++];
+			hashcpy(e->sha1, n->sha1);
+			e->bits = n->filter->bits;
+			e->map = n->filter->map;
+		}
+		if (nr && !hashcmp(entry[nr - 1].sha1, e->sha1))
+			continue;
+		nr++;
+	}
+
+	f = sha1fd(fd, lock.filename);
+	write_be32(f, TRIGRAM_INDEX_SIGNATURE);
+	write_be32(f, TRIGRAM_INDEX_VERSION);
+	write_be32(f, nr);
+	offset = TRIGRAM_HEADER_SIZE + nr * TRIGRAM_ENTRY_SIZE;
+	for (i = 0; i < nr; i++) {
+		sha1write(f, entry[i].sha1, 20);
+		write_be32(f, entry[i].bits ? offset : 0);
+		write_be32(f, entry[i].bits);
+		if (entry[i].bits)
+			offset += 1 << (entry[i].bits - 3);
+	}
+	for (i = 0; i < nr; i++)
+		if (entry[i].bits)
+			sha1write(f, entry[i].map, 1 << (entry[i].bits - 3));
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1;
+	free(entry);
+
+	/* we may not replace the file while we have it mapped */
+	release_trigram_data(idx);
+	if (commit_lock_file(&lock))
+		return error("unable to write %s", trigram_index_path());
+	return 0;
+}
@@ -0,0 +1,90 @@
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+/*
+ * The trigram index remembers, for each blob it has seen, a small
+ * filter of the three-byte sequences that occur in it, so that a
+ * search for a string can skip the blobs that cannot contain it
+ * without inflating them.  The filters may give false positives, but
+ * never false negatives.
+ */
+
+/*
+ * A string that must occur in a blob, as the (ASCII case folded)
+ * trigrams it consists of.  One without any trigrams (because it is
+ * too short) occurs in every blob.
+ */
+struct trigram_literal {
+	int nr;
+	uint32_t *trigram;
+};
+
+/* Satisfied by a blob that contains any of the literals */
+struct trigram_clause {
+	int nr, alloc;
+	struct trigram_literal *literal;
+};
+
+/* Satisfied by a blob that satisfies all of the clauses */
+struct trigram_query {
+	int nr, alloc;
+	struct trigram_clause *clause;
+};
+
+/*
+ * Add the string s to the literals of clause.  With ignore_case, the
+ * trigrams with non-ASCII bytes, whose case we cannot fold, are left
+ * out.
+ */
+extern void trigram_clause_add(struct trigram_clause *clause,
+			       const char *s, size_t len, int ignore_case);
+/* Add copies of the literals of src to dst */
+extern void trigram_clause_merge(struct trigram_clause *dst,
+				 const struct trigram_clause *src);
+/* Whether the clause is satisfied by every blob */
+extern int trigram_clause_is_trivial(const struct trigram_clause *clause);
+extern void trigram_clause_release(struct trigram_clause *clause);
+
+/* Add a new clause to query and return it */
+extern struct trigram_clause *trigram_query_add(struct trigram_query *query);
+extern void trigram_query_release(struct trigram_query *query);
+
+struct trigram_filter;
+struct trigram_index;
+
+/* Read $GIT_DIR/trigram-index, if any */
+extern struct trigram_index *trigram_index_open(void);
+extern void trigram_index_free(struct trigram_index *);
+
+/*
+ * Return 0 if the blob cannot satisfy the query, 1 if it may, or -1
+ * if the blob is not in the index.
+ */
+extern int trigram_index_may_match(struct trigram_index *,
+				   const unsigned char *sha1,
+				   const struct trigram_query *);
+
+/*
+ * Compute the filter for the contents of a blob; this does not touch
+ * the index, and can be done from any thread.
+ */
+extern struct trigram_filter *trigram_filter_compute(const char *buf,
+						     unsigned long size);
+
+/*
+ * Record the filter of the blob sha1 in the index; the index takes
+ * the ownership of the filter.  The callers are responsible for not
+ * calling this from several threads at once.
+ */
+extern void trigram_index_add(struct trigram_index *,
+			      const unsigned char *sha1,
+			      struct trigram_filter *);
+
+/*
+ * Write the index out if filters were added to it.  Return 0 on
+ * success, or when somebody else is updating the file at the same
+ * time, and -1 on errors.
+ */
+extern int trigram_index_write(struct trigram_index *);
+
+#endif
@@ -120,3 +120,110 @@ fail:
 	errno = saved_errno;
 	return -1;
 }
+
+/*
+ * The largest number of file descriptors unix_send_fds() and
+ * unix_recv_fds() pass in one message.
+ */
+#define UNIX_MAX_FDS 4
+
+union unix_fds_control {
+	struct cmsghdr align;
+	char buf[CMSG_SPACE(sizeof(int) * UNIX_MAX_FDS)];
+};
+
+int unix_send_fds(int fd, const void *buf, size_t len, const int *fds, int nr)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	union unix_fds_control control;
+	struct cmsghdr *cmsg;
+	ssize_t ret;
+
+	if (nr < 1 || nr > UNIX_MAX_FDS || !len) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = (void *)buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * nr);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nr);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nr);
+
+	do {
+		ret = sendmsg(fd, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+	if (ret != len) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+	return 0;
+}
+
+int unix_recv_fds(int fd, void *buf, size_t len, int *fds, int nr)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	union unix_fds_control control;
+	struct cmsghdr *cmsg;
+	ssize_t ret;
+	int i, got = 0;
+
+	for (i = 0; i < nr; i++)
+		fds[i] = -1;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	do {
+		ret = recvmsg(fd, &msg, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		int *data = (int *)CMSG_DATA(cmsg);
+		int count;
+
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < count; i++) {
+			int received;
+
+			memcpy(&received, data + i, sizeof(int));
+			if (got < nr) {
+				fcntl(received, F_SETFD, FD_CLOEXEC);
+				fds[got++] = received;
+			} else
+				close(received);
+		}
+	}
+
+	if (ret && got < nr) {
+		for (i = 0; i < got; i++) {
+			close(fds[i]);
+			fds[i] = -1;
+		}
+		errno = EPROTO;
+		return -1;
+	}
+	return ret;
+}
@@ -4,4 +4,20 @@
 int unix_stream_connect(const char *path);
 int unix_stream_listen(const char *path);
 
+/*
+ * Send the "len" bytes of "buf" over the unix socket "fd" in one
+ * message, along with the "nr" (at most 4) file descriptors in "fds".
+ * Return 0 on success, -1 with errno set on failure.
+ */
+int unix_send_fds(int fd, const void *buf, size_t len, const int *fds, int nr);
+
+/*
+ * Receive a message sent by unix_send_fds() into "buf", and exactly
+ * "nr" file descriptors with it into "fds"; they are marked close-on-exec.
+ * Return the number of bytes read, 0 at end of file (with "fds" all
+ * set to -1), or -1 with errno set on failure, including when the
+ * message did not come with "nr" file descriptors.
+ */
+int unix_recv_fds(int fd, void *buf, size_t len, int *fds, int nr);
+
 #endif /* UNIX_SOCKET_H */
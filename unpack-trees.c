@@ -8,6 +8,7 @@
 #include "progress.h"
 #include "refs.h"
 #include "attr.h"
+#include "parallel-checkout.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -224,6 +225,8 @@ static int check_updates(struct unpack_trees_options *o)
 	remove_marked_cache_entries(&o->result);
 	remove_scheduled_dirs();
 
+	if (o->update && !o->dry_run)
+		init_parallel_checkout();
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
@@ -235,6 +238,8 @@ static int check_updates(struct unpack_trees_options *o)
 			}
 		}
 	}
+	if (o->update && !o->dry_run)
+		errs |= run_parallel_checkout(&state);
 	stop_progress(&progress);
 	if (o->update)
 		git_attr_set_direction(GIT_ATTR_CHECKIN, NULL);
@@ -1018,6 +1023,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	int i, ret;
 	static struct cache_entry *dfc;
 	struct exclude_list el;
+	struct index_state *src_index;
 
 	if (len > MAX_UNPACK_TREES)
 		die("unpack_trees takes at most %d trees", MAX_UNPACK_TREES);
@@ -1155,9 +1161,24 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		}
 	}
 
+	src_index = o->src_index;
 	o->src_index = NULL;
 	ret = check_updates(o) ? (-2) : 0;
 	if (o->dst_index) {
+		/* keep writing to the same shared index, if any */
+		o->result.split_index = o->dst_index->split_index;
+		o->dst_index->split_index = NULL;
+		/*
+		 * the untracked cache was kept up to date with the
+		 * changes to src_index (see invalidate_ce_path())
+		 */
+		if (src_index == o->dst_index) {
+			o->result.untracked = src_index->untracked;
+			src_index->untracked = NULL;
+		}
+		/* CE_FSMONITOR_VALID came along with the entries */
+		o->result.fsmonitor_last_update = src_index->fsmonitor_last_update;
+		o->result.fsmonitor_has_run_once = src_index->fsmonitor_has_run_once;
 		discard_index(o->dst_index);
 		*o->dst_index = o->result;
 	}
@@ -1259,8 +1280,10 @@ static int verify_uptodate_sparse(const struct cache_entry *ce,
 static void invalidate_ce_path(const struct cache_entry *ce,
 			       struct unpack_trees_options *o)
 {
-	if (ce)
-		cache_tree_invalidate_path(o->src_index->cache_tree, ce->name);
+	if (!ce)
+		return;
+	cache_tree_invalidate_path(o->src_index->cache_tree, ce->name);
+	untracked_cache_invalidate_path(o->src_index, ce->name);
 }
 
 /*
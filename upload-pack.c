@@ -14,6 +14,11 @@
 #include "sigchain.h"
 #include "version.h"
 #include "string-list.h"
+#include "sha1-array.h"
+#include "protocol.h"
+#ifndef NO_UNIX_SOCKETS
+#include "unix-socket.h"
+#endif
 
 static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=<n>] <dir>";
 
@@ -28,6 +33,9 @@ static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=<
 #define NOT_SHALLOW	(1u << 17)
 #define CLIENT_SHALLOW	(1u << 18)
 #define HIDDEN_REF	(1u << 19)
+#define ALL_FLAGS	(THEY_HAVE | OUR_REF | WANTED | COMMON_KNOWN | \
+			 REACHABLE | SHALLOW | NOT_SHALLOW | CLIENT_SHALLOW | \
+			 HIDDEN_REF)
 
 static unsigned long oldest_have;
 
@@ -48,6 +56,7 @@ static int keepalive = 5;
 static int use_sideband;
 static int advertise_refs;
 static int stateless_rpc;
+static enum protocol_version version;
 
 static void reset_timeout(void)
 {
@@ -449,8 +458,12 @@ static void check_non_tip(void)
 	char namebuf[42]; /* ^ + SHA-1 + LF */
 	int i;
 
-	/* In the normal in-process case non-tip request can never happen */
-	if (!stateless_rpc)
+	/*
+	 * In the normal in-process case non-tip request can never
+	 * happen; in protocol v2, the refs may have moved since the
+	 * client listed them, even in the same process.
+	 */
+	if (!stateless_rpc && version != protocol_v2)
 		goto error;
 
 	cmd.argv = argv;
@@ -774,6 +787,283 @@ static void upload_pack(void)
 	}
 }
 
+/*
+ * Read a line of a protocol v2 request into packet_buffer.  Return
+ * NULL at a delim or a flush packet, which *status tells apart, and
+ * at the end of the input when options allow it.
+ */
+static char *read_request_line(int options, enum packet_read_status *status)
+{
+	int len;
+
+	*status = packet_read_with_status(0, NULL, NULL,
+					  packet_buffer, sizeof(packet_buffer),
+					  &len, options | PACKET_READ_CHOMP_NEWLINE);
+	reset_timeout();
+	return *status == PACKET_READ_NORMAL ? packet_buffer : NULL;
+}
+
+struct ls_refs_data {
+	unsigned symrefs:1;
+	unsigned peel:1;
+};
+
+static int send_ls_ref(const char *refname, const unsigned char *sha1,
+		       int flag, void *cb_data)
+{
+	struct ls_refs_data *data = cb_data;
+	const char *refname_nons = strip_namespace(refname);
+	struct strbuf line = STRBUF_INIT;
+	unsigned char peeled[20];
+
+	if (ref_is_hidden(refname))
+		return 0;
+
+	strbuf_addf(&line, "%s %s", sha1_to_hex(sha1), refname_nons);
+	if (data->symrefs && (flag & REF_ISSYMREF)) {
+		unsigned char unused[20];
+		const char *target = resolve_ref_unsafe(refname, unused, 0, NULL);
+
+		if (!target)
+			die("'%s' is a symref but it is not?", refname);
+		target = strip_namespace(target);
+		if (target)
+			strbuf_addf(&line, " symref-target:%s", target);
+	}
+	if (data->peel && !peel_ref(refname, peeled))
+		strbuf_addf(&line, " peeled:%s", sha1_to_hex(peeled));
+	packet_write(1, "%s\n", line.buf);
+	strbuf_release(&line);
+	return 0;
+}
+
+/*
+ * Drop the prefixes that are covered by a shorter one, so that no ref
+ * is listed twice; the list must be sorted.
+ */
+static void remove_redundant_prefixes(struct string_list *prefixes)
+{
+	int src, dst;
+
+	for (src = dst = 0; src < prefixes->nr; src++) {
+		const char *prefix = prefixes->items[src].string;
+
+		if (dst && starts_with(prefix, prefixes->items[dst - 1].string))
+			continue;
+		prefixes->items[dst++] = prefixes->items[src];
+	}
+	prefixes->nr = dst;
+}
+
+/*
+ * The "ls-refs" command lists the refs, or only those that start with
+ * one of the "ref-prefix" arguments, so that a client that wants a
+ * few branches out of many refs does not have to hear about all of
+ * them.
+ */
+static void ls_refs(const struct string_list *args)
+{
+	struct ls_refs_data data;
+	struct string_list prefixes = STRING_LIST_INIT_NODUP;
+	int i;
+
+	memset(&data, 0, sizeof(data));
+	for (i = 0; i < args->nr; i++) {
+		const char *line = args->items[i].string, *arg;
+
+		if (!strcmp(line, "symrefs"))
+			data.symrefs = 1;
+		else if (!strcmp(line, "peel"))
+			data.peel = 1;
+		else if ((arg = skip_prefix(line, "ref-prefix ")))
+			string_list_append(&prefixes, arg);
+		else
+			die("git upload-pack: unexpected line: '%s'", line);
+	}
+
+	if (!prefixes.nr) {
+		head_ref_namespaced(send_ls_ref, &data);
+		for_each_namespaced_ref(send_ls_ref, &data);
+	} else {
+		sort_string_list(&prefixes);
+		remove_redundant_prefixes(&prefixes);
+		for (i = 0; i < prefixes.nr; i++)
+			if (starts_with("HEAD", prefixes.items[i].string)) {
+				head_ref_namespaced(send_ls_ref, &data);
+				break;
+			}
+		for (i = 0; i < prefixes.nr; i++) {
+			const char *prefix = prefixes.items[i].string;
+
+			if (starts_with("refs/", prefix)) {
+				/* e.g. "ref": that is all of them */
+				for_each_namespaced_ref(send_ls_ref, &data);
+				break;
+			}
+			if (starts_with(prefix, "refs/"))
+				for_each_namespaced_ref_in(prefix, send_ls_ref,
+							   &data);
+		}
+	}
+	packet_flush(1);
+	string_list_clear(&prefixes, 0);
+}
+
+/*
+ * The "fetch" command of protocol v2.  The request carries all the
+ * state of the negotiation: the wants, the haves the client already
+ * knows to be common, and a new batch of haves.  We answer with the
+ * haves we have, and, once we have enough of them (or the client says
+ * "done"), with the pack.
+ */
+static void fetch_v2(const struct string_list *args)
+{
+	struct sha1_array common = SHA1_ARRAY_INIT;
+	int seen_haves = 0, done = 0, has_non_tip = 0;
+	int i;
+
+	clear_object_flags(ALL_FLAGS);
+	want_obj.nr = 0;
+	have_obj.nr = 0;
+	oldest_have = 0;
+	use_thin_pack = use_ofs_delta = use_include_tag = no_progress = 0;
+	use_sideband = LARGE_PACKET_MAX;
+
+	for (i = 0; i < args->nr; i++) {
+		const char *line = args->items[i].string;
+		unsigned char sha1[20];
+		struct object *o;
+
+		if (starts_with(line, "want ")) {
+			if (get_sha1_hex(line + 5, sha1))
+				die("git upload-pack: protocol error, "
+				    "expected to get sha, not '%s'", line);
+			o = parse_object(sha1);
+			if (!o)
+				die("git upload-pack: not our ref %s",
+				    sha1_to_hex(sha1));
+			if (!(o->flags & WANTED)) {
+				o->flags |= WANTED;
+				add_object_array(o, NULL, &want_obj);
+			}
+		} else if (starts_with(line, "have ")) {
+			seen_haves = 1;
+			if (got_sha1((char *)line + 5, sha1) >= 0)
+				sha1_array_append(&common, sha1);
+		} else if (!strcmp(line, "done"))
+			done = 1;
+		else if (!strcmp(line, "thin-pack"))
+			use_thin_pack = 1;
+		else if (!strcmp(line, "ofs-delta"))
+			use_ofs_delta = 1;
+		else if (!strcmp(line, "no-progress"))
+			no_progress = 1;
+		else if (!strcmp(line, "include-tag"))
+			use_include_tag = 1;
+		else
+			die("git upload-pack: unexpected line: '%s'", line);
+	}
+
+	if (!want_obj.nr) {
+		sha1_array_clear(&common);
+		return;
+	}
+
+	head_ref_namespaced(mark_our_ref, NULL);
+	for_each_namespaced_ref(mark_our_ref, NULL);
+	for (i = 0; i < want_obj.nr; i++)
+		if (!is_our_ref(want_obj.objects[i].item))
+			has_non_tip = 1;
+	if (has_non_tip)
+		check_non_tip();
+
+	if (seen_haves && !done) {
+		int ready;
+
+		packet_write(1, "acknowledgments\n");
+		if (!common.nr)
+			packet_write(1, "NAK\n");
+		for (i = 0; i < common.nr; i++)
+			packet_write(1, "ACK %s\n", sha1_to_hex(common.sha1[i]));
+		ready = ok_to_give_up();
+		if (ready)
+			packet_write(1, "ready\n");
+		sha1_array_clear(&common);
+		if (!ready) {
+			packet_flush(1);
+			return;
+		}
+		packet_delim(1);
+	}
+	sha1_array_clear(&common);
+
+	packet_write(1, "packfile\n");
+	create_pack_file();
+}
+
+/*
+ * Serve protocol v2: advertise our capabilities, and then the
+ * commands the client sends, until it hangs up or sends an empty
+ * request (or after the first one in the stateless RPC mode, whose
+ * advertisement is made by another process).
+ */
+static void serve_v2(void)
+{
+	if (advertise_refs || !stateless_rpc) {
+		reset_timeout();
+		packet_write(1, "version 2\n");
+		packet_write(1, "agent=%s\n", git_user_agent_sanitized());
+		packet_write(1, "ls-refs\n");
+		packet_write(1, "fetch\n");
+		packet_flush(1);
+	}
+	if (advertise_refs)
+		return;
+
+	for (;;) {
+		struct strbuf command = STRBUF_INIT;
+		struct string_list args = STRING_LIST_INIT_DUP;
+		enum packet_read_status status;
+		const char *line, *arg;
+
+		/* The command, and capabilities, up to the arguments */
+		line = read_request_line(PACKET_READ_GENTLE_ON_EOF, &status);
+		if (!line) {
+			if (status == PACKET_READ_DELIM)
+				die("git upload-pack: no command in request");
+			break;
+		}
+		do {
+			if ((arg = skip_prefix(line, "command="))) {
+				if (command.len)
+					die("git upload-pack: more than one command");
+				strbuf_addstr(&command, arg);
+			}
+		} while ((line = read_request_line(0, &status)));
+		if (!command.len)
+			die("git upload-pack: no command in request");
+
+		/* The arguments, if any, up to the end of the request */
+		if (status == PACKET_READ_DELIM) {
+			while ((line = read_request_line(0, &status)))
+				string_list_append(&args, line);
+			if (status != PACKET_READ_FLUSH)
+				die("git upload-pack: expected flush after arguments");
+		}
+
+		if (!strcmp(command.buf, "ls-refs"))
+			ls_refs(&args);
+		else if (!strcmp(command.buf, "fetch"))
+			fetch_v2(&args);
+		else
+			die("git upload-pack: unknown command '%s'", command.buf);
+		strbuf_release(&command);
+		string_list_clear(&args, 0);
+		if (stateless_rpc)
+			break;
+	}
+}
+
 static int upload_pack_config(const char *var, const char *value, void *unused)
 {
 	if (!strcmp("uploadpack.allowtipsha1inwant", var))
@@ -786,11 +1076,226 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 	return parse_hide_refs_config(var, value, "uploadpack");
 }
 
+static void serve(void)
+{
+	version = determine_protocol_version_server();
+	if (version == protocol_v2)
+		serve_v2();
+	else
+		upload_pack();
+}
+
+#ifndef NO_UNIX_SOCKETS
+/*
+ * In the --worker mode, we are started by "git daemon --worker-pool"
+ * in a repository, with a unix socket as our standard input.  Over it
+ * the daemon sends us connections to serve, each as a pkt-line holding
+ * the path of the repository and the $GIT_PROTOCOL of the request, with
+ * two file descriptors: the connection, and a pipe to tell the process
+ * that accepted it how it went.  We serve each connection in a child
+ * forked after the repository was set up, its packs opened and its refs
+ * read, and let the pipe be closed when the child exits.  If we cannot
+ * serve it, we write a byte to the pipe instead, for the connection to
+ * be served by a new upload-pack.
+ */
+
+/*
+ * What is read only once, when the worker starts, comes from these
+ * files; when one of them changes, the worker must be replaced.
+ */
+static struct watched_file {
+	char *path;
+	struct stat_validity validity;
+} *watched_files;
+static int watched_files_nr, watched_files_alloc;
+
+/*
+ * Besides, a worker is replaced after this many seconds, for what we
+ * do not watch, like the files included from the configuration.
+ */
+#define WORKER_LIFETIME 300
+static time_t worker_started;
+
+static int prepare_ref(const char *refname, const unsigned char *sha1,
+		       int flag, void *cb_data)
+{
+	return 0;
+}
+
+static void prepare_packs(void)
+{
+	struct packed_git *p;
+
+	reprepare_packed_git();
+	for (p = packed_git; p; p = p->next)
+		open_pack_index(p);
+}
+
+static void watch_file(const char *path)
+{
+	struct watched_file *f;
+	int fd;
+
+	if (!path)
+		return;
+	ALLOC_GROW(watched_files, watched_files_nr + 1, watched_files_alloc);
+	f = &watched_files[watched_files_nr++];
+	f->path = xstrdup(path);
+	memset(&f->validity, 0, sizeof(f->validity));
+	fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		stat_validity_update(&f->validity, fd);
+		close(fd);
+	}
+}
+
+static void prepare_worker(void)
+{
+	char *user_config, *xdg_config;
+
+	worker_started = time(NULL);
+	home_config_paths(&user_config, &xdg_config, "config");
+	watch_file(git_path("config"));
+	watch_file(user_config);
+	watch_file(xdg_config);
+	watch_file(git_etc_gitconfig());
+	watch_file(get_graft_file());
+	watch_file(git_path("shallow"));
+	watch_file(mkpath("%s/info/alternates", get_object_directory()));
+	free(user_config);
+	free(xdg_config);
+
+	prepare_packs();
+	for_each_ref(prepare_ref, NULL);
+}
+
+/*
+ * New packs and refs are picked up for each connection, but what was
+ * read from the configuration, the grafts or the alternates, or a pack
+ * that went away (e.g. after "git gc"), would not be: the worker must
+ * then be replaced.
+ */
+static int worker_is_stale(void)
+{
+	struct packed_git *p;
+	int i;
+
+	if (time(NULL) - worker_started >= WORKER_LIFETIME)
+		return 1;
+	for (i = 0; i < watched_files_nr; i++)
+		if (!stat_validity_check(&watched_files[i].validity,
+					 watched_files[i].path))
+			return 1;
+	for (p = packed_git; p; p = p->next)
+		if (access(p->pack_name, F_OK))
+			return 1;
+	return 0;
+}
+
+/*
+ * Read the next connection from the daemon.  Return its $GIT_PROTOCOL
+ * (an empty string if the request had none), or NULL at the end of
+ * the input.
+ */
+static const char *read_connection(int *fds)
+{
+	static char buf[LARGE_PACKET_MAX + 1];
+	char *end;
+	int len, path_len;
+
+	len = unix_recv_fds(0, buf, 4, fds, 2);
+	if (!len)
+		return NULL;
+	if (len < 0)
+		die_errno("git upload-pack: unable to receive connection");
+	if (len < 4 && read_in_full(0, buf + len, 4 - len) != 4 - len)
+		die("git upload-pack: truncated connection header");
+	buf[4] = '\0';
+	len = strtol(buf, &end, 16);
+	if (*end || len < 5 || LARGE_PACKET_MAX < len)
+		die("git upload-pack: protocol error: bad line length %d", len);
+	len -= 4;
+	if (read_in_full(0, buf, len) != len)
+		die("git upload-pack: truncated connection");
+	buf[len] = '\0';
+	path_len = strlen(buf);
+	return path_len < len ? buf + path_len + 1 : "";
+}
+
+static void refuse_connection(int *fds)
+{
+	sigchain_push(SIGPIPE, SIG_IGN);
+	write_in_full(fds[1], "n", 1);
+	sigchain_pop(SIGPIPE);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void serve_connection(int *fds, const char *protocol)
+{
+	pid_t pid = fork();
+
+	if (pid < 0) {
+		error("git upload-pack: unable to fork: %s", strerror(errno));
+		refuse_connection(fds);
+		return;
+	}
+	if (pid) {
+		close(fds[0]);
+		close(fds[1]);
+		return;
+	}
+
+	/* fds[1] stays open, to be closed when we exit */
+	if (dup2(fds[0], 0) < 0 || dup2(fds[0], 1) < 0)
+		die_errno("git upload-pack: unable to set up connection");
+	close(fds[0]);
+	if (*protocol)
+		setenv(GIT_PROTOCOL_ENVIRONMENT, protocol, 1);
+	else
+		unsetenv(GIT_PROTOCOL_ENVIRONMENT);
+	invalidate_loose_ref_cache();
+	serve();
+	exit(0);
+}
+
+static void worker(void)
+{
+	const char *protocol;
+	int fds[2];
+
+	prepare_worker();
+	while ((protocol = read_connection(fds))) {
+		while (waitpid(-1, NULL, WNOHANG) > 0)
+			; /* nothing */
+		prepare_packs();
+		if (worker_is_stale()) {
+			/*
+			 * Once our end is shut down, the daemon can
+			 * no longer send to us; hand back what it did.
+			 */
+			shutdown(0, SHUT_RD);
+			do {
+				refuse_connection(fds);
+			} while ((protocol = read_connection(fds)));
+			break;
+		}
+		serve_connection(fds, protocol);
+	}
+}
+#else
+static void worker(void)
+{
+	die("git upload-pack: --worker is not supported on this platform");
+}
+#endif
+
 int main(int argc, char **argv)
 {
 	char *dir;
 	int i;
 	int strict = 0;
+	int worker_mode = 0;
 
 	git_setup_gettext();
 
@@ -820,6 +1325,10 @@ int main(int argc, char **argv)
 			daemon_mode = 1;
 			continue;
 		}
+		if (!strcmp(arg, "--worker")) {
+			worker_mode = 1;
+			continue;
+		}
 		if (!strcmp(arg, "--")) {
 			i++;
 			break;
@@ -837,6 +1346,9 @@ int main(int argc, char **argv)
 		die("'%s' does not appear to be a git repository", dir);
 
 	git_config(upload_pack_config, NULL);
-	upload_pack();
+	if (worker_mode)
+		worker();
+	else
+		serve();
 	return 0;
 }
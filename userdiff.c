@@ -250,6 +250,12 @@ struct userdiff_driver *userdiff_find_by_name(const char *name) {
 }
 
 struct userdiff_driver *userdiff_find_by_path(const char *path)
+{
+	return userdiff_find_by_path_ctx(NULL, path);
+}
+
+struct userdiff_driver *userdiff_find_by_path_ctx(struct git_attr_context *ctx,
+						 const char *path)
 {
 	static struct git_attr *attr;
 	struct git_attr_check check;
@@ -260,7 +266,7 @@ struct userdiff_driver *userdiff_find_by_path(const char *path)
 
 	if (!path)
 		return NULL;
-	if (git_check_attr(path, 1, &check))
+	if (git_check_attr_ctx(ctx, path, 1, &check))
 		return NULL;
 
 	if (ATTR_TRUE(check.value))
@@ -3,6 +3,8 @@
 
 #include "notes-cache.h"
 
+struct git_attr_context;
+
 struct userdiff_funcname {
 	const char *pattern;
 	int cflags;
@@ -22,6 +24,8 @@ struct userdiff_driver {
 int userdiff_config(const char *k, const char *v);
 struct userdiff_driver *userdiff_find_by_name(const char *name);
 struct userdiff_driver *userdiff_find_by_path(const char *path);
+struct userdiff_driver *userdiff_find_by_path_ctx(struct git_attr_context *,
+						 const char *path);
 
 struct userdiff_driver *userdiff_get_textconv(struct userdiff_driver *driver);
 
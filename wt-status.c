@@ -545,6 +545,12 @@ static void wt_status_collect_untracked(struct wt_status *s)
 			DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES;
 	if (s->show_ignored_files)
 		dir.flags |= DIR_SHOW_IGNORED_TOO;
+
+	if (core_untracked_cache > 0)
+		add_untracked_cache(&the_index);
+	else if (!core_untracked_cache)
+		remove_untracked_cache(&the_index);
+	dir.untracked = the_index.untracked;
 	setup_standard_excludes(&dir);
 
 	fill_directory(&dir, &s->pathspec);
@@ -77,8 +77,22 @@ typedef struct s_mmbuffer {
 	long size;
 } mmbuffer_t;
 
+/*
+ * Scratch memory for the diff algorithms, which a caller running many
+ * diffs can keep around (zero-initialized) and point xpparam_t at, so
+ * that it is reused instead of allocated and freed for every diff.
+ * It grows to what the largest diff so far needed; release it with
+ * xdl_free_arena().
+ */
+typedef struct s_xdarena {
+	char *ptr;
+	long size, used, peak;
+	struct s_xdarenachunk *chunks;
+} xdarena_t;
+
 typedef struct s_xpparam {
 	unsigned long flags;
+	xdarena_t *arena;
 } xpparam_t;
 
 typedef struct s_xdemitcb {
@@ -110,6 +124,8 @@ typedef struct s_bdiffparam {
 #define xdl_free(ptr) free(ptr)
 #define xdl_realloc(ptr,x) realloc(ptr,x)
 
+void xdl_free_arena(xdarena_t *arena);
+
 void *xdl_mmfile_first(mmfile_t *mmf, long *size);
 long xdl_mmfile_size(mmfile_t *mmf);
 
@@ -321,19 +321,13 @@ int xdl_recs_cmp(diffdata_t *dd1, long off1, long lim1,
 }
 
 
-int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
-		xdfenv_t *xe) {
+static int xdl_do_classic_diff(mmfile_t *mf1, mmfile_t *mf2,
+			       xpparam_t const *xpp, xdfenv_t *xe) {
 	long ndiags;
 	long *kvd, *kvdf, *kvdb;
 	xdalgoenv_t xenv;
 	diffdata_t dd1, dd2;
 
-	if (XDF_DIFF_ALG(xpp->flags) == XDF_PATIENCE_DIFF)
-		return xdl_do_patience_diff(mf1, mf2, xpp, xe);
-
-	if (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF)
-		return xdl_do_histogram_diff(mf1, mf2, xpp, xe);
-
 	if (xdl_prepare_env(mf1, mf2, xpp, xe) < 0) {
 
 		return -1;
@@ -344,7 +338,8 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	 * One is to store the forward path and one to store the backward path.
 	 */
 	ndiags = xe->xdf1.nreff + xe->xdf2.nreff + 3;
-	if (!(kvd = (long *) xdl_malloc((2 * ndiags + 2) * sizeof(long)))) {
+	if (!(kvd = (long *) xdl_arena_alloc(xpp->arena,
+					     (2 * ndiags + 2) * sizeof(long)))) {
 
 		xdl_free_env(xe);
 		return -1;
@@ -372,17 +367,38 @@ int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
 	if (xdl_recs_cmp(&dd1, 0, dd1.nrec, &dd2, 0, dd2.nrec,
 			 kvdf, kvdb, (xpp->flags & XDF_NEED_MINIMAL) != 0, &xenv) < 0) {
 
-		xdl_free(kvd);
+		xdl_arena_free(xpp->arena, kvd);
 		xdl_free_env(xe);
 		return -1;
 	}
 
-	xdl_free(kvd);
+	xdl_arena_free(xpp->arena, kvd);
 
 	return 0;
 }
 
 
+int xdl_do_diff(mmfile_t *mf1, mmfile_t *mf2, xpparam_t const *xpp,
+		xdfenv_t *xe) {
+	int ret;
+
+	if (XDF_DIFF_ALG(xpp->flags) == XDF_PATIENCE_DIFF)
+		ret = xdl_do_patience_diff(mf1, mf2, xpp, xe);
+	else if (XDF_DIFF_ALG(xpp->flags) == XDF_HISTOGRAM_DIFF)
+		ret = xdl_do_histogram_diff(mf1, mf2, xpp, xe);
+	else
+		ret = xdl_do_classic_diff(mf1, mf2, xpp, xe);
+
+	/*
+	 * The algorithms are done with their scratch memory; let the
+	 * arena size itself for the next diff.
+	 */
+	xdl_arena_reset(xpp->arena);
+
+	return ret;
+}
+
+
 static xdchange_t *xdl_add_change(xdchange_t *xscr, long i1, long i2, long chg1, long chg2) {
 	xdchange_t *xch;
 
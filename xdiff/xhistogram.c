@@ -56,8 +56,9 @@ struct histindex {
 		unsigned int ptr, cnt;
 		struct record *next;
 	} **records, /* an occurrence */
-	  **line_map; /* map of line to record chain */
-	chastore_t rcha;
+	  **line_map, /* map of line to record chain */
+	  *rec_store; /* at most one record per line */
+	unsigned int rec_nr;
 	unsigned int *next_ptrs;
 	unsigned int table_bits,
 		     records_size,
@@ -145,8 +146,7 @@ static int scanA(struct histindex *index, int line1, int count1)
 		 * This is the first time we have ever seen this particular
 		 * element in the sequence. Construct a new chain for it.
 		 */
-		if (!(rec = xdl_cha_alloc(&index->rcha)))
-			return -1;
+		rec = index->rec_store + index->rec_nr++;
 		rec->ptr = ptr;
 		rec->cnt = 1;
 		rec->next = *rec_chain;
@@ -252,6 +252,7 @@ static int fall_back_to_classic_diff(struct histindex *index,
 		int line1, int count1, int line2, int count2)
 {
 	xpparam_t xpp;
+	memset(&xpp, 0, sizeof(xpp));
 	xpp.flags = index->xpp->flags & ~XDF_DIFF_ALGORITHM_MASK;
 
 	return xdl_fall_back_diff(index->env, &xpp,
@@ -263,6 +264,8 @@ static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env,
 {
 	struct histindex index;
 	struct region lcs;
+	xdarena_t *arena = xpp->arena;
+	long mark = xdl_arena_mark(arena);
 	int sz;
 	int result = -1;
 
@@ -289,30 +292,29 @@ static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env,
 
 	index.records = NULL;
 	index.line_map = NULL;
-	/* in case of early xdl_cha_free() */
-	index.rcha.head = NULL;
+	index.rec_store = NULL;
 
 	index.table_bits = xdl_hashbits(count1);
 	sz = index.records_size = 1 << index.table_bits;
 	sz *= sizeof(struct record *);
-	if (!(index.records = (struct record **) xdl_malloc(sz)))
+	if (!(index.records = (struct record **) xdl_arena_alloc(arena, sz)))
 		goto cleanup;
 	memset(index.records, 0, sz);
 
 	sz = index.line_map_size = count1;
 	sz *= sizeof(struct record *);
-	if (!(index.line_map = (struct record **) xdl_malloc(sz)))
+	if (!(index.line_map = (struct record **) xdl_arena_alloc(arena, sz)))
 		goto cleanup;
 	memset(index.line_map, 0, sz);
 
 	sz = index.line_map_size;
 	sz *= sizeof(unsigned int);
-	if (!(index.next_ptrs = (unsigned int *) xdl_malloc(sz)))
+	if (!(index.next_ptrs = (unsigned int *) xdl_arena_alloc(arena, sz)))
 		goto cleanup;
 	memset(index.next_ptrs, 0, sz);
 
-	/* lines / 4 + 1 comes from xprepare.c:xdl_prepare_ctx() */
-	if (xdl_cha_init(&index.rcha, sizeof(struct record), count1 / 4 + 1) < 0)
+	sz = count1 * sizeof(struct record);
+	if (!(index.rec_store = (struct record *) xdl_arena_alloc(arena, sz)))
 		goto cleanup;
 
 	index.ptr_shift = line1;
@@ -343,10 +345,11 @@ static int histogram_diff(xpparam_t const *xpp, xdfenv_t *env,
 	}
 
 cleanup:
-	xdl_free(index.records);
-	xdl_free(index.line_map);
-	xdl_free(index.next_ptrs);
-	xdl_cha_free(&index.rcha);
+	xdl_arena_free(arena, index.records);
+	xdl_arena_free(arena, index.line_map);
+	xdl_arena_free(arena, index.next_ptrs);
+	xdl_arena_free(arena, index.rec_store);
+	xdl_arena_rewind(arena, mark);
 
 	return result;
 }
@@ -140,7 +140,7 @@ static int fill_hashmap(mmfile_t *file1, mmfile_t *file2,
 	/* We know exactly how large we want the hash map */
 	result->alloc = count1 * 2;
 	result->entries = (struct entry *)
-		xdl_malloc(result->alloc * sizeof(struct entry));
+		xdl_arena_alloc(xpp->arena, result->alloc * sizeof(struct entry));
 	if (!result->entries)
 		return -1;
 	memset(result->entries, 0, result->alloc * sizeof(struct entry));
@@ -188,7 +188,10 @@ static int binary_search(struct entry **sequence, int longest,
  */
 static struct entry *find_longest_common_sequence(struct hashmap *map)
 {
-	struct entry **sequence = xdl_malloc(map->nr * sizeof(struct entry *));
+	xdarena_t *arena = map->xpp->arena;
+	long mark = xdl_arena_mark(arena);
+	struct entry **sequence =
+		xdl_arena_alloc(arena, map->nr * sizeof(struct entry *));
 	int longest = 0, i;
 	struct entry *entry;
 
@@ -204,7 +207,8 @@ static struct entry *find_longest_common_sequence(struct hashmap *map)
 
 	/* No common unique lines were found */
 	if (!longest) {
-		xdl_free(sequence);
+		xdl_arena_free(arena, sequence);
+		xdl_arena_rewind(arena, mark);
 		return NULL;
 	}
 
@@ -215,7 +219,8 @@ static struct entry *find_longest_common_sequence(struct hashmap *map)
 		entry->previous->next = entry;
 		entry = entry->previous;
 	}
-	xdl_free(sequence);
+	xdl_arena_free(arena, sequence);
+	xdl_arena_rewind(arena, mark);
 	return entry;
 }
 
@@ -288,6 +293,7 @@ static int fall_back_to_classic_diff(struct hashmap *map,
 		int line1, int count1, int line2, int count2)
 {
 	xpparam_t xpp;
+	memset(&xpp, 0, sizeof(xpp));
 	xpp.flags = map->xpp->flags & ~XDF_DIFF_ALGORITHM_MASK;
 
 	return xdl_fall_back_diff(map->env, &xpp,
@@ -306,6 +312,7 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 {
 	struct hashmap map;
 	struct entry *first;
+	long mark = xdl_arena_mark(xpp->arena);
 	int result = 0;
 
 	/* trivial case: one side is empty */
@@ -330,7 +337,8 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 			env->xdf1.rchg[line1++ - 1] = 1;
 		while(count2--)
 			env->xdf2.rchg[line2++ - 1] = 1;
-		xdl_free(map.entries);
+		xdl_arena_free(xpp->arena, map.entries);
+		xdl_arena_rewind(xpp->arena, mark);
 		return 0;
 	}
 
@@ -342,7 +350,8 @@ static int patience_diff(mmfile_t *file1, mmfile_t *file2,
 		result = fall_back_to_classic_diff(&map,
 			line1, count1, line2, count2);
 
-	xdl_free(map.entries);
+	xdl_arena_free(xpp->arena, map.entries);
+	xdl_arena_rewind(xpp->arena, mark);
 	return result;
 }
 
@@ -122,6 +122,101 @@ void *xdl_cha_alloc(chastore_t *cha) {
 	return data;
 }
 
+/*
+ * The arena hands out memory from one block, like a stack: the
+ * callers take a mark before they allocate, and rewind to it when
+ * they are done.  What does not fit into the block comes from chunks
+ * of its own, which live until the arena is reset at the end of the
+ * diff; by then the arena knows how much the diff needed, and makes
+ * the block that large for the next one.  With a NULL arena, these
+ * are plain xdl_malloc() and xdl_free().
+ */
+#define XDL_ARENA_ALIGN(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+/* Do not keep a block larger than this around between diffs */
+#define XDL_ARENA_MAX_KEEP (16L << 20)
+
+typedef struct s_xdarenachunk {
+	struct s_xdarenachunk *next;
+} xdarenachunk_t;
+
+void *xdl_arena_alloc(xdarena_t *arena, long size) {
+	xdarenachunk_t *chunk;
+	long hsize = XDL_ARENA_ALIGN(sizeof(xdarenachunk_t));
+
+	if (!arena)
+		return xdl_malloc(size);
+
+	size = XDL_ARENA_ALIGN(size);
+	arena->used += size;
+	if (arena->peak < arena->used)
+		arena->peak = arena->used;
+	if (arena->used <= arena->size)
+		return arena->ptr + arena->used - size;
+
+	if (!(chunk = (xdarenachunk_t *) xdl_malloc(hsize + size))) {
+		arena->used -= size;
+		return NULL;
+	}
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	return (char *) chunk + hsize;
+}
+
+
+void xdl_arena_free(xdarena_t *arena, void *ptr) {
+
+	if (!arena)
+		xdl_free(ptr);
+}
+
+
+long xdl_arena_mark(xdarena_t *arena) {
+
+	return arena ? arena->used : 0;
+}
+
+
+void xdl_arena_rewind(xdarena_t *arena, long mark) {
+
+	if (arena)
+		arena->used = mark;
+}
+
+
+static void xdl_arena_free_chunks(xdarena_t *arena) {
+	xdarenachunk_t *cur, *tmp;
+
+	for (cur = arena->chunks; (tmp = cur) != NULL;) {
+		cur = cur->next;
+		xdl_free(tmp);
+	}
+	arena->chunks = NULL;
+}
+
+
+void xdl_arena_reset(xdarena_t *arena) {
+
+	if (!arena)
+		return;
+	xdl_arena_free_chunks(arena);
+	if (arena->size < arena->peak && arena->peak <= XDL_ARENA_MAX_KEEP) {
+		xdl_free(arena->ptr);
+		arena->ptr = (char *) xdl_malloc(arena->peak);
+		arena->size = arena->ptr ? arena->peak : 0;
+	}
+	arena->used = arena->peak = 0;
+}
+
+
+void xdl_free_arena(xdarena_t *arena) {
+
+	xdl_arena_free_chunks(arena);
+	xdl_free(arena->ptr);
+	arena->ptr = NULL;
+	arena->size = arena->used = arena->peak = 0;
+}
+
+
 long xdl_guess_lines(mmfile_t *mf, long sample) {
 	long nl = 0, size, tsize = 0;
 	char const *data, *cur, *top;
@@ -264,66 +359,76 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 
 #ifdef XDL_FAST_HASH
 
-#define REPEAT_BYTE(x)  ((~0ul / 0xff) * (x))
-
-#define ONEBYTES	REPEAT_BYTE(0x01)
-#define NEWLINEBYTES	REPEAT_BYTE(0x0a)
-#define HIGHBITS	REPEAT_BYTE(0x80)
-
-/* Return the high bit set in the first byte that is a zero */
-static inline unsigned long has_zero(unsigned long a)
-{
-	return ((a - ONEBYTES) & ~a) & HIGHBITS;
-}
+#if defined(__GNUC__) && defined(__SSE2__) && defined(__x86_64__) && \
+    __SIZEOF_LONG__ == 8
+#include <emmintrin.h>
+#define XDL_SSE2_EOL
+#endif
 
-static inline long count_masked_bytes(unsigned long mask)
-{
-	if (sizeof(long) == 8) {
-		/*
-		 * Jan Achrenius on G+: microoptimized version of
-		 * the simpler "(mask & ONEBYTES) * ONEBYTES >> 56"
-		 * that works for the bytemasks without having to
-		 * mask them first.
-		 */
-		/*
-		 * return mask * 0x0001020304050608 >> 56;
-		 *
-		 * Doing it like this avoids warnings on 32-bit machines.
-		 */
-		long a = (REPEAT_BYTE(0x01) / 0xff + 1);
-		return mask * a >> (sizeof(long) * 7);
-	} else {
-		/* Carl Chatfield / Jan Achrenius G+ version for 32-bit */
-		/* (000000 0000ff 00ffff ffffff) -> ( 1 1 2 3 ) */
-		long a = (0x0ff0001 + mask) >> 23;
-		/* Fix the 1 for 00 case */
-		return a & mask;
-	}
-}
+#define XDL_HASH_WORD(h, w) (((h) + ((h) << 5)) ^ (w))
 
 unsigned long xdl_hash_record(char const **data, char const *top, long flags)
 {
 	unsigned long hash = 5381;
-	unsigned long a = 0, mask = 0;
+	unsigned long a = 0;
 	char const *ptr = *data;
-	char const *end = top - sizeof(unsigned long) + 1;
+	char const *eol;
+	long rest;
+#ifdef XDL_SSE2_EOL
+	__m128i newlines = _mm_set1_epi8('\n');
+#endif
 
 	if (flags & XDF_WHITESPACE_FLAGS)
 		return xdl_hash_record_with_whitespace(data, top, flags);
 
-	ptr -= sizeof(unsigned long);
-	do {
-		hash += hash << 5;
-		hash ^= a;
-		ptr += sizeof(unsigned long);
-		if (ptr >= end)
-			break;
-		a = *(unsigned long *)ptr;
-		/* Do we have any '\n' bytes in this word? */
-		mask = has_zero(a ^ NEWLINEBYTES);
-	} while (!mask);
-
-	if (ptr >= end) {
+	/*
+	 * The hash starts by mixing in a zero word, and then takes the
+	 * record a word at a time, up to its '\n' that comes into the
+	 * last, partial word as zero bytes.
+	 */
+	hash = XDL_HASH_WORD(hash, 0);
+
+#ifdef XDL_SSE2_EOL
+	/*
+	 * Look for the '\n' sixteen bytes at a time, and hash the two
+	 * words we have looked at as long as we do not find it.  When
+	 * we do, the record ends in this chunk with zero or one full
+	 * word followed by a partial one; hash both ways and pick the
+	 * right one, which is cheaper than mispredicting a branch on
+	 * every short line.
+	 */
+	for (; top - ptr >= 16; ptr += 16) {
+		__m128i chunk = _mm_loadu_si128((__m128i const *) ptr);
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, newlines));
+		unsigned long w0 = *(unsigned long *)ptr;
+		unsigned long w1 = *(unsigned long *)(ptr + 8);
+
+		if (mask) {
+			unsigned long h0, h1, low;
+
+			rest = __builtin_ctz(mask);
+			low = (1UL << (8 * (rest & 7))) - 1;
+			h0 = XDL_HASH_WORD(hash, w0 & low);
+			h1 = XDL_HASH_WORD(XDL_HASH_WORD(hash, w0), w1 & low);
+			hash = rest < 8 ? h0 : h1;
+			*data = ptr + rest + 1;
+			return hash;
+		}
+		hash = XDL_HASH_WORD(hash, w0);
+		hash = XDL_HASH_WORD(hash, w1);
+	}
+#endif
+	eol = memchr(ptr, '\n', top - ptr);
+	if (!eol)
+		eol = top;
+	for (; eol - ptr >= (long) sizeof(unsigned long);
+	     ptr += sizeof(unsigned long))
+		hash = XDL_HASH_WORD(hash, *(unsigned long *)ptr);
+
+	rest = eol - ptr;
+	if (top - ptr >= (long) sizeof(unsigned long))
+		a = *(unsigned long *)ptr & ((1UL << (8 * rest)) - 1);
+	else {
 		/*
 		 * There is only a partial word left at the end of the
 		 * buffer. Because we may work with a memory mapping,
@@ -334,32 +439,12 @@ unsigned long xdl_hash_record(char const **data, char const *top, long flags)
 		 * we use an unsigned char here.
 		 */
 		const char *p;
-		for (p = top - 1; p >= ptr; p--)
+		for (p = eol - 1; p >= ptr; p--)
 			a = (a << 8) + *((const unsigned char *)p);
-		mask = has_zero(a ^ NEWLINEBYTES);
-		if (!mask)
-			/*
-			 * No '\n' found in the partial word.  Make a
-			 * mask that matches what we read.
-			 */
-			mask = 1UL << (8 * (top - ptr) + 7);
-	}
-
-	/* The mask *below* the first high bit set */
-	mask = (mask - 1) & ~mask;
-	mask >>= 7;
-	hash += hash << 5;
-	hash ^= a & mask;
-
-	/* Advance past the last (possibly partial) word */
-	ptr += count_masked_bytes(mask);
-
-	if (ptr < top) {
-		assert(*ptr == '\n');
-		ptr++;
 	}
+	hash = XDL_HASH_WORD(hash, a);
 
-	*data = ptr;
+	*data = eol < top ? eol + 1 : eol;
 
 	return hash;
 }
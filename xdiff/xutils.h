@@ -31,6 +31,11 @@ int xdl_emit_diffrec(char const *rec, long size, char const *pre, long psize,
 int xdl_cha_init(chastore_t *cha, long isize, long icount);
 void xdl_cha_free(chastore_t *cha);
 void *xdl_cha_alloc(chastore_t *cha);
+void *xdl_arena_alloc(xdarena_t *arena, long size);
+void xdl_arena_free(xdarena_t *arena, void *ptr);
+long xdl_arena_mark(xdarena_t *arena);
+void xdl_arena_rewind(xdarena_t *arena, long mark);
+void xdl_arena_reset(xdarena_t *arena);
 long xdl_guess_lines(mmfile_t *mf, long sample);
 int xdl_blankline(const char *line, long size, long flags);
 int xdl_recmatch(const char *l1, long s1, const char *l2, long s2, long flags);